@@ -3,34 +3,131 @@
 
 //
 
-typedef struct int_set {
-    int             length, capacity;
-    int_range_t     *elements;
-} int_set_t;
+typedef struct int_set int_set_t;
+
+/*
+ * A chunk of the chunked backend:  the integers key * 65536 through
+ * key * 65536 + 65535 that are in the set, stored as one of
+ *
+ *     - array:  the sorted low 16 bits of each integer
+ *     - bitmap:  one bit per integer
+ *     - runs:  a range-array set of the low 16 bits
+ */
+typedef struct int_set_chunk {
+    base_int_t      key;
+    int             type;
+    int             cardinality;
+    int             capacity;           // allocated values
+    unsigned int    n_mutations;
+    uint16_t        *values;
+    uint64_t        *words;
+    int_set_t       *runs;
+} int_set_chunk_t;
+
+/*
+ * Ranges held inside the set itself before any range array is
+ * allocated; most sets never outgrow it.
+ */
+#define INT_SET_INLINE_RANGES   4
+
+struct int_set {
+    int_set_backend_t   backend;
+    bool                is_in_arena;
+    int                 length, capacity;   // of elements or chunks
+    base_int_t          count;
+    int_range_t         *elements;          // ranges backend
+    int_set_chunk_t     *chunks;            // chunked backend
+    int_range_t         inline_elements[INT_SET_INLINE_RANGES];
+};
+
+/*
+ * Sets in an arena are carved from blocks that are released together;
+ * the first block is sized to the caller's hint and each further block
+ * doubles.
+ */
+typedef struct int_set_arena_block {
+    struct int_set_arena_block  *link;
+    int                         n_sets, capacity;
+    int_set_t                   sets[];
+} int_set_arena_block_t;
+
+struct int_set_arena {
+    int                     n_sets_next;
+    int_set_arena_block_t   *blocks;
+};
+
+//
+
+static void
+__int_set_init(
+    int_set_t           *S,
+    int_set_backend_t   backend
+)
+{
+    S->backend = backend;
+    S->is_in_arena = false;
+    S->length = 0;
+    S->count = 0;
+    S->chunks = NULL;
+    if ( backend == int_set_backend_ranges ) {
+        S->elements = S->inline_elements;
+        S->capacity = INT_SET_INLINE_RANGES;
+    } else {
+        S->elements = NULL;
+        S->capacity = 0;
+    }
+}
 
 //
 
 int_set_t*
-__int_set_create()
+__int_set_create(
+    int_set_backend_t   backend
+)
 {
     int_set_t       *S = (int_set_t*)malloc(sizeof(int_set_t));
     
-    if ( S ) {
-        S->length = S->capacity = 0;
-        S->elements = NULL;
-    }
+    if ( S ) __int_set_init(S, backend);
     return S;
 }
 
 //
 
+void __int_set_destroy(int_set_t *S);
+
+static void
+__int_set_release(
+    int_set_t   *S
+)
+{
+    if ( S->chunks ) {
+        int         ci = 0;
+        
+        while ( ci < S->length ) {
+            int_set_chunk_t *c = &S->chunks[ci++];
+            
+            if ( c->values ) free((void*)c->values);
+            if ( c->words ) free((void*)c->words);
+            if ( c->runs ) __int_set_destroy(c->runs);
+        }
+        free((void*)S->chunks);
+        S->chunks = NULL;
+    }
+    if ( S->elements && (S->elements != S->inline_elements) ) free((void*)S->elements);
+    S->elements = NULL;
+    S->length = S->capacity = 0;
+    S->count = 0;
+}
+
+//
+
 void
 __int_set_destroy(
     int_set_t   *S
 )
 {
-    if ( S->elements ) free((void*)S->elements);
-    free((void*)S);
+    __int_set_release(S);
+    if ( ! S->is_in_arena ) free((void*)S);
 }
 
 //
@@ -40,9 +137,16 @@ __int_set_grow(
     int_set_t   *S
 )
 {
-    int             new_capacity = S->capacity + 64;
-    int_range_t     *new_elements = (int_range_t*)realloc(S->elements, new_capacity * sizeof(int_range_t));
+    int             new_capacity = 2 * S->capacity;
+    int_range_t     *new_elements;
     
+    // The inline ranges are copied out the first time the set outgrows them:
+    if ( S->elements == S->inline_elements ) {
+        new_elements = (int_range_t*)malloc(new_capacity * sizeof(int_range_t));
+        if ( new_elements ) memcpy(new_elements, S->inline_elements, S->length * sizeof(int_range_t));
+    } else {
+        new_elements = (int_range_t*)realloc(S->elements, new_capacity * sizeof(int_range_t));
+    }
     if ( new_elements ) {
         S->elements = new_elements;
         S->capacity = new_capacity;
@@ -51,77 +155,69 @@ __int_set_grow(
     return false;
 }
 
-//
-////
-//
-
-int_set_ref
-int_set_create()
-{
-    return (int_set_ref)__int_set_create();
-}
-
 //
 
-void
-int_set_destroy(
-    int_set_ref S
+static inline int
+__int_set_search(
+    int_set_t   *S,
+    base_int_t  i
 )
 {
-    __int_set_destroy((int_set_t*)S);
+    int         lo = 0, hi = S->length;
+    
+    // Binary search for the first range whose upper bound (exclusive)
+    // is at least i -- the first range that contains i, ends just before
+    // it or is ordered after it:
+    while ( lo < hi ) {
+        int     mid = lo + (hi - lo) / 2;
+        
+        if ( int_range_get_max(S->elements[mid]) < i ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
 }
 
 //
 
-base_int_t
-int_set_get_length(
-    int_set_ref S
+static inline int
+__int_set_search_start(
+    int_set_t   *S,
+    base_int_t  i
 )
 {
-    base_int_t  l = 0;
-    int         ri = 0;
+    int         lo = 0, hi = S->length;
     
-    while ( ri < S->length ) l += S->elements[ri++].length;
-    return l;
+    // Binary search for the first range that starts after i:
+    while ( lo < hi ) {
+        int     mid = lo + (hi - lo) / 2;
+        
+        if ( S->elements[mid].start <= i ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
 }
 
+//
+// Range-array backend:
 //
 
-bool
-int_set_push_int(
-    int_set_ref S,
+static bool
+__int_set_ranges_push_int(
+    int_set_t   *S,
     base_int_t  i
 )
 {
-    int         ri = 0;
+    int         ri = __int_set_search(S, i);
     
-    // Check existing ranges for overlap/extension:
-    while ( ri < S->length ) {
+    if ( ri < S->length ) {
         // Already exists?
         if ( int_range_does_contain(S->elements[ri], i) ) return true;
         
-        // Does the number occur immediately before this range?
-        if ( i + 1 == S->elements[ri].start ) {
-            // Extend this range:
-            S->elements[ri].start--, S->elements[ri].length++;
-            
-            // Check if it now overlaps the range occurring before it:
-            if ( (ri > 0) && int_range_is_adjacent_or_intersecting(S->elements[ri-1], S->elements[ri]) ) {
-                // Replace with single range:
-                S->elements[ri-1] = int_range_union(S->elements[ri-1], S->elements[ri]);
-                
-                // Shift anything else down:
-                if ( ri + 1 < S->length )
-                    memmove(&S->elements[ri], &S->elements[ri+1], sizeof(int_range_t) * (S->length - ri - 1));
-                S->length--;
-            }
-            return true;
-        }
-        
         // Does the number occur immediately after this range?
-        if ( S->elements[ri].start + S->elements[ri].length == i ) {
+        if ( int_range_get_max(S->elements[ri]) == i ) {
             // Extend this range:
             S->elements[ri].length++;
+            S->count++;
             
             // Check if it now overlaps the range occurring after it:
             if ( (ri + 1 < S->length) && int_range_is_adjacent_or_intersecting(S->elements[ri], S->elements[ri+1]) ) {
@@ -136,11 +232,13 @@ int_set_push_int(
             return true;
         }
         
-        // Is the number ordered before this range?  If so, we found our
-        // insertion point:
-        if ( i < S->elements[ri].start ) break;
-        
-        ri++;
+        // Does the number occur immediately before this range?  The range
+        // before it ends at least two below i, so no merge is possible:
+        if ( i + 1 == S->elements[ri].start ) {
+            S->elements[ri].start--, S->elements[ri].length++;
+            S->count++;
+            return true;
+        }
     }
     
     // New range necessary at index ri.  Start by making room for another
@@ -157,95 +255,47 @@ int_set_push_int(
     
     // Insert the new range:
     S->elements[ri] = int_range_make_with_low_and_high(i, i);
+    S->count++;
     return true;
 }
 
 //
 
-bool
-int_set_push_range(
-    int_set_ref S,
+static bool
+__int_set_ranges_push_range(
+    int_set_t   *S,
     int_range_t r
 )
 {
-    int         ri = 0;
+    int         ri, rj;
     
-    // Check existing ranges for overlap/extension:
-    while ( ri < S->length ) {
-        // Do we have overlap?
-        if ( int_range_does_intersect(S->elements[ri], r) ) {
-            base_int_t  end_r  = int_range_get_end(r);
-            base_int_t  end_ri = int_range_get_end(S->elements[ri]);
-            bool        ordered_asc;
-            
-            // Is r contained fully within the range?
-            if ( r.start >= S->elements[ri].start && end_r <= end_ri ) return true;
-            
-            // Is r ordered before this range?
-            ordered_asc = ( r.start < S->elements[ri].start );
-            
-            // Merge the new range into this one:
-            S->elements[ri] = int_range_union(r, S->elements[ri]);
-            
-            // If r was before this range, we don't need to check for
-            // merging-down with any previous range; but if r was
-            // ordered after this range, we need to see if the next
-            // range in S now overlaps:
-            if ( ! ordered_asc && (ri + 1 < S->length) ) {
-                if ( int_range_is_adjacent_or_intersecting(S->elements[ri], S->elements[ri+1]) ) {
-                    // Merge the two ranges:
-                    S->elements[ri] = int_range_union(S->elements[ri], S->elements[ri+1]);
-                    
-                    // Shift anything else down:
-                    if ( ri + 2 < S->length )
-                        memmove(&S->elements[ri+1], &S->elements[ri+2], sizeof(int_range_t) * (S->length - ri - 2));
-                    S->length--;
-                }
-            }
-            return true;
-        }
-        
-        // Does r sit just before this range?
-        if ( int_range_get_max(r) == S->elements[ri].start ) {
-            S->elements[ri] = int_range_union(r, S->elements[ri]);
-            
-            // Does the new range now overlap with or directly precede the
-            // following range?
-            if ( ri + 1 < S->length && int_range_is_adjacent_or_intersecting(S->elements[ri], S->elements[ri+1]) ) {
-                // Merge the two ranges:
-                S->elements[ri] = int_range_union(S->elements[ri], S->elements[ri+1]);
-                
-                // Shift anything else down:
-                if ( ri + 2 < S->length )
-                    memmove(&S->elements[ri+1], &S->elements[ri+2], sizeof(int_range_t) * (S->length - ri - 2));
-                S->length--;
-            }
-            return true;
-        }
+    if ( r.length <= 0 ) return true;
+    
+    // Ranges ri through rj - 1 overlap or are adjacent to r:
+    ri = __int_set_search(S, r.start);
+    rj = __int_set_search_start(S, int_range_get_max(r));
+    
+    if ( ri < rj ) {
+        base_int_t  n_merged = 0;
+        int         rk = ri;
         
-        // Does r sit just after this range?
-        if ( int_range_get_max(S->elements[ri]) == r.start ) {
-            S->elements[ri] = int_range_union(S->elements[ri], r);
-            
-            // Does the new range now overlap with or directly precede the
-            // following range?
-            if ( ri + 1 < S->length && int_range_is_adjacent_or_intersecting(S->elements[ri], S->elements[ri+1]) ) {
-                // Merge the two ranges:
-                S->elements[ri] = int_range_union(S->elements[ri], S->elements[ri+1]);
-                
-                // Shift anything else down:
-                if ( ri + 2 < S->length )
-                    memmove(&S->elements[ri+1], &S->elements[ri+2], sizeof(int_range_t) * (S->length - ri - 2));
-                S->length--;
-            }
-            return true;
-        }
+        // Is r contained fully within a single range?
+        if ( (rj == ri + 1) && (r.start >= S->elements[ri].start) && (int_range_get_max(r) <= int_range_get_max(S->elements[ri])) ) return true;
         
-        // Is the range ordered before this range?  If so, we found our
-        // insertion point:
-        if ( r.start < S->elements[ri].start ) break;
+        // Merge r and all of those ranges into the first one:
+        while ( rk < rj ) n_merged += S->elements[rk++].length;
+        r = int_range_union(r, S->elements[ri]);
+        r = int_range_union(r, S->elements[rj-1]);
+        S->elements[ri] = r;
+        S->count += r.length - n_merged;
         
-        ri++;
+        // Shift anything else down:
+        if ( rj - ri > 1 ) {
+            if ( rj < S->length )
+                memmove(&S->elements[ri+1], &S->elements[rj], sizeof(int_range_t) * (S->length - rj));
+            S->length -= rj - ri - 1;
+        }
+        return true;
     }
     
     // New range necessary at index ri.  Start by making room for another
@@ -262,84 +312,224 @@ int_set_push_range(
     
     // Insert the new range:
     S->elements[ri] = r;
+    S->count += r.length;
     return true;
 }
 
 //
 
-bool
-int_set_remove_int(
-    int_set_ref S,
+static bool
+__int_set_ranges_remove_int(
+    int_set_t   *S,
     base_int_t  i
 )
 {
-    int         ri = 0;
+    int         ri = __int_set_search(S, i + 1);
+    bool        did_contract = false;
     
-    // Check ranges for inclusion of i:
-    while ( ri < S->length ) {
-        bool    did_contract = false;
-        
-        // In this range?
-        if ( int_range_does_contain(S->elements[ri], i) ) {
-            // Does the range start with this number?
-            if ( S->elements[ri].start == i ) {
-                S->elements[ri].start++;
-                S->elements[ri].length--;
-                did_contract = true;
-            }
-            // Does the range end with this number?
-            else if ( i == int_range_get_end(S->elements[ri]) ) {
-                S->elements[ri].length--;
-                did_contract = true;
-            }
-            if ( did_contract ) {
-                // Make sure the range is NOT zero length now:
-                if ( S->elements[ri].length == 0 ) {
-                    // Move everything else over this element:
-                    if ( ri + 1 < S->length ) {
-                        memmove(&S->elements[ri], &S->elements[ri+1], sizeof(int_range_t) * (S->length - ri - 1));
-                    }
-                    S->length--;
-                }
-            } else {
-                // The range needs to be broken into two ranges:
-                if ( S->length == S->capacity ) {
-                    if ( ! __int_set_grow(S) ) return false;
-                }
-                if ( ri + 1 < S->length ) {
-                    memmove(&S->elements[ri+2], &S->elements[ri+1], sizeof(int_range_t) * (S->length - ri - 1));
-                }
-                S->elements[ri+1] = int_range_make_with_low_and_high(i + 1, S->elements[ri].start + S->elements[ri].length - 1);
-                S->elements[ri].length = i - S->elements[ri].start;
-                S->length++;
+    // In this range?
+    if ( (ri >= S->length) || ! int_range_does_contain(S->elements[ri], i) ) return false;
+    
+    // Does the range start with this number?
+    if ( S->elements[ri].start == i ) {
+        S->elements[ri].start++;
+        S->elements[ri].length--;
+        did_contract = true;
+    }
+    // Does the range end with this number?
+    else if ( i == int_range_get_end(S->elements[ri]) ) {
+        S->elements[ri].length--;
+        did_contract = true;
+    }
+    if ( did_contract ) {
+        // Make sure the range is NOT zero length now:
+        if ( S->elements[ri].length == 0 ) {
+            // Move everything else over this element:
+            if ( ri + 1 < S->length ) {
+                memmove(&S->elements[ri], &S->elements[ri+1], sizeof(int_range_t) * (S->length - ri - 1));
             }
-            return true;
+            S->length--;
+        }
+    } else {
+        // The range needs to be broken into two ranges:
+        if ( S->length == S->capacity ) {
+            if ( ! __int_set_grow(S) ) return false;
         }
-        if ( i < S->elements[ri].start ) break;
-        ri++;
+        if ( ri + 1 < S->length ) {
+            memmove(&S->elements[ri+2], &S->elements[ri+1], sizeof(int_range_t) * (S->length - ri - 1));
+        }
+        S->elements[ri+1] = int_range_make_with_low_and_high(i + 1, S->elements[ri].start + S->elements[ri].length - 1);
+        S->elements[ri].length = i - S->elements[ri].start;
+        S->length++;
     }
-    return false;
+    S->count--;
+    return true;
 }
 
 //
 
-bool
-int_set_remove_range(
-    int_set_ref S,
+static bool
+__int_set_ranges_remove_range(
+    int_set_t   *S,
     int_range_t r
 )
 {
-    bool        rc = false;
+    int         ri, rj, n_keep = 0, rk;
+    int_range_t keep[2];
+    base_int_t  n_removed = 0;
     
-    while ( r.length-- ) if ( int_set_remove_int(S, r.start++) ) rc = true;
-    return rc;
+    if ( r.length <= 0 ) return false;
+    
+    // Ranges ri through rj - 1 intersect r:
+    ri = __int_set_search(S, r.start + 1);
+    rj = __int_set_search_start(S, int_range_get_end(r));
+    if ( ri >= rj ) return false;
+    
+    // Only the first and last of those ranges can extend beyond r:
+    if ( S->elements[ri].start < r.start )
+        keep[n_keep++] = int_range_make_with_low_and_high(S->elements[ri].start, r.start - 1);
+    if ( int_range_get_max(S->elements[rj-1]) > int_range_get_max(r) )
+        keep[n_keep++] = int_range_make_with_low_and_high(int_range_get_max(r), int_range_get_end(S->elements[rj-1]));
+    for ( rk = ri; rk < rj; rk++ ) n_removed += S->elements[rk].length;
+    for ( rk = 0; rk < n_keep; rk++ ) n_removed -= keep[rk].length;
+    
+    // Replace the rj - ri intersecting ranges with the n_keep remainders,
+    // shifting the ranges that follow:
+    if ( n_keep > rj - ri ) {
+        // A single range split in two:
+        if ( S->length == S->capacity ) {
+            if ( ! __int_set_grow(S) ) return false;
+        }
+    }
+    if ( (n_keep != rj - ri) && (rj < S->length) )
+        memmove(&S->elements[ri + n_keep], &S->elements[rj], sizeof(int_range_t) * (S->length - rj));
+    S->length += n_keep - (rj - ri);
+    for ( rk = 0; rk < n_keep; rk++ ) S->elements[ri + rk] = keep[rk];
+    S->count -= n_removed;
+    return true;
 }
 
 //
 
-bool
-int_set_peek_next_int(
-    int_set_ref S,
+static inline void
+__int_set_append(
+    int_range_t *elements,
+    int         *length,
+    base_int_t  *count,
+    int_range_t r
+)
+{
+    // Ranges arrive in ascending order of start, coalesce with the last
+    // one if they touch:
+    if ( (*length > 0) && (r.start <= int_range_get_max(elements[*length - 1])) ) {
+        base_int_t  r_max = int_range_get_max(r);
+        
+        if ( r_max > int_range_get_max(elements[*length - 1]) ) {
+            *count += r_max - int_range_get_max(elements[*length - 1]);
+            elements[*length - 1].length = r_max - elements[*length - 1].start;
+        }
+    } else {
+        elements[(*length)++] = r;
+        *count += r.length;
+    }
+}
+
+typedef enum {
+    __int_set_op_union,
+    __int_set_op_intersection,
+    __int_set_op_difference
+} __int_set_op_t;
+
+static bool
+__int_set_ranges_merge(
+    int_set_t       *R,
+    int_set_t       *A,
+    int_set_t       *B,
+    __int_set_op_t  op
+)
+{
+    int             capacity = A->length + B->length, length = 0, ai = 0, bi = 0;
+    int_range_t     scratch[2 * INT_SET_INLINE_RANGES];
+    int_range_t     *elements = scratch;
+    base_int_t      count = 0;
+    
+    // Every result range begins at a distinct range boundary, so there can
+    // be no more than A and B have together:
+    if ( capacity > 2 * INT_SET_INLINE_RANGES ) {
+        elements = (int_range_t*)malloc(capacity * sizeof(int_range_t));
+        if ( ! elements ) return false;
+    }
+    switch ( op ) {
+        case __int_set_op_union:
+            while ( (ai < A->length) || (bi < B->length) ) {
+                if ( (bi >= B->length) || ((ai < A->length) && (A->elements[ai].start <= B->elements[bi].start)) )
+                    __int_set_append(elements, &length, &count, A->elements[ai++]);
+                else
+                    __int_set_append(elements, &length, &count, B->elements[bi++]);
+            }
+            break;
+        
+        case __int_set_op_intersection:
+            while ( (ai < A->length) && (bi < B->length) ) {
+                base_int_t  lo = A->elements[ai].start, hi = int_range_get_max(A->elements[ai]);
+                base_int_t  b_max = int_range_get_max(B->elements[bi]);
+                
+                if ( B->elements[bi].start > lo ) lo = B->elements[bi].start;
+                if ( b_max < hi ) hi = b_max;
+                if ( lo < hi ) __int_set_append(elements, &length, &count, int_range_make(lo, hi - lo));
+                
+                // Advance past whichever range ends first:
+                if ( int_range_get_max(A->elements[ai]) < b_max ) ai++;
+                else bi++;
+            }
+            break;
+        
+        case __int_set_op_difference:
+            while ( ai < A->length ) {
+                base_int_t  lo = A->elements[ai].start, a_max = int_range_get_max(A->elements[ai]);
+                
+                while ( (bi < B->length) && (int_range_get_max(B->elements[bi]) <= lo) ) bi++;
+                while ( (bi < B->length) && (B->elements[bi].start < a_max) ) {
+                    if ( B->elements[bi].start > lo )
+                        __int_set_append(elements, &length, &count, int_range_make(lo, B->elements[bi].start - lo));
+                    if ( int_range_get_max(B->elements[bi]) > lo ) lo = int_range_get_max(B->elements[bi]);
+                    
+                    // A range of B reaching past this range of A may cut the next one too:
+                    if ( int_range_get_max(B->elements[bi]) > a_max ) break;
+                    bi++;
+                }
+                if ( lo < a_max ) __int_set_append(elements, &length, &count, int_range_make(lo, a_max - lo));
+                ai++;
+            }
+            break;
+    }
+    
+    // R may be A or B, so it is only replaced once the merge is done:
+    if ( (length > INT_SET_INLINE_RANGES) && (elements == scratch) ) {
+        elements = (int_range_t*)malloc(capacity * sizeof(int_range_t));
+        if ( ! elements ) return false;
+        memcpy(elements, scratch, length * sizeof(int_range_t));
+    }
+    if ( R->elements != R->inline_elements ) free((void*)R->elements);
+    if ( length <= INT_SET_INLINE_RANGES ) {
+        memcpy(R->inline_elements, elements, length * sizeof(int_range_t));
+        if ( elements != scratch ) free((void*)elements);
+        R->elements = R->inline_elements;
+        R->capacity = INT_SET_INLINE_RANGES;
+    } else {
+        R->elements = elements;
+        R->capacity = capacity;
+    }
+    R->length = length;
+    R->count = count;
+    return true;
+}
+
+//
+
+static bool
+__int_set_ranges_peek_next_int(
+    int_set_t   *S,
     base_int_t  *i
 )
 {
@@ -352,14 +542,15 @@ int_set_peek_next_int(
 
 //
 
-bool
-int_set_pop_next_int(
-    int_set_ref S,
+static bool
+__int_set_ranges_pop_next_int(
+    int_set_t   *S,
     base_int_t  *i
 )
 {
     if ( S->length ) {
         *i = S->elements[0].start++, S->elements[0].length--;
+        S->count--;
         if ( S->elements[0].length == 0 ) {
             if ( S->length > 1 )
                 memmove(&S->elements[0], &S->elements[1], sizeof(int_range_t) * (S->length - 1));
@@ -372,58 +563,1379 @@ int_set_pop_next_int(
 
 //
 
-void
-int_set_summary(
-    int_set_ref S,
-    FILE        *stream
+static bool
+__int_set_ranges_pop_next_range(
+    int_set_t   *S,
+    base_int_t  max_length,
+    int_range_t *r
 )
 {
-    static const char *fmt_counter_eq_0 = "\n    [" BASE_INT_FMT ", " BASE_INT_FMT "]";
-    static const char *fmt_counter_ne_0 = ", [" BASE_INT_FMT ", " BASE_INT_FMT "]";
-    
-    int         ri = 0, counter = 0;
+    if ( S->length && (max_length > 0) ) {
+        if ( S->elements[0].length <= max_length ) {
+            *r = S->elements[0];
+            if ( S->length > 1 )
+                memmove(&S->elements[0], &S->elements[1], sizeof(int_range_t) * (S->length - 1));
+            S->length--;
+        } else {
+            *r = int_range_make(S->elements[0].start, max_length);
+            S->elements[0].start += max_length, S->elements[0].length -= max_length;
+        }
+        S->count -= r->length;
+        return true;
+    }
+    return false;
+}
+
+//
+
+static bool
+__int_set_ranges_enumerate_ranges(
+    int_set_t                   *S,
+    int_set_range_enumerator_t  enumerator,
+    const void                  *context
+)
+{
+    int         ri = 0;
     
-    fprintf(stream, "int_set@%p (l=%d, c=%d) {", S, S->length, S->capacity);
     while ( ri < S->length ) {
-        fprintf(stream, ((counter == 0) ? fmt_counter_eq_0 : fmt_counter_ne_0),
-                    S->elements[ri].start, S->elements[ri].start + S->elements[ri].length - 1);
-        counter = (counter + 1) % 16;
-        ri++;
+        if ( ! enumerator(S->elements[ri++], context) ) return false;
     }
-    fprintf(stream, "\n}\n");
+    return true;
 }
 
 //
-////
+// Chunked backend:  integers are grouped by their high bits into chunks of
+// 65536 values; each chunk is stored as a sorted array of the low bits, a
+// bitmap or a range-array set of the low bits, whichever is smallest for
+// the chunk's density.
 //
 
-#ifdef ENABLE_INT_SET_TEST
+#define INT_SET_CHUNK_BITS          16
+#define INT_SET_CHUNK_SIZE          ((base_int_t)1 << INT_SET_CHUNK_BITS)
+#define INT_SET_CHUNK_WORDS         (INT_SET_CHUNK_SIZE / 64)
+#define INT_SET_CHUNK_BITMAP_BYTES  (INT_SET_CHUNK_WORDS * sizeof(uint64_t))
+#define INT_SET_CHUNK_ARRAY_MAX     4096
 
-int
-main()
+enum {
+    __int_set_chunk_array = 0,
+    __int_set_chunk_bitmap,
+    __int_set_chunk_runs
+};
+
+static inline base_int_t
+__int_set_chunk_key(
+    base_int_t  i
+)
 {
-    int_set_ref     S = int_set_create();
-    int             i;
-    
-    int_set_push_int(S, 10);
-    int_set_summary(S, stdout);
-    int_set_push_int(S, 11);
-    int_set_summary(S, stdout);
-    int_set_push_int(S, 12);
-    int_set_summary(S, stdout);
-    int_set_push_int(S, 15);
-    int_set_summary(S, stdout);
-    int_set_push_range(S, int_range_make_with_low_and_high(13, 14));
-    int_set_summary(S, stdout);
-    int_set_remove_range(S, int_range_make_with_low_and_high(14, 18));
-    int_set_summary(S, stdout);
-    int_set_remove_int(S, 11);
-    int_set_summary(S, stdout);
+    // Floor division, so negative integers work, too:
+    return (i >= 0) ? (i / INT_SET_CHUNK_SIZE) : -((-i - 1) / INT_SET_CHUNK_SIZE) - 1;
+}
+
+//
+
+static int
+__int_set_bitmap_set(
+    uint64_t    *words,
+    int         lo,
+    int         hi
+)
+{
+    int         w = lo >> 6, w_hi = hi >> 6, n_set = 0;
     
-    while ( int_set_pop_next_int(S, &i) ) printf("..." BASE_INT_FMT "...\n", i);
+    while ( w <= w_hi ) {
+        uint64_t    mask = ~UINT64_C(0);
+        
+        if ( w == (lo >> 6) ) mask &= ~UINT64_C(0) << (lo & 63);
+        if ( w == w_hi ) mask &= ~UINT64_C(0) >> (63 - (hi & 63));
+        n_set += __builtin_popcountll(mask & ~words[w]);
+        words[w++] |= mask;
+    }
+    return n_set;
+}
 
-    int_set_destroy(S);
+static int
+__int_set_bitmap_clear(
+    uint64_t    *words,
+    int         lo,
+    int         hi
+)
+{
+    int         w = lo >> 6, w_hi = hi >> 6, n_cleared = 0;
+    
+    while ( w <= w_hi ) {
+        uint64_t    mask = ~UINT64_C(0);
+        
+        if ( w == (lo >> 6) ) mask &= ~UINT64_C(0) << (lo & 63);
+        if ( w == w_hi ) mask &= ~UINT64_C(0) >> (63 - (hi & 63));
+        n_cleared += __builtin_popcountll(mask & words[w]);
+        words[w++] &= ~mask;
+    }
+    return n_cleared;
+}
 
+static bool
+__int_set_bitmap_next_run(
+    const uint64_t  *words,
+    int             from,
+    int             *lo,
+    int             *hi
+)
+{
+    int             w = from >> 6;
+    uint64_t        bits;
+    
+    if ( from >= INT_SET_CHUNK_SIZE ) return false;
+    
+    // First set bit at or after from:
+    bits = words[w] & (~UINT64_C(0) << (from & 63));
+    while ( ! bits ) {
+        if ( ++w == INT_SET_CHUNK_WORDS ) return false;
+        bits = words[w];
+    }
+    *lo = (w << 6) + __builtin_ctzll(bits);
+    
+    // First clear bit after that:
+    bits = ~words[w] & (~UINT64_C(0) << (*lo & 63));
+    while ( ! bits ) {
+        if ( ++w == INT_SET_CHUNK_WORDS ) {
+            *hi = INT_SET_CHUNK_SIZE - 1;
+            return true;
+        }
+        bits = ~words[w];
+    }
+    *hi = (w << 6) + __builtin_ctzll(bits) - 1;
+    return true;
+}
+
+static int
+__int_set_bitmap_count_runs(
+    const uint64_t  *words
+)
+{
+    int             w = 0, n_runs = 0;
+    uint64_t        carry = 0;
+    
+    // A run starts at every set bit whose predecessor is clear:
+    while ( w < INT_SET_CHUNK_WORDS ) {
+        n_runs += __builtin_popcountll(words[w] & ~((words[w] << 1) | carry));
+        carry = words[w++] >> 63;
+    }
+    return n_runs;
+}
+
+//
+
+static inline int
+__int_set_array_search(
+    const uint16_t  *values,
+    int             n_values,
+    int             v
+)
+{
+    int             lo = 0, hi = n_values;
+    
+    // Binary search for the first value at least v:
+    while ( lo < hi ) {
+        int         mid = lo + (hi - lo) / 2;
+        
+        if ( values[mid] < v ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+//
+
+static void
+__int_set_chunk_free_data(
+    int_set_chunk_t *c
+)
+{
+    if ( c->values ) free((void*)c->values);
+    if ( c->words ) free((void*)c->words);
+    if ( c->runs ) __int_set_destroy(c->runs);
+    c->values = NULL;
+    c->words = NULL;
+    c->runs = NULL;
+    c->capacity = 0;
+}
+
+//
+
+static bool
+__int_set_chunk_next_run(
+    const int_set_chunk_t   *c,
+    int                     from,
+    int                     *lo,
+    int                     *hi
+)
+{
+    switch ( c->type ) {
+        case __int_set_chunk_array: {
+            int             vi = __int_set_array_search(c->values, c->cardinality, from);
+            
+            if ( vi >= c->cardinality ) return false;
+            *lo = *hi = c->values[vi];
+            while ( (++vi < c->cardinality) && (c->values[vi] == *hi + 1) ) (*hi)++;
+            return true;
+        }
+        case __int_set_chunk_bitmap:
+            return __int_set_bitmap_next_run(c->words, from, lo, hi);
+        
+        case __int_set_chunk_runs: {
+            int             ri = __int_set_search(c->runs, from + 1);
+            
+            if ( ri >= c->runs->length ) return false;
+            *lo = (c->runs->elements[ri].start > from) ? c->runs->elements[ri].start : from;
+            *hi = int_range_get_end(c->runs->elements[ri]);
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+
+static int
+__int_set_chunk_count_runs(
+    const int_set_chunk_t   *c
+)
+{
+    int                     n_runs = 0, vi = 0;
+    
+    switch ( c->type ) {
+        case __int_set_chunk_array:
+            while ( vi < c->cardinality ) {
+                if ( (vi == 0) || (c->values[vi] != c->values[vi-1] + 1) ) n_runs++;
+                vi++;
+            }
+            break;
+        case __int_set_chunk_bitmap:
+            n_runs = __int_set_bitmap_count_runs(c->words);
+            break;
+        case __int_set_chunk_runs:
+            n_runs = c->runs->length;
+            break;
+    }
+    return n_runs;
+}
+
+//
+
+static void
+__int_set_chunk_to_bitmap(
+    const int_set_chunk_t   *c,
+    uint64_t                *words
+)
+{
+    int                     lo, hi, from = 0;
+    
+    if ( c->type == __int_set_chunk_bitmap ) {
+        memcpy(words, c->words, INT_SET_CHUNK_BITMAP_BYTES);
+    } else {
+        memset(words, 0, INT_SET_CHUNK_BITMAP_BYTES);
+        while ( __int_set_chunk_next_run(c, from, &lo, &hi) ) {
+            __int_set_bitmap_set(words, lo, hi);
+            from = hi + 1;
+        }
+    }
+}
+
+//
+
+static bool
+__int_set_chunk_from_bitmap(
+    int_set_chunk_t *c,
+    const uint64_t  *words
+)
+{
+    int_set_chunk_t new_c;
+    int             w = 0, n_runs = __int_set_bitmap_count_runs(words);
+    size_t          runs_bytes, array_bytes;
+    
+    memset(&new_c, 0, sizeof(new_c));
+    new_c.key = c->key;
+    while ( w < INT_SET_CHUNK_WORDS ) new_c.cardinality += __builtin_popcountll(words[w++]);
+    runs_bytes = n_runs * sizeof(int_range_t);
+    array_bytes = new_c.cardinality * sizeof(uint16_t);
+    
+    // Use whichever encoding is smallest:
+    if ( (runs_bytes <= array_bytes) && (runs_bytes <= INT_SET_CHUNK_BITMAP_BYTES) ) {
+        int         lo, hi, from = 0;
+        
+        new_c.type = __int_set_chunk_runs;
+        new_c.runs = __int_set_create(int_set_backend_ranges);
+        if ( ! new_c.runs ) return false;
+        while ( __int_set_bitmap_next_run(words, from, &lo, &hi) ) {
+            if ( ! __int_set_ranges_push_range(new_c.runs, int_range_make_with_low_and_high(lo, hi)) ) {
+                __int_set_chunk_free_data(&new_c);
+                return false;
+            }
+            from = hi + 1;
+        }
+    } else if ( new_c.cardinality <= INT_SET_CHUNK_ARRAY_MAX ) {
+        int         lo, hi, from = 0, vi = 0;
+        
+        new_c.type = __int_set_chunk_array;
+        if ( new_c.cardinality > 0 ) {
+            new_c.values = (uint16_t*)malloc(array_bytes);
+            if ( ! new_c.values ) return false;
+            new_c.capacity = new_c.cardinality;
+            while ( __int_set_bitmap_next_run(words, from, &lo, &hi) ) {
+                while ( lo <= hi ) new_c.values[vi++] = (uint16_t)lo++;
+                from = hi + 1;
+            }
+        }
+    } else {
+        new_c.type = __int_set_chunk_bitmap;
+        new_c.words = (uint64_t*)malloc(INT_SET_CHUNK_BITMAP_BYTES);
+        if ( ! new_c.words ) return false;
+        memcpy(new_c.words, words, INT_SET_CHUNK_BITMAP_BYTES);
+    }
+    __int_set_chunk_free_data(c);
+    *c = new_c;
+    return true;
+}
+
+//
+
+static bool
+__int_set_chunk_optimize(
+    int_set_chunk_t *c
+)
+{
+    uint64_t        words[INT_SET_CHUNK_WORDS];
+    
+    __int_set_chunk_to_bitmap(c, words);
+    return __int_set_chunk_from_bitmap(c, words);
+}
+
+//
+
+static bool
+__int_set_chunk_check(
+    int_set_chunk_t *c,
+    int             span
+)
+{
+    size_t          bytes;
+    
+    if ( c->cardinality == 0 ) return true;
+    switch ( c->type ) {
+        case __int_set_chunk_runs:
+            // Re-encode fragmented runs as soon as they outgrow the alternatives:
+            bytes = c->runs->length * sizeof(int_range_t);
+            if ( (bytes > INT_SET_CHUNK_BITMAP_BYTES) || (bytes > c->cardinality * sizeof(uint16_t)) )
+                return __int_set_chunk_optimize(c);
+            break;
+        
+        case __int_set_chunk_array:
+        case __int_set_chunk_bitmap:
+            if ( (c->type == __int_set_chunk_bitmap) && (c->cardinality <= INT_SET_CHUNK_ARRAY_MAX) )
+                return __int_set_chunk_optimize(c);
+            
+            // Counting runs is linear in the size of the chunk, so it is only
+            // done after range operations or every 64 single-value changes:
+            if ( (span < 64) && ((++c->n_mutations & 63) != 0) ) break;
+            bytes = (c->type == __int_set_chunk_bitmap) ? INT_SET_CHUNK_BITMAP_BYTES : (c->cardinality * sizeof(uint16_t));
+            if ( __int_set_chunk_count_runs(c) * sizeof(int_range_t) < bytes ) return __int_set_chunk_optimize(c);
+            break;
+    }
+    return true;
+}
+
+//
+
+static bool
+__int_set_chunk_add_range(
+    int_set_chunk_t *c,
+    int             lo,
+    int             hi
+)
+{
+    switch ( c->type ) {
+        case __int_set_chunk_array: {
+            int         vi_lo = __int_set_array_search(c->values, c->cardinality, lo);
+            int         vi_hi = __int_set_array_search(c->values, c->cardinality, hi + 1);
+            int         n_new = (hi - lo + 1) - (vi_hi - vi_lo);
+            
+            if ( n_new == 0 ) return true;
+            if ( c->cardinality + n_new > INT_SET_CHUNK_ARRAY_MAX ) {
+                uint64_t    words[INT_SET_CHUNK_WORDS];
+                
+                // Too dense for an array:
+                __int_set_chunk_to_bitmap(c, words);
+                __int_set_bitmap_set(words, lo, hi);
+                return __int_set_chunk_from_bitmap(c, words);
+            }
+            if ( c->cardinality + n_new > c->capacity ) {
+                int         new_capacity = 2 * c->capacity;
+                uint16_t    *new_values;
+                
+                if ( new_capacity < c->cardinality + n_new ) new_capacity = c->cardinality + n_new;
+                if ( new_capacity < 16 ) new_capacity = 16;
+                if ( new_capacity > INT_SET_CHUNK_ARRAY_MAX ) new_capacity = INT_SET_CHUNK_ARRAY_MAX;
+                new_values = (uint16_t*)realloc(c->values, new_capacity * sizeof(uint16_t));
+                if ( ! new_values ) return false;
+                c->values = new_values;
+                c->capacity = new_capacity;
+            }
+            if ( vi_hi < c->cardinality )
+                memmove(&c->values[vi_lo + (hi - lo + 1)], &c->values[vi_hi], sizeof(uint16_t) * (c->cardinality - vi_hi));
+            while ( lo <= hi ) c->values[vi_lo++] = (uint16_t)lo++;
+            c->cardinality += n_new;
+            break;
+        }
+        case __int_set_chunk_bitmap:
+            c->cardinality += __int_set_bitmap_set(c->words, lo, hi);
+            break;
+        
+        case __int_set_chunk_runs:
+            if ( ! __int_set_ranges_push_range(c->runs, int_range_make_with_low_and_high(lo, hi)) ) return false;
+            c->cardinality = c->runs->count;
+            break;
+    }
+    return __int_set_chunk_check(c, hi - lo + 1);
+}
+
+//
+
+static bool
+__int_set_chunk_remove_range(
+    int_set_chunk_t *c,
+    int             lo,
+    int             hi
+)
+{
+    switch ( c->type ) {
+        case __int_set_chunk_array: {
+            int         vi_lo = __int_set_array_search(c->values, c->cardinality, lo);
+            int         vi_hi = __int_set_array_search(c->values, c->cardinality, hi + 1);
+            
+            if ( vi_hi == vi_lo ) return true;
+            if ( vi_hi < c->cardinality )
+                memmove(&c->values[vi_lo], &c->values[vi_hi], sizeof(uint16_t) * (c->cardinality - vi_hi));
+            c->cardinality -= vi_hi - vi_lo;
+            break;
+        }
+        case __int_set_chunk_bitmap:
+            c->cardinality -= __int_set_bitmap_clear(c->words, lo, hi);
+            break;
+        
+        case __int_set_chunk_runs:
+            if ( ! __int_set_ranges_remove_range(c->runs, int_range_make_with_low_and_high(lo, hi)) ) return true;
+            c->cardinality = c->runs->count;
+            break;
+    }
+    return __int_set_chunk_check(c, hi - lo + 1);
+}
+
+//
+
+static bool
+__int_set_chunk_clone(
+    const int_set_chunk_t   *c,
+    int_set_chunk_t         *clone
+)
+{
+    *clone = *c;
+    clone->values = NULL;
+    clone->words = NULL;
+    clone->runs = NULL;
+    switch ( c->type ) {
+        case __int_set_chunk_array:
+            clone->capacity = c->cardinality;
+            if ( c->cardinality > 0 ) {
+                clone->values = (uint16_t*)malloc(c->cardinality * sizeof(uint16_t));
+                if ( ! clone->values ) return false;
+                memcpy(clone->values, c->values, c->cardinality * sizeof(uint16_t));
+            }
+            break;
+        case __int_set_chunk_bitmap:
+            clone->words = (uint64_t*)malloc(INT_SET_CHUNK_BITMAP_BYTES);
+            if ( ! clone->words ) return false;
+            memcpy(clone->words, c->words, INT_SET_CHUNK_BITMAP_BYTES);
+            break;
+        case __int_set_chunk_runs: {
+            int             ri = 0;
+            
+            clone->runs = __int_set_create(int_set_backend_ranges);
+            if ( ! clone->runs ) return false;
+            while ( ri < c->runs->length ) {
+                if ( ! __int_set_ranges_push_range(clone->runs, c->runs->elements[ri++]) ) {
+                    __int_set_chunk_free_data(clone);
+                    return false;
+                }
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+//
+
+static int
+__int_set_chunks_search(
+    int_set_t   *S,
+    base_int_t  key
+)
+{
+    int         lo = 0, hi = S->length;
+    
+    // Binary search for the first chunk with a key at least key:
+    while ( lo < hi ) {
+        int     mid = lo + (hi - lo) / 2;
+        
+        if ( S->chunks[mid].key < key ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int_set_chunk_t*
+__int_set_chunks_get(
+    int_set_t   *S,
+    base_int_t  key
+)
+{
+    int         ci = __int_set_chunks_search(S, key);
+    
+    if ( (ci < S->length) && (S->chunks[ci].key == key) ) return &S->chunks[ci];
+    
+    // Add a new, empty chunk at ci:
+    if ( S->length == S->capacity ) {
+        int             new_capacity = (S->capacity > 0) ? (2 * S->capacity) : 4;
+        int_set_chunk_t *new_chunks = (int_set_chunk_t*)realloc(S->chunks, new_capacity * sizeof(int_set_chunk_t));
+        
+        if ( ! new_chunks ) return NULL;
+        S->chunks = new_chunks;
+        S->capacity = new_capacity;
+    }
+    if ( ci < S->length )
+        memmove(&S->chunks[ci+1], &S->chunks[ci], sizeof(int_set_chunk_t) * (S->length - ci));
+    S->length++;
+    memset(&S->chunks[ci], 0, sizeof(int_set_chunk_t));
+    S->chunks[ci].key = key;
+    S->chunks[ci].type = __int_set_chunk_array;
+    return &S->chunks[ci];
+}
+
+static void
+__int_set_chunks_drop_if_empty(
+    int_set_t   *S,
+    int         ci
+)
+{
+    if ( S->chunks[ci].cardinality == 0 ) {
+        __int_set_chunk_free_data(&S->chunks[ci]);
+        if ( ci + 1 < S->length )
+            memmove(&S->chunks[ci], &S->chunks[ci+1], sizeof(int_set_chunk_t) * (S->length - ci - 1));
+        S->length--;
+    }
+}
+
+//
+
+static bool
+__int_set_chunked_push_range(
+    int_set_t   *S,
+    int_range_t r
+)
+{
+    base_int_t  i = r.start, i_end = int_range_get_end(r);
+    
+    while ( i <= i_end ) {
+        base_int_t      key = __int_set_chunk_key(i), base = key * INT_SET_CHUNK_SIZE;
+        base_int_t      hi = (i_end < base + INT_SET_CHUNK_SIZE - 1) ? i_end : (base + INT_SET_CHUNK_SIZE - 1);
+        int_set_chunk_t *c = __int_set_chunks_get(S, key);
+        int             cardinality;
+        bool            rc;
+        
+        if ( ! c ) return false;
+        cardinality = c->cardinality;
+        rc = __int_set_chunk_add_range(c, (int)(i - base), (int)(hi - base));
+        S->count += c->cardinality - cardinality;
+        if ( ! rc ) {
+            __int_set_chunks_drop_if_empty(S, c - S->chunks);
+            return false;
+        }
+        i = hi + 1;
+    }
+    return true;
+}
+
+//
+
+static bool
+__int_set_chunked_remove_range(
+    int_set_t   *S,
+    int_range_t r
+)
+{
+    base_int_t  i_end = int_range_get_end(r);
+    int         ci;
+    bool        rc = false;
+    
+    if ( r.length <= 0 ) return false;
+    ci = __int_set_chunks_search(S, __int_set_chunk_key(r.start));
+    while ( (ci < S->length) && (S->chunks[ci].key * INT_SET_CHUNK_SIZE <= i_end) ) {
+        int_set_chunk_t *c = &S->chunks[ci];
+        base_int_t      base = c->key * INT_SET_CHUNK_SIZE;
+        base_int_t      lo = (r.start > base) ? r.start : base;
+        base_int_t      hi = (i_end < base + INT_SET_CHUNK_SIZE - 1) ? i_end : (base + INT_SET_CHUNK_SIZE - 1);
+        int             cardinality = c->cardinality;
+        
+        __int_set_chunk_remove_range(c, (int)(lo - base), (int)(hi - base));
+        if ( c->cardinality != cardinality ) {
+            S->count -= cardinality - c->cardinality;
+            rc = true;
+        }
+        if ( c->cardinality == 0 ) __int_set_chunks_drop_if_empty(S, ci);
+        else ci++;
+    }
+    return rc;
+}
+
+//
+
+static bool
+__int_set_chunked_peek_next_int(
+    int_set_t   *S,
+    base_int_t  *i
+)
+{
+    int         lo, hi;
+    
+    if ( S->length && __int_set_chunk_next_run(&S->chunks[0], 0, &lo, &hi) ) {
+        *i = S->chunks[0].key * INT_SET_CHUNK_SIZE + lo;
+        return true;
+    }
+    return false;
+}
+
+//
+
+static bool
+__int_set_chunked_pop_next_range(
+    int_set_t   *S,
+    base_int_t  max_length,
+    int_range_t *r
+)
+{
+    int         lo, hi, ci = 1;
+    base_int_t  start, end;
+    
+    if ( ! S->length || (max_length <= 0) || ! __int_set_chunk_next_run(&S->chunks[0], 0, &lo, &hi) ) return false;
+    start = S->chunks[0].key * INT_SET_CHUNK_SIZE + lo;
+    end = S->chunks[0].key * INT_SET_CHUNK_SIZE + hi;
+    
+    // A run reaching the end of a chunk may continue into the next one:
+    while ( (end - start + 1 < max_length) && (hi == INT_SET_CHUNK_SIZE - 1) && (ci < S->length) &&
+            (S->chunks[ci].key == S->chunks[ci-1].key + 1) && __int_set_chunk_next_run(&S->chunks[ci], 0, &lo, &hi) && (lo == 0) )
+    {
+        end = S->chunks[ci++].key * INT_SET_CHUNK_SIZE + hi;
+    }
+    if ( end - start + 1 > max_length ) end = start + max_length - 1;
+    *r = int_range_make_with_low_and_high(start, end);
+    __int_set_chunked_remove_range(S, *r);
+    return true;
+}
+
+//
+
+static bool
+__int_set_chunked_enumerate_ranges(
+    int_set_t                   *S,
+    int_set_range_enumerator_t  enumerator,
+    const void                  *context
+)
+{
+    int_range_t                 pending = int_range_make(0, 0);
+    int                         ci = 0;
+    
+    // Runs that meet at a chunk boundary are joined into one range:
+    while ( ci < S->length ) {
+        int_set_chunk_t         *c = &S->chunks[ci++];
+        int                     lo, hi, from = 0;
+        
+        while ( __int_set_chunk_next_run(c, from, &lo, &hi) ) {
+            int_range_t         r = int_range_make_with_low_and_high(c->key * INT_SET_CHUNK_SIZE + lo, c->key * INT_SET_CHUNK_SIZE + hi);
+            
+            if ( (pending.length > 0) && (int_range_get_max(pending) == r.start) ) {
+                pending.length += r.length;
+            } else {
+                if ( (pending.length > 0) && ! enumerator(pending, context) ) return false;
+                pending = r;
+            }
+            from = hi + 1;
+        }
+    }
+    if ( (pending.length > 0) && ! enumerator(pending, context) ) return false;
+    return true;
+}
+
+//
+
+static void
+__int_set_chunked_clear(
+    int_set_t   *S
+)
+{
+    int         ci = 0;
+    
+    while ( ci < S->length ) __int_set_chunk_free_data(&S->chunks[ci++]);
+    S->length = 0;
+    S->count = 0;
+}
+
+//
+
+static bool
+__int_set_chunked_merge(
+    int_set_t       *R,
+    int_set_t       *A,
+    int_set_t       *B,
+    __int_set_op_t  op
+)
+{
+    int             capacity = A->length + B->length, length = 0, ai = 0, bi = 0;
+    int_set_chunk_t *chunks = NULL;
+    base_int_t      count = 0;
+    bool            is_ok = true;
+    uint64_t        a_words[INT_SET_CHUNK_WORDS], b_words[INT_SET_CHUNK_WORDS];
+    
+    if ( capacity > 0 ) {
+        chunks = (int_set_chunk_t*)malloc(capacity * sizeof(int_set_chunk_t));
+        if ( ! chunks ) return false;
+    }
+    while ( is_ok && ((ai < A->length) || (bi < B->length)) ) {
+        int_set_chunk_t *a = (ai < A->length) ? &A->chunks[ai] : NULL;
+        int_set_chunk_t *b = (bi < B->length) ? &B->chunks[bi] : NULL;
+        
+        if ( a && b && (a->key == b->key) ) {
+            int_set_chunk_t new_c;
+            int             w = 0;
+            
+            // Chunks present in both are combined a word at a time:
+            __int_set_chunk_to_bitmap(a, a_words);
+            __int_set_chunk_to_bitmap(b, b_words);
+            switch ( op ) {
+                case __int_set_op_union:
+                    while ( w < INT_SET_CHUNK_WORDS ) a_words[w] |= b_words[w], w++;
+                    break;
+                case __int_set_op_intersection:
+                    while ( w < INT_SET_CHUNK_WORDS ) a_words[w] &= b_words[w], w++;
+                    break;
+                case __int_set_op_difference:
+                    while ( w < INT_SET_CHUNK_WORDS ) a_words[w] &= ~b_words[w], w++;
+                    break;
+            }
+            memset(&new_c, 0, sizeof(new_c));
+            new_c.key = a->key;
+            if ( ! (is_ok = __int_set_chunk_from_bitmap(&new_c, a_words)) ) break;
+            if ( new_c.cardinality > 0 ) {
+                count += new_c.cardinality;
+                chunks[length++] = new_c;
+            } else {
+                __int_set_chunk_free_data(&new_c);
+            }
+            ai++, bi++;
+        } else if ( ! b || (a && (a->key < b->key)) ) {
+            // Only in A:
+            if ( op != __int_set_op_intersection ) {
+                if ( ! (is_ok = __int_set_chunk_clone(a, &chunks[length])) ) break;
+                count += chunks[length++].cardinality;
+            }
+            ai++;
+        } else {
+            // Only in B:
+            if ( op == __int_set_op_union ) {
+                if ( ! (is_ok = __int_set_chunk_clone(b, &chunks[length])) ) break;
+                count += chunks[length++].cardinality;
+            }
+            bi++;
+        }
+    }
+    if ( ! is_ok ) {
+        while ( length > 0 ) __int_set_chunk_free_data(&chunks[--length]);
+        if ( chunks ) free((void*)chunks);
+        return false;
+    }
+    
+    // R may be A or B, so it is only replaced once the merge is done:
+    __int_set_chunked_clear(R);
+    if ( R->chunks ) free((void*)R->chunks);
+    R->chunks = chunks;
+    R->capacity = capacity;
+    R->length = length;
+    R->count = count;
+    return true;
+}
+
+//
+////
+//
+
+int_set_ref
+int_set_create()
+{
+#ifdef ENABLE_INT_SET_CHUNKED
+    return (int_set_ref)__int_set_create(int_set_backend_chunked);
+#else
+    return (int_set_ref)__int_set_create(int_set_backend_ranges);
+#endif
+}
+
+//
+
+int_set_ref
+int_set_create_with_backend(
+    int_set_backend_t   backend
+)
+{
+    if ( (backend != int_set_backend_ranges) && (backend != int_set_backend_chunked) ) return NULL;
+    return (int_set_ref)__int_set_create(backend);
+}
+
+//
+
+void
+int_set_destroy(
+    int_set_ref S
+)
+{
+    __int_set_destroy((int_set_t*)S);
+}
+
+//
+
+int_set_arena_ref
+int_set_arena_create(
+    int         n_sets_hint
+)
+{
+    int_set_arena_ref   A = (int_set_arena_ref)malloc(sizeof(struct int_set_arena));
+    
+    if ( A ) {
+        A->n_sets_next = (n_sets_hint > 16) ? n_sets_hint : 16;
+        A->blocks = NULL;
+    }
+    return A;
+}
+
+//
+
+void
+int_set_arena_destroy(
+    int_set_arena_ref   A
+)
+{
+    while ( A->blocks ) {
+        int_set_arena_block_t   *block = A->blocks;
+        int                     si = 0;
+        
+        while ( si < block->n_sets ) __int_set_release(&block->sets[si++]);
+        A->blocks = block->link;
+        free((void*)block);
+    }
+    free((void*)A);
+}
+
+//
+
+int_set_ref
+int_set_create_in_arena(
+    int_set_arena_ref   A
+)
+{
+    int_set_arena_block_t   *block = A->blocks;
+    int_set_t               *S;
+    
+    if ( ! block || (block->n_sets == block->capacity) ) {
+        block = (int_set_arena_block_t*)malloc(sizeof(int_set_arena_block_t) + A->n_sets_next * sizeof(int_set_t));
+        if ( ! block ) return NULL;
+        block->link = A->blocks;
+        block->n_sets = 0;
+        block->capacity = A->n_sets_next;
+        A->blocks = block;
+        A->n_sets_next *= 2;
+    }
+    S = &block->sets[block->n_sets++];
+#ifdef ENABLE_INT_SET_CHUNKED
+    __int_set_init(S, int_set_backend_chunked);
+#else
+    __int_set_init(S, int_set_backend_ranges);
+#endif
+    S->is_in_arena = true;
+    return (int_set_ref)S;
+}
+
+//
+
+int_set_backend_t
+int_set_get_backend(
+    int_set_ref S
+)
+{
+    return S->backend;
+}
+
+//
+
+base_int_t
+int_set_get_length(
+    int_set_ref S
+)
+{
+    return S->count;
+}
+
+//
+
+bool
+int_set_push_int(
+    int_set_ref S,
+    base_int_t  i
+)
+{
+    if ( S->backend == int_set_backend_chunked ) return __int_set_chunked_push_range(S, int_range_make(i, 1));
+    return __int_set_ranges_push_int(S, i);
+}
+
+//
+
+bool
+int_set_push_range(
+    int_set_ref S,
+    int_range_t r
+)
+{
+    if ( S->backend == int_set_backend_chunked ) return __int_set_chunked_push_range(S, r);
+    return __int_set_ranges_push_range(S, r);
+}
+
+//
+
+bool
+int_set_remove_int(
+    int_set_ref S,
+    base_int_t  i
+)
+{
+    if ( S->backend == int_set_backend_chunked ) return __int_set_chunked_remove_range(S, int_range_make(i, 1));
+    return __int_set_ranges_remove_int(S, i);
+}
+
+//
+
+bool
+int_set_remove_range(
+    int_set_ref S,
+    int_range_t r
+)
+{
+    if ( S->backend == int_set_backend_chunked ) return __int_set_chunked_remove_range(S, r);
+    return __int_set_ranges_remove_range(S, r);
+}
+
+//
+
+bool
+int_set_peek_next_int(
+    int_set_ref S,
+    base_int_t  *i
+)
+{
+    if ( S->backend == int_set_backend_chunked ) return __int_set_chunked_peek_next_int(S, i);
+    return __int_set_ranges_peek_next_int(S, i);
+}
+
+//
+
+bool
+int_set_pop_next_int(
+    int_set_ref S,
+    base_int_t  *i
+)
+{
+    int_range_t r;
+    
+    if ( S->backend == int_set_backend_chunked ) {
+        if ( ! __int_set_chunked_pop_next_range(S, 1, &r) ) return false;
+        *i = r.start;
+        return true;
+    }
+    return __int_set_ranges_pop_next_int(S, i);
+}
+
+//
+
+bool
+int_set_pop_next_range(
+    int_set_ref S,
+    base_int_t  max_length,
+    int_range_t *r
+)
+{
+    if ( S->backend == int_set_backend_chunked ) return __int_set_chunked_pop_next_range(S, max_length, r);
+    return __int_set_ranges_pop_next_range(S, max_length, r);
+}
+
+//
+
+void
+int_set_clear(
+    int_set_ref S
+)
+{
+    if ( S->backend == int_set_backend_chunked ) {
+        __int_set_chunked_clear(S);
+    } else {
+        S->length = 0;
+        S->count = 0;
+    }
+}
+
+//
+
+static bool
+__int_set_push_range_enumerator(
+    int_range_t r,
+    const void  *context
+)
+{
+    return int_set_push_range((int_set_ref)context, r);
+}
+
+static bool
+__int_set_merge(
+    int_set_t       *R,
+    int_set_t       *A,
+    int_set_t       *B,
+    __int_set_op_t  op
+)
+{
+    int_set_t       *a = A, *b = B;
+    bool            rc = false;
+    
+    // Operands stored differently than R are first copied into R's backend:
+    if ( A->backend != R->backend ) {
+        a = __int_set_create(R->backend);
+        if ( a && ! int_set_enumerate_ranges(A, __int_set_push_range_enumerator, a) ) {
+            __int_set_destroy(a);
+            a = NULL;
+        }
+    }
+    if ( B->backend != R->backend ) {
+        b = __int_set_create(R->backend);
+        if ( b && ! int_set_enumerate_ranges(B, __int_set_push_range_enumerator, b) ) {
+            __int_set_destroy(b);
+            b = NULL;
+        }
+    }
+    if ( a && b ) {
+        if ( R->backend == int_set_backend_chunked )
+            rc = __int_set_chunked_merge(R, a, b, op);
+        else
+            rc = __int_set_ranges_merge(R, a, b, op);
+    }
+    if ( a && (a != A) ) __int_set_destroy(a);
+    if ( b && (b != B) ) __int_set_destroy(b);
+    return rc;
+}
+
+//
+
+bool
+int_set_union(
+    int_set_ref R,
+    int_set_ref A,
+    int_set_ref B
+)
+{
+    return __int_set_merge(R, A, B, __int_set_op_union);
+}
+
+//
+
+bool
+int_set_intersection(
+    int_set_ref R,
+    int_set_ref A,
+    int_set_ref B
+)
+{
+    return __int_set_merge(R, A, B, __int_set_op_intersection);
+}
+
+//
+
+bool
+int_set_difference(
+    int_set_ref R,
+    int_set_ref A,
+    int_set_ref B
+)
+{
+    return __int_set_merge(R, A, B, __int_set_op_difference);
+}
+
+//
+
+bool
+int_set_enumerate_ranges(
+    int_set_ref                 S,
+    int_set_range_enumerator_t  enumerator,
+    const void                  *context
+)
+{
+    if ( S->backend == int_set_backend_chunked ) return __int_set_chunked_enumerate_ranges(S, enumerator, context);
+    return __int_set_ranges_enumerate_ranges(S, enumerator, context);
+}
+
+//
+
+/*
+ * Packed form:  the number of ranges followed by each range's offset
+ * from the end of the previous one (the first from zero, zigzag-encoded
+ * since it may be negative) and its length, all as LEB128 varints.
+ */
+static inline size_t
+__int_set_varint_size(
+    uint64_t    v
+)
+{
+    size_t      n = 1;
+    
+    while ( v >= 0x80 ) v >>= 7, n++;
+    return n;
+}
+
+static inline uint8_t*
+__int_set_varint_put(
+    uint8_t     *p,
+    uint64_t    v
+)
+{
+    while ( v >= 0x80 ) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t*
+__int_set_varint_get(
+    const uint8_t   *p,
+    const uint8_t   *p_end,
+    uint64_t        *v
+)
+{
+    int             shift = 0;
+    
+    *v = 0;
+    while ( (p < p_end) && (shift < 64) ) {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        if ( ! (*p++ & 0x80) ) return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+static inline uint64_t
+__int_set_zigzag(
+    base_int_t  i
+)
+{
+    return (i < 0) ? ((((uint64_t)-(i + 1)) << 1) | 1) : ((uint64_t)i << 1);
+}
+
+static inline base_int_t
+__int_set_unzigzag(
+    uint64_t    v
+)
+{
+    return (v & 1) ? -(base_int_t)(v >> 1) - 1 : (base_int_t)(v >> 1);
+}
+
+typedef struct {
+    size_t      n_bytes;
+    base_int_t  n_ranges;
+    base_int_t  prev_end;
+    uint8_t     *p;
+} __int_set_pack_context_t;
+
+static bool
+__int_set_pack_size_enumerator(
+    int_range_t r,
+    const void  *context
+)
+{
+    __int_set_pack_context_t    *CONTEXT = (__int_set_pack_context_t*)context;
+    uint64_t                    delta = CONTEXT->n_ranges ? (uint64_t)(r.start - CONTEXT->prev_end) : __int_set_zigzag(r.start);
+    
+    CONTEXT->n_bytes += __int_set_varint_size(delta) + __int_set_varint_size(r.length);
+    CONTEXT->n_ranges++;
+    CONTEXT->prev_end = int_range_get_max(r);
+    return true;
+}
+
+static bool
+__int_set_pack_enumerator(
+    int_range_t r,
+    const void  *context
+)
+{
+    __int_set_pack_context_t    *CONTEXT = (__int_set_pack_context_t*)context;
+    uint64_t                    delta = CONTEXT->n_ranges ? (uint64_t)(r.start - CONTEXT->prev_end) : __int_set_zigzag(r.start);
+    
+    CONTEXT->p = __int_set_varint_put(CONTEXT->p, delta);
+    CONTEXT->p = __int_set_varint_put(CONTEXT->p, r.length);
+    CONTEXT->n_ranges++;
+    CONTEXT->prev_end = int_range_get_max(r);
+    return true;
+}
+
+//
+
+size_t
+int_set_pack_size(
+    int_set_ref S
+)
+{
+    __int_set_pack_context_t    context = { .n_bytes = 0, .n_ranges = 0, .prev_end = 0, .p = NULL };
+    
+    int_set_enumerate_ranges(S, __int_set_pack_size_enumerator, &context);
+    return context.n_bytes + __int_set_varint_size(context.n_ranges);
+}
+
+//
+
+size_t
+int_set_pack(
+    int_set_ref S,
+    void        *buffer,
+    size_t      buffer_size
+)
+{
+    __int_set_pack_context_t    context = { .n_bytes = 0, .n_ranges = 0, .prev_end = 0, .p = NULL };
+    size_t                      n_bytes;
+    
+    // The range count leads, so it must be known up front:
+    int_set_enumerate_ranges(S, __int_set_pack_size_enumerator, &context);
+    n_bytes = context.n_bytes + __int_set_varint_size(context.n_ranges);
+    if ( n_bytes > buffer_size ) return 0;
+    
+    context.p = __int_set_varint_put((uint8_t*)buffer, context.n_ranges);
+    context.n_ranges = 0;
+    int_set_enumerate_ranges(S, __int_set_pack_enumerator, &context);
+    return n_bytes;
+}
+
+//
+
+bool
+int_set_unpack(
+    int_set_ref S,
+    const void  *buffer,
+    size_t      buffer_size
+)
+{
+    const uint8_t   *p = (const uint8_t*)buffer, *p_end = p + buffer_size;
+    uint64_t        n_ranges, ri = 0, v;
+    base_int_t      prev_end = 0;
+    
+    int_set_clear(S);
+    if ( ! (p = __int_set_varint_get(p, p_end, &n_ranges)) ) return false;
+    while ( ri < n_ranges ) {
+        int_range_t r;
+        
+        if ( ! (p = __int_set_varint_get(p, p_end, &v)) ) return false;
+        r.start = (ri++ == 0) ? __int_set_unzigzag(v) : prev_end + (base_int_t)v;
+        if ( ! (p = __int_set_varint_get(p, p_end, &v)) || (v == 0) ) return false;
+        r.length = (base_int_t)v;
+        if ( ! int_set_push_range(S, r) ) return false;
+        prev_end = int_range_get_max(r);
+    }
+    return true;
+}
+//
+
+typedef struct {
+    FILE        *stream;
+    int         counter;
+} __int_set_summary_context_t;
+
+static bool
+__int_set_summary_enumerator(
+    int_range_t r,
+    const void  *context
+)
+{
+    static const char *fmt_counter_eq_0 = "\n    [" BASE_INT_FMT ", " BASE_INT_FMT "]";
+    static const char *fmt_counter_ne_0 = ", [" BASE_INT_FMT ", " BASE_INT_FMT "]";
+    
+    __int_set_summary_context_t *summary = (__int_set_summary_context_t*)context;
+    
+    fprintf(summary->stream, ((summary->counter == 0) ? fmt_counter_eq_0 : fmt_counter_ne_0), r.start, int_range_get_end(r));
+    summary->counter = (summary->counter + 1) % 16;
+    return true;
+}
+
+void
+int_set_summary(
+    int_set_ref S,
+    FILE        *stream
+)
+{
+    __int_set_summary_context_t summary = { .stream = stream, .counter = 0 };
+    
+    if ( S->backend == int_set_backend_chunked ) {
+        int             ci = 0, n_type[3] = { 0, 0, 0 };
+        
+        while ( ci < S->length ) n_type[S->chunks[ci++].type]++;
+        fprintf(stream, "int_set@%p (chunked, n=" BASE_INT_FMT ", chunks=%d: %d array, %d bitmap, %d runs) {",
+                    S, S->count, S->length, n_type[__int_set_chunk_array], n_type[__int_set_chunk_bitmap], n_type[__int_set_chunk_runs]);
+    } else {
+        fprintf(stream, "int_set@%p (n=" BASE_INT_FMT ", l=%d, c=%d) {", S, S->count, S->length, S->capacity);
+    }
+    int_set_enumerate_ranges(S, __int_set_summary_enumerator, &summary);
+    fprintf(stream, "\n}\n");
+}
+
+//
+////
+//
+
+#ifdef ENABLE_INT_SET_TEST
+
+int
+main()
+{
+    int_set_ref     S = int_set_create();
+    int             i;
+    
+    int_set_push_int(S, 10);
+    int_set_summary(S, stdout);
+    int_set_push_int(S, 11);
+    int_set_summary(S, stdout);
+    int_set_push_int(S, 12);
+    int_set_summary(S, stdout);
+    int_set_push_int(S, 15);
+    int_set_summary(S, stdout);
+    int_set_push_range(S, int_range_make_with_low_and_high(13, 14));
+    int_set_summary(S, stdout);
+    int_set_remove_range(S, int_range_make_with_low_and_high(14, 18));
+    int_set_summary(S, stdout);
+    int_set_remove_int(S, 11);
+    int_set_summary(S, stdout);
+    
+    while ( int_set_pop_next_int(S, &i) ) printf("..." BASE_INT_FMT "...\n", i);
+    
+    int_set_destroy(S);
+    
     return 0;
 }
 
@@ -9,7 +9,19 @@
 	integer values.  Members of the set are represented as
 	integer ranges, so the implementation is optimal for sets
 	that minimize gaps (which is exactly what we need for the
-	matrix element server).
+	matrix element server).  The ranges are kept sorted, so
+	lookups are a binary search over them.  The first few ranges
+	are stored inside the set itself and the range array grows
+	geometrically beyond that.
+	
+	Sets that become heavily fragmented can instead use a chunked
+	(roaring-style) backend:  integers are grouped into chunks of
+	65536 and each chunk is stored as a sorted array, a bitmap or
+	an array of ranges, whichever is smallest for its density.
+	Memory and operation cost then stay bounded no matter how
+	scattered the set is.  The backend is chosen per set with
+	int_set_create_with_backend(); int_set_create() uses the range
+	array unless the ENABLE_INT_SET_CHUNKED build option is on.
 */
 
 #ifndef __INT_SET_H__
@@ -25,13 +37,41 @@
  */
 typedef struct int_set * int_set_ref;
 
+/*
+ * @enum int_set backends
+ *
+ * The storage used behind the int_set API:
+ *
+ *     - ranges:  a sorted array of ranges
+ *     - chunked:  per-chunk array, bitmap or range encodings
+ */
+enum {
+    int_set_backend_ranges = 0,
+    int_set_backend_chunked = 1
+};
+
+/*
+ * @typedef int_set_backend_t
+ *
+ * The type of an int_set backend identifier.
+ */
+typedef unsigned int int_set_backend_t;
+
 /*
  * @function int_set_create
  *
- * Create a new (empty) integer set.
+ * Create a new (empty) integer set using the default backend.
  */
 int_set_ref int_set_create();
 
+/*
+ * @function int_set_create_with_backend
+ *
+ * Create a new (empty) integer set using the given backend.  Returns
+ * NULL if the backend is not valid or memory could not be allocated.
+ */
+int_set_ref int_set_create_with_backend(int_set_backend_t backend);
+
 /*
  * @function int_set_destroy
  *
@@ -39,10 +79,51 @@ int_set_ref int_set_create();
  */
 void int_set_destroy(int_set_ref S);
 
+/*
+ * @typedef int_set_arena_ref
+ *
+ * Opaque reference to an arena of integer sets.  All sets created in an
+ * arena are allocated from a few large blocks and are released together
+ * when the arena is destroyed.
+ */
+typedef struct int_set_arena * int_set_arena_ref;
+
+/*
+ * @function int_set_arena_create
+ *
+ * Create a new (empty) arena sized to hold n_sets_hint sets in its first
+ * block.  Returns NULL if memory could not be allocated.
+ */
+int_set_arena_ref int_set_arena_create(int n_sets_hint);
+
+/*
+ * @function int_set_arena_destroy
+ *
+ * Deallocate the arena A and every set that was created in it.
+ */
+void int_set_arena_destroy(int_set_arena_ref A);
+
+/*
+ * @function int_set_create_in_arena
+ *
+ * Create a new (empty) integer set in the arena A using the default
+ * backend.  The set may be passed to int_set_destroy() to release its
+ * contents early; its own storage is only reclaimed with the arena.
+ */
+int_set_ref int_set_create_in_arena(int_set_arena_ref A);
+
+/*
+ * @function int_set_get_backend
+ *
+ * Returns the backend used by the set S.
+ */
+int_set_backend_t int_set_get_backend(int_set_ref S);
+
 /*
  * @function int_set_get_length
  *
- * Returns the number of integers in the set S.
+ * Returns the number of integers in the set S.  The count is
+ * maintained as the set is modified, so this is O(1).
  */
 base_int_t int_set_get_length(int_set_ref S);
 
@@ -76,11 +157,50 @@ bool int_set_remove_int(int_set_ref S, base_int_t i);
 /*
  * @function int_set_remove_range
  *
- * Remove all integers in range r from the set S.  Returns
- * true if successful.
+ * Remove all integers in range r from the set S.  Ranges are
+ * trimmed or split in a single pass.  Returns true if any integer
+ * was removed.
  */
 bool int_set_remove_range(int_set_ref S, int_range_t r);
 
+/*
+ * @function int_set_clear
+ *
+ * Remove all integers from the set S.
+ */
+void int_set_clear(int_set_ref S);
+
+/*
+ * @function int_set_union
+ *
+ * Replace the contents of set R with the integers in either of the
+ * sets A and B.  R may be the same set as A or B.  The sets are merged
+ * in a single pass over their ranges (or chunks); an operand using a
+ * different backend than R is first copied into R's backend.  Returns
+ * false (and R is not altered) if memory could not be allocated.
+ */
+bool int_set_union(int_set_ref R, int_set_ref A, int_set_ref B);
+
+/*
+ * @function int_set_intersection
+ *
+ * Replace the contents of set R with the integers in both of the
+ * sets A and B.  R may be the same set as A or B.  The sets are merged
+ * in a single pass as for int_set_union().  Returns false (and R is
+ * not altered) if memory could not be allocated.
+ */
+bool int_set_intersection(int_set_ref R, int_set_ref A, int_set_ref B);
+
+/*
+ * @function int_set_difference
+ *
+ * Replace the contents of set R with the integers in set A that are
+ * not in set B.  R may be the same set as A or B.  The sets are merged
+ * in a single pass as for int_set_union().  Returns false (and R is
+ * not altered) if memory could not be allocated.
+ */
+bool int_set_difference(int_set_ref R, int_set_ref A, int_set_ref B);
+
 /*
  * @function int_set_peek_next_int
  *
@@ -99,6 +219,63 @@ bool int_set_peek_next_int(int_set_ref S, base_int_t *i);
  */
 bool int_set_pop_next_int(int_set_ref S, base_int_t *i);
 
+/*
+ * @function int_set_pop_next_range
+ *
+ * Set *r to the range of at most max_length consecutive integers
+ * starting at the lowest integer value currently in the set and
+ * remove them from set S.  Returns true if a value was present and
+ * *r was set, false if the set was empty.
+ */
+bool int_set_pop_next_range(int_set_ref S, base_int_t max_length, int_range_t *r);
+
+/*
+ * @typedef int_set_range_enumerator_t
+ *
+ * Type of the callback function used by int_set_enumerate_ranges().
+ * The function is passed each range r in the set and the context
+ * pointer passed to int_set_enumerate_ranges().  Returning false
+ * stops the enumeration.
+ */
+typedef bool (*int_set_range_enumerator_t)(int_range_t r, const void *context);
+
+/*
+ * @function int_set_enumerate_ranges
+ *
+ * Call enumerator for each range of integers in the set S in
+ * ascending order.  Returns false if the enumerator stopped the
+ * enumeration early, true otherwise.
+ */
+bool int_set_enumerate_ranges(int_set_ref S, int_set_range_enumerator_t enumerator, const void *context);
+
+/*
+ * @function int_set_pack_size
+ *
+ * Returns the number of bytes int_set_pack() will produce for the
+ * set S.
+ */
+size_t int_set_pack_size(int_set_ref S);
+
+/*
+ * @function int_set_pack
+ *
+ * Serialize the set S into buffer:  the number of ranges followed by
+ * each range's offset from the end of the previous one and its length,
+ * as variable-length integers.  A set of a few clustered ranges packs
+ * into a handful of bytes no matter where the ranges lie.  Returns the
+ * number of bytes written, or 0 if buffer_size was too small.
+ */
+size_t int_set_pack(int_set_ref S, void *buffer, size_t buffer_size);
+
+/*
+ * @function int_set_unpack
+ *
+ * Replace the contents of the set S with the set serialized by
+ * int_set_pack() in buffer.  Returns false if the buffer was truncated
+ * or malformed or memory could not be allocated.
+ */
+bool int_set_unpack(int_set_ref S, const void *buffer, size_t buffer_size);
+
 /*
  * @function int_set_summary
  *
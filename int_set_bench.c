@@ -0,0 +1,430 @@
+/*	int_set_bench.c
+	Copyright (c) 2024, J T Frey
+*/
+
+/*
+ * Microbenchmark for the int_set implementation.
+ *
+ * Each combination of backend, access pattern and set size is run in a
+ * child process (so its peak memory can be measured in isolation and a
+ * runaway case can be stopped at the time limit) through four timed
+ * phases:
+ *
+ *     push:    add every value of the pattern
+ *     length:  query the element count once per value
+ *     remove:  remove every other value of the pattern
+ *     pop:     pop the lowest value until the set is empty
+ *
+ * The patterns are:
+ *
+ *     sequential:  0, 1, 2, ... (one growing range)
+ *     strided:     0, 2, 4, ... (as many ranges as values)
+ *     random:      uniformly random values in [0, 2N)
+ *     workmgr:     the work unit manager's use, with N indices split
+ *                  into units popped from an available set; units are
+ *                  completed out of order within a window of
+ *                  outstanding units (push into the completed set),
+ *                  and removed in another such order
+ *
+ * The mean time per operation of each phase and the growth in peak
+ * resident memory are reported.
+ */
+
+#include "int_set.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+//
+
+enum {
+    bench_pattern_sequential = 0,
+    bench_pattern_strided,
+    bench_pattern_random,
+    bench_pattern_workmgr,
+    bench_pattern_max
+};
+
+static const char *bench_pattern_names[] = { "sequential", "strided", "random", "workmgr" };
+static const char *bench_backend_names[] = { "ranges", "chunked" };
+
+enum {
+    bench_phase_push = 0,
+    bench_phase_length,
+    bench_phase_remove,
+    bench_phase_pop,
+    bench_phase_max
+};
+
+typedef struct {
+    double          ns_per_op[bench_phase_max];
+    long            peak_kib;
+} bench_result_t;
+
+#define BENCH_MAX_SIZES     16
+
+// Work unit size and window of outstanding units for the workmgr pattern:
+#define BENCH_UNIT_SIZE     16
+#define BENCH_UNIT_WINDOW   64
+
+//
+
+static inline double
+bench_now(void)
+{
+    struct timespec     t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+
+//
+
+static inline uint64_t
+bench_hash(
+    uint64_t    x
+)
+{
+    // splitmix64 finalizer:
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//
+
+static inline base_int_t
+bench_value(
+    int         pattern,
+    base_int_t  n,
+    base_int_t  k
+)
+{
+    switch ( pattern ) {
+        case bench_pattern_strided:
+            return 2 * k;
+        case bench_pattern_random:
+            return (base_int_t)(bench_hash(k) % (uint64_t)(2 * n));
+    }
+    return k;
+}
+
+//
+
+static void
+bench_window_shuffle(
+    int_range_t     *units,
+    base_int_t      n_units,
+    uint64_t        seed
+)
+{
+    base_int_t      w = 0;
+    
+    // Fisher-Yates within each window of outstanding units:
+    while ( w < n_units ) {
+        base_int_t  n = (n_units - w < BENCH_UNIT_WINDOW) ? (n_units - w) : BENCH_UNIT_WINDOW;
+        
+        while ( n > 1 ) {
+            base_int_t  j = (base_int_t)(bench_hash(seed++) % (uint64_t)n);
+            int_range_t t = units[w + --n];
+            
+            units[w + n] = units[w + j];
+            units[w + j] = t;
+        }
+        w += BENCH_UNIT_WINDOW;
+    }
+}
+
+//
+
+static bool
+bench_run_workmgr(
+    int_set_ref     S,
+    int_set_backend_t backend,
+    base_int_t      n,
+    double          *t_phase,
+    base_int_t      *n_ops
+)
+{
+    int_set_ref     available = int_set_create_with_backend(backend);
+    int_range_t     *units = (int_range_t*)malloc(((n + BENCH_UNIT_SIZE - 1) / BENCH_UNIT_SIZE) * sizeof(int_range_t));
+    base_int_t      n_units = 0, k;
+    double          t0;
+    
+    if ( ! available || ! units ) return false;
+    int_set_push_range(available, int_range_make(0, n));
+    
+    t0 = bench_now();
+    while ( int_set_pop_next_range(available, BENCH_UNIT_SIZE, &units[n_units]) ) n_units++;
+    t_phase[bench_phase_pop] = bench_now() - t0;
+    n_ops[bench_phase_pop] = n_units;
+    
+    bench_window_shuffle(units, n_units, 1);
+    t0 = bench_now();
+    for ( k = 0; k < n_units; k++ ) int_set_push_range(S, units[k]);
+    t_phase[bench_phase_push] = bench_now() - t0;
+    n_ops[bench_phase_push] = n_units;
+    
+    bench_window_shuffle(units, n_units, 2);
+    t0 = bench_now();
+    for ( k = 0; k < n_units; k++ ) int_set_remove_range(S, units[k]);
+    t_phase[bench_phase_remove] = bench_now() - t0;
+    n_ops[bench_phase_remove] = n_units;
+    
+    free((void*)units);
+    int_set_destroy(available);
+    return true;
+}
+
+//
+
+static bool
+bench_run(
+    int_set_backend_t backend,
+    int             pattern,
+    base_int_t      n,
+    bench_result_t  *result
+)
+{
+    int_set_ref     S = int_set_create_with_backend(backend);
+    double          t_phase[bench_phase_max] = { 0.0 }, t0;
+    base_int_t      n_ops[bench_phase_max] = { 0 }, k, i;
+    volatile base_int_t sink = 0;
+    struct rusage   usage;
+    long            base_kib;
+    int             phase;
+    
+    if ( ! S ) return false;
+    getrusage(RUSAGE_SELF, &usage);
+    base_kib = usage.ru_maxrss;
+    
+    if ( pattern == bench_pattern_workmgr ) {
+        if ( ! bench_run_workmgr(S, backend, n, t_phase, n_ops) ) return false;
+        
+        // Leave the set as the completed indices for the length phase:
+        int_set_push_range(S, int_range_make(0, n));
+    } else {
+        t0 = bench_now();
+        for ( k = 0; k < n; k++ ) int_set_push_int(S, bench_value(pattern, n, k));
+        t_phase[bench_phase_push] = bench_now() - t0;
+        n_ops[bench_phase_push] = n;
+    }
+    
+    t0 = bench_now();
+    for ( k = 0; k < n; k++ ) sink += int_set_get_length(S);
+    t_phase[bench_phase_length] = bench_now() - t0;
+    n_ops[bench_phase_length] = n;
+    
+    if ( pattern != bench_pattern_workmgr ) {
+        t0 = bench_now();
+        for ( k = 0; k < n; k += 2 ) int_set_remove_int(S, bench_value(pattern, n, k));
+        t_phase[bench_phase_remove] = bench_now() - t0;
+        n_ops[bench_phase_remove] = (n + 1) / 2;
+        
+        t0 = bench_now();
+        while ( int_set_pop_next_int(S, &i) ) n_ops[bench_phase_pop]++;
+        t_phase[bench_phase_pop] = bench_now() - t0;
+    }
+    
+    getrusage(RUSAGE_SELF, &usage);
+    result->peak_kib = usage.ru_maxrss - base_kib;
+    for ( phase = 0; phase < bench_phase_max; phase++ )
+        result->ns_per_op[phase] = (n_ops[phase] > 0) ? (1e9 * t_phase[phase] / n_ops[phase]) : 0.0;
+    int_set_destroy(S);
+    return true;
+}
+
+//
+
+static bool
+bench_run_isolated(
+    int_set_backend_t backend,
+    int             pattern,
+    base_int_t      n,
+    unsigned int    time_limit,
+    bench_result_t  *result,
+    bool            *is_timed_out
+)
+{
+    int             fds[2], status;
+    pid_t           pid;
+    bool            rc = false;
+    
+    *is_timed_out = false;
+    if ( pipe(fds) != 0 ) return false;
+    fflush(stdout);
+    pid = fork();
+    if ( pid == 0 ) {
+        close(fds[0]);
+        if ( time_limit > 0 ) alarm(time_limit);
+        rc = bench_run(backend, pattern, n, result);
+        if ( rc && (write(fds[1], result, sizeof(*result)) != sizeof(*result)) ) rc = false;
+        close(fds[1]);
+        _exit(rc ? 0 : 1);
+    }
+    close(fds[1]);
+    if ( pid > 0 ) {
+        rc = (read(fds[0], result, sizeof(*result)) == sizeof(*result));
+        waitpid(pid, &status, 0);
+        if ( WIFSIGNALED(status) && (WTERMSIG(status) == SIGALRM) ) *is_timed_out = true;
+        else if ( ! WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) rc = false;
+    }
+    close(fds[0]);
+    return rc;
+}
+
+//
+
+static const struct option cliOptions[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "sizes", required_argument, NULL, 'n' },
+        { "patterns", required_argument, NULL, 'p' },
+        { "backends", required_argument, NULL, 'B' },
+        { "time-limit", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 }
+    };
+static const char *cliOptionsStr = "hn:p:B:t:";
+
+//
+
+void
+usage(
+    const char  *exe
+)
+{
+    printf(
+            "usage:\n\n"
+            "    %s {options}\n\n"
+            "  options:\n\n"
+            "    --help/-h                  show this information\n"
+            "    --sizes/-n <list>          comma-separated set sizes (default 1e3,1e4,1e5,1e6);\n"
+            "                               at most 1e8\n"
+            "    --patterns/-p <list>       comma-separated access patterns (default all):\n"
+            "                               sequential, strided, random, workmgr\n"
+            "    --backends/-B <list>       comma-separated int_set backends (default all):\n"
+            "                               ranges, chunked\n"
+            "    --time-limit/-t #          seconds allowed per case, 0 for none (default 60)\n"
+            "\n",
+            exe
+        );
+}
+
+//
+
+static bool
+parse_name_list(
+    const char  *optarg,
+    const char  **names,
+    int         n_names,
+    bool        *selected
+)
+{
+    char        *list = strdup(optarg), *name, *state = NULL;
+    int         i;
+    bool        rc = true;
+    
+    for ( i = 0; i < n_names; i++ ) selected[i] = false;
+    for ( name = strtok_r(list, ",", &state); rc && name; name = strtok_r(NULL, ",", &state) ) {
+        for ( i = 0; i < n_names; i++ )
+            if ( strcmp(name, names[i]) == 0 ) break;
+        if ( i == n_names ) rc = false;
+        else selected[i] = true;
+    }
+    free((void*)list);
+    return rc;
+}
+
+//
+
+int
+main(
+    int         argc,
+    char*       argv[]
+)
+{
+    int             optch, i_size, pattern;
+    unsigned int    time_limit = 60;
+    double          sizes[BENCH_MAX_SIZES] = { 1e3, 1e4, 1e5, 1e6 };
+    int             n_sizes = 4;
+    bool            patterns[bench_pattern_max] = { true, true, true, true };
+    bool            backends[2] = { true, true };
+    int_set_backend_t backend;
+    
+    while ( (optch = getopt_long(argc, argv, cliOptionsStr, cliOptions, NULL)) != -1 ) {
+        switch ( optch ) {
+            
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            
+            case 'n': {
+                const char  *p = optarg;
+                char        *endptr;
+                
+                n_sizes = 0;
+                while ( n_sizes < BENCH_MAX_SIZES ) {
+                    sizes[n_sizes] = strtod(p, &endptr);
+                    if ( (endptr == p) || (sizes[n_sizes] < 1.0) || (sizes[n_sizes] > 1e8) ) break;
+                    n_sizes++;
+                    if ( *endptr != ',' ) break;
+                    p = endptr + 1;
+                }
+                if ( ! n_sizes || (*endptr != '\0') ) {
+                    fprintf(stderr, "ERROR:  invalid sizes `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'p':
+                if ( ! parse_name_list(optarg, bench_pattern_names, bench_pattern_max, patterns) ) {
+                    fprintf(stderr, "ERROR:  invalid patterns `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 'B':
+                if ( ! parse_name_list(optarg, bench_backend_names, 2, backends) ) {
+                    fprintf(stderr, "ERROR:  invalid backends `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 't':
+                time_limit = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+        
+        }
+    }
+    
+    printf("# base_int_t is %d bits, ns per operation by phase\n", (int)(8 * sizeof(base_int_t)));
+    printf("%-8s %-10s %10s %10s %10s %10s %10s %12s\n",
+            "backend", "pattern", "size", "push", "length", "remove", "pop", "peak_KiB");
+    for ( backend = int_set_backend_ranges; backend <= int_set_backend_chunked; backend++ ) {
+        if ( ! backends[backend] ) continue;
+        for ( pattern = 0; pattern < bench_pattern_max; pattern++ ) {
+            if ( ! patterns[pattern] ) continue;
+            for ( i_size = 0; i_size < n_sizes; i_size++ ) {
+                base_int_t      n = (base_int_t)sizes[i_size];
+                bench_result_t  result;
+                bool            is_timed_out;
+                
+                printf("%-8s %-10s %10" PRId64, bench_backend_names[backend], bench_pattern_names[pattern], (int64_t)n);
+                if ( bench_run_isolated(backend, pattern, n, time_limit, &result, &is_timed_out) ) {
+                    printf(" %10.1lf %10.1lf %10.1lf %10.1lf %12ld\n",
+                            result.ns_per_op[bench_phase_push], result.ns_per_op[bench_phase_length],
+                            result.ns_per_op[bench_phase_remove], result.ns_per_op[bench_phase_pop],
+                            result.peak_kib);
+                } else if ( is_timed_out ) {
+                    printf("  (exceeded the %u s time limit)\n", time_limit);
+                } else {
+                    printf("  (failed)\n");
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*	matrix_element.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header Matrix element storage type
+
+	Kernels always produce matrix elements in double precision; the
+	sub-matrices hold them (and ranks exchange them) as the
+	matrix_element_t chosen at build time (see project_config.h).  The
+	functions in this header convert between the two.
+
+	Rounding:  conversion to float uses the C conversion, i.e. the
+	current floating-point rounding mode, which is round-to-nearest,
+	ties-to-even unless the program changes it.  Conversion to bfloat16
+	is always round-to-nearest, ties-to-even, and is correctly rounded
+	from the double value:  the intermediate float is rounded to odd so
+	that rounding twice cannot move a value across a bfloat16 halfway
+	point.  Values beyond the largest finite element overflow to
+	infinity, NaNs stay (quiet) NaNs.  Converting an element back to
+	double is exact.
+*/
+
+#ifndef __MATRIX_ELEMENT_H__
+#define __MATRIX_ELEMENT_H__
+
+#include "project_config.h"
+
+#ifdef ENABLE_ELEMENT_BFLOAT16
+
+static inline matrix_element_t
+__matrix_element_bfloat16_from_double(
+    double      v
+)
+{
+    float       f = (float)v;
+    uint32_t    u;
+    
+    memcpy(&u, &f, sizeof(u));
+    if ( isnan(f) ) return (matrix_element_t)((u >> 16) | 0x0040);
+    
+    // Round to odd:  truncate toward zero, then make the last bit sticky
+    // if anything was lost:
+    if ( (double)f != v ) {
+        if ( fabs((double)f) > fabs(v) ) u--;
+        u |= 1;
+    }
+    u += 0x7fff + ((u >> 16) & 1);
+    return (matrix_element_t)(u >> 16);
+}
+
+static inline double
+__matrix_element_bfloat16_to_double(
+    matrix_element_t    e
+)
+{
+    uint32_t    u = (uint32_t)e << 16;
+    float       f;
+    
+    memcpy(&f, &u, sizeof(f));
+    return (double)f;
+}
+
+#endif
+
+/*
+ * @function matrix_element_from_double
+ *
+ * Returns v rounded to the matrix element type.
+ */
+static inline matrix_element_t
+matrix_element_from_double(
+    double      v
+)
+{
+#ifdef ENABLE_ELEMENT_BFLOAT16
+    return __matrix_element_bfloat16_from_double(v);
+#else
+    return (matrix_element_t)v;
+#endif
+}
+
+/*
+ * @function matrix_element_to_double
+ *
+ * Returns the matrix element e as a double (exactly).
+ */
+static inline double
+matrix_element_to_double(
+    matrix_element_t    e
+)
+{
+#ifdef ENABLE_ELEMENT_BFLOAT16
+    return __matrix_element_bfloat16_to_double(e);
+#else
+    return (double)e;
+#endif
+}
+
+/*
+ * @function matrix_element_from_double_n
+ *
+ * Round the n values to the matrix element type, storing them in
+ * elements.  The two arrays must not overlap.
+ */
+static inline void
+matrix_element_from_double_n(
+    matrix_element_t    *elements,
+    const double        *values,
+    base_int_t          n
+)
+{
+#ifdef MATRIX_ELEMENT_IS_DOUBLE
+    memcpy(elements, values, n * sizeof(double));
+#else
+    while ( n-- > 0 ) *elements++ = matrix_element_from_double(*values++);
+#endif
+}
+
+#endif /* __MATRIX_ELEMENT_H__ */
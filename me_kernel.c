@@ -0,0 +1,288 @@
+/*	me_kernel.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "me_kernel.h"
+#include "me_kernel_plugin.h"
+
+#include <dlfcn.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define ME_KERNEL_HAVE_X86
+#   include <immintrin.h>
+#endif
+
+//
+
+const char me_kernel_description[] = "A_{i,j} = Sqrt[i*i + j*j]";
+
+const char me_kernel_feature_description[] = "A_{i,j} = Exp[-|x_i - y_j|^2 / 2]";
+
+//
+
+/*
+ * Each implementation produces Sqrt[fixed*fixed + k*k] for k in [lo, hi).
+ * The kernel is symmetric in i and j, so the row and column segments
+ * share them.  Multiply and add are kept separate (no FMA) so that the
+ * rounding matches me_kernel() exactly.
+ */
+typedef void (*__me_kernel_segment_fn_t)(double fixed, base_int_t lo, base_int_t hi, double *values);
+
+static void
+__me_kernel_segment_scalar(
+    double      fixed,
+    base_int_t  lo,
+    base_int_t  hi,
+    double      *values
+)
+{
+    double      f2 = fixed * fixed;
+    
+    while ( lo < hi ) {
+        double  k = (double)lo++;
+        
+        *values++ = sqrt(f2 + k * k);
+    }
+}
+
+#ifdef ME_KERNEL_HAVE_X86
+
+__attribute__((target("avx2")))
+static void
+__me_kernel_segment_avx2(
+    double      fixed,
+    base_int_t  lo,
+    base_int_t  hi,
+    double      *values
+)
+{
+    __m256d     f2 = _mm256_set1_pd(fixed * fixed);
+    __m256d     k = _mm256_setr_pd((double)lo, (double)(lo + 1), (double)(lo + 2), (double)(lo + 3));
+    __m256d     step = _mm256_set1_pd(4.0);
+    
+    // Integral doubles below 2^53 are exact, so k can simply be stepped:
+    while ( hi - lo >= 4 ) {
+        _mm256_storeu_pd(values, _mm256_sqrt_pd(_mm256_add_pd(f2, _mm256_mul_pd(k, k))));
+        k = _mm256_add_pd(k, step);
+        values += 4, lo += 4;
+    }
+    __me_kernel_segment_scalar(fixed, lo, hi, values);
+}
+
+__attribute__((target("avx512f")))
+static void
+__me_kernel_segment_avx512(
+    double      fixed,
+    base_int_t  lo,
+    base_int_t  hi,
+    double      *values
+)
+{
+    __m512d     f2 = _mm512_set1_pd(fixed * fixed);
+    __m512d     k = _mm512_add_pd(_mm512_set1_pd((double)lo), _mm512_setr_pd(0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0));
+    __m512d     step = _mm512_set1_pd(8.0);
+    
+    while ( hi - lo >= 8 ) {
+        _mm512_storeu_pd(values, _mm512_sqrt_pd(_mm512_add_pd(f2, _mm512_mul_pd(k, k))));
+        k = _mm512_add_pd(k, step);
+        values += 8, lo += 8;
+    }
+    __me_kernel_segment_scalar(fixed, lo, hi, values);
+}
+
+#endif
+
+//
+
+static __me_kernel_segment_fn_t __me_kernel_segment = NULL;
+static const char               *__me_kernel_isa = NULL;
+
+static __me_kernel_segment_fn_t
+__me_kernel_select(void)
+{
+    // Any thread racing to select arrives at the same choice:
+    if ( ! __me_kernel_segment ) {
+        __me_kernel_segment_fn_t    fn = __me_kernel_segment_scalar;
+        
+        __me_kernel_isa = "scalar";
+#ifdef ME_KERNEL_HAVE_X86
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx512f") ) {
+            fn = __me_kernel_segment_avx512;
+            __me_kernel_isa = "avx512";
+        } else if ( __builtin_cpu_supports("avx2") ) {
+            fn = __me_kernel_segment_avx2;
+            __me_kernel_isa = "avx2";
+        }
+#endif
+        __me_kernel_segment = fn;
+    }
+    return __me_kernel_segment;
+}
+
+//
+
+static void                     *__me_kernel_plugin_handle = NULL;
+static const me_kernel_plugin_t *__me_kernel_plugin = NULL;
+
+bool
+me_kernel_load(
+    const char      *path,
+    base_int_t      n_rows,
+    base_int_t      n_cols,
+    const char*     *error_msg
+)
+{
+    void                        *handle;
+    const me_kernel_plugin_t    *plugin;
+    
+    if ( __me_kernel_plugin ) {
+        *error_msg = "a kernel plugin is already loaded";
+        return false;
+    }
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if ( ! handle ) {
+        *error_msg = dlerror();
+        return false;
+    }
+    plugin = (const me_kernel_plugin_t*)dlsym(handle, ME_KERNEL_PLUGIN_SYMBOL);
+    if ( ! plugin ) {
+        *error_msg = "no " ME_KERNEL_PLUGIN_SYMBOL " symbol exported";
+    } else if ( (plugin->abi_version < 1) || (plugin->abi_version > ME_KERNEL_PLUGIN_ABI_VERSION) ) {
+        *error_msg = "plugin ABI version mismatch";
+    } else if ( ! plugin->row_segment ) {
+        *error_msg = "plugin has no row_segment function";
+    } else if ( plugin->init && plugin->init((int64_t)n_rows, (int64_t)n_cols) ) {
+        *error_msg = "plugin initialization failed";
+    } else {
+        __me_kernel_plugin_handle = handle;
+        __me_kernel_plugin = plugin;
+        return true;
+    }
+    dlclose(handle);
+    return false;
+}
+
+//
+
+void
+me_kernel_unload(void)
+{
+    if ( __me_kernel_plugin ) {
+        if ( __me_kernel_plugin->fini ) __me_kernel_plugin->fini();
+        dlclose(__me_kernel_plugin_handle);
+        __me_kernel_plugin_handle = NULL;
+        __me_kernel_plugin = NULL;
+    }
+}
+
+//
+
+const char*
+me_kernel_get_description(void)
+{
+    if ( __me_kernel_plugin ) return __me_kernel_plugin->description ? __me_kernel_plugin->description : "(no description)";
+    return me_kernel_description;
+}
+
+//
+
+double
+me_kernel_cost_hint(void)
+{
+    return __me_kernel_plugin ? __me_kernel_plugin->element_cost_hint : 0.0;
+}
+
+//
+
+void
+me_kernel_row_segment(
+    base_int_t  i,
+    base_int_t  j_lo,
+    base_int_t  j_hi,
+    double      *values
+)
+{
+    if ( __me_kernel_plugin ) __me_kernel_plugin->row_segment((int64_t)i, (int64_t)j_lo, (int64_t)j_hi, values);
+    else __me_kernel_select()((double)i, j_lo, j_hi, values);
+}
+
+//
+
+void
+me_kernel_col_segment(
+    base_int_t  j,
+    base_int_t  i_lo,
+    base_int_t  i_hi,
+    double      *values
+)
+{
+    if ( ! __me_kernel_plugin ) {
+        __me_kernel_select()((double)j, i_lo, i_hi, values);
+    } else if ( __me_kernel_plugin->col_segment ) {
+        __me_kernel_plugin->col_segment((int64_t)j, (int64_t)i_lo, (int64_t)i_hi, values);
+    } else if ( __me_kernel_plugin->is_symmetric ) {
+        __me_kernel_plugin->row_segment((int64_t)j, (int64_t)i_lo, (int64_t)i_hi, values);
+    } else {
+        while ( i_lo < i_hi ) {
+            __me_kernel_plugin->row_segment((int64_t)i_lo, (int64_t)j, (int64_t)j + 1, values++);
+            i_lo++;
+        }
+    }
+}
+
+//
+
+bool
+me_kernel_has_feature_segment(void)
+{
+    // Version 1 plugins end before the feature_segment member:
+    return __me_kernel_plugin && (__me_kernel_plugin->abi_version >= 2) && __me_kernel_plugin->feature_segment;
+}
+
+//
+
+const char*
+me_kernel_get_feature_description(void)
+{
+    if ( me_kernel_has_feature_segment() ) return __me_kernel_plugin->description ? __me_kernel_plugin->description : "(no description)";
+    return me_kernel_feature_description;
+}
+
+//
+
+void
+me_kernel_feature_segment(
+    const double    *x,
+    const double    *y,
+    base_int_t      n,
+    base_int_t      n_features,
+    double          *values
+)
+{
+    if ( me_kernel_has_feature_segment() ) {
+        __me_kernel_plugin->feature_segment(x, y, (int64_t)n, (int64_t)n_features, values);
+        return;
+    }
+    while ( n-- > 0 ) {
+        double      d2 = 0.0;
+        base_int_t  f;
+        
+        for ( f = 0; f < n_features; f++ ) {
+            double  d = x[f] - y[f];
+            
+            d2 += d * d;
+        }
+        *values++ = exp(-0.5 * d2);
+        y += n_features;
+    }
+}
+
+//
+
+const char*
+me_kernel_isa(void)
+{
+    __me_kernel_select();
+    return __me_kernel_isa;
+}
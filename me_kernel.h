@@ -5,7 +5,20 @@
 
 #include "int_pair.h"
 
-static const char *me_kernel_description = "A_{i,j} = Sqrt[i*i + j*j]";
+/*
+ * @constant me_kernel_description
+ *
+ * Description of the built-in kernel, me_kernel().
+ */
+extern const char me_kernel_description[];
+
+/*
+ * @constant me_kernel_feature_description
+ *
+ * Description of the built-in feature kernel (see
+ * me_kernel_feature_segment()).
+ */
+extern const char me_kernel_feature_description[];
 
 static inline double
 me_kernel(
@@ -17,4 +30,99 @@ me_kernel(
     return sqrt(i * i + j * j);
 }
 
+/*
+ * @function me_kernel_load
+ *
+ * Load a kernel plugin (see me_kernel_plugin.h) from the shared object
+ * at path and initialize it for an n_rows x n_cols matrix.  The
+ * segment functions use the plugin until me_kernel_unload() is
+ * called.
+ *
+ * Returns false and sets *error_msg to a description of the problem
+ * if the plugin could not be loaded.
+ */
+bool me_kernel_load(const char *path, base_int_t n_rows, base_int_t n_cols, const char* *error_msg);
+
+/*
+ * @function me_kernel_unload
+ *
+ * Finalize and unload the kernel plugin, if any, reverting to the
+ * built-in kernel.
+ */
+void me_kernel_unload(void);
+
+/*
+ * @function me_kernel_get_description
+ *
+ * Returns the description of the kernel plugin or, if none is loaded,
+ * me_kernel_description.
+ */
+const char* me_kernel_get_description(void);
+
+/*
+ * @function me_kernel_cost_hint
+ *
+ * Returns the kernel plugin's expected time in seconds to produce an
+ * element, or zero if it is unknown or no plugin is loaded.
+ */
+double me_kernel_cost_hint(void);
+
+/*
+ * @function me_kernel_row_segment
+ *
+ * Produce the elements (i, j_lo) through (i, j_hi - 1) into
+ * values[0] through values[j_hi - j_lo - 1].
+ *
+ * Without a plugin the results are identical to calling me_kernel()
+ * for each element and the implementation is chosen on first use
+ * according to the CPU's features:  AVX-512, AVX2 or scalar (see
+ * me_kernel_isa()).
+ */
+void me_kernel_row_segment(base_int_t i, base_int_t j_lo, base_int_t j_hi, double *values);
+
+/*
+ * @function me_kernel_col_segment
+ *
+ * Produce the elements (i_lo, j) through (i_hi - 1, j) into
+ * values[0] through values[i_hi - i_lo - 1], as for
+ * me_kernel_row_segment().
+ */
+void me_kernel_col_segment(base_int_t j, base_int_t i_lo, base_int_t i_hi, double *values);
+
+/*
+ * @function me_kernel_has_feature_segment
+ *
+ * Returns true if the loaded kernel plugin produces elements from row
+ * and column input vectors (see me_kernel_feature_segment()).
+ */
+bool me_kernel_has_feature_segment(void);
+
+/*
+ * @function me_kernel_get_feature_description
+ *
+ * Returns the description of the kernel plugin's feature kernel or, if
+ * it has none, me_kernel_feature_description.
+ */
+const char* me_kernel_get_feature_description(void);
+
+/*
+ * @function me_kernel_feature_segment
+ *
+ * Produce the elements K(x, y_k) for the n input vectors y_0 through
+ * y_{n - 1} into values[0] through values[n - 1], where x and each
+ * y_k hold n_features values and the y_k follow one another in y.
+ * The built-in kernel is a Gaussian, see me_kernel_feature_description;
+ * it is symmetric, so a column segment is produced by passing the
+ * column's vector as x and the rows' vectors as y.
+ */
+void me_kernel_feature_segment(const double *x, const double *y, base_int_t n, base_int_t n_features, double *values);
+
+/*
+ * @function me_kernel_isa
+ *
+ * Returns the name of the instruction set used by the built-in
+ * segment kernels:  "avx512", "avx2" or "scalar".
+ */
+const char* me_kernel_isa(void);
+
 #endif /* __ME_KERNEL_H__ */
@@ -0,0 +1,41 @@
+/*	me_kernel_example.c
+	Copyright (c) 2024, J T Frey
+*/
+
+/*
+ * Example kernel plugin (see me_kernel_plugin.h) that reproduces the
+ * built-in kernel, e.g.
+ *
+ *     mpirun ./mpi_dist_matrix --kernel=./libme_kernel_example.so
+ */
+
+#include "me_kernel_plugin.h"
+#include <math.h>
+
+//
+
+static void
+me_kernel_example_row_segment(
+    int64_t     i,
+    int64_t     j_lo,
+    int64_t     j_hi,
+    double      *values
+)
+{
+    double      i2 = (double)i * (double)i;
+    
+    while ( j_lo < j_hi ) {
+        double  j = (double)j_lo++;
+        
+        *values++ = sqrt(i2 + j * j);
+    }
+}
+
+//
+
+const me_kernel_plugin_t me_kernel_plugin = {
+        .abi_version = ME_KERNEL_PLUGIN_ABI_VERSION,
+        .description = "A_{i,j} = Sqrt[i*i + j*j] (example plugin)",
+        .is_symmetric = true,
+        .row_segment = me_kernel_example_row_segment
+    };
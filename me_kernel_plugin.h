@@ -0,0 +1,99 @@
+/*	me_kernel_plugin.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header Matrix element kernel plugin ABI
+
+	A kernel plugin is a shared object that exports a single data
+	symbol named ME_KERNEL_PLUGIN_SYMBOL of type me_kernel_plugin_t.
+	The program loads it with dlopen() when --kernel is given on the
+	command line; otherwise the built-in kernel (me_kernel.h) is used.
+
+	Kernels are called with whole segments of a matrix row or column
+	so the cost of the indirect call is spread over many elements.
+	With --threads several segments are produced at once, so the
+	segment functions must be safe to call concurrently.
+
+	This header depends only on the C standard library so that plugins
+	can be built without the rest of the project:
+
+	    cc -shared -fPIC -o my_kernel.so my_kernel.c
+
+	A minimal plugin:
+
+	    #include "me_kernel_plugin.h"
+
+	    static void
+	    my_row_segment(int64_t i, int64_t j_lo, int64_t j_hi, double *values)
+	    {
+	        while ( j_lo < j_hi ) *values++ = (double)(i * j_lo++);
+	    }
+
+	    const me_kernel_plugin_t me_kernel_plugin = {
+	            .abi_version = ME_KERNEL_PLUGIN_ABI_VERSION,
+	            .description = "A_{i,j} = i*j",
+	            .is_symmetric = true,
+	            .row_segment = my_row_segment
+	        };
+*/
+
+#ifndef __ME_KERNEL_PLUGIN_H__
+#define __ME_KERNEL_PLUGIN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * @defined ME_KERNEL_PLUGIN_ABI_VERSION
+ *
+ * Plugins must set the abi_version field to this value; the program
+ * refuses to load a plugin built against a newer version.  Version 1
+ * plugins (without feature_segment) are still accepted.
+ */
+#define ME_KERNEL_PLUGIN_ABI_VERSION    2
+
+/*
+ * @defined ME_KERNEL_PLUGIN_SYMBOL
+ *
+ * The name of the me_kernel_plugin_t exported by a plugin.
+ */
+#define ME_KERNEL_PLUGIN_SYMBOL         "me_kernel_plugin"
+
+/*
+ * @typedef me_kernel_plugin_t
+ *
+ * The interface a plugin exports.  Indices are zero-based global
+ * matrix indices and segments are half-open:  row_segment() produces
+ * A(i, j_lo) through A(i, j_hi - 1) into values[0] onward.
+ *
+ * Optional members may be left NULL (zero):
+ *
+ *   - init is called once with the global matrix dimensions before any
+ *     segment is produced; a non-zero return aborts the program
+ *   - col_segment produces A(i_lo, j) through A(i_hi - 1, j); without it
+ *     column segments come from row_segment(), with the indices swapped
+ *     if is_symmetric is set and one element at a time otherwise
+ *   - element_cost_hint is the expected time in seconds to produce one
+ *     element, used by --autotune in place of measuring the kernel
+ *   - fini is called once when the plugin is unloaded
+ *   - feature_segment produces K(x, y_0) through K(x, y_{n - 1}) from
+ *     input vectors of n_features values each, the y_k following one
+ *     another in y; it is used in place of the index segments when the
+ *     program is given row and column input arrays (--features), and
+ *     must be symmetric in its two arguments
+ */
+typedef struct me_kernel_plugin {
+    uint32_t    abi_version;
+    const char  *description;
+    double      element_cost_hint;
+    bool        is_symmetric;
+    
+    int         (*init)(int64_t n_rows, int64_t n_cols);
+    void        (*row_segment)(int64_t i, int64_t j_lo, int64_t j_hi, double *values);
+    void        (*col_segment)(int64_t j, int64_t i_lo, int64_t i_hi, double *values);
+    void        (*fini)(void);
+    void        (*feature_segment)(const double *x, const double *y, int64_t n, int64_t n_features, double *values);
+} me_kernel_plugin_t;
+
+#endif /* __ME_KERNEL_PLUGIN_H__ */
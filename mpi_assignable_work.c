@@ -0,0 +1,841 @@
+/*	mpi_assignable_work.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_assignable_work.h"
+
+//
+
+bool
+mpi_assignable_work_geometry_static_unit(
+    const mpi_assignable_work_geometry_t    *geometry,
+    double                                  static_fraction,
+    int                                     rank,
+    int_pair_t                              *p_low,
+    int_pair_t                              *p_high
+)
+{
+    int                 slot = mpi_assignable_work_geometry_rank_to_slot(geometry, rank);
+    base_int_t          slot_length, n_ranks, rank_in_slot, n_static, lo, hi;
+    
+    if ( (static_fraction <= 0.0) || (slot < 0) ) return false;
+    if ( geometry->is_row_major ) {
+        slot_length = geometry->dim_per_rank[0];
+        n_ranks = geometry->dim_blocks[1];
+    } else {
+        slot_length = geometry->dim_per_rank[1];
+        n_ranks = geometry->dim_blocks[0];
+    }
+    rank_in_slot = rank % n_ranks;
+    n_static = (base_int_t)(static_fraction * slot_length);
+    if ( n_static > slot_length ) n_static = slot_length;
+    
+    // Split evenly, with any remainder spread across the ranks:
+    lo = slot * slot_length + (n_static * rank_in_slot) / n_ranks;
+    hi = slot * slot_length + (n_static * (rank_in_slot + 1)) / n_ranks;
+    if ( hi <= lo ) return false;
+    
+    mpi_assignable_work_geometry_range_to_unit(geometry, int_range_make(lo, hi - lo), p_low, p_high);
+    return true;
+}
+
+//
+
+double
+mpi_assignable_work_default_clock(void)
+{
+    struct timespec     t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+
+//
+
+mpi_assignable_work_t*
+mpi_assignable_work_create(
+    const mpi_assignable_work_geometry_t *geometry
+)
+{
+    mpi_assignable_work_t   *new_work = NULL;
+    void                    *new_ptr;
+    size_t                  work_rec_size = sizeof(mpi_assignable_work_t);
+    
+    base_int_t              n_indices = (geometry->is_row_major) ? geometry->dim_global[0] : geometry->dim_global[1];
+    
+    // Space for the three lists of int_set_ref's for the block rows/cols:
+    work_rec_size += 3 * sizeof(int_set_ref) * ((geometry->is_row_major) ? geometry->dim_blocks[0] : geometry->dim_blocks[1]);
+    
+    // Space for the per-index leases:
+    work_rec_size += sizeof(mpi_assignable_work_lease_t) * n_indices;
+    
+    // Space for the per-rank and per-slot throughput data:
+    work_rec_size += sizeof(mpi_assignable_work_rank_stats_t) * geometry->dist_size;
+    work_rec_size += sizeof(double) * ((geometry->is_row_major) ? geometry->dim_blocks[0] : geometry->dim_blocks[1]);
+    
+    new_ptr = malloc(work_rec_size);
+    if ( new_ptr ) {
+        memset(new_ptr, 0, work_rec_size);
+        new_work = (mpi_assignable_work_t*)new_ptr;
+        new_work->geometry = *geometry;
+        new_work->clock = mpi_assignable_work_default_clock;
+        new_work->n_slots = (geometry->is_row_major) ? geometry->dim_blocks[0] : geometry->dim_blocks[1];
+        new_work->available_indices = (int_set_ref*)(new_ptr + sizeof(mpi_assignable_work_t));
+        new_work->assigned_indices = new_work->available_indices + new_work->n_slots;
+        new_work->completed_indices = new_work->assigned_indices + new_work->n_slots;
+        new_work->leases = (mpi_assignable_work_lease_t*)(new_work->completed_indices + new_work->n_slots);
+        new_work->rank_stats = (mpi_assignable_work_rank_stats_t*)(new_work->leases + n_indices);
+        new_work->slot_rates = (double*)(new_work->rank_stats + geometry->dist_size);
+        while ( n_indices-- > 0 ) new_work->leases[n_indices].issued_at = -1.0;
+        new_work->lease_max_replicas = 1;
+        new_work->unit_size = 1;
+        new_work->idle_threshold = 0.05;
+        pthread_mutex_init(&new_work->alloc_lock, NULL);
+        
+        // All of the index sets are allocated from a single arena:
+        new_work->set_arena = int_set_arena_create(3 * new_work->n_slots + 1);
+        if ( ! new_work->set_arena ) {
+            free(new_ptr);
+            return NULL;
+        }
+        new_work->completing_indices = int_set_create_in_arena(new_work->set_arena);
+        
+        if ( geometry->is_row_major ) {
+            int         i = 0;
+            base_int_t  r = 0;
+            
+            while ( i < new_work->n_slots ) {
+                new_work->available_indices[i] = int_set_create_in_arena(new_work->set_arena);
+                new_work->assigned_indices[i] = int_set_create_in_arena(new_work->set_arena);
+                new_work->completed_indices[i] = int_set_create_in_arena(new_work->set_arena);
+                
+                // Push the index set for this block to the available list:
+                int_set_push_range(new_work->available_indices[i++], int_range_make(r, geometry->dim_per_rank[0]));
+                
+                // Next chunk:
+                r += geometry->dim_per_rank[0];
+            }
+        } else {
+            int         i = 0;
+            base_int_t  c = 0;
+            
+            while ( i < new_work->n_slots ) {
+                new_work->available_indices[i] = int_set_create_in_arena(new_work->set_arena);
+                new_work->assigned_indices[i] = int_set_create_in_arena(new_work->set_arena);
+                new_work->completed_indices[i] = int_set_create_in_arena(new_work->set_arena);
+                
+                // Push the index set for this block to the available list:
+                int_set_push_range(new_work->available_indices[i++], int_range_make(c, geometry->dim_per_rank[1]));
+                
+                // Next chunk:
+                c += geometry->dim_per_rank[1];
+            }
+        }
+    }
+    return new_work;
+}
+
+//
+
+void
+mpi_assignable_work_destroy(
+    mpi_assignable_work_t   *work_units
+)
+{
+    int_set_arena_destroy(work_units->set_arena);
+    free((void*)work_units);
+}
+
+//
+
+static inline bool
+__mpi_assignable_work_slot_is_completed(
+    mpi_assignable_work_t   *work_units,
+    int                     slot
+)
+{
+    if ( int_set_get_length(work_units->available_indices[slot]) > 0 ) return false;
+    if ( int_set_get_length(work_units->assigned_indices[slot]) > 0 ) return false;
+    return ( int_set_get_length(work_units->completed_indices[slot]) >= ((work_units->geometry.is_row_major) ? work_units->geometry.dim_per_rank[0] : work_units->geometry.dim_per_rank[1]) );
+}
+
+//
+
+bool
+mpi_assignable_work_all_completed(
+    mpi_assignable_work_t   *work_units
+)
+{
+    int                     i = 0;
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    while ( i < work_units->n_slots ) {
+        if ( ! __mpi_assignable_work_slot_is_completed(work_units, i) ) break;
+        i++;
+    }
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    return (i == work_units->n_slots);
+}
+
+//
+
+bool
+mpi_assignable_work_slot_is_completed(
+    mpi_assignable_work_t   *work_units,
+    int                     slot
+)
+{
+    bool                    rc = false;
+    
+    if ( (slot >= 0) && (slot < work_units->n_slots) ) {
+        pthread_mutex_lock(&work_units->alloc_lock);
+        rc = __mpi_assignable_work_slot_is_completed(work_units, slot);
+        pthread_mutex_unlock(&work_units->alloc_lock);
+    }
+    return rc;
+}
+
+//
+
+bool
+mpi_assignable_work_rank_is_completed(
+    mpi_assignable_work_t   *work_units,
+    int                     rank
+)
+{
+    return mpi_assignable_work_slot_is_completed(work_units, mpi_assignable_work_geometry_rank_to_slot(&work_units->geometry, rank));
+}
+
+//
+
+static inline void
+__mpi_assignable_work_lease(
+    mpi_assignable_work_t   *work_units,
+    int_range_t             r,
+    int                     target_rank
+)
+{
+    double                  now = work_units->clock();
+    
+    while ( r.length-- > 0 ) {
+        mpi_assignable_work_lease_t *lease = &work_units->leases[r.start++];
+        
+        lease->issued_at = now;
+        lease->rank = target_rank;
+        lease->n_replicas = 0;
+        lease->replica_rank = -1;
+    }
+}
+
+static bool
+__mpi_assignable_work_next_speculative_unit(
+    mpi_assignable_work_t   *work_units,
+    int                     target_rank,
+    int_range_t             *unit_r
+)
+{
+    base_int_t              index = 0, index_max, oldest_index = -1;
+    double                  expired_at = work_units->clock() - work_units->lease_timeout, oldest_issued_at = 0.0;
+    
+    index_max = (work_units->geometry.is_row_major) ? work_units->geometry.dim_global[0] : work_units->geometry.dim_global[1];
+    
+    // Find the oldest lease that has expired and may still be replicated
+    // to the target rank:
+    while ( index < index_max ) {
+        mpi_assignable_work_lease_t *lease = &work_units->leases[index];
+        
+        if ( (lease->issued_at >= 0.0) && (lease->issued_at <= expired_at) &&
+             ((oldest_index < 0) || (lease->issued_at < oldest_issued_at)) &&
+             (lease->n_replicas < work_units->lease_max_replicas) &&
+             (lease->rank != target_rank) && (lease->replica_rank != target_rank) )
+        {
+            oldest_index = index;
+            oldest_issued_at = lease->issued_at;
+        }
+        index++;
+    }
+    if ( oldest_index >= 0 ) {
+        mpi_assignable_work_lease_t *lease = &work_units->leases[oldest_index];
+        int_range_t r = int_range_make(oldest_index, 0);
+        
+        // Replicate the entire work unit the lease was issued for (all
+        // following indices leased at the same time to the same rank):
+        while ( (r.start + r.length < index_max) && (r.length < work_units->unit_size * 4) &&
+                (lease[r.length].issued_at == lease->issued_at) && (lease[r.length].rank == lease->rank) &&
+                (lease[r.length].n_replicas == lease->n_replicas) )
+        {
+            lease[r.length].replica_rank = target_rank;
+            r.length++;
+        }
+        //mpi_printf(-1, "speculatively allocated indices [" BASE_INT_FMT "," BASE_INT_FMT "] (leased by rank %d) for rank %d", r.start, int_range_get_end(r), lease->rank, target_rank);
+        index = 0;
+        while ( index < r.length ) lease[index++].n_replicas++;
+        work_units->n_speculative_units++;
+        *unit_r = r;
+        return true;
+    }
+    return false;
+}
+
+static double
+__mpi_assignable_work_mean_rate(
+    mpi_assignable_work_t   *work_units
+)
+{
+    double                  rate_sum = 0.0;
+    int                     rank = 0, n_rates = 0;
+    
+    while ( rank < work_units->geometry.dist_size ) {
+        if ( work_units->rank_stats[rank].rate > 0.0 ) {
+            rate_sum += work_units->rank_stats[rank].rate;
+            n_rates++;
+        }
+        rank++;
+    }
+    return (n_rates > 0) ? (rate_sum / n_rates) : 0.0;
+}
+
+static int
+__mpi_assignable_work_slot_most_at_risk(
+    mpi_assignable_work_t   *work_units,
+    double                  mean_rate
+)
+{
+    int                     rank = 0, slot_idx = 0, slot_idx_max = -1;
+    double                  risk_max = 0.0;
+    
+    // Aggregate rate of the ranks whose primary slot each slot is; ranks
+    // that have not been measured yet count at the mean rate:
+    while ( slot_idx < work_units->n_slots ) work_units->slot_rates[slot_idx++] = 0.0;
+    while ( rank < work_units->geometry.dist_size ) {
+        double              rate = work_units->rank_stats[rank].rate;
+        int                 slot = mpi_assignable_work_geometry_rank_to_slot(&work_units->geometry, rank);
+        
+        if ( slot >= 0 ) work_units->slot_rates[slot] += (rate > 0.0) ? rate : mean_rate;
+        rank++;
+    }
+    
+    // The slot with the longest expected time to drain is most at risk of
+    // finishing last:
+    slot_idx = 0;
+    while ( slot_idx < work_units->n_slots ) {
+        base_int_t          l = int_set_get_length(work_units->available_indices[slot_idx]);
+        
+        if ( l > 0 ) {
+            double          risk = (work_units->slot_rates[slot_idx] > 0.0) ? (l / work_units->slot_rates[slot_idx]) : INFINITY;
+            
+            if ( (slot_idx_max < 0) || (risk > risk_max) ) {
+                slot_idx_max = slot_idx;
+                risk_max = risk;
+            }
+        }
+        slot_idx++;
+    }
+    return slot_idx_max;
+}
+
+static base_int_t
+__mpi_assignable_work_triangle_unit_size(
+    mpi_assignable_work_t   *work_units,
+    int                     slot_idx,
+    base_int_t              n_indices
+)
+{
+    base_int_t              n = (work_units->geometry.is_row_major) ? work_units->geometry.dim_global[1] : work_units->geometry.dim_global[0];
+    base_int_t              k;
+    double                  n_scaled;
+    
+    // Index k covers n - k elements, the average index (n + 1) / 2:
+    if ( ! int_set_peek_next_int(work_units->available_indices[slot_idx], &k) || (k >= n) ) return n_indices;
+    n_scaled = ceil(n_indices * 0.5 * (n + 1) / (double)(n - k));
+    if ( n_scaled > (double)(n - k) ) return n - k;
+    return (base_int_t)n_scaled;
+}
+
+static base_int_t
+__mpi_assignable_work_weighted_unit_size(
+    mpi_assignable_work_t   *work_units,
+    int                     slot_idx,
+    base_int_t              n_indices
+)
+{
+    const base_int_t        *offsets = work_units->element_offsets;
+    base_int_t              n = (work_units->geometry.is_row_major) ? work_units->geometry.dim_global[0] : work_units->geometry.dim_global[1];
+    base_int_t              k, lo, hi;
+    double                  target;
+    
+    // Find the fewest indices from k onward that hold as many elements as
+    // n_indices indices of average cost:
+    if ( ! int_set_peek_next_int(work_units->available_indices[slot_idx], &k) || (k >= n) || (offsets[n] <= 0) ) return n_indices;
+    target = offsets[k] + n_indices * (double)offsets[n] / (double)n;
+    lo = k + 1;
+    hi = n;
+    while ( lo < hi ) {
+        base_int_t          mid = lo + (hi - lo) / 2;
+        
+        if ( (double)offsets[mid] < target ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - k;
+}
+
+static int
+__mpi_assignable_work_choose_slot(
+    mpi_assignable_work_t   *work_units,
+    int                     target_rank,
+    int                     primary_slot,
+    base_int_t              *unit_size
+)
+{
+    base_int_t              n_indices = work_units->unit_size;
+    int                     slot_idx = -1;
+    
+    if ( work_units->order == mpi_assignable_work_order_block_completion ) {
+        // Everyone works on the lowest slot with work remaining:
+        slot_idx = 0;
+        while ( (slot_idx < work_units->n_slots) && (int_set_get_length(work_units->available_indices[slot_idx]) == 0) ) slot_idx++;
+        if ( slot_idx == work_units->n_slots ) slot_idx = -1;
+    }
+    if ( work_units->is_throughput_aware ) {
+        double              mean_rate = __mpi_assignable_work_mean_rate(work_units);
+        double              rate = work_units->rank_stats[target_rank].rate;
+        
+        if ( (mean_rate > 0.0) && (rate > 0.0) ) {
+            // Size the unit proportional to the rank's relative speed:
+            n_indices = (base_int_t)llround(work_units->unit_size * rate / mean_rate);
+            if ( n_indices < 1 ) n_indices = 1;
+            else if ( n_indices > 4 * work_units->unit_size ) n_indices = 4 * work_units->unit_size;
+            
+            // Fast ranks help out wherever the tail is going to be:
+            if ( (slot_idx < 0) && (rate > mean_rate) ) slot_idx = __mpi_assignable_work_slot_most_at_risk(work_units, mean_rate);
+        }
+    }
+    if ( (slot_idx < 0) && (work_units->order == mpi_assignable_work_order_slot_affinity) ) {
+        // Try to get work from the preferred slot:
+        if ( (primary_slot >= 0) && (primary_slot < work_units->n_slots) &&
+             (int_set_get_length(work_units->available_indices[primary_slot]) > 0) )
+        {
+            slot_idx = primary_slot;
+        } else {
+            // Preferred slot was empty, take a work unit from the slot with the
+            // most work remaining:
+            int         slot_idx_max = 0;
+            base_int_t  avail_max = 0;
+            
+            while ( slot_idx_max < work_units->n_slots ) {
+                base_int_t  l = int_set_get_length(work_units->available_indices[slot_idx_max]);
+                
+                if ( l > avail_max ) {
+                    slot_idx = slot_idx_max;
+                    avail_max = l;
+                }
+                slot_idx_max++;
+            }
+        }
+    }
+    if ( (slot_idx >= 0) && work_units->element_offsets )
+        n_indices = __mpi_assignable_work_weighted_unit_size(work_units, slot_idx, n_indices);
+    else if ( (slot_idx >= 0) && work_units->geometry.is_triangular )
+        n_indices = __mpi_assignable_work_triangle_unit_size(work_units, slot_idx, n_indices);
+    *unit_size = n_indices;
+    return slot_idx;
+}
+
+static inline void
+__mpi_assignable_work_assign(
+    mpi_assignable_work_t   *work_units,
+    int                     slot_idx,
+    int_range_t             r,
+    int                     target_rank
+)
+{
+    //mpi_printf(-1, "allocated indices [" BASE_INT_FMT "," BASE_INT_FMT "] from slot %d for rank %d", r.start, int_range_get_end(r), slot_idx, target_rank);
+    int_set_push_range(work_units->assigned_indices[slot_idx], r);
+    __mpi_assignable_work_lease(work_units, r, target_rank);
+}
+
+bool
+mpi_assignable_work_next_unit(
+    mpi_assignable_work_t   *work_units,
+    int                     target_rank,
+    int                     primary_slot,
+    int_pair_t              *p_low,
+    int_pair_t              *p_high
+)
+{
+    int_range_t             next_range;
+    base_int_t              n_indices;
+    int                     slot_idx;
+    bool                    rc = false;
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    slot_idx = __mpi_assignable_work_choose_slot(work_units, target_rank, primary_slot, &n_indices);
+    if ( (slot_idx >= 0) && int_set_pop_next_range(work_units->available_indices[slot_idx], n_indices, &next_range) ) {
+        __mpi_assignable_work_assign(work_units, slot_idx, next_range, target_rank);
+        rc = true;
+    } else if ( work_units->lease_timeout > 0.0 ) {
+        // Nothing left to assign, re-issue the oldest expired lease:
+        rc = __mpi_assignable_work_next_speculative_unit(work_units, target_rank, &next_range);
+    }
+    if ( rc ) {
+        mpi_assignable_work_geometry_range_to_unit(&work_units->geometry, next_range, p_low, p_high);
+        work_units->rank_stats[target_rank].alloc_time = work_units->clock();
+    }
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    return rc;
+}
+
+//
+
+bool
+mpi_assignable_work_next_unit_set(
+    mpi_assignable_work_t   *work_units,
+    int                     target_rank,
+    int                     primary_slot,
+    int_set_ref             unit
+)
+{
+    int_range_t             next_range;
+    base_int_t              n_indices;
+    int                     slot_idx;
+    
+    int_set_clear(unit);
+    pthread_mutex_lock(&work_units->alloc_lock);
+    slot_idx = __mpi_assignable_work_choose_slot(work_units, target_rank, primary_slot, &n_indices);
+    if ( slot_idx >= 0 ) {
+        // Keep taking runs from the slot until the unit is full:
+        while ( (n_indices > 0) && int_set_pop_next_range(work_units->available_indices[slot_idx], n_indices, &next_range) ) {
+            __mpi_assignable_work_assign(work_units, slot_idx, next_range, target_rank);
+            int_set_push_range(unit, next_range);
+            n_indices -= next_range.length;
+        }
+    }
+    if ( (int_set_get_length(unit) == 0) && (work_units->lease_timeout > 0.0) ) {
+        // Nothing left to assign, re-issue the oldest expired lease:
+        if ( __mpi_assignable_work_next_speculative_unit(work_units, target_rank, &next_range) ) int_set_push_range(unit, next_range);
+    }
+    if ( int_set_get_length(unit) > 0 ) work_units->rank_stats[target_rank].alloc_time = work_units->clock();
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    return (int_set_get_length(unit) > 0);
+}
+
+//
+
+static void
+__mpi_assignable_work_note_rate(
+    mpi_assignable_work_t   *work_units,
+    int                     source_rank,
+    base_int_t              n_indices
+)
+{
+    mpi_assignable_work_rank_stats_t *stats = &work_units->rank_stats[source_rank];
+    double                  elapsed = work_units->clock() - stats->alloc_time;
+    
+    // Blend this unit's throughput into the rank's rate:
+    if ( (elapsed > 0.0) && (n_indices > 0) ) {
+        double              rate = n_indices / elapsed;
+        
+        stats->rate = (stats->rate > 0.0) ? (0.75 * stats->rate + 0.25 * rate) : rate;
+        stats->n_completed += n_indices;
+    }
+}
+
+static void
+__mpi_assignable_work_complete_range(
+    mpi_assignable_work_t   *work_units,
+    int                     source_rank,
+    int_range_t             r
+)
+{
+    base_int_t              i = r.start, i_max = int_range_get_max(r);
+    base_int_t              slot_length = (work_units->geometry.is_row_major) ?
+                                                work_units->geometry.dim_per_rank[0]
+                                              : work_units->geometry.dim_per_rank[1];
+    int                     completed_slot = -1;
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    
+    if ( work_units->trace_stream )
+        fprintf(work_units->trace_stream, "%d," BASE_INT_FMT "," BASE_INT_FMT ",%.6f,%.6f\n", source_rank, i, i_max - i,
+                work_units->rank_stats[source_rank].alloc_time, work_units->clock());
+    
+    while ( i < i_max ) {
+        int         slot = i / slot_length;
+        int_range_t slot_r = int_range_intersection(int_range_make(i, i_max - i), int_range_make(slot * slot_length, slot_length));
+        int_set_ref completing = work_units->completing_indices;
+        base_int_t  n_completing;
+        
+        // The first completion of a (possibly replicated) index wins, any
+        // later ones are ignored:
+        int_set_clear(completing);
+        int_set_push_range(completing, slot_r);
+        int_set_intersection(completing, completing, work_units->assigned_indices[slot]);
+        n_completing = int_set_get_length(completing);
+        if ( n_completing > 0 ) {
+            int_set_remove_range(work_units->assigned_indices[slot], slot_r);
+            int_set_union(work_units->completed_indices[slot], work_units->completed_indices[slot], completing);
+            
+            // Did this unit complete the slot?
+            if ( int_set_get_length(work_units->completed_indices[slot]) == slot_length ) completed_slot = slot;
+        }
+        work_units->n_duplicate_completions += slot_r.length - n_completing;
+        for ( ; i < int_range_get_max(slot_r); i++ ) work_units->leases[i].issued_at = -1.0;
+    }
+    
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    
+    if ( (completed_slot >= 0) && work_units->slot_completed_callback )
+        work_units->slot_completed_callback(work_units, completed_slot, work_units->slot_completed_context);
+}
+
+void
+mpi_assignable_work_complete(
+    mpi_assignable_work_t   *work_units,
+    int                     source_rank,
+    int_pair_t              p_low,
+    int_pair_t              p_high
+)
+{
+    int_range_t             r = (work_units->geometry.is_row_major) ?
+                                    int_range_make(p_low.i, p_high.i - p_low.i)
+                                  : int_range_make(p_low.j, p_high.j - p_low.j);
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    __mpi_assignable_work_note_rate(work_units, source_rank, r.length);
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    __mpi_assignable_work_complete_range(work_units, source_rank, r);
+}
+
+//
+
+typedef struct {
+    mpi_assignable_work_t   *work_units;
+    int                     source_rank;
+} __mpi_assignable_work_complete_context_t;
+
+static bool
+__mpi_assignable_work_complete_enumerator(
+    int_range_t r,
+    const void  *context
+)
+{
+    const __mpi_assignable_work_complete_context_t  *CONTEXT = (const __mpi_assignable_work_complete_context_t*)context;
+    
+    __mpi_assignable_work_complete_range(CONTEXT->work_units, CONTEXT->source_rank, r);
+    return true;
+}
+
+void
+mpi_assignable_work_complete_set(
+    mpi_assignable_work_t   *work_units,
+    int                     source_rank,
+    int_set_ref             unit
+)
+{
+    __mpi_assignable_work_complete_context_t    context = { .work_units = work_units, .source_rank = source_rank };
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    __mpi_assignable_work_note_rate(work_units, source_rank, int_set_get_length(unit));
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    int_set_enumerate_ranges(unit, __mpi_assignable_work_complete_enumerator, &context);
+}
+
+//
+
+void
+mpi_assignable_work_note_idle(
+    mpi_assignable_work_t   *work_units,
+    double                  idle_fraction
+)
+{
+    base_int_t              n_available = 0;
+    int                     i = 0;
+    
+    if ( ! work_units->is_autotuned || (idle_fraction < 0.0) ) return;
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    work_units->idle_fraction = 0.9 * work_units->idle_fraction + 0.1 * idle_fraction;
+    while ( i < work_units->n_slots ) n_available += int_set_get_length(work_units->available_indices[i++]);
+    if ( (work_units->unit_size > 1) && (n_available < 2 * work_units->geometry.dist_size * work_units->unit_size) ) {
+        // Smaller units toward the end keep the tail short:
+        work_units->unit_size = (work_units->unit_size + 1) / 2;
+        work_units->n_unit_size_changes++;
+    } else if ( (work_units->idle_fraction > work_units->idle_threshold) && (work_units->unit_size < work_units->unit_size_max) &&
+                (n_available >= 4 * work_units->geometry.dist_size * work_units->unit_size) )
+    {
+        // Ranks are waiting on the root too much, amortize the round trip
+        // over more work:
+        work_units->unit_size *= 2;
+        if ( work_units->unit_size > work_units->unit_size_max ) work_units->unit_size = work_units->unit_size_max;
+        work_units->n_unit_size_changes++;
+        
+        // Measure afresh at the new size:
+        work_units->idle_fraction = 0.0;
+    }
+    pthread_mutex_unlock(&work_units->alloc_lock);
+}
+
+//
+
+void
+mpi_assignable_work_apply_static_partition(
+    mpi_assignable_work_t   *work_units,
+    double                  static_fraction
+)
+{
+    int                     rank = 0;
+    double                  now = work_units->clock();
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    while ( rank < work_units->geometry.dist_size ) {
+        int_pair_t          p_low, p_high;
+        
+        if ( mpi_assignable_work_geometry_static_unit(&work_units->geometry, static_fraction, rank, &p_low, &p_high) ) {
+            int             slot = mpi_assignable_work_geometry_rank_to_slot(&work_units->geometry, rank);
+            int_range_t     r = (work_units->geometry.is_row_major) ?
+                                    int_range_make(p_low.i, p_high.i - p_low.i)
+                                  : int_range_make(p_low.j, p_high.j - p_low.j);
+            
+            int_set_remove_range(work_units->available_indices[slot], r);
+            int_set_push_range(work_units->assigned_indices[slot], r);
+            __mpi_assignable_work_lease(work_units, r, rank);
+            work_units->rank_stats[rank].alloc_time = now;
+        }
+        rank++;
+    }
+    pthread_mutex_unlock(&work_units->alloc_lock);
+}
+
+//
+
+void
+mpi_assignable_work_restore_completed(
+    mpi_assignable_work_t   *work_units,
+    int_range_t             r
+)
+{
+    base_int_t              slot_length = (work_units->geometry.is_row_major) ?
+                                                work_units->geometry.dim_per_rank[0]
+                                              : work_units->geometry.dim_per_rank[1];
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    while ( r.length > 0 ) {
+        int                 slot = r.start / slot_length;
+        int_range_t         slot_r = int_range_intersection(r, int_range_make(slot * slot_length, slot_length));
+        
+        if ( slot >= work_units->n_slots ) break;
+        int_set_remove_range(work_units->available_indices[slot], slot_r);
+        int_set_push_range(work_units->completed_indices[slot], slot_r);
+        r.start += slot_r.length, r.length -= slot_r.length;
+    }
+    pthread_mutex_unlock(&work_units->alloc_lock);
+}
+
+//
+
+bool
+mpi_assignable_work_should_defer(
+    mpi_assignable_work_t   *work_units,
+    double                  *retry_delay
+)
+{
+    int                     i = 0;
+    
+    if ( work_units->lease_timeout <= 0.0 ) return false;
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    while ( i < work_units->n_slots ) {
+        if ( int_set_get_length(work_units->assigned_indices[i]) > 0 ) break;
+        i++;
+    }
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    if ( i < work_units->n_slots ) {
+        // Poll a few times per lease period, but not excessively:
+        *retry_delay = 0.25 * work_units->lease_timeout;
+        if ( *retry_delay > 1.0 ) *retry_delay = 1.0;
+        return true;
+    }
+    return false;
+}
+
+//
+
+void
+mpi_assignable_work_release_rank(
+    mpi_assignable_work_t   *work_units,
+    int                     target_rank
+)
+{
+    (void)target_rank;
+    pthread_mutex_lock(&work_units->alloc_lock);
+    work_units->n_ranks_released++;
+    pthread_mutex_unlock(&work_units->alloc_lock);
+}
+
+//
+
+bool
+mpi_assignable_work_all_released(
+    mpi_assignable_work_t   *work_units
+)
+{
+    bool                    rc;
+    
+    pthread_mutex_lock(&work_units->alloc_lock);
+    rc = (work_units->n_ranks_released >= work_units->geometry.dist_size - 1);
+    pthread_mutex_unlock(&work_units->alloc_lock);
+    return rc;
+}
+
+//
+
+void
+mpi_assignable_work_trace_begin(
+    mpi_assignable_work_t   *work_units,
+    FILE                    *stream
+)
+{
+    pthread_mutex_lock(&work_units->alloc_lock);
+    if ( stream ) {
+        fprintf(stream, "# dim_global=" BASE_INT_FMT "," BASE_INT_FMT " dim_blocks=" BASE_INT_FMT "," BASE_INT_FMT " is_row_major=%d dist_size=%d\n",
+                    work_units->geometry.dim_global[0], work_units->geometry.dim_global[1],
+                    work_units->geometry.dim_blocks[0], work_units->geometry.dim_blocks[1],
+                    work_units->geometry.is_row_major ? 1 : 0, work_units->geometry.dist_size);
+        fprintf(stream, "# rank,index,count,start,end\n");
+    }
+    work_units->trace_stream = stream;
+    pthread_mutex_unlock(&work_units->alloc_lock);
+}
+
+//
+
+void
+mpi_assignable_work_summary(
+    mpi_assignable_work_t   *work_units,
+    FILE                    *stream
+)
+{
+    int                     i = 0;
+    
+    fprintf(stream, "mpi_assignable_work@%p (n_slots=%d, order=%s, unit_size=" BASE_INT_FMT ", is_throughput_aware=%s, lease_timeout=%lg, n_speculative_units=" BASE_INT_FMT ", n_duplicate_completions=" BASE_INT_FMT ") {\n",
+                work_units, work_units->n_slots,
+                (work_units->order == mpi_assignable_work_order_block_completion) ? "block-completion" : "slot-affinity",
+                work_units->unit_size, work_units->is_throughput_aware ? "true" : "false",
+                work_units->lease_timeout, work_units->n_speculative_units, work_units->n_duplicate_completions);
+    while ( i < work_units->geometry.dist_size ) {
+        if ( work_units->rank_stats[i].n_completed > 0 )
+            fprintf(stream, "rank %d: rate=%lg/s, completed=" BASE_INT_FMT "\n", i, work_units->rank_stats[i].rate, work_units->rank_stats[i].n_completed);
+        i++;
+    }
+    i = 0;
+    while ( i < work_units->n_slots ) {
+        fprintf(stream, "%d: available -> ", i);
+        int_set_summary(work_units->available_indices[i], stream);
+        fprintf(stream, "       assigned -> ");
+        int_set_summary(work_units->assigned_indices[i], stream);
+        fprintf(stream, "       completed -> ");
+        int_set_summary(work_units->completed_indices[i], stream);
+        i++;
+    }
+    fprintf(stream, "}\n");
+}
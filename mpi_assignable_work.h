@@ -0,0 +1,433 @@
+/*	mpi_assignable_work.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix work units
+
+	The root rank's bookkeeping of which row (row-major) or column
+	(column-major) indices of the global matrix are available,
+	assigned to a rank or completed, and the policies used to choose
+	the next work unit for a requesting rank.
+
+	Nothing in this API communicates:  the MPI server thread calls it
+	in response to messages, but it can equally be driven by an
+	offline simulation.  Geometry is therefore passed in explicitly
+	and time is read through a replaceable clock function.
+*/
+
+#ifndef __MPI_ASSIGNABLE_WORK_H__
+#define __MPI_ASSIGNABLE_WORK_H__
+
+#include "project_config.h"
+#include "int_set.h"
+#include "int_pair.h"
+
+/*
+ * @typedef mpi_assignable_work_geometry_t
+ *
+ * The dimensions of the global matrix, its partitioning into blocks
+ * and the number of ranks (one per block) that the work units are
+ * distributed across.  See mpi_server_thread_t for the mapping of
+ * blocks to ranks.  A dedicated work unit manager is the one rank
+ * beyond the last block and holds none.
+ *
+ * With is_triangular (a symmetric matrix) the work for row (column)
+ * index k only covers the minor indices from k onward, so the cost of
+ * an index falls linearly across the matrix.
+ */
+typedef struct {
+    base_int_t          dim_global[2];
+    base_int_t          dim_per_rank[2];
+    base_int_t          dim_blocks[2];
+    bool                is_row_major;
+    bool                is_triangular;
+    int                 dist_size;
+} mpi_assignable_work_geometry_t;
+
+/*
+ * @function mpi_assignable_work_geometry_rank_to_slot
+ *
+ * Calculate the work unit slot (block row for row-major, block column
+ * for column-major distribution) in which the given MPI rank's local
+ * sub-matrix lies.  Returns -1 for a rank that holds no block.
+ */
+static inline int
+mpi_assignable_work_geometry_rank_to_slot(
+    const mpi_assignable_work_geometry_t    *geometry,
+    int                                     rank
+)
+{
+    if ( rank >= geometry->dim_blocks[0] * geometry->dim_blocks[1] ) return -1;
+    return (geometry->is_row_major) ? (rank / geometry->dim_blocks[1]) : (rank / geometry->dim_blocks[0]);
+}
+
+/*
+ * @function mpi_assignable_work_geometry_range_to_unit
+ *
+ * Set *p_low and *p_high to the bounds of the work unit covering the
+ * row (row-major) or column (column-major) indices in r.  With
+ * triangular geometry the minor lower bound is r.start, the first
+ * minor index any of the unit's rows (columns) covers.
+ */
+static inline void
+mpi_assignable_work_geometry_range_to_unit(
+    const mpi_assignable_work_geometry_t    *geometry,
+    int_range_t                             r,
+    int_pair_t                              *p_low,
+    int_pair_t                              *p_high
+)
+{
+    base_int_t                              minor_lo = geometry->is_triangular ? r.start : 0;
+    
+    if ( geometry->is_row_major ) {
+        p_low->i = r.start; p_high->i = int_range_get_max(r);
+        p_low->j = minor_lo; p_high->j = geometry->dim_global[1];
+    } else {
+        p_low->j = r.start; p_high->j = int_range_get_max(r);
+        p_low->i = minor_lo; p_high->i = geometry->dim_global[0];
+    }
+}
+
+/*
+ * @function mpi_assignable_work_geometry_static_unit
+ *
+ * Calculate the statically-assigned work unit for the given MPI rank:
+ * the first static_fraction of the indices in each slot is split
+ * evenly among the ranks whose primary slot it is.
+ *
+ * Returns false if the rank has no statically-assigned work, otherwise
+ * *p_low and *p_high are set to the bounds of the work unit.
+ */
+bool mpi_assignable_work_geometry_static_unit(const mpi_assignable_work_geometry_t *geometry,
+            double static_fraction, int rank, int_pair_t *p_low, int_pair_t *p_high);
+
+/*
+ * @typedef mpi_assignable_work_clock_t
+ *
+ * Type of a function returning the current time in seconds.  Only
+ * differences between its values are used.
+ */
+typedef double (*mpi_assignable_work_clock_t)(void);
+
+/*
+ * @function mpi_assignable_work_default_clock
+ *
+ * The monotonic system clock, in seconds.
+ */
+double mpi_assignable_work_default_clock(void);
+
+/*
+ * @typedef mpi_assignable_work_lease_t
+ *
+ * Lease on an assigned row/col index.  The issued_at timestamp is
+ * the time (see clock below) at which the index was first assigned (negative
+ * if the index is not currently leased) and rank is the MPI rank
+ * that received it.  Speculative copies of the work unit handed
+ * to other ranks are counted in n_replicas, with the most recent
+ * recipient in replica_rank.
+ */
+typedef struct {
+    double              issued_at;
+    int                 rank;
+    int                 n_replicas;
+    int                 replica_rank;
+} mpi_assignable_work_lease_t;
+
+/*
+ * @typedef mpi_assignable_work_rank_stats_t
+ *
+ * Per-rank throughput bookkeeping.  The alloc_time is the time at
+ * which the rank was last allocated a work unit; when the rank
+ * reports a unit complete the number of indices in it divided by the
+ * elapsed time is blended into rate (indices per second) as an
+ * exponentially-weighted moving average.  A rate of zero means no
+ * measurement has been made yet.
+ */
+typedef struct {
+    double              alloc_time;
+    double              rate;
+    base_int_t          n_completed;
+} mpi_assignable_work_rank_stats_t;
+
+/*
+ * @enum MPI assignable work, ordering policies
+ *
+ * How mpi_assignable_work_next_unit() chooses the slot from which a
+ * work unit is drawn:
+ *
+ *     - slot affinity:  prefer the requestor's own slot, fall back
+ *              to the slot with the most work remaining (or, when
+ *              throughput-aware, the slot most at risk of finishing
+ *              last)
+ *     - block completion:  all requestors draw from the lowest slot
+ *              that still has work available, so slots (and the
+ *              sub-matrix blocks in them) are completed one after
+ *              the other rather than all at once near the end
+ */
+enum {
+    mpi_assignable_work_order_slot_affinity = 0,
+    mpi_assignable_work_order_block_completion = 1
+};
+
+/*
+ * @typedef mpi_assignable_work_order_t
+ *
+ * The type of an assignable work ordering policy.
+ */
+typedef unsigned int mpi_assignable_work_order_t;
+
+struct mpi_assignable_work;
+
+/*
+ * @typedef mpi_assignable_work_slot_callback_t
+ *
+ * Type of a function called when every index in a slot has been
+ * completed.  The context is the pointer registered alongside the
+ * callback.
+ */
+typedef void (*mpi_assignable_work_slot_callback_t)(struct mpi_assignable_work *work_units, int slot, const void *context);
+
+typedef struct mpi_assignable_work {
+    // Matrix and rank grid the work is distributed over:
+    mpi_assignable_work_geometry_t geometry;
+    
+    // Source of timestamps for leases and throughput measurement:
+    mpi_assignable_work_clock_t clock;
+    
+    // Optional record of every completed work unit:
+    FILE                *trace_stream;
+    
+    //
+    // For a row-major distribution, it would be ideal to assign rows
+    // lying within the first block row to the ranks holding the
+    // sub-matrices for those blocks.  Likewise, for the second block row
+    // only those ranks would be ideal.  In short, the work assignment
+    // should be biased toward rows that will at least partially overlap
+    // with the local sub-matrix.
+    //
+    // For column-major distribution, the difference is that the bias is
+    // w.r.t. block columns and the distribution is over columns and not
+    // rows.
+    //
+    // To that end, the assigned work unit should consist of a pair of
+    // rows [lo,hi] and columns [lo,hi].  Generally-speaking, the worker
+    // rank should loop over both ranges -- for a single-row work unit
+    // rows [lo,hi] = [lo,lo] and there is only a single row iteration
+    // involved.
+    //
+    // We will split the row/col indices (as determined by the row- versus
+    // column major attribute of geometry) into a number of ranges
+    // matching with the block-cyclic row/col count.  Initially all ranks
+    // in that row/col of the grid will be allocated indices from the
+    // corresponding set -- if those workers complete all the rows early
+    // then they can be assigned indices from the set with the most rows
+    // available.
+    //
+    int                 n_slots;                // e.g. geometry.dim_blocks[0]
+    int_set_ref         *available_indices;     // e.g. [geometry.dim_blocks[0]]
+    int_set_ref         *assigned_indices;      // e.g. [geometry.dim_blocks[0]]
+    int_set_ref         *completed_indices;     // e.g. [geometry.dim_blocks[0]]
+    int_set_ref         completing_indices;     // scratch for mpi_assignable_work_complete()
+    int_set_arena_ref   set_arena;              // owns all of the above
+    
+    // Every assigned index carries a lease.  Once the available sets run
+    // dry, indices whose lease has been outstanding for at least
+    // lease_timeout seconds can be handed out again to idle ranks (up to
+    // lease_max_replicas extra copies); whichever completion arrives
+    // first wins and later ones are ignored.  Memory writes are idempotent
+    // overwrites, so duplicated work is harmless.  A lease_timeout of zero
+    // disables speculative re-execution:
+    mpi_assignable_work_lease_t *leases;        // e.g. [geometry.dim_global[0]]
+    double              lease_timeout;
+    int                 lease_max_replicas;
+    base_int_t          n_speculative_units;
+    base_int_t          n_duplicate_completions;
+    
+    // Number of non-root ranks that have been told no more work remains:
+    int                 n_ranks_released;
+    
+    // Work units span up to unit_size consecutive indices (with
+    // triangular geometry, as many indices as hold the elements of
+    // unit_size indices of average length).  With
+    // is_throughput_aware the size is scaled by the requestor's measured
+    // rate relative to the mean rate across ranks (slow ranks get smaller
+    // units) and ranks faster than the mean are given work from the slot
+    // expected to finish last (most remaining indices per unit of rate of
+    // the ranks whose primary slot it is):
+    base_int_t          unit_size;
+    bool                is_throughput_aware;
+    
+    // With element_offsets (e.g. from a sparsity pattern) index k covers
+    // element_offsets[k + 1] - element_offsets[k] elements; work units
+    // then span as many indices as hold the elements of unit_size indices
+    // of average cost.  The array is owned by the caller:
+    const base_int_t    *element_offsets;           // e.g. [geometry.dim_global[0] + 1]
+    mpi_assignable_work_rank_stats_t *rank_stats;   // e.g. [geometry.dist_size]
+    double              *slot_rates;                // e.g. [geometry.dim_blocks[0]]
+    
+    // With is_autotuned the unit size adapts to how long requestors wait
+    // on the root:  each reports the fraction of its time spent idle (see
+    // mpi_assignable_work_note_idle()) and whenever the smoothed fraction
+    // exceeds idle_threshold the unit size is doubled, up to unit_size_max.
+    // Once the remaining work would no longer give every rank two units
+    // of the current size it is halved again (down to one index) to keep
+    // the tail short:
+    bool                is_autotuned;
+    double              idle_threshold;
+    double              idle_fraction;
+    base_int_t          unit_size_max;
+    base_int_t          n_unit_size_changes;
+    
+    // Slot ordering policy:
+    mpi_assignable_work_order_t order;
+    
+    // Optional notification when a slot has been completed; it is
+    // called outside alloc_lock on whichever thread reported the final
+    // completion in the slot:
+    mpi_assignable_work_slot_callback_t slot_completed_callback;
+    const void          *slot_completed_context;
+    
+    // A mutex is necessary because the root rank will allocate work
+    // directly versus going through the MPI protocol; we need to ensure
+    // the server thread isn't allocating work to another rank while the
+    // root's client thread is doing likewise:
+    pthread_mutex_t     alloc_lock;
+} mpi_assignable_work_t;
+
+//
+
+/*
+ * @function mpi_assignable_work_create
+ *
+ * Allocate and initialize the work units for the given geometry:
+ * every row (row-major) or column (column-major) index is available.
+ * The clock defaults to mpi_assignable_work_default_clock().
+ *
+ * Returns NULL on error.
+ */
+mpi_assignable_work_t* mpi_assignable_work_create(const mpi_assignable_work_geometry_t *geometry);
+
+void mpi_assignable_work_destroy(mpi_assignable_work_t *work_units);
+
+bool mpi_assignable_work_all_completed(mpi_assignable_work_t *work_units);
+
+bool mpi_assignable_work_next_unit(mpi_assignable_work_t *work_units, int target_rank,
+            int primary_slot, int_pair_t *p_low, int_pair_t *p_high);
+
+void mpi_assignable_work_complete(mpi_assignable_work_t *work_units, int source_rank, int_pair_t p_low, int_pair_t p_high);
+
+/*
+ * @function mpi_assignable_work_next_unit_set
+ *
+ * Like mpi_assignable_work_next_unit(), but the work unit may span
+ * several runs of the chosen slot's available indices:  ranges are
+ * taken in ascending order until the unit size is reached.  The row
+ * (row-major) or column (column-major) indices of the unit replace the
+ * contents of unit.  Returns false if no work was allocated.
+ */
+bool mpi_assignable_work_next_unit_set(mpi_assignable_work_t *work_units, int target_rank,
+            int primary_slot, int_set_ref unit);
+
+/*
+ * @function mpi_assignable_work_complete_set
+ *
+ * Like mpi_assignable_work_complete() for a work unit allocated by
+ * mpi_assignable_work_next_unit_set().  A trace line is recorded for
+ * each range in unit.
+ */
+void mpi_assignable_work_complete_set(mpi_assignable_work_t *work_units, int source_rank, int_set_ref unit);
+
+/*
+ * @function mpi_assignable_work_slot_is_completed
+ *
+ * Returns true if every index in the given slot has been completed.
+ * All sub-matrix blocks in that slot then hold their final values,
+ * less any remote memory writes still in flight (none when a
+ * checkpoint is attached, since writes are then synchronous, or with
+ * mpi_server_thread_track_block_completion(), which also notifies the
+ * ranks holding those blocks).
+ */
+bool mpi_assignable_work_slot_is_completed(mpi_assignable_work_t *work_units, int slot);
+
+/*
+ * @function mpi_assignable_work_rank_is_completed
+ *
+ * Returns true if all work units covering the local sub-matrix of
+ * the given MPI rank have been completed.
+ */
+bool mpi_assignable_work_rank_is_completed(mpi_assignable_work_t *work_units, int rank);
+
+/*
+ * @function mpi_assignable_work_note_idle
+ *
+ * Record the fraction of its time a requestor spent waiting for work
+ * since its previous report; reports from all ranks are smoothed
+ * together.  Has no effect unless is_autotuned is set, in which case
+ * the unit size may be adjusted.
+ */
+void mpi_assignable_work_note_idle(mpi_assignable_work_t *work_units, double idle_fraction);
+
+/*
+ * @function mpi_assignable_work_apply_static_partition
+ *
+ * Move every rank's statically-assigned work unit (see
+ * mpi_assignable_work_geometry_static_unit()) from the available to
+ * the assigned indices and lease it to that rank.  Must be called
+ * before any work is allocated.
+ */
+void mpi_assignable_work_apply_static_partition(mpi_assignable_work_t *work_units, double static_fraction);
+
+/*
+ * @function mpi_assignable_work_restore_completed
+ *
+ * Mark all indices in r as completed without their having been
+ * assigned, e.g. when restarting from a checkpoint.
+ */
+void mpi_assignable_work_restore_completed(mpi_assignable_work_t *work_units, int_range_t r);
+
+/*
+ * @function mpi_assignable_work_should_defer
+ *
+ * Returns true if mpi_assignable_work_next_unit() found no work for a
+ * requestor but speculative re-execution is enabled and work units
+ * are still outstanding:  the requestor should wait *retry_delay
+ * seconds and ask again rather than exiting.
+ */
+bool mpi_assignable_work_should_defer(mpi_assignable_work_t *work_units, double *retry_delay);
+
+/*
+ * @function mpi_assignable_work_release_rank
+ *
+ * Note that target_rank has been told no more work remains and will
+ * not make any further work requests.
+ */
+void mpi_assignable_work_release_rank(mpi_assignable_work_t *work_units, int target_rank);
+
+/*
+ * @function mpi_assignable_work_all_released
+ *
+ * Returns true once every non-root rank has been released via
+ * mpi_assignable_work_release_rank().  Only then is it safe for the
+ * root to shut down the server threads.
+ */
+bool mpi_assignable_work_all_released(mpi_assignable_work_t *work_units);
+
+/*
+ * @function mpi_assignable_work_trace_begin
+ *
+ * Start recording completed work units to stream.  A header noting
+ * the geometry is written first, followed by one line per completed
+ * range of indices (one per call to mpi_assignable_work_complete()):
+ *
+ *     <rank>,<first index>,<index count>,<start time>,<end time>
+ *
+ * where start time is when the unit was allocated to the rank and
+ * end time is when its completion was noted.  Pass NULL to stop
+ * recording; the caller owns (and must close) the stream.
+ */
+void mpi_assignable_work_trace_begin(mpi_assignable_work_t *work_units, FILE *stream);
+
+void mpi_assignable_work_summary(mpi_assignable_work_t *work_units, FILE *stream);
+
+#endif /* __MPI_ASSIGNABLE_WORK_H__ */
@@ -0,0 +1,167 @@
+/*	mpi_autotune.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_autotune.h"
+#include "mpi_utils.h"
+
+//
+
+// Round trips used to measure latency and bandwidth:
+#define MPI_AUTOTUNE_LATENCY_ITERS      20
+#define MPI_AUTOTUNE_BANDWIDTH_ITERS    4
+#define MPI_AUTOTUNE_BANDWIDTH_BYTES    (1 << 20)
+
+// Limits on the write buffer depth:
+#define MPI_AUTOTUNE_DEPTH_MAX          8
+
+//
+
+static void
+__mpi_autotune_measure_fabric(
+    mpi_server_thread_t *server_info,
+    char                *buffer,
+    double              *latency,
+    double              *bandwidth
+)
+{
+    int                 i;
+    
+    *latency = *bandwidth = 0.0;
+    if ( server_info->dist_rank == server_info->root_rank ) {
+        int             rank = 0;
+        
+        // Echo everything back to each rank in turn:
+        while ( rank < server_info->dist_size ) {
+            if ( rank != server_info->root_rank ) {
+                for ( i = 0; i < MPI_AUTOTUNE_LATENCY_ITERS; i++ ) {
+                    MPI_Recv(buffer, 1, MPI_CHAR, rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    MPI_Send(buffer, 1, MPI_CHAR, rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD);
+                }
+                for ( i = 0; i < MPI_AUTOTUNE_BANDWIDTH_ITERS; i++ ) {
+                    MPI_Recv(buffer, MPI_AUTOTUNE_BANDWIDTH_BYTES, MPI_CHAR, rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    MPI_Send(buffer, MPI_AUTOTUNE_BANDWIDTH_BYTES, MPI_CHAR, rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD);
+                }
+            }
+            rank++;
+        }
+    } else {
+        double          t0;
+        
+        t0 = MPI_Wtime();
+        for ( i = 0; i < MPI_AUTOTUNE_LATENCY_ITERS; i++ ) {
+            MPI_Send(buffer, 1, MPI_CHAR, server_info->root_rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD);
+            MPI_Recv(buffer, 1, MPI_CHAR, server_info->root_rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+        *latency = (MPI_Wtime() - t0) / (2 * MPI_AUTOTUNE_LATENCY_ITERS);
+        
+        t0 = MPI_Wtime();
+        for ( i = 0; i < MPI_AUTOTUNE_BANDWIDTH_ITERS; i++ ) {
+            MPI_Send(buffer, MPI_AUTOTUNE_BANDWIDTH_BYTES, MPI_CHAR, server_info->root_rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD);
+            MPI_Recv(buffer, MPI_AUTOTUNE_BANDWIDTH_BYTES, MPI_CHAR, server_info->root_rank, mpi_server_thread_autotune_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+        // Latency is not subtracted:  on a busy node it can be of the same
+        // order as the transfer itself and the estimate would be meaningless:
+        *bandwidth = MPI_AUTOTUNE_BANDWIDTH_BYTES / ((MPI_Wtime() - t0) / (2 * MPI_AUTOTUNE_BANDWIDTH_ITERS));
+    }
+}
+
+//
+
+void
+mpi_autotune_run(
+    mpi_server_thread_t *server_info,
+    double              local_element_cost,
+    mpi_autotune_t      *tuning
+)
+{
+    double              local[3], sum[3];
+    char                *buffer = (char*)malloc(MPI_AUTOTUNE_BANDWIDTH_BYTES);
+    int                 n_remote = server_info->dist_size - 1;
+    base_int_t          n_indices, n_minor, elements_per_dest;
+    double              index_cost, transfer_time;
+    
+    if ( ! buffer ) {
+        mpi_printf(-1, "ERROR:  unable to allocate autotuning buffer");
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    memset(buffer, 0, MPI_AUTOTUNE_BANDWIDTH_BYTES);
+    __mpi_autotune_measure_fabric(server_info, buffer, &local[1], &local[2]);
+    free((void*)buffer);
+    
+    // Element cost is averaged over all ranks, the fabric over all but
+    // the root:
+    local[0] = local_element_cost;
+    MPI_Allreduce(local, sum, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    memset(tuning, 0, sizeof(*tuning));
+    tuning->element_cost = sum[0] / server_info->dist_size;
+    tuning->latency = (n_remote > 0) ? (sum[1] / n_remote) : 0.0;
+    tuning->bandwidth = (n_remote > 0) ? (sum[2] / n_remote) : 0.0;
+    
+    if ( server_info->is_row_major ) {
+        n_indices = server_info->dim_global[0];
+        n_minor = server_info->dim_global[1];
+        elements_per_dest = server_info->dim_per_rank[1];
+    } else {
+        n_indices = server_info->dim_global[1];
+        n_minor = server_info->dim_global[0];
+        elements_per_dest = server_info->dim_per_rank[0];
+    }
+    index_cost = tuning->element_cost * n_minor;
+    
+    // Keep the request round trip under 2% of the time spent producing a
+    // unit, but leave at least four units per rank:
+    tuning->unit_size_max = n_indices / (4 * server_info->dist_size);
+    if ( tuning->unit_size_max < 1 ) tuning->unit_size_max = 1;
+    tuning->unit_size = (index_cost > 0.0) ? (base_int_t)ceil(50.0 * 2.0 * tuning->latency / index_cost) : 1;
+    if ( tuning->unit_size < 1 ) tuning->unit_size = 1;
+    else if ( tuning->unit_size > tuning->unit_size_max ) tuning->unit_size = tuning->unit_size_max;
+    
+    // Keep latency under 10% of a batch's transfer time, but a batch
+    // should fill within a single work unit:
+    tuning->write_batch_size = (tuning->bandwidth > 0.0) ?
+                    (base_int_t)ceil(10.0 * tuning->latency * tuning->bandwidth / sizeof(mpi_server_thread_element_t))
+                  : 1;
+    elements_per_dest *= tuning->unit_size;
+    if ( tuning->write_batch_size > elements_per_dest ) tuning->write_batch_size = elements_per_dest;
+    if ( tuning->write_batch_size < 16 ) tuning->write_batch_size = 16;
+    
+    // Enough buffers to cover a batch's transfer with production of the
+    // following batches:
+    transfer_time = tuning->latency + ((tuning->bandwidth > 0.0) ? (tuning->write_batch_size * sizeof(mpi_server_thread_element_t) / tuning->bandwidth) : 0.0);
+    tuning->write_batch_depth = 1 + (int)ceil(transfer_time / (tuning->write_batch_size * ((tuning->element_cost > 0.0) ? tuning->element_cost : 1e-9)));
+    if ( tuning->write_batch_depth < 2 ) tuning->write_batch_depth = 2;
+    else if ( tuning->write_batch_depth > MPI_AUTOTUNE_DEPTH_MAX ) tuning->write_batch_depth = MPI_AUTOTUNE_DEPTH_MAX;
+    
+    if ( ! mpi_server_thread_set_write_batching(server_info, tuning->write_batch_size, tuning->write_batch_depth) ) {
+        mpi_printf(-1, "WARNING:  unable to allocate write batches, writes will not be batched");
+    }
+    if ( server_info->assignable_work ) {
+        server_info->assignable_work->unit_size = tuning->unit_size;
+        server_info->assignable_work->unit_size_max = tuning->unit_size_max;
+        server_info->assignable_work->is_autotuned = true;
+    }
+}
+
+//
+
+void
+mpi_autotune_note_unit(
+    mpi_server_thread_t *server_info,
+    mpi_autotune_t      *tuning,
+    double              produce_time
+)
+{
+    tuning->produce_time += produce_time;
+    
+    // Judge over at least a second of production:
+    if ( tuning->produce_time < 1.0 ) return;
+    if ( (server_info->write_wait_time - tuning->write_wait_time > 0.05 * tuning->produce_time) &&
+         (server_info->write_batch_size > 1) && (server_info->write_batch_depth < MPI_AUTOTUNE_DEPTH_MAX) )
+    {
+        tuning->write_batch_depth = server_info->write_batch_depth + 1;
+        mpi_server_thread_set_write_batching(server_info, server_info->write_batch_size, tuning->write_batch_depth);
+    }
+    tuning->write_wait_time = server_info->write_wait_time;
+    tuning->produce_time = 0.0;
+}
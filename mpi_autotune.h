@@ -0,0 +1,77 @@
+/*	mpi_autotune.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix autotuning
+
+	Choose the work unit size and the remote write batch size and
+	buffer depth from measurements taken at startup:
+
+	    1. the cost of a matrix element, averaged across ranks
+	    2. the one-way message latency between each rank and the root
+	    3. the point-to-point bandwidth between each rank and the root
+
+	Work units are sized so that the request/response round trip is a
+	small fraction of the time spent producing the unit, while still
+	leaving enough units for every rank to share in the tail.  Write
+	batches are sized so that latency is a small fraction of the time
+	to transfer a batch, and enough buffers are kept per destination
+	to cover a batch's transfer time with production of the next.
+
+	During the run the root adjusts the unit size from the idle time
+	ranks report (see mpi_assignable_work_note_idle()) and each rank
+	deepens its write buffers if it spends too long waiting on them.
+*/
+
+#ifndef __MPI_AUTOTUNE_H__
+#define __MPI_AUTOTUNE_H__
+
+#include "project_config.h"
+#include "mpi_server_thread.h"
+
+/*
+ * @typedef mpi_autotune_t
+ *
+ * Measured characteristics of the kernel and fabric and the values
+ * chosen from them.  The write_wait_time and produce_time fields
+ * track the last check of the rank's write buffer stalls.
+ */
+typedef struct {
+    double          element_cost;       // seconds per matrix element
+    double          latency;            // one-way, seconds
+    double          bandwidth;          // bytes per second
+    
+    base_int_t      unit_size;
+    base_int_t      unit_size_max;
+    base_int_t      write_batch_size;
+    int             write_batch_depth;
+    
+    double          write_wait_time;
+    double          produce_time;
+} mpi_autotune_t;
+
+/*
+ * @function mpi_autotune_run
+ *
+ * Collective:  every rank must call this function before the server
+ * thread is started.  The local_element_cost is the calling rank's
+ * measured time to produce one matrix element.  The latency and
+ * bandwidth to the root are measured, results are averaged across
+ * ranks and the same tuning is chosen on every rank.
+ *
+ * The write batching of server_info is configured and, on the root,
+ * the assignable work is switched to autotuned unit sizing.
+ */
+void mpi_autotune_run(mpi_server_thread_t *server_info, double local_element_cost, mpi_autotune_t *tuning);
+
+/*
+ * @function mpi_autotune_note_unit
+ *
+ * Called after the calling rank produced a work unit in produce_time
+ * seconds.  If the rank spent more than 5% of its production time
+ * waiting for write buffers to drain, the buffer depth is increased.
+ */
+void mpi_autotune_note_unit(mpi_server_thread_t *server_info, mpi_autotune_t *tuning, double produce_time);
+
+#endif /* __MPI_AUTOTUNE_H__ */
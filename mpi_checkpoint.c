@@ -0,0 +1,440 @@
+
+#include "mpi_checkpoint.h"
+#include "mpi_utils.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+//
+
+const base_int_t mpi_checkpoint_tile_length = 32768;
+
+//
+
+static const char __mpi_checkpoint_submatrix_magic[8] = { 'M', 'D', 'M', 'S', 'U', 'B', 'M', 'X' };
+static const char __mpi_checkpoint_completed_magic[8] = { 'M', 'D', 'M', 'C', 'O', 'M', 'P', 'L' };
+
+enum {
+    __mpi_checkpoint_version = 1,
+    // Sub-matrix data starts at this offset in the rank's file:
+    __mpi_checkpoint_data_offset = 4096
+};
+
+typedef struct {
+    char        magic[8];
+    int32_t     version;
+    int32_t     epoch;
+    int32_t     dist_rank, dist_size;
+    int32_t     is_row_major;
+    int32_t     element_size;
+    int64_t     dim_global[2];
+    int64_t     dim_per_rank[2];
+    int64_t     dim_blocks[2];
+} __mpi_checkpoint_submatrix_header_t;
+
+typedef struct {
+    char        magic[8];
+    int32_t     version;
+    int32_t     epoch;
+    int64_t     n_ranges;
+} __mpi_checkpoint_completed_header_t;
+
+//
+
+static void
+__mpi_checkpoint_submatrix_header_init(
+    __mpi_checkpoint_submatrix_header_t *header,
+    mpi_server_thread_t                 *server_info,
+    int                                 epoch
+)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, __mpi_checkpoint_submatrix_magic, sizeof(header->magic));
+    header->version = __mpi_checkpoint_version;
+    header->epoch = epoch;
+    header->dist_rank = server_info->dist_rank;
+    header->dist_size = server_info->dist_size;
+    header->is_row_major = server_info->is_row_major;
+    header->element_size = sizeof(matrix_element_t);
+    header->dim_global[0] = server_info->dim_global[0];
+    header->dim_global[1] = server_info->dim_global[1];
+    header->dim_per_rank[0] = server_info->dim_per_rank[0];
+    header->dim_per_rank[1] = server_info->dim_per_rank[1];
+    header->dim_blocks[0] = server_info->dim_blocks[0];
+    header->dim_blocks[1] = server_info->dim_blocks[1];
+}
+
+//
+
+static bool
+__mpi_checkpoint_pwrite(
+    int         fd,
+    const void  *buffer,
+    size_t      length,
+    off_t       offset
+)
+{
+    while ( length > 0 ) {
+        ssize_t n = pwrite(fd, buffer, length, offset);
+        
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            return false;
+        }
+        buffer += n, length -= n, offset += n;
+    }
+    return true;
+}
+
+static bool
+__mpi_checkpoint_pread(
+    int         fd,
+    void        *buffer,
+    size_t      length,
+    off_t       offset
+)
+{
+    while ( length > 0 ) {
+        ssize_t n = pread(fd, buffer, length, offset);
+        
+        if ( n <= 0 ) {
+            if ( (n < 0) && (errno == EINTR) ) continue;
+            return false;
+        }
+        buffer += n, length -= n, offset += n;
+    }
+    return true;
+}
+
+//
+
+static char*
+__mpi_checkpoint_completed_path(
+    mpi_checkpoint_t    *checkpoint,
+    int                 epoch
+)
+{
+    size_t              path_len = strlen(checkpoint->path_prefix) + 32;
+    char                *path = (char*)malloc(path_len);
+    
+    if ( path ) snprintf(path, path_len, "%s.completed.%d", checkpoint->path_prefix, epoch);
+    return path;
+}
+
+//
+////
+//
+
+mpi_checkpoint_t*
+mpi_checkpoint_create(
+    mpi_server_thread_t *server_info,
+    const char          *path_prefix,
+    bool                is_restart
+)
+{
+    mpi_checkpoint_t    *new_checkpoint;
+    base_int_t          n_elements = server_info->local_sub_matrix_length;
+    base_int_t          n_tiles = (n_elements + mpi_checkpoint_tile_length - 1) / mpi_checkpoint_tile_length;
+    size_t              prefix_len = strlen(path_prefix);
+    size_t              rec_size = sizeof(mpi_checkpoint_t) + n_tiles + prefix_len + 1;
+    char                *path;
+    
+    new_checkpoint = (mpi_checkpoint_t*)malloc(rec_size);
+    if ( ! new_checkpoint ) return NULL;
+    memset(new_checkpoint, 0, rec_size);
+    new_checkpoint->dirty_tiles = (unsigned char*)((void*)new_checkpoint + sizeof(mpi_checkpoint_t));
+    new_checkpoint->path_prefix = (char*)(new_checkpoint->dirty_tiles + n_tiles);
+    strcpy(new_checkpoint->path_prefix, path_prefix);
+    new_checkpoint->n_elements = n_elements;
+    new_checkpoint->n_tiles = n_tiles;
+    new_checkpoint->epoch = -1;
+    new_checkpoint->last_time = MPI_Wtime();
+    
+    path = (char*)malloc(prefix_len + 32);
+    if ( ! path ) {
+        free((void*)new_checkpoint);
+        return NULL;
+    }
+    snprintf(path, prefix_len + 32, "%s.%d.submatrix", path_prefix, server_info->dist_rank);
+    new_checkpoint->fd = open(path, O_RDWR | O_CREAT | (is_restart ? 0 : O_TRUNC), 0644);
+    if ( new_checkpoint->fd < 0 ) {
+        mpi_printf(-1, "ERROR:  unable to open checkpoint file `%s` (errno = %d)", path, errno);
+        free((void*)path);
+        free((void*)new_checkpoint);
+        return NULL;
+    }
+    free((void*)path);
+    
+    if ( ! is_restart ) {
+        // Write a header with no valid epoch so that a stale checkpoint can
+        // never be mistaken for this run's data:
+        __mpi_checkpoint_submatrix_header_t header;
+        
+        __mpi_checkpoint_submatrix_header_init(&header, server_info, -1);
+        if ( ! __mpi_checkpoint_pwrite(new_checkpoint->fd, &header, sizeof(header), 0) ) {
+            mpi_checkpoint_destroy(new_checkpoint);
+            return NULL;
+        }
+    }
+    return new_checkpoint;
+}
+
+//
+
+void
+mpi_checkpoint_destroy(
+    mpi_checkpoint_t    *checkpoint
+)
+{
+    if ( checkpoint->fd >= 0 ) close(checkpoint->fd);
+    free((void*)checkpoint);
+}
+
+//
+
+int
+mpi_checkpoint_restore(
+    mpi_checkpoint_t    *checkpoint,
+    mpi_server_thread_t *server_info
+)
+{
+    __mpi_checkpoint_submatrix_header_t file_header, our_header;
+    
+    if ( ! __mpi_checkpoint_pread(checkpoint->fd, &file_header, sizeof(file_header), 0) ) return -1;
+    
+    // The file must be for the same matrix geometry and rank:
+    __mpi_checkpoint_submatrix_header_init(&our_header, server_info, file_header.epoch);
+    if ( memcmp(&file_header, &our_header, sizeof(file_header)) != 0 ) {
+        mpi_printf(-1, "checkpoint file does not match the current matrix and rank layout");
+        return -1;
+    }
+    if ( file_header.epoch < 0 ) return -1;
+    
+    // Regions of the file never written read back as zeroes (holes) which is
+    // fine since their indices cannot have been completed:
+    if ( ! __mpi_checkpoint_pread(checkpoint->fd, server_info->local_sub_matrix,
+                    sizeof(matrix_element_t) * checkpoint->n_elements, __mpi_checkpoint_data_offset) )
+    {
+        struct stat     finfo;
+        
+        // Short file?  Anything beyond the end was never written:
+        if ( (fstat(checkpoint->fd, &finfo) != 0) || (finfo.st_size < __mpi_checkpoint_data_offset) ) return -1;
+        memset(server_info->local_sub_matrix, 0, sizeof(matrix_element_t) * checkpoint->n_elements);
+        if ( (finfo.st_size > __mpi_checkpoint_data_offset) &&
+             ! __mpi_checkpoint_pread(checkpoint->fd, server_info->local_sub_matrix,
+                    finfo.st_size - __mpi_checkpoint_data_offset, __mpi_checkpoint_data_offset) ) return -1;
+    }
+    checkpoint->epoch = file_header.epoch;
+    checkpoint->next_epoch = file_header.epoch + 1;
+    return file_header.epoch;
+}
+
+//
+
+bool
+mpi_checkpoint_write(
+    mpi_checkpoint_t    *checkpoint,
+    mpi_server_thread_t *server_info,
+    int                 epoch
+)
+{
+    __mpi_checkpoint_submatrix_header_t header;
+    base_int_t          tile = 0, n_written = 0;
+    
+    while ( tile < checkpoint->n_tiles ) {
+        if ( checkpoint->dirty_tiles[tile] ) {
+            base_int_t  offset = tile * mpi_checkpoint_tile_length;
+            base_int_t  length = checkpoint->n_elements - offset;
+            
+            if ( length > mpi_checkpoint_tile_length ) length = mpi_checkpoint_tile_length;
+            
+            // Clear the flag first:  a concurrent write to the tile will
+            // mark it dirty again for the next checkpoint:
+            checkpoint->dirty_tiles[tile] = 0;
+            __sync_synchronize();
+            if ( ! __mpi_checkpoint_pwrite(checkpoint->fd, server_info->local_sub_matrix + offset,
+                            sizeof(matrix_element_t) * length, __mpi_checkpoint_data_offset + sizeof(matrix_element_t) * offset) )
+            {
+                checkpoint->dirty_tiles[tile] = 1;
+                return false;
+            }
+            n_written++;
+        }
+        tile++;
+    }
+    if ( fdatasync(checkpoint->fd) != 0 ) return false;
+    
+    // Only now is the data for this epoch safely on disk:
+    __mpi_checkpoint_submatrix_header_init(&header, server_info, epoch);
+    if ( ! __mpi_checkpoint_pwrite(checkpoint->fd, &header, sizeof(header), 0) ) return false;
+    if ( fdatasync(checkpoint->fd) != 0 ) return false;
+    checkpoint->epoch = epoch;
+    //mpi_printf(-1, "checkpoint epoch %d wrote " BASE_INT_FMT " of " BASE_INT_FMT " tiles", epoch, n_written, checkpoint->n_tiles);
+    return true;
+}
+
+//
+
+bool
+mpi_checkpoint_begin(
+    mpi_server_thread_t     *server_info
+)
+{
+    mpi_checkpoint_t        *checkpoint = server_info->checkpoint;
+    mpi_server_thread_msg_t msg;
+    int                     rank = 0, epoch = checkpoint->next_epoch++;
+    
+    checkpoint->last_time = MPI_Wtime();
+    if ( ! mpi_checkpoint_write_completed(checkpoint, server_info->assignable_work, epoch) ) {
+        mpi_printf(-1, "ERROR:  unable to write completed indices for checkpoint epoch %d (errno = %d)", epoch, errno);
+        return false;
+    }
+    msg.msg_type = mpi_server_thread_msg_type_memory;
+    msg.msg_id = mpi_server_thread_msg_id_memory_checkpoint;
+    msg.p_low = msg.p_high = int_pair_make(epoch, epoch);
+    msg.value = 0.0;
+    while ( rank < server_info->dist_size )
+        MPI_Send(&msg, 1, mpi_get_msg_datatype(), rank++, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+    mpi_printf(-1, "started checkpoint epoch %d", epoch);
+    return true;
+}
+
+//
+
+static bool
+__mpi_checkpoint_write_range(
+    int_range_t r,
+    const void  *context
+)
+{
+    int64_t     range[2] = { r.start, r.length };
+    
+    return (fwrite(range, sizeof(range), 1, (FILE*)context) == 1);
+}
+
+static bool
+__mpi_checkpoint_count_ranges(
+    int_range_t r,
+    const void  *context
+)
+{
+    (void)r;
+    (*((int64_t*)context))++;
+    return true;
+}
+
+bool
+mpi_checkpoint_write_completed(
+    mpi_checkpoint_t        *checkpoint,
+    mpi_assignable_work_t   *work_units,
+    int                     epoch
+)
+{
+    __mpi_checkpoint_completed_header_t header;
+    char                    *path = __mpi_checkpoint_completed_path(checkpoint, epoch);
+    char                    *tmp_path;
+    FILE                    *fptr;
+    bool                    rc = false;
+    int                     slot;
+    
+    if ( ! path ) return false;
+    tmp_path = (char*)malloc(strlen(path) + 5);
+    if ( ! tmp_path ) {
+        free((void*)path);
+        return false;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+    
+    fptr = fopen(tmp_path, "w");
+    if ( fptr ) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, __mpi_checkpoint_completed_magic, sizeof(header.magic));
+        header.version = __mpi_checkpoint_version;
+        header.epoch = epoch;
+        
+        // Hold the allocation lock so the snapshot is consistent:
+        pthread_mutex_lock(&work_units->alloc_lock);
+        for ( slot = 0; slot < work_units->n_slots; slot++ )
+            int_set_enumerate_ranges(work_units->completed_indices[slot], __mpi_checkpoint_count_ranges, &header.n_ranges);
+        rc = (fwrite(&header, sizeof(header), 1, fptr) == 1);
+        for ( slot = 0; rc && (slot < work_units->n_slots); slot++ )
+            rc = int_set_enumerate_ranges(work_units->completed_indices[slot], __mpi_checkpoint_write_range, fptr);
+        pthread_mutex_unlock(&work_units->alloc_lock);
+        
+        if ( fflush(fptr) != 0 ) rc = false;
+        if ( rc && (fsync(fileno(fptr)) != 0) ) rc = false;
+        fclose(fptr);
+        if ( rc ) rc = (rename(tmp_path, path) == 0);
+        if ( ! rc ) unlink(tmp_path);
+    }
+    free((void*)tmp_path);
+    free((void*)path);
+    
+    // Ranks may lag the root by an epoch, keep the previous snapshot around
+    // but nothing older:
+    if ( rc && (epoch >= 2) ) {
+        path = __mpi_checkpoint_completed_path(checkpoint, epoch - 2);
+        if ( path ) {
+            unlink(path);
+            free((void*)path);
+        }
+    }
+    return rc;
+}
+
+//
+
+static bool
+__mpi_checkpoint_restore_range(
+    int_range_t r,
+    const void  *context
+)
+{
+    mpi_assignable_work_restore_completed((mpi_assignable_work_t*)context, r);
+    return true;
+}
+
+int
+mpi_checkpoint_read_completed(
+    mpi_checkpoint_t        *checkpoint,
+    mpi_assignable_work_t   *work_units,
+    int                     max_epoch
+)
+{
+    while ( max_epoch >= 0 ) {
+        char                *path = __mpi_checkpoint_completed_path(checkpoint, max_epoch);
+        FILE                *fptr;
+        
+        if ( ! path ) return -1;
+        fptr = fopen(path, "r");
+        free((void*)path);
+        if ( fptr ) {
+            __mpi_checkpoint_completed_header_t header;
+            int_set_ref     completed = int_set_create();
+            bool            rc = false;
+            
+            // Collect every range before touching the work units, so a short
+            // snapshot leaves nothing marked complete:
+            if ( completed && (fread(&header, sizeof(header), 1, fptr) == 1) &&
+                 (memcmp(header.magic, __mpi_checkpoint_completed_magic, sizeof(header.magic)) == 0) &&
+                 (header.version == __mpi_checkpoint_version) && (header.epoch == max_epoch) )
+            {
+                int64_t     range[2];
+                
+                rc = true;
+                while ( rc && header.n_ranges-- ) {
+                    rc = (fread(range, sizeof(range), 1, fptr) == 1) &&
+                            int_set_push_range(completed, int_range_make(range[0], range[1]));
+                }
+            }
+            fclose(fptr);
+            if ( rc ) int_set_enumerate_ranges(completed, __mpi_checkpoint_restore_range, work_units);
+            if ( completed ) int_set_destroy(completed);
+            if ( rc ) return max_epoch;
+            mpi_printf(-1, "ERROR:  completed indices snapshot for epoch %d is corrupt", max_epoch);
+            return -1;
+        }
+        max_epoch--;
+    }
+    return -1;
+}
@@ -0,0 +1,184 @@
+/*	mpi_checkpoint.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix checkpoint/restart
+
+	Periodic checkpointing of matrix element generation progress.
+	Each rank persists its local sub-matrix to a file named
+
+	    <prefix>.<rank>.submatrix
+
+	The local sub-matrix is divided into fixed-size tiles (runs of
+	elements in storage order) and only tiles written since the
+	previous checkpoint are rewritten.  The root rank additionally
+	persists a snapshot of the completed work unit indices for each
+	checkpoint epoch:
+
+	    <prefix>.completed.<epoch>
+
+	The root takes the completed snapshot before it asks the ranks to
+	write their sub-matrices, so a rank file at epoch N contains at
+	least every value implied by the completed snapshot for epoch N.
+	On restart all ranks agree on the lowest epoch any of them reached
+	and the root reloads the newest completed snapshot not exceeding
+	it; only the remaining work units are then scheduled.
+
+	For that guarantee to hold, remote memory writes must have been
+	received before the producing rank reports the work unit completed,
+	so mpi_server_thread_memory_write() uses synchronous sends while a
+	checkpoint is attached to the server instance.
+*/
+
+#ifndef __MPI_CHECKPOINT_H__
+#define __MPI_CHECKPOINT_H__
+
+#include "project_config.h"
+#include "mpi_server_thread.h"
+
+/*
+ * @constant mpi_checkpoint_tile_length
+ *
+ * Number of local sub-matrix elements in a checkpoint tile.
+ */
+extern const base_int_t mpi_checkpoint_tile_length;
+
+/*
+ * @typedef mpi_checkpoint_t
+ *
+ * Checkpoint state attached to a rank's server instance.  The
+ * dirty_tiles array holds a flag per tile of the local sub-matrix
+ * that is set whenever an element in the tile is written.
+ *
+ * The root rank uses next_epoch, interval and last_time to schedule
+ * checkpoints; epoch is the last epoch this rank wrote.
+ */
+typedef struct mpi_checkpoint {
+    char                *path_prefix;
+    int                 fd;
+    int                 epoch;
+    int                 next_epoch;
+    double              interval;
+    double              last_time;
+    base_int_t          n_elements;
+    base_int_t          n_tiles;
+    unsigned char       *dirty_tiles;
+} mpi_checkpoint_t;
+
+/*
+ * @function mpi_checkpoint_create
+ *
+ * Open (is_restart == true) or create the sub-matrix checkpoint file
+ * for the calling rank and return a new checkpoint instance for the
+ * given server_info.  Creating the file discards any previous
+ * checkpoint content.
+ *
+ * Returns NULL on error.
+ */
+mpi_checkpoint_t* mpi_checkpoint_create(mpi_server_thread_t *server_info, const char *path_prefix, bool is_restart);
+
+/*
+ * @function mpi_checkpoint_destroy
+ *
+ * Close the checkpoint file and dispose of the checkpoint instance.
+ */
+void mpi_checkpoint_destroy(mpi_checkpoint_t *checkpoint);
+
+/*
+ * @function mpi_checkpoint_mark_dirty
+ *
+ * Note that the element at the given offset in the local sub-matrix
+ * was written.  Multiple threads may mark tiles concurrently.
+ */
+static inline void
+mpi_checkpoint_mark_dirty(
+    mpi_checkpoint_t    *checkpoint,
+    base_int_t          local_offset
+)
+{
+    checkpoint->dirty_tiles[local_offset / mpi_checkpoint_tile_length] = 1;
+}
+
+/*
+ * @function mpi_checkpoint_mark_dirty_range
+ *
+ * Note that the length elements starting at the given offset in the
+ * local sub-matrix were written.
+ */
+static inline void
+mpi_checkpoint_mark_dirty_range(
+    mpi_checkpoint_t    *checkpoint,
+    base_int_t          local_offset,
+    base_int_t          length
+)
+{
+    base_int_t          tile = local_offset / mpi_checkpoint_tile_length,
+                        tile_hi = (local_offset + length - 1) / mpi_checkpoint_tile_length;
+    
+    while ( tile <= tile_hi ) checkpoint->dirty_tiles[tile++] = 1;
+}
+
+/*
+ * @function mpi_checkpoint_restore
+ *
+ * Load the local sub-matrix of server_info from the checkpoint file.
+ * Returns the epoch of the checkpoint that was loaded or -1 if the
+ * file contains no usable checkpoint (e.g. it does not exist or was
+ * written for a different matrix/rank geometry).
+ */
+int mpi_checkpoint_restore(mpi_checkpoint_t *checkpoint, mpi_server_thread_t *server_info);
+
+/*
+ * @function mpi_checkpoint_write
+ *
+ * Write all dirty tiles of the local sub-matrix of server_info to
+ * the checkpoint file, then record epoch as the file's checkpoint
+ * epoch.  Returns true if successful.
+ */
+bool mpi_checkpoint_write(mpi_checkpoint_t *checkpoint, mpi_server_thread_t *server_info, int epoch);
+
+/*
+ * @function mpi_checkpoint_is_due
+ *
+ * Root rank only:  returns true if at least interval seconds have
+ * passed since the last checkpoint was started.
+ */
+static inline bool
+mpi_checkpoint_is_due(
+    mpi_checkpoint_t    *checkpoint
+)
+{
+    return ((checkpoint->interval > 0.0) && (MPI_Wtime() - checkpoint->last_time >= checkpoint->interval));
+}
+
+/*
+ * @function mpi_checkpoint_begin
+ *
+ * Root rank only:  start the next checkpoint epoch.  The completed
+ * indices of the server_info work units are persisted, then every
+ * rank's server thread (including the root's) is sent a checkpoint
+ * message.  Returns true if successful.
+ */
+bool mpi_checkpoint_begin(mpi_server_thread_t *server_info);
+
+/*
+ * @function mpi_checkpoint_write_completed
+ *
+ * Root rank only:  persist the completed indices of work_units for
+ * the given epoch.  Older snapshots that can no longer be needed are
+ * removed.  Returns true if successful.
+ */
+bool mpi_checkpoint_write_completed(mpi_checkpoint_t *checkpoint, mpi_assignable_work_t *work_units, int epoch);
+
+/*
+ * @function mpi_checkpoint_read_completed
+ *
+ * Root rank only:  load the newest completed indices snapshot whose
+ * epoch does not exceed max_epoch into work_units.  Returns the
+ * epoch that was loaded or -1 if no snapshot was found.  A corrupt or
+ * truncated snapshot also returns -1 and leaves work_units untouched.
+ */
+int mpi_checkpoint_read_completed(mpi_checkpoint_t *checkpoint, mpi_assignable_work_t *work_units, int max_epoch);
+
+#endif /* __MPI_CHECKPOINT_H__ */
@@ -1,5 +1,13 @@
 
 #include "mpi_server_thread.h"
+#include "mpi_checkpoint.h"
+#include "mpi_autotune.h"
+#include "mpi_producer_pool.h"
+#include "mpi_tile_cache.h"
+#include "mpi_sparse_matrix.h"
+#include "mpi_lazy_matrix.h"
+#include "mpi_sparsity_pattern.h"
+#include "mpi_feature_cache.h"
 #include "mpi_utils.h"
 
 // Include the matrix element kernel function:
@@ -8,6 +16,15 @@
 // Default matrix size
 #define GLOBAL_DIM  10000LL
 
+// Default seconds between checkpoints
+#define CHECKPOINT_INTERVAL 300
+
+// Rows and columns per lazily-produced tile
+#define LAZY_TILE_DIM 256
+
+// Default MiB of remote kernel inputs cached per rank
+#define FEATURE_CACHE_MIB 64
+
 // CLI options:
 #include <getopt.h>
 
@@ -19,9 +36,35 @@ static const struct option cliOptions[] = {
         { "row-major", no_argument, NULL, 'r' },
         { "column-major", no_argument, NULL, 'c' },
         { "root", required_argument, NULL, '0' },
+        { "lease-timeout", required_argument, NULL, 'l' },
+        { "checkpoint", required_argument, NULL, 'C' },
+        { "checkpoint-interval", required_argument, NULL, 'I' },
+        { "restart", no_argument, NULL, 'R' },
+        { "unit-size", required_argument, NULL, 'u' },
+        { "throughput-aware", no_argument, NULL, 't' },
+        { "static-fraction", required_argument, NULL, 's' },
+        { "block-order", no_argument, NULL, 'B' },
+        { "trace", required_argument, NULL, 'T' },
+        { "write-batch", required_argument, NULL, 'w' },
+        { "write-depth", required_argument, NULL, 'W' },
+        { "autotune", no_argument, NULL, 'A' },
+        { "manager-only", no_argument, NULL, 'M' },
+        { "throttle", required_argument, NULL, 'Q' },
+        { "kernel", required_argument, NULL, 'K' },
+        { "symmetric", no_argument, NULL, 'S' },
+        { "packed", no_argument, NULL, 'P' },
+        { "threads", required_argument, NULL, 'j' },
+        { "block-writes", no_argument, NULL, 'G' },
+        { "tile-cache", required_argument, NULL, 'D' },
+        { "cache-key", required_argument, NULL, 'k' },
+        { "sparse", required_argument, NULL, 'Z' },
+        { "lazy", required_argument, NULL, 'L' },
+        { "pattern", required_argument, NULL, 'p' },
+        { "features", required_argument, NULL, 'F' },
+        { "feature-cache", required_argument, NULL, 'X' },
         { NULL, 0, NULL, 0 }
     };
-static const char *cliOptionsStr = "hd:b:arc0:";
+static const char *cliOptionsStr = "hd:b:arc0:l:C:I:Ru:ts:BT:w:W:AMQ:K:SPj:GD:k:Z:L:p:F:X:";
 
 //
 
@@ -43,6 +86,104 @@ usage(
             "    --row-major/-r             use column-major storage and distribution across ranks\n"
             "    --column-major/-c          use column-major storage and distribution across ranks\n"
             "    --root/-0 #                elect the given rank id as the root server\n"
+            "    --lease-timeout/-l #       once no unassigned work remains, re-issue work units\n"
+            "                               that have been outstanding for at least this many\n"
+            "                               seconds to idle ranks (default 0, disabled)\n"
+            "    --checkpoint/-C <prefix>   periodically checkpoint progress and sub-matrices to\n"
+            "                               files named with the given path prefix\n"
+            "    --checkpoint-interval/-I # seconds between checkpoints (default %d)\n"
+            "    --restart/-R               reload the checkpoint files at <prefix> and only\n"
+            "                               generate the remaining matrix elements; the same rank\n"
+            "                               count and matrix options must be used\n"
+            "    --unit-size/-u #           number of rows (row-major) or columns (column-major)\n"
+            "                               in a work unit (default 1)\n"
+            "    --throughput-aware/-t      size and place work units according to each rank's\n"
+            "                               measured throughput:  slower ranks get smaller units,\n"
+            "                               faster ranks get larger units from the slots that\n"
+            "                               would otherwise finish last\n"
+            "    --static-fraction/-s #     pre-assign this fraction (0 to 1) of the rows/columns\n"
+            "                               of each rank's block row/column at startup without\n"
+            "                               any messaging; the rest is assigned dynamically\n"
+            "                               (default 0, fully dynamic)\n"
+            "    --block-order/-B           all ranks work on the lowest block row/column with work\n"
+            "                               remaining so that sub-matrices are completed one block\n"
+            "                               row/column at a time; each rank is told when its own\n"
+            "                               sub-matrix holds its final values\n"
+            "    --trace/-T <path>          record every completed work unit (rank, indices, start\n"
+            "                               and end time) to the given file for replay by the\n"
+            "                               mpi_work_sim scheduling simulator\n"
+            "    --write-batch/-w #         send remote matrix element writes in batches of up to\n"
+            "                               this many elements per destination rank (default 1,\n"
+            "                               no batching)\n"
+            "    --write-depth/-W #         number of write batch buffers per destination rank\n"
+            "                               that may be in flight at once (default 2)\n"
+            "    --autotune/-A              measure the kernel cost, latency and bandwidth at\n"
+            "                               startup to choose the unit size, write batch size and\n"
+            "                               depth, then adjust them from idle time during the run;\n"
+            "                               the chosen values are printed\n"
+            "    --manager-only/-M          the root only manages work units:  it produces no\n"
+            "                               matrix elements and holds no sub-matrix, the blocks\n"
+            "                               are distributed across the other ranks; the root\n"
+            "                               defaults to the last rank and must be the last rank\n"
+            "    --throttle/-Q #            the root pauses its own production whenever this\n"
+            "                               many requests from other ranks are queued behind one\n"
+            "                               another at its server thread (default 0, disabled)\n"
+            "    --kernel/-K <path>         load the matrix element kernel from the given plugin\n"
+            "                               shared object (see me_kernel_plugin.h) rather than\n"
+            "                               using the built-in kernel\n"
+            "    --symmetric/-S             the kernel is symmetric:  only the upper (row-major)\n"
+            "                               or lower (column-major) triangle is produced and each\n"
+            "                               value is also written to its transposed position;\n"
+            "                               the matrix must be square\n"
+            "    --packed/-P                implies --symmetric, but only the produced triangle\n"
+            "                               is stored (packed in diagonal blocks); the blocks\n"
+            "                               must be square\n"
+            "    --threads/-j #             number of threads producing matrix elements in each\n"
+            "                               rank (default 1)\n"
+            "    --block-writes/-G          the rows (row-major) or columns (column-major) of a\n"
+            "                               work unit that belong to another rank's block are\n"
+            "                               produced into a buffer and sent whole, straight into\n"
+            "                               that rank's sub-matrix; with MPI-4 each row (column)\n"
+            "                               is handed over as soon as it is produced (ignored\n"
+            "                               with --symmetric)\n"
+            "    --tile-cache/-D <dir>      load previously produced matrix tiles from the cache in\n"
+            "                               the given directory and only produce the rest; the\n"
+            "                               newly produced tiles are added to the cache at the end\n"
+            "                               (not with --packed or --restart)\n"
+            "    --cache-key/-k <string>    tiles are cached per kernel description and this string,\n"
+            "                               which should name any kernel parameters that change\n"
+            "                               its output (default empty)\n"
+            "    --sparse/-Z <threshold>    drop matrix elements whose magnitude is below the\n"
+            "                               threshold where they are produced and store each\n"
+            "                               sub-matrix in compressed sparse rows (row-major) or\n"
+            "                               columns (column-major); not with --checkpoint, block\n"
+            "                               writes and the tile cache are disabled\n"
+            "    --lazy/-L #                produce no work units; instead each rank reads # random\n"
+            "                               matrix elements and one tile, producing each tile of\n"
+            "                               256x256 elements the first time it is read; not with\n"
+            "                               --checkpoint or --sparse\n"
+            "    --pattern/-p <pattern>     only produce the elements in the given sparsity pattern,\n"
+            "                               the rest are zero; work units are sized by the number\n"
+            "                               of elements they produce; not with --symmetric,\n"
+            "                               --packed or --lazy, block writes and the tile cache are\n"
+            "                               disabled\n"
+            "    --features/-F <features>   produce A_{i,j} = K(x_i, y_j) from input vectors per row\n"
+            "                               and column instead of from the indices; each rank\n"
+            "                               reads its own rows' and columns' inputs and fetches\n"
+            "                               the others as needed; not with --lazy, the tile cache\n"
+            "                               is disabled\n"
+            "    --feature-cache/-X #       cache up to # MiB of fetched inputs per rank (default\n"
+            "                               %d)\n"
+            "\n"
+            "  <pattern> = band:# | block-diagonal:# | csr:<path>\n"
+            "                               elements with |i - j| <= #, the diagonal blocks of #x#\n"
+            "                               elements, or the nonzero structure in a CSR text file\n"
+            "                               (see the README)\n"
+            "\n"
+            "  <features> = #:<path>[,<path>]\n"
+            "                               # inputs per row and column, read as native doubles from\n"
+            "                               the first file (rows) and second file (columns, default\n"
+            "                               the first file)\n"
             "\n"
             "  <matrix-2d-dims> = # | #,#   given a single integer value, a square matrix of the given\n"
             "                               number of rows and columns is chosen; otherwise, the first\n"
@@ -53,7 +194,9 @@ usage(
             "                                   #,# : the given integer number of rows,columns\n"
             "\n",
             exe,
-            GLOBAL_DIM
+            GLOBAL_DIM,
+            CHECKPOINT_INTERVAL,
+            FEATURE_CACHE_MIB
         );
 }
 
@@ -107,6 +250,443 @@ base_int_min(
     return (i1 > i2) ? i2 : i1;
 }
 
+static inline base_int_t
+base_int_max(
+    base_int_t      i1,
+    base_int_t      i2
+)
+{
+    return (i1 > i2) ? i1 : i2;
+}
+
+//
+
+// The rank's producer threads and a scratch segment for each of them, for
+// segments that are produced for another rank:
+static mpi_producer_pool_ref producer_pool = NULL;
+static double               *segment_buffers = NULL;
+
+// With block writes, a work unit's segments for other ranks' blocks are
+// produced into block_buffer, one block write per destination block:
+static bool                 is_block_writes = false;
+static matrix_element_t     *block_buffer = NULL;
+static base_int_t           block_buffer_capacity = 0;
+static mpi_server_thread_block_send_t *block_sends = NULL;
+
+// Tiles loaded from the tile cache are not produced again:
+static mpi_tile_cache_t     *tile_cache = NULL;
+
+// Only the elements in the sparsity pattern are produced:
+static mpi_sparsity_pattern_t *pattern = NULL;
+
+typedef struct {
+    mpi_server_thread_t     *server_info;
+    base_int_t              major_lo, minor_lo, minor_hi;
+    base_int_t              block_length, segment_lo, n_segments;
+    mpi_server_thread_block_send_t *sends;
+} produce_context_t;
+
+//
+
+static void
+produce_kernel_segment(
+    mpi_server_thread_t     *server_info,
+    int_pair_t              p,
+    base_int_t              length,
+    double                  *values
+)
+{
+    mpi_feature_cache_t     *features = server_info->features;
+    bool                    is_row_major = server_info->is_row_major;
+    mpi_feature_cache_side_t major_side = is_row_major ? mpi_feature_cache_side_rows : mpi_feature_cache_side_cols,
+                            minor_side = is_row_major ? mpi_feature_cache_side_cols : mpi_feature_cache_side_rows;
+    base_int_t              major = is_row_major ? p.i : p.j,
+                            minor = is_row_major ? p.j : p.i,
+                            minor_hi = minor + length, n;
+    const double            *x;
+    
+    if ( ! features ) {
+        if ( is_row_major ) me_kernel_row_segment(p.i, p.j, p.j + length, values);
+        else me_kernel_col_segment(p.j, p.i, p.i + length, values);
+        return;
+    }
+    
+    // The major index' inputs against each cached chunk of minor inputs:
+    x = mpi_feature_cache_acquire(features, server_info, major_side, major, &n);
+    while ( minor < minor_hi ) {
+        const double        *y = mpi_feature_cache_acquire(features, server_info, minor_side, minor, &n);
+        
+        if ( n > minor_hi - minor ) n = minor_hi - minor;
+        me_kernel_feature_segment(x, y, n, features->n_features, values);
+        mpi_feature_cache_release(features, minor_side, minor);
+        values += n, minor += n;
+    }
+    mpi_feature_cache_release(features, major_side, major);
+}
+
+//
+
+static void
+produce_run(
+    mpi_server_thread_t     *server_info,
+    base_int_t              major,
+    base_int_t              lo,
+    base_int_t              hi,
+    double                  *scratch
+)
+{
+    bool                    is_row_major = server_info->is_row_major;
+    base_int_t              length = hi - lo;
+    int_pair_t              p = is_row_major ? int_pair_make(major, lo) : int_pair_make(lo, major);
+    double                  *values = scratch;
+    
+#ifdef MATRIX_ELEMENT_IS_DOUBLE
+    // Produce in place when the block is local:
+    values = mpi_server_thread_local_segment(server_info, p, length);
+    if ( ! values ) values = scratch;
+#endif
+    produce_kernel_segment(server_info, p, length, values);
+    mpi_server_thread_memory_write_segment(server_info, p, length, values);
+    if ( server_info->symmetry == mpi_server_thread_symmetry_mirror ) {
+        base_int_t          k = (lo == major) ? 1 : 0;
+        
+        // The transposed elements lie along the major dimension:
+        while ( k < length ) {
+            mpi_server_thread_memory_write(server_info,
+                    is_row_major ? int_pair_make(p.j + k, p.i) : int_pair_make(p.j, p.i + k), values[k]);
+            k++;
+        }
+    }
+}
+
+//
+
+static void
+produce_segment(
+    base_int_t              item,
+    int                     thread_idx,
+    const void              *context
+)
+{
+    const produce_context_t *ctx = (const produce_context_t*)context;
+    mpi_server_thread_t     *server_info = ctx->server_info;
+    bool                    is_row_major = server_info->is_row_major;
+    base_int_t              major = ctx->major_lo + item / ctx->n_segments,
+                            segment = ctx->segment_lo + item % ctx->n_segments;
+    base_int_t              lo = segment * ctx->block_length,
+                            hi = base_int_min(ctx->minor_hi, lo + ctx->block_length),
+                            length;
+    int_pair_t              p;
+    double                  *scratch = segment_buffers + thread_idx * ctx->block_length;
+    
+    // A symmetric matrix starts each row (column) at the diagonal:
+    if ( lo < ctx->minor_lo ) lo = ctx->minor_lo;
+    if ( (server_info->symmetry != mpi_server_thread_symmetry_none) && (lo < major) ) lo = major;
+    if ( lo >= hi ) return;
+    length = hi - lo;
+    p = is_row_major ? int_pair_make(major, lo) : int_pair_make(lo, major);
+    
+    // Segments of a block write go straight into its buffer:
+    if ( ctx->sends && ctx->sends[segment - ctx->segment_lo].values ) {
+        mpi_server_thread_block_send_t  *send = &ctx->sends[segment - ctx->segment_lo];
+        matrix_element_t                *elements = send->values + (major - ctx->major_lo) * length;
+        
+#ifdef MATRIX_ELEMENT_IS_DOUBLE
+        scratch = elements;
+#endif
+        produce_kernel_segment(server_info, p, length, scratch);
+        if ( (const void*)scratch != (const void*)elements ) matrix_element_from_double_n(elements, scratch, length);
+        mpi_server_thread_block_send_ready(server_info, send, major - ctx->major_lo);
+        mpi_server_thread_throttle(server_info);
+        return;
+    }
+    
+    // Only the pattern's runs that overlap the segment are produced:
+    if ( pattern ) {
+        base_int_t          n_runs;
+        const int_range_t   *run = mpi_sparsity_pattern_get_runs(pattern, major, &n_runs);
+        
+        while ( n_runs-- > 0 ) {
+            base_int_t      run_lo = base_int_max(lo, run->start),
+                            run_hi = base_int_min(hi, int_range_get_max(*run));
+            
+            if ( run_lo < run_hi ) produce_run(server_info, major, run_lo, run_hi, scratch);
+            run++;
+        }
+        mpi_server_thread_throttle(server_info);
+        return;
+    }
+    
+    // Runs of tiles loaded from the tile cache are skipped:
+    while ( lo < hi ) {
+        base_int_t          run_hi = hi;
+        
+        if ( tile_cache ) {
+            bool            is_cached = mpi_tile_cache_is_valid(tile_cache, p);
+            
+            run_hi = lo;
+            do {
+                run_hi = base_int_min(hi, (run_hi / mpi_tile_cache_tile_dim + 1) * mpi_tile_cache_tile_dim);
+            } while ( (run_hi < hi) &&
+                      (mpi_tile_cache_is_valid(tile_cache, is_row_major ? int_pair_make(major, run_hi) : int_pair_make(run_hi, major)) == is_cached) );
+            if ( ! is_cached ) produce_run(server_info, major, lo, run_hi, scratch);
+        } else {
+            produce_run(server_info, major, lo, hi, scratch);
+        }
+        lo = run_hi;
+        p = is_row_major ? int_pair_make(major, lo) : int_pair_make(lo, major);
+    }
+    mpi_server_thread_throttle(server_info);
+}
+
+//
+
+static void
+produce_block_writes(
+    produce_context_t       *ctx,
+    base_int_t              major_hi
+)
+{
+    mpi_server_thread_t     *server_info = ctx->server_info;
+    bool                    is_row_major = server_info->is_row_major;
+    base_int_t              n_majors = major_hi - ctx->major_lo, k;
+    base_int_t              n_values = n_majors * ctx->n_segments * ctx->block_length;
+    
+    if ( n_values > block_buffer_capacity ) {
+        matrix_element_t    *new_buffer = (matrix_element_t*)realloc(block_buffer, n_values * sizeof(matrix_element_t));
+        
+        if ( ! new_buffer ) {
+            mpi_printf(-1, "ERROR:  unable to allocate block write buffer for " BASE_INT_FMT " elements", n_values);
+            MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+        }
+        block_buffer = new_buffer;
+        block_buffer_capacity = n_values;
+    }
+    
+    // Only whole segments held by another rank are block writes; the
+    // rest are produced as usual:
+    for ( k = 0; k < ctx->n_segments; k++ ) {
+        mpi_server_thread_block_send_t  *send = &block_sends[k];
+        base_int_t          lo = (ctx->segment_lo + k) * ctx->block_length;
+        
+        send->values = NULL;
+        if ( (lo < ctx->minor_lo) || (lo + ctx->block_length > ctx->minor_hi) ) continue;
+        send->p = is_row_major ? int_pair_make(ctx->major_lo, lo) : int_pair_make(lo, ctx->major_lo);
+        if ( mpi_server_thread_local_segment(server_info, send->p, ctx->block_length) ) continue;
+        if ( tile_cache && mpi_tile_cache_any_valid(tile_cache, send->p,
+                    is_row_major ? int_pair_make(major_hi, lo + ctx->block_length) : int_pair_make(lo + ctx->block_length, major_hi)) ) continue;
+        send->n_partitions = n_majors;
+        send->partition_length = ctx->block_length;
+        send->values = block_buffer + k * n_majors * ctx->block_length;
+        mpi_server_thread_block_send_begin(server_info, send);
+    }
+    ctx->sends = block_sends;
+    mpi_producer_pool_run(producer_pool, n_majors * ctx->n_segments, produce_segment, ctx);
+    for ( k = 0; k < ctx->n_segments; k++ ) {
+        if ( block_sends[k].values ) mpi_server_thread_block_send_end(server_info, &block_sends[k]);
+    }
+    ctx->sends = NULL;
+}
+
+//
+
+static inline void
+produce_elements(
+    mpi_server_thread_t     *server_info,
+    int_pair_t              p_low,
+    int_pair_t              p_high
+)
+{
+    bool                    is_row_major = server_info->is_row_major;
+    base_int_t              major_hi = is_row_major ? p_high.i : p_high.j;
+    produce_context_t       ctx = {
+                                .server_info = server_info,
+                                .major_lo = is_row_major ? p_low.i : p_low.j,
+                                .minor_lo = is_row_major ? p_low.j : p_low.i,
+                                .minor_hi = is_row_major ? p_high.j : p_high.i,
+                                .block_length = is_row_major ? server_info->dim_per_rank[1] : server_info->dim_per_rank[0]
+                            };
+    
+    // Each row (column) is split at the sub-matrix block boundaries and
+    // the segments are shared across the producer threads:
+    ctx.segment_lo = ctx.minor_lo / ctx.block_length;
+    ctx.n_segments = (ctx.minor_hi - 1) / ctx.block_length - ctx.segment_lo + 1;
+    if ( is_block_writes && (server_info->symmetry == mpi_server_thread_symmetry_none) ) {
+        base_int_t          major_block = is_row_major ? server_info->dim_per_rank[0] : server_info->dim_per_rank[1];
+        
+        // A block write must stay within one block row (column) of the
+        // destination:
+        while ( ctx.major_lo < major_hi ) {
+            base_int_t      chunk_hi = base_int_min(major_hi, (ctx.major_lo / major_block + 1) * major_block);
+            
+            produce_block_writes(&ctx, chunk_hi);
+            ctx.major_lo = chunk_hi;
+        }
+    } else {
+        mpi_producer_pool_run(producer_pool, (major_hi - ctx.major_lo) * ctx.n_segments, produce_segment, &ctx);
+    }
+    mpi_server_thread_memory_sync(server_info);
+}
+
+//
+
+static bool
+produce_unit_range(
+    int_range_t             r,
+    const void              *context
+)
+{
+    mpi_server_thread_t     *server_info = (mpi_server_thread_t*)context;
+    int_pair_t              p_low, p_high;
+    
+    mpi_server_thread_range_to_unit(server_info, r, &p_low, &p_high);
+    produce_elements(server_info, p_low, p_high);
+    return true;
+}
+
+static inline void
+produce_unit(
+    mpi_server_thread_t     *server_info,
+    int_set_ref             unit
+)
+{
+    int_set_enumerate_ranges(unit, produce_unit_range, server_info);
+}
+
+//
+
+static double
+measure_element_cost(
+    mpi_server_thread_t     *server_info
+)
+{
+    volatile double         sink = 0.0;
+    double                  values[1024];
+    base_int_t              n = 0;
+    int_pair_t              p = int_pair_make(server_info->local_sub_matrix_row_range.start, server_info->local_sub_matrix_col_range.start);
+    double                  t0, dt;
+    
+    if ( me_kernel_cost_hint() > 0.0 ) return me_kernel_cost_hint();
+    
+    // Sample the local inputs' elements for at least 10 ms:
+    if ( server_info->features && (server_info->local_sub_matrix_col_range.length > 0) ) {
+        mpi_feature_cache_t *features = server_info->features;
+        base_int_t          length = base_int_min(1024, features->local_range[1].length);
+        
+        t0 = MPI_Wtime();
+        do {
+            me_kernel_feature_segment(features->local_features[0], features->local_features[1], length, features->n_features, values);
+            sink += values[length - 1];
+            n += length;
+        } while ( (dt = MPI_Wtime() - t0) < 0.01 );
+        return dt / n;
+    }
+    
+    // Sample row segments from the local block for at least 10 ms:
+    t0 = MPI_Wtime();
+    do {
+        me_kernel_row_segment(p.i, p.j, p.j + 1024, values);
+        sink += values[1023];
+        if ( ++p.i > int_range_get_end(server_info->local_sub_matrix_row_range) ) p.i = server_info->local_sub_matrix_row_range.start;
+        n += 1024;
+    } while ( (dt = MPI_Wtime() - t0) < 0.01 );
+    return dt / n;
+}
+
+//
+
+static uint64_t
+block_checksum(
+    mpi_server_thread_t     *server_info
+)
+{
+    const unsigned char     *bytes = (const unsigned char*)server_info->local_sub_matrix;
+    size_t                  n_bytes = server_info->local_sub_matrix_length * sizeof(matrix_element_t);
+    uint64_t                h = 14695981039346656037ULL;
+    
+    // FNV-1a over the raw storage, so unset (or NaN) elements compare too:
+    while ( n_bytes-- ) h = (h ^ *bytes++) * 1099511628211ULL;
+    return h;
+}
+
+//
+
+static double block_completed_time = -1.0;
+static uint64_t block_completed_checksum = 0;
+
+static void
+consume_completed_block(
+    mpi_server_thread_t     *server_info,
+    const void              *context
+)
+{
+    (void)context;
+    
+    // Stands in for a downstream stage that starts on the finished block
+    // while the rest of the matrix is still being produced:
+    block_completed_time = MPI_Wtime();
+    if ( server_info->local_sub_matrix && ! server_info->sparse ) block_completed_checksum = block_checksum(server_info);
+}
+
+//
+
+static void
+lazy_produce_segment(
+    int_pair_t              p,
+    base_int_t              length,
+    double                  *values,
+    const void              *context
+)
+{
+    if ( ((const mpi_server_thread_t*)context)->is_row_major ) me_kernel_row_segment(p.i, p.j, p.j + length, values);
+    else me_kernel_col_segment(p.j, p.i, p.i + length, values);
+}
+
+//
+
+static void
+lazy_read_samples(
+    mpi_server_thread_t     *server_info,
+    base_int_t              n_samples
+)
+{
+    unsigned int            seed = server_info->dist_rank + 1;
+    base_int_t              n = 0, n_tile;
+    double                  sum = 0.0, t0 = MPI_Wtime(), dt;
+    int_pair_t              p, p_low, p_high;
+    matrix_element_t        *tile = (matrix_element_t*)malloc(LAZY_TILE_DIM * LAZY_TILE_DIM * sizeof(matrix_element_t));
+    
+    if ( ! tile ) {
+        mpi_printf(-1, "ERROR:  unable to allocate lazy tile buffer");
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    while ( n++ < n_samples ) {
+        p.i = (base_int_t)(((double)rand_r(&seed) / ((double)RAND_MAX + 1.0)) * server_info->dim_global[0]);
+        p.j = (base_int_t)(((double)rand_r(&seed) / ((double)RAND_MAX + 1.0)) * server_info->dim_global[1]);
+        sum += mpi_lazy_matrix_get_element(server_info->lazy, server_info, p);
+    }
+    dt = MPI_Wtime() - t0;
+    
+    // Read the tile holding the last sample, too:
+    n_tile = (n_samples > 0) ? mpi_lazy_matrix_get_tile(server_info->lazy, server_info, p, &p_low, &p_high, tile) : 0;
+    mpi_printf(-1, "read " BASE_INT_FMT " random elements in %.3lf s (sum %.6lg) and a tile of " BASE_INT_FMT " elements",
+            n_samples, dt, sum, n_tile);
+    free((void*)tile);
+}
+
+//
+
+static double
+local_element(
+    mpi_server_thread_t     *server_info,
+    int_pair_t              p
+)
+{
+    if ( server_info->sparse ) return mpi_sparse_matrix_get(server_info->sparse, p);
+    if ( server_info->lazy ) return mpi_lazy_matrix_get_element(server_info->lazy, server_info, p);
+    return matrix_element_to_double(server_info->local_sub_matrix[mpi_server_thread_index_global_to_local_offset(server_info, p)]);
+}
+
 //
 
 int
@@ -118,12 +698,41 @@ main(
     int                     thread_req, thread_prov, optch;
     mpi_server_thread_t     the_server;
     mpi_server_thread_msg_t msg;
+    int_set_ref             unit = int_set_create();
     void                    *thread_rc;
     
-    int                     root_rank = 0;
+    int                     root_rank = -1;
+    mpi_server_thread_role_t root_roles = mpi_server_thread_role_all;
+    int                     throttle_backlog = 0;
     base_int_t              global_rows = GLOBAL_DIM, global_cols = GLOBAL_DIM,
                             block_rows = 0, block_cols = 0;
     bool                    is_row_major = true;
+    double                  lease_timeout = 0.0;
+    const char              *checkpoint_prefix = NULL;
+    double                  checkpoint_interval = CHECKPOINT_INTERVAL;
+    bool                    is_restart = false;
+    base_int_t              unit_size = 1;
+    bool                    is_throughput_aware = false;
+    double                  static_fraction = 0.0;
+    bool                    is_block_order = false;
+    const char              *trace_path = NULL;
+    FILE                    *trace_stream = NULL;
+    base_int_t              write_batch_size = 1;
+    int                     write_batch_depth = 2;
+    bool                    is_autotune = false;
+    const char              *kernel_path = NULL;
+    mpi_server_thread_symmetry_t symmetry = mpi_server_thread_symmetry_none;
+    int                     n_threads = 1;
+    const char              *tile_cache_dir = NULL;
+    const char              *cache_key = "";
+    bool                    is_sparse = false;
+    double                  sparse_threshold = 0.0;
+    base_int_t              lazy_samples = -1;
+    const char              *pattern_spec = NULL;
+    base_int_t              n_features = 0;
+    char                    *feature_paths[2] = { NULL, NULL };
+    size_t                  feature_cache_mib = FEATURE_CACHE_MIB;
+    mpi_autotune_t          tuning;
     
     thread_req = MPI_THREAD_MULTIPLE;
     MPI_Init_thread(&argc, &argv, thread_req, &thread_prov);
@@ -174,24 +783,496 @@ main(
                 break;
             }
             
+            case 'l': {
+                char        *endptr;
+                double      d = strtod(optarg, &endptr);
+                
+                if ( (d >= 0.0) && (endptr > optarg) ) {
+                    lease_timeout = d;
+                } else {
+                    mpi_printf(0, "invalid lease timeout `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'C':
+                checkpoint_prefix = optarg;
+                break;
+            
+            case 'I': {
+                char        *endptr;
+                double      d = strtod(optarg, &endptr);
+                
+                if ( (d > 0.0) && (endptr > optarg) ) {
+                    checkpoint_interval = d;
+                } else {
+                    mpi_printf(0, "invalid checkpoint interval `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'R':
+                is_restart = true;
+                break;
+            
+            case 'u': {
+                char        *endptr;
+                long long   l = strtoll(optarg, &endptr, 0);
+                
+                if ( (l > 0) && (endptr > optarg) ) {
+                    unit_size = (base_int_t)l;
+                } else {
+                    mpi_printf(0, "invalid unit size `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 't':
+                is_throughput_aware = true;
+                break;
+            
+            case 's': {
+                char        *endptr;
+                double      d = strtod(optarg, &endptr);
+                
+                if ( (d >= 0.0) && (d <= 1.0) && (endptr > optarg) ) {
+                    static_fraction = d;
+                } else {
+                    mpi_printf(0, "invalid static fraction `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'B':
+                is_block_order = true;
+                break;
+            
+            case 'T':
+                trace_path = optarg;
+                break;
+            
+            case 'w': {
+                char        *endptr;
+                long long   l = strtoll(optarg, &endptr, 0);
+                
+                if ( (l >= 1) && (endptr > optarg) ) {
+                    write_batch_size = (base_int_t)l;
+                } else {
+                    mpi_printf(0, "invalid write batch size `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'W': {
+                char        *endptr;
+                long        l = strtol(optarg, &endptr, 0);
+                
+                if ( (l >= 1) && (l <= 64) && (endptr > optarg) ) {
+                    write_batch_depth = (int)l;
+                } else {
+                    mpi_printf(0, "invalid write batch depth `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'A':
+                is_autotune = true;
+                break;
+            
+            case 'M':
+                root_roles = mpi_server_thread_role_work_unit_mgr;
+                break;
+            
+            case 'Q': {
+                char        *endptr;
+                long        l = strtol(optarg, &endptr, 0);
+                
+                if ( (l >= 0) && (endptr > optarg) ) {
+                    throttle_backlog = (int)l;
+                } else {
+                    mpi_printf(0, "invalid throttle backlog `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'K':
+                kernel_path = optarg;
+                break;
+            
+            case 'S':
+                if ( symmetry == mpi_server_thread_symmetry_none ) symmetry = mpi_server_thread_symmetry_mirror;
+                break;
+            
+            case 'P':
+                symmetry = mpi_server_thread_symmetry_packed;
+                break;
+            
+            case 'G':
+                is_block_writes = true;
+                break;
+            
+            case 'D':
+                tile_cache_dir = optarg;
+                break;
+            
+            case 'k':
+                cache_key = optarg;
+                break;
+            
+            case 'Z': {
+                char        *endptr;
+                double      d = strtod(optarg, &endptr);
+                
+                if ( (d >= 0.0) && (endptr > optarg) ) {
+                    is_sparse = true;
+                    sparse_threshold = d;
+                } else {
+                    mpi_printf(0, "invalid sparse threshold `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'L': {
+                char        *endptr;
+                long long   n = strtoll(optarg, &endptr, 0);
+                
+                if ( (n >= 0) && (endptr > optarg) ) {
+                    lazy_samples = (base_int_t)n;
+                } else {
+                    mpi_printf(0, "invalid lazy sample count `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'p':
+                pattern_spec = optarg;
+                break;
+            
+            case 'F': {
+                char        *endptr;
+                long        l = strtol(optarg, &endptr, 0);
+                
+                if ( (l >= 1) && (endptr > optarg) && (*endptr == ':') && *(endptr + 1) ) {
+                    n_features = (base_int_t)l;
+                    if ( feature_paths[0] ) free((void*)feature_paths[0]);
+                    feature_paths[0] = strdup(endptr + 1);
+                    if ( ! feature_paths[0] ) {
+                        mpi_printf(-1, "ERROR:  unable to copy feature inputs `%s`", optarg);
+                        exit(ENOMEM);
+                    }
+                    if ( (feature_paths[1] = strchr(feature_paths[0], ',')) ) *feature_paths[1]++ = '\0';
+                } else {
+                    mpi_printf(0, "invalid feature inputs `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'X': {
+                char        *endptr;
+                long        l = strtol(optarg, &endptr, 0);
+                
+                if ( (l >= 0) && (endptr > optarg) ) {
+                    feature_cache_mib = (size_t)l;
+                } else {
+                    mpi_printf(0, "invalid feature cache size `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
+            case 'j': {
+                char        *endptr;
+                long        l = strtol(optarg, &endptr, 0);
+                
+                if ( (l >= 1) && (l <= 1024) && (endptr > optarg) ) {
+                    n_threads = (int)l;
+                } else {
+                    mpi_printf(0, "invalid thread count `%s`", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            }
+            
         }
     }
     
-    if ( ! mpi_server_thread_init(&the_server, 0, global_rows, global_cols, block_rows, block_cols, is_row_major, NULL) ) {
+    // A dedicated manager holds no block, so it goes beyond the last one:
+    if ( root_rank < 0 ) root_rank = (root_roles == mpi_server_thread_role_all) ? 0 : (thread_req - 1);
+    if ( ! mpi_server_thread_init(&the_server, root_rank, root_roles, global_rows, global_cols, block_rows, block_cols, is_row_major,
+                is_sparse ? mpi_server_thread_storage_sparse : ((lazy_samples >= 0) ? mpi_server_thread_storage_lazy : mpi_server_thread_storage_dense),
+                NULL) ) {
         mpi_printf(-1, "ERROR:  unable to initialize mpi_server instance");
         MPI_Finalize();
         exit(1);
     }
+    the_server.throttle_backlog = throttle_backlog;
+    if ( ! mpi_server_thread_set_symmetry(&the_server, symmetry) ) {
+        mpi_printf(0, "ERROR:  %s requires a square matrix%s", (symmetry == mpi_server_thread_symmetry_packed) ? "--packed" : "--symmetric",
+                (symmetry == mpi_server_thread_symmetry_packed) ? " and square blocks" : "");
+        MPI_Finalize();
+        exit(EINVAL);
+    }
+    if ( is_sparse ) {
+        if ( checkpoint_prefix ) {
+            mpi_printf(0, "ERROR:  --checkpoint cannot be used with --sparse");
+            MPI_Finalize();
+            exit(EINVAL);
+        }
+        if ( ! mpi_server_thread_set_sparse(&the_server, sparse_threshold) ) {
+            mpi_printf(-1, "ERROR:  unable to allocate sparse sub-matrix");
+            MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+        }
+    }
+    if ( lazy_samples >= 0 ) {
+        if ( checkpoint_prefix || is_sparse ) {
+            mpi_printf(0, "ERROR:  %s cannot be used with --lazy", checkpoint_prefix ? "--checkpoint" : "--sparse");
+            MPI_Finalize();
+            exit(EINVAL);
+        }
+        if ( ! mpi_server_thread_set_lazy(&the_server, LAZY_TILE_DIM, lazy_produce_segment, &the_server) ) {
+            mpi_printf(-1, "ERROR:  unable to allocate lazy sub-matrix");
+            MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+        }
+    }
+    if ( pattern_spec ) {
+        const char          *error_msg;
+        
+        if ( (symmetry != mpi_server_thread_symmetry_none) || the_server.lazy ) {
+            mpi_printf(0, "ERROR:  %s cannot be used with --pattern", the_server.lazy ? "--lazy" : ((symmetry == mpi_server_thread_symmetry_packed) ? "--packed" : "--symmetric"));
+            MPI_Finalize();
+            exit(EINVAL);
+        }
+        pattern = mpi_sparsity_pattern_create(pattern_spec, the_server.dim_global[0], the_server.dim_global[1], is_row_major, &error_msg);
+        if ( ! pattern ) {
+            mpi_printf(-1, "ERROR:  unable to load sparsity pattern `%s`: %s", pattern_spec, error_msg);
+            MPI_Abort(MPI_COMM_WORLD, EINVAL);
+        }
+        
+        // Elements outside the pattern are never written:
+        if ( the_server.local_sub_matrix )
+            memset(the_server.local_sub_matrix, 0, the_server.local_sub_matrix_length * sizeof(matrix_element_t));
+    }
+    producer_pool = mpi_producer_pool_create(n_threads);
+    segment_buffers = (double*)malloc(n_threads * base_int_max(the_server.dim_per_rank[0], the_server.dim_per_rank[1]) * sizeof(double));
+    if ( is_block_writes ) {
+        base_int_t          n_blocks_minor = is_row_major ? the_server.dim_blocks[1] : the_server.dim_blocks[0];
+        
+        if ( symmetry != mpi_server_thread_symmetry_none ) {
+            mpi_printf(0, "block writes are disabled for symmetric matrices");
+            is_block_writes = false;
+        } else if ( is_sparse ) {
+            mpi_printf(0, "block writes are disabled for sparse sub-matrices");
+            is_block_writes = false;
+        } else if ( the_server.lazy ) {
+            mpi_printf(0, "block writes are disabled with --lazy");
+            is_block_writes = false;
+        } else if ( pattern ) {
+            mpi_printf(0, "block writes are disabled with --pattern");
+            is_block_writes = false;
+        } else {
+            block_sends = (mpi_server_thread_block_send_t*)calloc(n_blocks_minor, sizeof(mpi_server_thread_block_send_t));
+            if ( ! block_sends ) {
+                mpi_printf(-1, "ERROR:  unable to allocate block writes");
+                MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+            }
+        }
+    }
+    if ( ! producer_pool || ! segment_buffers ) {
+        mpi_printf(-1, "ERROR:  unable to create %d producer threads", n_threads);
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    if ( kernel_path ) {
+        const char          *error_msg;
+        
+        if ( ! me_kernel_load(kernel_path, the_server.dim_global[0], the_server.dim_global[1], &error_msg) ) {
+            mpi_printf(-1, "ERROR:  unable to load kernel plugin `%s`: %s", kernel_path, error_msg);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    if ( n_features > 0 ) {
+        const char          *error_msg;
+        
+        if ( the_server.lazy ) {
+            mpi_printf(0, "ERROR:  --lazy cannot be used with --features");
+            MPI_Finalize();
+            exit(EINVAL);
+        }
+        if ( (symmetry != mpi_server_thread_symmetry_none) && feature_paths[1] && strcmp(feature_paths[0], feature_paths[1]) ) {
+            mpi_printf(0, "ERROR:  %s requires the same row and column inputs", (symmetry == mpi_server_thread_symmetry_packed) ? "--packed" : "--symmetric");
+            MPI_Finalize();
+            exit(EINVAL);
+        }
+        the_server.features = mpi_feature_cache_create(&the_server, n_features, feature_paths[0], feature_paths[1],
+                                    feature_cache_mib << 20, n_threads, &error_msg);
+        if ( ! the_server.features ) {
+            mpi_printf(-1, "ERROR:  unable to load kernel inputs `%s`: %s", feature_paths[0], error_msg);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    if ( the_server.assignable_work ) {
+        the_server.assignable_work->lease_timeout = lease_timeout;
+        the_server.assignable_work->unit_size = unit_size;
+        the_server.assignable_work->is_throughput_aware = is_throughput_aware;
+        if ( pattern ) the_server.assignable_work->element_offsets = pattern->element_offsets;
+        if ( is_block_order ) {
+            the_server.assignable_work->order = mpi_assignable_work_order_block_completion;
+        }
+        if ( trace_path ) {
+            trace_stream = fopen(trace_path, "w");
+            if ( ! trace_stream ) {
+                mpi_printf(-1, "ERROR:  unable to open trace file `%s` (errno = %d)", trace_path, errno);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            mpi_assignable_work_trace_begin(the_server.assignable_work, trace_stream);
+        }
+    }
+    
+    if ( is_restart && ! checkpoint_prefix ) {
+        mpi_printf(0, "ERROR:  --restart requires --checkpoint");
+        MPI_Finalize();
+        exit(EINVAL);
+    }
+    if ( checkpoint_prefix ) {
+        int         epoch = -1, min_epoch;
+        
+        the_server.checkpoint = mpi_checkpoint_create(&the_server, checkpoint_prefix, is_restart);
+        if ( ! the_server.checkpoint ) {
+            mpi_printf(-1, "ERROR:  unable to initialize checkpoint");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        the_server.checkpoint->interval = checkpoint_interval;
+        if ( is_restart ) epoch = mpi_checkpoint_restore(the_server.checkpoint, &the_server);
+        
+        // All ranks must agree on the epoch:  every rank's sub-matrix holds at
+        // least the values implied by the oldest one:
+        MPI_Allreduce(&epoch, &min_epoch, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        if ( is_restart ) {
+            if ( the_server.assignable_work ) {
+                epoch = mpi_checkpoint_read_completed(the_server.checkpoint, the_server.assignable_work, min_epoch);
+                if ( epoch >= 0 )
+                    mpi_printf(-1, "restarted from checkpoint epoch %d", epoch);
+                else
+                    mpi_printf(-1, "no usable checkpoint found, generating all matrix elements");
+            }
+            // Continue numbering after the newest epoch any rank has seen:
+            MPI_Allreduce(&the_server.checkpoint->next_epoch, &epoch, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+            the_server.checkpoint->next_epoch = epoch;
+        }
+    }
+    
+    if ( tile_cache_dir ) {
+        if ( is_restart ) {
+            mpi_printf(0, "the tile cache is not used when restarting");
+        } else if ( symmetry == mpi_server_thread_symmetry_packed ) {
+            mpi_printf(0, "the tile cache is not used with --packed");
+        } else if ( is_sparse ) {
+            mpi_printf(0, "the tile cache is not used with --sparse");
+        } else if ( the_server.lazy ) {
+            mpi_printf(0, "the tile cache is not used with --lazy");
+        } else if ( pattern ) {
+            mpi_printf(0, "the tile cache is not used with --pattern");
+        } else if ( n_features > 0 ) {
+            mpi_printf(0, "the tile cache is not used with --features");
+        } else {
+            size_t          key_len = strlen(me_kernel_get_description()) + strlen(cache_key) + 2;
+            char            *key = (char*)malloc(key_len);
+            base_int_t      n_valid;
+            
+            // The kernel and its parameters identify the cached values:
+            if ( key ) {
+                snprintf(key, key_len, "%s\n%s", me_kernel_get_description(), cache_key);
+                tile_cache = mpi_tile_cache_create(&the_server, tile_cache_dir, key);
+                free((void*)key);
+            }
+            if ( ! tile_cache ) {
+                mpi_printf(-1, "ERROR:  unable to initialize tile cache");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            n_valid = mpi_tile_cache_load(tile_cache, &the_server);
+            if ( the_server.assignable_work ) {
+                base_int_t  n_completed = mpi_tile_cache_restore_completed(tile_cache, the_server.assignable_work);
+                
+                mpi_printf(-1, "tile cache: loaded " BASE_INT_FMT " of " BASE_INT_FMT " tiles, " BASE_INT_FMT " %s need no work",
+                        n_valid, tile_cache->n_tiles[0] * tile_cache->n_tiles[1], n_completed, is_row_major ? "rows" : "columns");
+            }
+        }
+    }
+    
+    // The static partition would overlap work completed before a restart
+    // or loaded from the tile cache:
+    if ( (static_fraction > 0.0) && is_restart ) {
+        mpi_printf(0, "static partitioning is disabled when restarting");
+        static_fraction = 0.0;
+    } else if ( (static_fraction > 0.0) && tile_cache ) {
+        mpi_printf(0, "static partitioning is disabled with the tile cache");
+        static_fraction = 0.0;
+    }
+    the_server.static_fraction = static_fraction;
+    if ( the_server.assignable_work ) mpi_assignable_work_apply_static_partition(the_server.assignable_work, static_fraction);
+    if ( is_block_order ) mpi_server_thread_track_block_completion(&the_server, consume_completed_block, NULL);
     
     mpi_printf(0, "");
     mpi_printf(0, "Welcome to the threaded MPI matrix element work server demo!");
     mpi_printf(0, "");
-    mpi_printf(0, "A " BASE_INT_FMT "x" BASE_INT_FMT " matrix is distributed across %d ranks and matrix elements of the form", the_server.dim_global[0], the_server.dim_global[1], thread_req);
+    mpi_printf(0, "A " BASE_INT_FMT "x" BASE_INT_FMT " matrix is distributed across %d ranks (%d producer thread%s each) and matrix elements of the form",
+            the_server.dim_global[0], the_server.dim_global[1], thread_req, n_threads, (n_threads == 1) ? "" : "s");
     mpi_printf(0, "");
-    mpi_printf(0, "    %s", me_kernel_description);
+    mpi_printf(0, "    %s", the_server.features ? me_kernel_get_feature_description() : me_kernel_get_description());
     mpi_printf(0, "");
-    mpi_printf(0, "are calculated.");
+    if ( the_server.features )
+        mpi_printf(0, "are calculated from " BASE_INT_FMT " inputs per row and column (%s%s, up to %zu MiB of remote inputs cached per rank).",
+                n_features, me_kernel_has_feature_segment() ? "kernel plugin " : "built-in feature kernel",
+                me_kernel_has_feature_segment() ? kernel_path : "", feature_cache_mib);
+    else if ( kernel_path )
+        mpi_printf(0, "are calculated (kernel plugin %s).", kernel_path);
+    else
+        mpi_printf(0, "are calculated (%s segment kernel).", me_kernel_isa());
+    if ( symmetry == mpi_server_thread_symmetry_mirror )
+        mpi_printf(0, "Only the %s triangle is calculated and mirrored.", is_row_major ? "upper" : "lower");
+    else if ( symmetry == mpi_server_thread_symmetry_packed )
+        mpi_printf(0, "Only the %s triangle is calculated and stored.", is_row_major ? "upper" : "lower");
+#ifndef MATRIX_ELEMENT_IS_DOUBLE
+    mpi_printf(0, "Matrix elements are stored and transferred as " MATRIX_ELEMENT_NAME ".");
+#endif
+    if ( is_sparse )
+        mpi_printf(0, "Elements smaller than %g in magnitude are dropped, sub-matrices are stored %s.", sparse_threshold, is_row_major ? "CSR" : "CSC");
+    if ( pattern )
+        mpi_printf(0, "Only the " BASE_INT_FMT " elements (%.3lf%%) in the sparsity pattern %s are calculated.",
+                pattern->nnz, 100.0 * (double)pattern->nnz / ((double)the_server.dim_global[0] * (double)the_server.dim_global[1]), pattern_spec);
+    if ( the_server.lazy )
+        mpi_printf(0, "Elements are produced on first read in %dx%d tiles; each rank reads " BASE_INT_FMT " random elements.",
+                LAZY_TILE_DIM, LAZY_TILE_DIM, lazy_samples);
+    if ( is_block_writes ) {
+#ifdef MPI_SERVER_THREAD_HAVE_PARTITIONED
+        mpi_printf(0, "%s destined for other ranks are sent as partitioned block writes.", is_row_major ? "Rows" : "Columns");
+#else
+        mpi_printf(0, "%s destined for other ranks are sent as block writes.", is_row_major ? "Rows" : "Columns");
+#endif
+    }
     mpi_printf(0, "");
+    
+    if ( is_autotune ) {
+        // The rank's threads share each unit, so an element costs it less:
+        mpi_autotune_run(&the_server, measure_element_cost(&the_server) / n_threads, &tuning);
+        if ( the_server.dist_rank == the_server.root_rank ) {
+            mpi_printf(-1, "autotune: element cost %.3lg s, latency %.3lg s, bandwidth %.3lg MB/s",
+                    tuning.element_cost, tuning.latency, 1e-6 * tuning.bandwidth);
+            mpi_printf(-1, "autotune: chose --unit-size=" BASE_INT_FMT " --write-batch=" BASE_INT_FMT " --write-depth=%d",
+                    tuning.unit_size, tuning.write_batch_size, tuning.write_batch_depth);
+        }
+    } else if ( (write_batch_size > 1) && ! mpi_server_thread_set_write_batching(&the_server, write_batch_size, write_batch_depth) ) {
+        mpi_printf(-1, "WARNING:  unable to allocate write batches, writes will not be batched");
+    }
     MPI_Barrier(MPI_COMM_WORLD);
     
     if ( ! mpi_server_thread_start(&the_server) ) {
@@ -201,71 +1282,228 @@ main(
     }
     
     // Proceed to request work...
-    if ( the_server.dist_rank == the_server.root_rank ) {
+    if ( the_server.lazy ) {
+        // No work units, elements are produced as they are read.  Every rank's
+        // reads must have been answered before the server threads are shut
+        // down:
+        lazy_read_samples(&the_server, lazy_samples);
+        MPI_Barrier(MPI_COMM_WORLD);
+        if ( the_server.dist_rank == the_server.root_rank ) {
+            int         rank = 0;
+            
+            mpi_printf(-1, "sending shutdown message to all ranks' server threads");
+            msg.msg_type = mpi_server_thread_msg_type_memory;
+            msg.msg_id = mpi_server_thread_msg_id_shutdown;
+            while ( rank < the_server.dist_size )
+                MPI_Send(&msg, 1, mpi_get_msg_datatype(), rank++, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+        }
+    } else if ( the_server.dist_rank == the_server.root_rank ) {
         int             rank;
         
-        mpi_printf(-1, "matrix element loop running");
-        while ( true ) {
-            int_pair_t  p_low, p_high, p;
+        int_pair_t      p_low, p_high;
+        
+        mpi_printf(-1, (the_server.roles & mpi_server_thread_role_memory_mgr) ? "matrix element loop running" : "managing work units only");
+        
+        // Produce our pre-assigned work first:
+        if ( mpi_server_thread_static_unit(&the_server, the_server.root_rank, &p_low, &p_high) ) {
+            double      t0 = MPI_Wtime();
+            
+            produce_elements(&the_server, p_low, p_high);
+            if ( is_autotune ) mpi_autotune_note_unit(&the_server, &tuning, MPI_Wtime() - t0);
+            mpi_assignable_work_complete(the_server.assignable_work, the_server.root_rank, p_low, p_high);
+        }
+        while ( the_server.roles & mpi_server_thread_role_memory_mgr ) {
+            double      retry_delay, t0;
             
-            if ( ! mpi_assignable_work_next_unit(the_server.assignable_work, the_server.root_rank, 0, &p_low, &p_high) ) break;
+            if ( ! mpi_assignable_work_next_unit_set(the_server.assignable_work, the_server.root_rank, mpi_server_thread_rank_to_slot(&the_server, the_server.root_rank), unit) ) {
+                // Wait for straggling work units to be re-issued or completed:
+                if ( mpi_assignable_work_should_defer(the_server.assignable_work, &retry_delay) ) {
+                    usleep((useconds_t)(retry_delay * 1e6));
+                    continue;
+                }
+                break;
+            }
             
             //
             // Produce matrix elements:
             //
-            for ( p.i = p_low.i; p.i < p_high.i; p.i++ )
-                for ( p.j = p_low.j; p.j < p_high.j; p.j++ )
-                    mpi_server_thread_memory_write(&the_server, p, me_kernel(p));
+            t0 = MPI_Wtime();
+            produce_unit(&the_server, unit);
+            if ( is_autotune ) mpi_autotune_note_unit(&the_server, &tuning, MPI_Wtime() - t0);
                     
             // Notify the work unit manager that we finished this unit:
-            mpi_assignable_work_complete(the_server.assignable_work, p_low, p_high);
+            mpi_assignable_work_complete_set(the_server.assignable_work, the_server.root_rank, unit);
+            
+            if ( the_server.checkpoint && mpi_checkpoint_is_due(the_server.checkpoint) ) mpi_checkpoint_begin(&the_server);
         }
         mpi_printf(-1, "exited element loop, waiting for all work to complete");
-        while ( ! mpi_assignable_work_all_completed(the_server.assignable_work) ) sleep (1);
-        mpi_printf(-1, "sending shutdown message to other ranks' server threads");
+        while ( ! mpi_assignable_work_all_completed(the_server.assignable_work) ) {
+            if ( the_server.checkpoint && mpi_checkpoint_is_due(the_server.checkpoint) ) mpi_checkpoint_begin(&the_server);
+            sleep (1);
+        }
+        while ( ! mpi_assignable_work_all_released(the_server.assignable_work) ) usleep(10000);
+        
+        // Every rank's batched writes must have been received before the
+        // server threads are shut down:
+        mpi_server_thread_set_write_batching(&the_server, 1, 1);
+        MPI_Barrier(MPI_COMM_WORLD);
+        
+        // A final checkpoint records the finished matrix; it is ordered before the
+        // shutdown message at every server thread:
+        if ( the_server.checkpoint ) mpi_checkpoint_begin(&the_server);
+        if ( the_server.assignable_work->lease_timeout > 0.0 )
+            mpi_printf(-1, "speculatively re-issued " BASE_INT_FMT " work units, ignored " BASE_INT_FMT " duplicate completions",
+                    the_server.assignable_work->n_speculative_units, the_server.assignable_work->n_duplicate_completions);
+        if ( the_server.throttle_backlog > 0 )
+            mpi_printf(-1, "throttled own production for %.3lf s", the_server.throttle_time);
+        if ( is_autotune )
+            mpi_printf(-1, "autotune: unit size changed " BASE_INT_FMT " times, final --unit-size=" BASE_INT_FMT,
+                    the_server.assignable_work->n_unit_size_changes, the_server.assignable_work->unit_size);
+        if ( trace_stream ) {
+            mpi_assignable_work_trace_begin(the_server.assignable_work, NULL);
+            fclose(trace_stream);
+        }
+        
+        mpi_printf(-1, "sending shutdown message to all ranks' server threads");
         msg.msg_type = mpi_server_thread_msg_type_memory;
         msg.msg_id = mpi_server_thread_msg_id_shutdown;
-        rank = 1;
+        rank = 0;
         while ( rank < the_server.dist_size )
             MPI_Send(&msg, 1, mpi_get_msg_datatype(), rank++, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
-        mpi_printf(-1, "canceling server thread");
-        mpi_server_thread_cancel(&the_server);
     } else {
         MPI_Status  status;
         int         mpi_rc;
         
+        double      t_produce = 0.0, t_wait = 0.0, t0;
+        
         mpi_printf(-1, "matrix element loop running");
         msg.msg_type = mpi_server_thread_msg_type_work;
-        msg.msg_id = mpi_server_thread_msg_id_work_request;
+        msg.value = -1.0;
+        
+        // Produce our pre-assigned work first, its completion doubles as our
+        // first request for work:
+        if ( mpi_server_thread_static_unit(&the_server, the_server.dist_rank, &msg.p_low, &msg.p_high) ) {
+            t0 = MPI_Wtime();
+            produce_elements(&the_server, msg.p_low, msg.p_high);
+            if ( is_autotune ) mpi_autotune_note_unit(&the_server, &tuning, MPI_Wtime() - t0);
+            msg.msg_id = mpi_server_thread_msg_id_work_complete_and_allocate;
+        } else {
+            msg.msg_id = mpi_server_thread_msg_id_work_request;
+        }
+        t0 = MPI_Wtime();
         mpi_rc = MPI_Send(&msg, 1, mpi_get_msg_datatype(), the_server.root_rank, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
         if ( mpi_rc == MPI_SUCCESS ) {
             while ( true ) {
-                int_pair_t      p;
-                
                 mpi_rc = MPI_Recv(&msg, 1, mpi_get_msg_datatype(), the_server.root_rank, mpi_client_thread_msg_tag, MPI_COMM_WORLD, &status);
                 if ( mpi_rc != MPI_SUCCESS ) {
                     mpi_printf(-1, "MPI_Recv error %d", mpi_rc);
                 }
-                if ( msg.p_low.i == -1 ) break;
+                t_wait = MPI_Wtime() - t0;
+                if ( msg.msg_id == mpi_server_thread_msg_id_work_deferred ) {
+                    // No work right now, but straggling work units may be
+                    // re-issued soon:
+                    usleep((useconds_t)(msg.value * 1e6));
+                    msg.msg_type = mpi_server_thread_msg_type_work;
+                    msg.msg_id = mpi_server_thread_msg_id_work_request;
+                    t0 = MPI_Wtime();
+                    mpi_rc = MPI_Send(&msg, 1, mpi_get_msg_datatype(), the_server.root_rank, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+                    continue;
+                }
+                if ( (msg.msg_id == mpi_server_thread_msg_id_work_allocated) && (msg.p_low.i == -1) ) break;
+                if ( ! mpi_server_thread_recv_work_unit(&the_server, &msg, the_server.root_rank, unit) ) {
+                    mpi_printf(-1, "ERROR:  unable to receive work unit");
+                    MPI_Abort(MPI_COMM_WORLD, EINVAL);
+                }
                 
                 //
                 // Produce matrix elements:
                 //
-                for ( p.i = msg.p_low.i; p.i < msg.p_high.i; p.i++ )
-                    for ( p.j = msg.p_low.j; p.j < msg.p_high.j; p.j++ )
-                        mpi_server_thread_memory_write(&the_server, p, me_kernel(p));
+                t0 = MPI_Wtime();
+                produce_unit(&the_server, unit);
+                t_produce = MPI_Wtime() - t0;
+                if ( is_autotune ) mpi_autotune_note_unit(&the_server, &tuning, t_produce);
                 
-                // Notify the work unit manager that we finished this unit:
+                // Notify the work unit manager that we finished this unit, along
+                // with how long we sat idle waiting for it:
                 msg.msg_type = mpi_server_thread_msg_type_work;
                 msg.msg_id = mpi_server_thread_msg_id_work_complete_and_allocate;
-                mpi_rc = MPI_Send(&msg, 1, mpi_get_msg_datatype(), the_server.root_rank, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+                msg.value = t_wait / (t_wait + t_produce);
+                t0 = MPI_Wtime();
+                mpi_rc = mpi_server_thread_send_work_unit(&the_server, &msg, mpi_server_thread_msg_id_work_set_complete_and_allocate,
+                                unit, the_server.root_rank, mpi_server_thread_msg_tag);
             }
             mpi_printf(-1, "exited element loop");
         }
+        
+        // Every rank's batched writes must have been received before the
+        // server threads are shut down:
+        mpi_server_thread_set_write_batching(&the_server, 1, 1);
+        MPI_Barrier(MPI_COMM_WORLD);
     }
     mpi_server_thread_join(&the_server);
     MPI_Barrier(MPI_COMM_WORLD);
     
+    // A block reported complete must not have changed since:
+    if ( is_block_order && (the_server.local_sub_matrix_length > 0) ) {
+        if ( ! mpi_server_thread_block_is_completed(&the_server) ) {
+            mpi_printf(-1, "WARNING:  local sub-matrix was never reported complete");
+        } else if ( the_server.local_sub_matrix && ! the_server.sparse ) {
+            bool        is_unchanged = (block_checksum(&the_server) == block_completed_checksum);
+            
+            mpi_printf(-1, "local sub-matrix completed %.3lf s before the end of the run%s", MPI_Wtime() - block_completed_time,
+                    is_unchanged ? "" : ", but has CHANGED since");
+        } else {
+            mpi_printf(-1, "local sub-matrix completed %.3lf s before the end of the run", MPI_Wtime() - block_completed_time);
+        }
+    }
+    
+    // Every element has been received, compress the sparse sub-matrices:
+    if ( the_server.sparse ) {
+        base_int_t  nnz = mpi_sparse_matrix_compact(the_server.sparse), total_nnz = 0;
+        
+        if ( nnz < 0 ) {
+            mpi_printf(-1, "ERROR:  unable to compact the sparse sub-matrix");
+            MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+        }
+        MPI_Reduce(&nnz, &total_nnz, 1, MPI_BASE_INT_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        mpi_printf(0, "sparse sub-matrices hold " BASE_INT_FMT " of " BASE_INT_FMT " elements (%.3lf%%)",
+                total_nnz, the_server.dim_global[0] * the_server.dim_global[1],
+                100.0 * (double)total_nnz / ((double)the_server.dim_global[0] * (double)the_server.dim_global[1]));
+    }
+    
+    // Report how much of the matrix the reads actually required:
+    if ( the_server.lazy ) {
+        base_int_t  n_tiles[2] = { the_server.lazy->n_valid, the_server.lazy->n_tiles[0] * the_server.lazy->n_tiles[1] },
+                    total_tiles[2] = { 0, 0 };
+        
+        MPI_Reduce(n_tiles, total_tiles, 2, MPI_BASE_INT_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        mpi_printf(0, "lazy sub-matrices produced " BASE_INT_FMT " of " BASE_INT_FMT " tiles (%.3lf%%)",
+                total_tiles[0], total_tiles[1], total_tiles[1] ? (100.0 * (double)total_tiles[0] / (double)total_tiles[1]) : 0.0);
+    }
+    
+    // Report how well the kernel input cache worked:
+    if ( the_server.features ) {
+        mpi_feature_cache_t *features = the_server.features;
+        double              counts[4] = { (double)features->n_hits, (double)features->n_misses, (double)features->bytes_fetched, (double)features->n_local },
+                            totals[4] = { 0.0, 0.0, 0.0, 0.0 };
+        
+        mpi_printf(-1, "feature cache: " BASE_INT_FMT " local, " BASE_INT_FMT " hits, " BASE_INT_FMT " misses (%.1lf%% hit rate), %.3lf MiB fetched (cache of " BASE_INT_FMT " chunks of " BASE_INT_FMT ")",
+                features->n_local, features->n_hits, features->n_misses,
+                (features->n_hits + features->n_misses) ? (100.0 * features->n_hits / (double)(features->n_hits + features->n_misses)) : 0.0,
+                (double)features->bytes_fetched / 1048576.0, features->n_slots, features->chunk_dim);
+        MPI_Reduce(counts, totals, 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        mpi_printf(0, "feature cache: %.0lf local, %.0lf hits, %.0lf misses (%.1lf%% hit rate), %.3lf MiB fetched in total",
+                totals[3], totals[0], totals[1], (totals[0] + totals[1] > 0.0) ? (100.0 * totals[0] / (totals[0] + totals[1])) : 0.0,
+                totals[2] / 1048576.0);
+    }
+    
+    // Every element has been received, add the new tiles to the cache:
+    if ( tile_cache ) {
+        base_int_t  n_saved = mpi_tile_cache_save(tile_cache, &the_server);
+        
+        mpi_printf(0, "tile cache: saved " BASE_INT_FMT " tiles", n_saved);
+    }
+    
     //
     // Pass the ball from rank 0 on down, when a rank receives the ball it prints
     // the upper-left 10x10 chunk of its local sub-matrix:
@@ -276,9 +1514,9 @@ main(
         
         mpi_printf(-1, "Sub-matrices in sequence by rank:\n\nRank 0:\n");
         for ( i = 0; i < base_int_min(10, the_server.dim_per_rank[0]); i++ ) {
-            printf("    %8.3lf", the_server.local_sub_matrix[mpi_server_thread_index_global_to_local_offset(&the_server, int_pair_make(i, 0))]);
+            printf("    %8.3lf", local_element(&the_server, int_pair_make(i, 0)));
             for ( j = 1; j < base_int_min(10, the_server.dim_per_rank[1]); j++ )
-                printf(", %8.3lf", the_server.local_sub_matrix[mpi_server_thread_index_global_to_local_offset(&the_server, int_pair_make(i, j))]);
+                printf(", %8.3lf", local_element(&the_server, int_pair_make(i, j)));
             printf("\n");
         }
         MPI_Send(&the_ball, 1, MPI_INT, 1, 0, MPI_COMM_WORLD);
@@ -288,18 +1526,33 @@ main(
         
         MPI_Recv(&the_ball, 1, MPI_INT, the_server.dist_rank - 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         printf("\nRank %d:\n", the_server.dist_rank);
-        for ( i = the_server.local_sub_matrix_row_range.start; i < the_server.local_sub_matrix_row_range.start + base_int_min(10, the_server.dim_per_rank[0]); i++ ) {
-            printf("    %8.3lf", the_server.local_sub_matrix[mpi_server_thread_index_global_to_local_offset(&the_server, int_pair_make(i, the_server.local_sub_matrix_col_range.start))]);
-            for ( j = the_server.local_sub_matrix_col_range.start + 1; j < the_server.local_sub_matrix_col_range.start + base_int_min(10, the_server.dim_per_rank[1]); j++ )
-                printf(", %8.3lf", the_server.local_sub_matrix[mpi_server_thread_index_global_to_local_offset(&the_server, int_pair_make(i, j))]);
-            printf("\n");
+        if ( the_server.local_sub_matrix_row_range.length == 0 ) {
+            printf("    (work unit manager, no sub-matrix)\n");
+        } else if ( mpi_server_thread_index_to_rank(&the_server, int_pair_make(the_server.local_sub_matrix_row_range.start, the_server.local_sub_matrix_col_range.start)) != the_server.dist_rank ) {
+            printf("    (packed symmetric, held by the rank with the transposed block)\n");
+        } else {
+            for ( i = the_server.local_sub_matrix_row_range.start; i < the_server.local_sub_matrix_row_range.start + base_int_min(10, the_server.local_sub_matrix_row_range.length); i++ ) {
+                printf("    %8.3lf", local_element(&the_server, int_pair_make(i, the_server.local_sub_matrix_col_range.start)));
+                for ( j = the_server.local_sub_matrix_col_range.start + 1; j < the_server.local_sub_matrix_col_range.start + base_int_min(10, the_server.local_sub_matrix_col_range.length); j++ )
+                    printf(", %8.3lf", local_element(&the_server, int_pair_make(i, j)));
+                printf("\n");
+            }
         }
         if ( the_server.dist_rank + 1 < the_server.dist_size )
             MPI_Send(&the_ball, 1, MPI_INT, the_server.dist_rank + 1, 0, MPI_COMM_WORLD);
     }
-
+    
     mpi_printf(-1, "ready to exit");
     
+    int_set_destroy(unit);
+    mpi_producer_pool_destroy(producer_pool);
+    free((void*)segment_buffers);
+    if ( block_buffer ) free((void*)block_buffer);
+    if ( block_sends ) free((void*)block_sends);
+    if ( tile_cache ) mpi_tile_cache_destroy(tile_cache);
+    if ( pattern ) mpi_sparsity_pattern_destroy(pattern);
+    if ( feature_paths[0] ) free((void*)feature_paths[0]);
+    me_kernel_unload();
     MPI_Finalize();
     return 0;
 }
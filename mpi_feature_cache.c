@@ -0,0 +1,342 @@
+/*	mpi_feature_cache.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_feature_cache.h"
+#include "mpi_utils.h"
+
+#include <fcntl.h>
+
+//
+
+enum {
+    // Input vectors fetched and cached at a time:
+    __mpi_feature_cache_chunk_dim = 256
+};
+
+//
+
+static bool
+__mpi_feature_cache_pread(
+    int         fd,
+    void        *buffer,
+    size_t      length,
+    off_t       offset
+)
+{
+    while ( length > 0 ) {
+        ssize_t n = pread(fd, buffer, length, offset);
+        
+        if ( n <= 0 ) {
+            if ( (n < 0) && (errno == EINTR) ) continue;
+            return false;
+        }
+        buffer += n, length -= n, offset += n;
+    }
+    return true;
+}
+
+static bool
+__mpi_feature_cache_read(
+    const char  *path,
+    base_int_t  n_features,
+    int_range_t r,
+    double      *features,
+    const char* *error_msg
+)
+{
+    size_t      vector_bytes = n_features * sizeof(double);
+    int         fd;
+    bool        rc;
+    
+    if ( r.length == 0 ) return true;
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        *error_msg = strerror(errno);
+        return false;
+    }
+    rc = __mpi_feature_cache_pread(fd, features, r.length * vector_bytes, (off_t)r.start * vector_bytes);
+    if ( ! rc ) *error_msg = "feature file holds too few input vectors";
+    close(fd);
+    return rc;
+}
+
+//
+
+static int
+__mpi_feature_cache_owner(
+    mpi_server_thread_t         *server_info,
+    mpi_feature_cache_side_t    side,
+    base_int_t                  index
+)
+{
+    // Ask the rank in our own block column (rows) or block row (columns)
+    // so that requests are spread across the ranks holding the inputs:
+    base_int_t                  bi, bj;
+    
+    if ( side == mpi_feature_cache_side_rows ) {
+        bi = index / server_info->dim_per_rank[0];
+        bj = server_info->local_sub_matrix_col_range.length ? (server_info->local_sub_matrix_col_range.start / server_info->dim_per_rank[1]) : 0;
+    } else {
+        bi = server_info->local_sub_matrix_row_range.length ? (server_info->local_sub_matrix_row_range.start / server_info->dim_per_rank[0]) : 0;
+        bj = index / server_info->dim_per_rank[1];
+    }
+    if ( bi >= server_info->dim_blocks[0] ) bi = server_info->dim_blocks[0] - 1;
+    if ( bj >= server_info->dim_blocks[1] ) bj = server_info->dim_blocks[1] - 1;
+    return (int)(server_info->is_row_major ? (bi * server_info->dim_blocks[1] + bj) : (bj * server_info->dim_blocks[0] + bi));
+}
+
+//
+
+static void
+__mpi_feature_cache_fetch(
+    mpi_feature_cache_t         *cache,
+    mpi_server_thread_t         *server_info,
+    mpi_feature_cache_side_t    side,
+    base_int_t                  lo,
+    base_int_t                  hi,
+    double                      *features
+)
+{
+    base_int_t                  block_dim = server_info->dim_per_rank[side];
+    
+    // A chunk may straddle a block boundary, in which case each part
+    // comes from a different rank:
+    pthread_mutex_lock(&cache->fetch_lock);
+    while ( lo < hi ) {
+        base_int_t              part_hi = (lo / block_dim + 1) * block_dim;
+        mpi_server_thread_msg_t msg = {
+                                    .msg_type = mpi_server_thread_msg_type_memory,
+                                    .msg_id = (side == mpi_feature_cache_side_rows) ?
+                                                    mpi_server_thread_msg_id_memory_get_row_features
+                                                  : mpi_server_thread_msg_id_memory_get_col_features,
+                                    .value = 0.0
+                                };
+        int                     owner = __mpi_feature_cache_owner(server_info, side, lo);
+        
+        if ( part_hi > hi ) part_hi = hi;
+        if ( side == mpi_feature_cache_side_rows ) {
+            msg.p_low = int_pair_make(lo, 0);
+            msg.p_high = int_pair_make(part_hi, 0);
+        } else {
+            msg.p_low = int_pair_make(0, lo);
+            msg.p_high = int_pair_make(0, part_hi);
+        }
+        MPI_Send(&msg, 1, mpi_get_msg_datatype(), owner, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+        MPI_Recv(features, (part_hi - lo) * cache->n_features, MPI_DOUBLE, owner, mpi_server_thread_feature_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        features += (part_hi - lo) * cache->n_features;
+        lo = part_hi;
+    }
+    pthread_mutex_unlock(&cache->fetch_lock);
+}
+
+//
+
+mpi_feature_cache_t*
+mpi_feature_cache_create(
+    mpi_server_thread_t *server_info,
+    base_int_t          n_features,
+    const char          *row_path,
+    const char          *col_path,
+    size_t              cache_bytes,
+    int                 max_users,
+    const char*         *error_msg
+)
+{
+    mpi_feature_cache_t *new_cache;
+    const char          *dummy_msg;
+    size_t              chunk_bytes = __mpi_feature_cache_chunk_dim * n_features * sizeof(double);
+    base_int_t          n_slots = cache_bytes / chunk_bytes, n_chunks[2], k;
+    int                 side;
+    
+    if ( ! error_msg ) error_msg = &dummy_msg;
+    if ( n_features <= 0 ) {
+        *error_msg = "invalid feature count";
+        return NULL;
+    }
+    n_chunks[0] = (server_info->dim_blocks[0] * server_info->dim_per_rank[0] + __mpi_feature_cache_chunk_dim - 1) / __mpi_feature_cache_chunk_dim;
+    n_chunks[1] = (server_info->dim_blocks[1] * server_info->dim_per_rank[1] + __mpi_feature_cache_chunk_dim - 1) / __mpi_feature_cache_chunk_dim;
+    
+    // No more slots than there are chunks to cache:
+    if ( n_slots > n_chunks[0] + n_chunks[1] ) n_slots = n_chunks[0] + n_chunks[1];
+    if ( n_slots < 2 * max_users ) n_slots = 2 * max_users;
+    
+    *error_msg = "unable to allocate feature cache";
+    new_cache = (mpi_feature_cache_t*)malloc(sizeof(mpi_feature_cache_t));
+    if ( ! new_cache ) return NULL;
+    memset(new_cache, 0, sizeof(mpi_feature_cache_t));
+    new_cache->n_features = n_features;
+    new_cache->chunk_dim = __mpi_feature_cache_chunk_dim;
+    
+    // Indices beyond the last block are never produced:
+    new_cache->dim[0] = server_info->dim_blocks[0] * server_info->dim_per_rank[0];
+    new_cache->dim[1] = server_info->dim_blocks[1] * server_info->dim_per_rank[1];
+    
+    new_cache->local_range[0] = server_info->local_sub_matrix_row_range;
+    new_cache->local_range[1] = server_info->local_sub_matrix_col_range;
+    new_cache->n_slots = n_slots;
+    pthread_mutex_init(&new_cache->lock, NULL);
+    pthread_cond_init(&new_cache->slot_changed, NULL);
+    pthread_mutex_init(&new_cache->fetch_lock, NULL);
+    
+    new_cache->slots = (mpi_feature_cache_slot_t*)calloc(n_slots, sizeof(mpi_feature_cache_slot_t));
+    if ( new_cache->slots ) new_cache->slots[0].features = (double*)malloc(n_slots * chunk_bytes);
+    for ( side = 0; side < 2; side++ ) {
+        new_cache->local_features[side] = (double*)malloc((new_cache->local_range[side].length ? new_cache->local_range[side].length : 1) * n_features * sizeof(double));
+        new_cache->chunk_slot[side] = (base_int_t*)malloc(n_chunks[side] * sizeof(base_int_t));
+        if ( new_cache->chunk_slot[side] ) for ( k = 0; k < n_chunks[side]; k++ ) new_cache->chunk_slot[side][k] = -1;
+    }
+    if ( ! new_cache->slots || ! new_cache->slots[0].features || ! new_cache->local_features[0] || ! new_cache->local_features[1] ||
+         ! new_cache->chunk_slot[0] || ! new_cache->chunk_slot[1] )
+    {
+        mpi_feature_cache_destroy(new_cache);
+        return NULL;
+    }
+    for ( k = 0; k < n_slots; k++ ) {
+        new_cache->slots[k].chunk = -1;
+        new_cache->slots[k].features = new_cache->slots[0].features + k * __mpi_feature_cache_chunk_dim * n_features;
+    }
+    
+    // Each rank reads the inputs of its own rows and columns:
+    if ( ! __mpi_feature_cache_read(row_path, n_features, new_cache->local_range[0], new_cache->local_features[0], error_msg) ||
+         ! __mpi_feature_cache_read(col_path ? col_path : row_path, n_features, new_cache->local_range[1], new_cache->local_features[1], error_msg) )
+    {
+        mpi_feature_cache_destroy(new_cache);
+        return NULL;
+    }
+    return new_cache;
+}
+
+//
+
+void
+mpi_feature_cache_destroy(
+    mpi_feature_cache_t *cache
+)
+{
+    int                 side;
+    
+    for ( side = 0; side < 2; side++ ) {
+        if ( cache->local_features[side] ) free((void*)cache->local_features[side]);
+        if ( cache->chunk_slot[side] ) free((void*)cache->chunk_slot[side]);
+    }
+    if ( cache->slots ) {
+        if ( cache->slots[0].features ) free((void*)cache->slots[0].features);
+        free((void*)cache->slots);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->slot_changed);
+    pthread_mutex_destroy(&cache->fetch_lock);
+    free((void*)cache);
+}
+
+//
+
+const double*
+mpi_feature_cache_acquire(
+    mpi_feature_cache_t         *cache,
+    mpi_server_thread_t         *server_info,
+    mpi_feature_cache_side_t    side,
+    base_int_t                  index,
+    base_int_t                  *n_available
+)
+{
+    base_int_t                  chunk = index / cache->chunk_dim, lo = chunk * cache->chunk_dim,
+                                hi = lo + cache->chunk_dim, s;
+    mpi_feature_cache_slot_t    *slot;
+    
+    if ( hi > cache->dim[side] ) hi = cache->dim[side];
+    if ( int_range_does_contain(cache->local_range[side], index) ) {
+        pthread_mutex_lock(&cache->lock);
+        cache->n_local++;
+        pthread_mutex_unlock(&cache->lock);
+        *n_available = int_range_get_max(cache->local_range[side]) - index;
+        return cache->local_features[side] + (index - cache->local_range[side].start) * cache->n_features;
+    }
+    
+    pthread_mutex_lock(&cache->lock);
+    while ( true ) {
+        s = cache->chunk_slot[side][chunk];
+        if ( s >= 0 ) {
+            // Cached, or being fetched by another thread:
+            slot = &cache->slots[s];
+            slot->n_users++;
+            cache->n_hits++;
+            while ( ! slot->is_ready ) pthread_cond_wait(&cache->slot_changed, &cache->lock);
+            break;
+        } else {
+            base_int_t          victim = -1;
+            
+            // Replace the least recently used chunk not in use:
+            for ( s = 0; s < cache->n_slots; s++ ) {
+                if ( cache->slots[s].n_users ) continue;
+                if ( (victim < 0) || (cache->slots[s].last_use < cache->slots[victim].last_use) ) victim = s;
+            }
+            if ( victim < 0 ) {
+                pthread_cond_wait(&cache->slot_changed, &cache->lock);
+                continue;
+            }
+            slot = &cache->slots[victim];
+            if ( slot->chunk >= 0 ) cache->chunk_slot[slot->side][slot->chunk] = -1;
+            slot->side = side;
+            slot->chunk = chunk;
+            slot->n_users = 1;
+            slot->is_ready = false;
+            cache->chunk_slot[side][chunk] = victim;
+            cache->n_misses++;
+            pthread_mutex_unlock(&cache->lock);
+            
+            __mpi_feature_cache_fetch(cache, server_info, side, lo, hi, slot->features);
+            
+            pthread_mutex_lock(&cache->lock);
+            slot->is_ready = true;
+            cache->bytes_fetched += (hi - lo) * cache->n_features * sizeof(double);
+            pthread_cond_broadcast(&cache->slot_changed);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    *n_available = hi - index;
+    return slot->features + (index - lo) * cache->n_features;
+}
+
+//
+
+void
+mpi_feature_cache_release(
+    mpi_feature_cache_t         *cache,
+    mpi_feature_cache_side_t    side,
+    base_int_t                  index
+)
+{
+    mpi_feature_cache_slot_t    *slot;
+    
+    if ( int_range_does_contain(cache->local_range[side], index) ) return;
+    pthread_mutex_lock(&cache->lock);
+    slot = &cache->slots[cache->chunk_slot[side][index / cache->chunk_dim]];
+    slot->last_use = ++cache->use_clock;
+    if ( --slot->n_users == 0 ) pthread_cond_broadcast(&cache->slot_changed);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+//
+
+void
+mpi_feature_cache_serve(
+    mpi_feature_cache_t             *cache,
+    const mpi_server_thread_msg_t   *msg,
+    int                             source
+)
+{
+    mpi_feature_cache_side_t        side = (msg->msg_id == mpi_server_thread_msg_id_memory_get_row_features) ?
+                                            mpi_feature_cache_side_rows : mpi_feature_cache_side_cols;
+    base_int_t                      lo = (side == mpi_feature_cache_side_rows) ? msg->p_low.i : msg->p_low.j,
+                                    hi = (side == mpi_feature_cache_side_rows) ? msg->p_high.i : msg->p_high.j;
+    
+    if ( (lo >= hi) || ! int_range_does_contain(cache->local_range[side], lo) || ! int_range_does_contain(cache->local_range[side], hi - 1) ) {
+        mpi_printf(-1, "ERROR:  rank %d requested kernel inputs that are not local", source);
+        MPI_Abort(MPI_COMM_WORLD, EINVAL);
+    }
+    MPI_Send(cache->local_features[side] + (lo - cache->local_range[side].start) * cache->n_features, (hi - lo) * cache->n_features,
+            MPI_DOUBLE, source, mpi_server_thread_feature_tag, MPI_COMM_WORLD);
+}
@@ -0,0 +1,146 @@
+/*	mpi_feature_cache.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix feature arrays
+
+	Kernels of the form A_{i,j} = K(x_i, y_j) depend on a vector of
+	n_features inputs per row (x) and per column (y) -- point
+	coordinates, say -- rather than on the indices themselves.  Each
+	rank reads only the row inputs of its sub-matrix's rows and the
+	column inputs of its columns, so the arrays are partitioned by the
+	block layout instead of replicated on every rank.
+
+	Producers need the inputs of every row and column their work units
+	touch, most of which lie outside the local block.  Those are fetched
+	from a rank that holds them, chunk_dim consecutive vectors at a
+	time, and kept in a fixed-size cache shared by the rank's producer
+	threads; the least recently used chunk is replaced when it is full.
+	Hits, misses and the bytes fetched are counted so the cache can be
+	sized.
+*/
+
+#ifndef __MPI_FEATURE_CACHE_H__
+#define __MPI_FEATURE_CACHE_H__
+
+#include "project_config.h"
+#include "mpi_server_thread.h"
+
+/*
+ * @enum Feature array sides
+ *
+ * The row (x) and column (y) inputs.
+ */
+enum {
+    mpi_feature_cache_side_rows = 0,
+    mpi_feature_cache_side_cols = 1
+};
+
+/*
+ * @typedef mpi_feature_cache_side_t
+ *
+ * The type of a feature array side.
+ */
+typedef unsigned int mpi_feature_cache_side_t;
+
+/*
+ * @typedef mpi_feature_cache_slot_t
+ *
+ * A cached chunk:  chunk_dim input vectors (fewer at the end of the
+ * array) starting at index chunk * chunk_dim of the given side.  A
+ * slot is not replaced while n_users is non-zero, and its vectors are
+ * only valid once is_ready is set.
+ */
+typedef struct {
+    mpi_feature_cache_side_t    side;
+    base_int_t                  chunk;
+    unsigned int                n_users;
+    bool                        is_ready;
+    uint64_t                    last_use;
+    double                      *features;
+} mpi_feature_cache_slot_t;
+
+/*
+ * @typedef mpi_feature_cache_t
+ *
+ * The inputs of local_range[side] are held in local_features[side],
+ * n_features doubles per index.  The cache has n_slots chunks;
+ * chunk_slot[side][c] is the slot holding chunk c of a side, or -1.
+ */
+typedef struct mpi_feature_cache {
+    base_int_t                  n_features;
+    base_int_t                  chunk_dim;
+    base_int_t                  dim[2];             // rows, cols covered by blocks
+    int_range_t                 local_range[2];
+    double                      *local_features[2];
+    //
+    pthread_mutex_t             lock;
+    pthread_cond_t              slot_changed;
+    base_int_t                  n_slots;
+    mpi_feature_cache_slot_t    *slots;
+    base_int_t                  *chunk_slot[2];
+    uint64_t                    use_clock;
+    //
+    // Remote fetches, serialized since replies are matched by source
+    // and tag alone:
+    pthread_mutex_t             fetch_lock;
+    //
+    // Statistics:
+    base_int_t                  n_local, n_hits, n_misses;
+    uint64_t                    bytes_fetched;
+} mpi_feature_cache_t;
+
+/*
+ * @function mpi_feature_cache_create
+ *
+ * Read the row inputs of the local sub-matrix of server_info from the
+ * file at row_path and its column inputs from col_path (row_path if
+ * NULL).  Each file holds n_features native doubles per index, index
+ * 0 first.  Remote chunks are cached in up to cache_bytes of memory,
+ * but at least two chunks per thread in max_users, since each
+ * producer thread may hold a row and a column chunk at once.
+ *
+ * Returns NULL on error, with *error_msg (if not NULL) set to a
+ * description of the problem.
+ */
+mpi_feature_cache_t* mpi_feature_cache_create(mpi_server_thread_t *server_info, base_int_t n_features,
+            const char *row_path, const char *col_path, size_t cache_bytes, int max_users, const char **error_msg);
+
+/*
+ * @function mpi_feature_cache_destroy
+ *
+ * Dispose of the feature arrays and cache.
+ */
+void mpi_feature_cache_destroy(mpi_feature_cache_t *cache);
+
+/*
+ * @function mpi_feature_cache_acquire
+ *
+ * Returns the input vector of the given index on side, fetching its
+ * chunk from another rank first if it is neither local nor cached.
+ * The vectors of the following indices follow it; *n_available is set
+ * to the number of vectors (including index) that may be read.  Each
+ * call must be paired with mpi_feature_cache_release().
+ */
+const double* mpi_feature_cache_acquire(mpi_feature_cache_t *cache, mpi_server_thread_t *server_info,
+            mpi_feature_cache_side_t side, base_int_t index, base_int_t *n_available);
+
+/*
+ * @function mpi_feature_cache_release
+ *
+ * Done with the vectors returned by mpi_feature_cache_acquire() for
+ * the same side and index.
+ */
+void mpi_feature_cache_release(mpi_feature_cache_t *cache, mpi_feature_cache_side_t side, base_int_t index);
+
+/*
+ * @function mpi_feature_cache_serve
+ *
+ * Called by the server thread for a memory_get_row_features or
+ * memory_get_col_features message from source:  reply with the local
+ * input vectors it asks for on mpi_server_thread_feature_tag.
+ */
+void mpi_feature_cache_serve(mpi_feature_cache_t *cache, const mpi_server_thread_msg_t *msg, int source);
+
+#endif /* __MPI_FEATURE_CACHE_H__ */
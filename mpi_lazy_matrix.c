@@ -0,0 +1,289 @@
+/*	mpi_lazy_matrix.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_lazy_matrix.h"
+#include "mpi_utils.h"
+
+//
+
+static inline base_int_t
+__mpi_lazy_matrix_min(
+    base_int_t  a,
+    base_int_t  b
+)
+{
+    return (a < b) ? a : b;
+}
+
+//
+
+static void
+__mpi_lazy_matrix_tile_bounds(
+    mpi_lazy_matrix_t   *lazy,
+    mpi_server_thread_t *server_info,
+    base_int_t          tile,
+    int_pair_t          *p_low,
+    int_pair_t          *p_high
+)
+{
+    base_int_t          ti = tile / lazy->n_tiles[1], tj = tile % lazy->n_tiles[1];
+    
+    p_low->i = server_info->local_sub_matrix_row_range.start + ti * lazy->tile_dim;
+    p_low->j = server_info->local_sub_matrix_col_range.start + tj * lazy->tile_dim;
+    p_high->i = __mpi_lazy_matrix_min(p_low->i + lazy->tile_dim, int_range_get_max(server_info->local_sub_matrix_row_range));
+    p_high->j = __mpi_lazy_matrix_min(p_low->j + lazy->tile_dim, int_range_get_max(server_info->local_sub_matrix_col_range));
+}
+
+//
+
+static matrix_element_t*
+__mpi_lazy_matrix_tile(
+    mpi_lazy_matrix_t   *lazy,
+    mpi_server_thread_t *server_info,
+    base_int_t          tile
+)
+{
+    matrix_element_t    *values;
+#ifndef MATRIX_ELEMENT_IS_DOUBLE
+    double              *scratch;
+#endif
+    int_pair_t          p_low, p_high;
+    base_int_t          n_major, n_minor, k;
+    
+    pthread_mutex_lock(&lazy->lock);
+    while ( lazy->tile_state[tile] == mpi_lazy_matrix_tile_producing ) pthread_cond_wait(&lazy->tile_produced, &lazy->lock);
+    if ( lazy->tile_state[tile] == mpi_lazy_matrix_tile_valid ) {
+        values = lazy->tiles[tile];
+        pthread_mutex_unlock(&lazy->lock);
+        return values;
+    }
+    lazy->tile_state[tile] = mpi_lazy_matrix_tile_producing;
+    pthread_mutex_unlock(&lazy->lock);
+    
+    // We produce the tile outside the lock, one major index at a time:
+    __mpi_lazy_matrix_tile_bounds(lazy, server_info, tile, &p_low, &p_high);
+    n_major = server_info->is_row_major ? (p_high.i - p_low.i) : (p_high.j - p_low.j);
+    n_minor = server_info->is_row_major ? (p_high.j - p_low.j) : (p_high.i - p_low.i);
+    values = (matrix_element_t*)malloc(n_major * n_minor * sizeof(matrix_element_t));
+#ifndef MATRIX_ELEMENT_IS_DOUBLE
+    // Narrower elements are produced in double first:
+    scratch = (double*)malloc(n_minor * sizeof(double));
+    if ( ! scratch ) values = NULL;
+#endif
+    if ( ! values ) {
+        mpi_printf(-1, "ERROR:  unable to allocate lazy tile of " BASE_INT_FMT " elements", n_major * n_minor);
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    for ( k = 0; k < n_major; k++ ) {
+        int_pair_t      p = server_info->is_row_major ? int_pair_make(p_low.i + k, p_low.j) : int_pair_make(p_low.i, p_low.j + k);
+
+#ifdef MATRIX_ELEMENT_IS_DOUBLE
+        lazy->produce(p, n_minor, values + k * n_minor, lazy->context);
+#else
+        lazy->produce(p, n_minor, scratch, lazy->context);
+        matrix_element_from_double_n(values + k * n_minor, scratch, n_minor);
+#endif
+    }
+#ifndef MATRIX_ELEMENT_IS_DOUBLE
+    free((void*)scratch);
+#endif
+
+    pthread_mutex_lock(&lazy->lock);
+    lazy->tiles[tile] = values;
+    lazy->tile_state[tile] = mpi_lazy_matrix_tile_valid;
+    lazy->n_valid++;
+    pthread_cond_broadcast(&lazy->tile_produced);
+    pthread_mutex_unlock(&lazy->lock);
+    return values;
+}
+
+//
+
+static base_int_t
+__mpi_lazy_matrix_locate(
+    mpi_lazy_matrix_t   *lazy,
+    mpi_server_thread_t *server_info,
+    int_pair_t          p,
+    base_int_t          *offset
+)
+{
+    // Returns the local tile holding the global index p and the element's
+    // offset within it, or -1 if p is not local:
+    int_pair_t          p_low, p_high;
+    base_int_t          tile;
+    
+    p = mpi_server_thread_index_to_stored(server_info->symmetry == mpi_server_thread_symmetry_packed, server_info->is_row_major, p);
+    if ( ! mpi_server_thread_index_global_to_local(server_info, &p) ) return -1;
+    tile = (p.i / lazy->tile_dim) * lazy->n_tiles[1] + (p.j / lazy->tile_dim);
+    if ( offset ) {
+        __mpi_lazy_matrix_tile_bounds(lazy, server_info, tile, &p_low, &p_high);
+        p.i %= lazy->tile_dim;
+        p.j %= lazy->tile_dim;
+        *offset = server_info->is_row_major ?
+                        int_pair_get_i_major_offset(p, p_high.j - p_low.j)
+                      : int_pair_get_j_major_offset(p, p_high.i - p_low.i);
+    }
+    return tile;
+}
+
+//
+
+mpi_lazy_matrix_t*
+mpi_lazy_matrix_create(
+    mpi_server_thread_t             *server_info,
+    base_int_t                      tile_dim,
+    mpi_server_thread_produce_fn    produce,
+    const void                      *context
+)
+{
+    mpi_lazy_matrix_t   *new_lazy;
+    base_int_t          n_tiles[2], n;
+    
+    if ( tile_dim <= 0 ) return NULL;
+    n_tiles[0] = (server_info->local_sub_matrix_row_range.length + tile_dim - 1) / tile_dim;
+    n_tiles[1] = (server_info->local_sub_matrix_col_range.length + tile_dim - 1) / tile_dim;
+    n = n_tiles[0] * n_tiles[1];
+    
+    new_lazy = (mpi_lazy_matrix_t*)malloc(sizeof(mpi_lazy_matrix_t) + n * (sizeof(matrix_element_t*) + 1));
+    if ( new_lazy ) {
+        memset(new_lazy, 0, sizeof(mpi_lazy_matrix_t) + n * (sizeof(matrix_element_t*) + 1));
+        new_lazy->tiles = (matrix_element_t**)((char*)new_lazy + sizeof(mpi_lazy_matrix_t));
+        new_lazy->tile_state = (unsigned char*)(new_lazy->tiles + n);
+        new_lazy->tile_dim = tile_dim;
+        new_lazy->n_tiles[0] = n_tiles[0];
+        new_lazy->n_tiles[1] = n_tiles[1];
+        new_lazy->produce = produce;
+        new_lazy->context = context;
+        pthread_mutex_init(&new_lazy->lock, NULL);
+        pthread_cond_init(&new_lazy->tile_produced, NULL);
+        pthread_mutex_init(&new_lazy->fetch_lock, NULL);
+    }
+    return new_lazy;
+}
+
+//
+
+void
+mpi_lazy_matrix_destroy(
+    mpi_lazy_matrix_t   *lazy
+)
+{
+    base_int_t          tile = 0, n = lazy->n_tiles[0] * lazy->n_tiles[1];
+    
+    while ( tile < n ) {
+        if ( lazy->tiles[tile] ) free((void*)lazy->tiles[tile]);
+        tile++;
+    }
+    pthread_mutex_destroy(&lazy->lock);
+    pthread_cond_destroy(&lazy->tile_produced);
+    pthread_mutex_destroy(&lazy->fetch_lock);
+    free((void*)lazy);
+}
+
+//
+
+double
+mpi_lazy_matrix_get_element(
+    mpi_lazy_matrix_t   *lazy,
+    mpi_server_thread_t *server_info,
+    int_pair_t          p
+)
+{
+    base_int_t          offset, tile = __mpi_lazy_matrix_locate(lazy, server_info, p, &offset);
+    
+    if ( tile >= 0 ) {
+        return matrix_element_to_double(__mpi_lazy_matrix_tile(lazy, server_info, tile)[offset]);
+    } else if ( (p.i >= 0) && (p.i < server_info->dim_global[0]) && (p.j >= 0) && (p.j < server_info->dim_global[1]) ) {
+        mpi_server_thread_msg_t msg = {
+                                    .msg_type = mpi_server_thread_msg_type_memory,
+                                    .msg_id = mpi_server_thread_msg_id_memory_get_element,
+                                    .p_low = p,
+                                    .p_high = p,
+                                    .value = 0.0
+                                };
+        int                     owner = mpi_server_thread_index_to_rank(server_info, p);
+        
+        pthread_mutex_lock(&lazy->fetch_lock);
+        MPI_Send(&msg, 1, mpi_get_msg_datatype(), owner, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+        MPI_Recv(&msg, 1, mpi_get_msg_datatype(), owner, mpi_server_thread_lazy_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        pthread_mutex_unlock(&lazy->fetch_lock);
+        return msg.value;
+    }
+    return NAN;
+}
+
+//
+
+base_int_t
+mpi_lazy_matrix_get_tile(
+    mpi_lazy_matrix_t   *lazy,
+    mpi_server_thread_t *server_info,
+    int_pair_t          p,
+    int_pair_t          *p_low,
+    int_pair_t          *p_high,
+    matrix_element_t    *values
+)
+{
+    base_int_t          n, tile = __mpi_lazy_matrix_locate(lazy, server_info, p, NULL);
+    
+    if ( tile >= 0 ) {
+        matrix_element_t    *tile_values = __mpi_lazy_matrix_tile(lazy, server_info, tile);
+        
+        __mpi_lazy_matrix_tile_bounds(lazy, server_info, tile, p_low, p_high);
+        n = (p_high->i - p_low->i) * (p_high->j - p_low->j);
+        memcpy(values, tile_values, n * sizeof(matrix_element_t));
+    } else if ( (p.i >= 0) && (p.i < server_info->dim_global[0]) && (p.j >= 0) && (p.j < server_info->dim_global[1]) ) {
+        mpi_server_thread_msg_t msg = {
+                                    .msg_type = mpi_server_thread_msg_type_memory,
+                                    .msg_id = mpi_server_thread_msg_id_memory_get_tile,
+                                    .p_low = p,
+                                    .p_high = p,
+                                    .value = 0.0
+                                };
+        int                     owner = mpi_server_thread_index_to_rank(server_info, p);
+        
+        // The reply carries the tile bounds, then its elements follow:
+        pthread_mutex_lock(&lazy->fetch_lock);
+        MPI_Send(&msg, 1, mpi_get_msg_datatype(), owner, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+        MPI_Recv(&msg, 1, mpi_get_msg_datatype(), owner, mpi_server_thread_lazy_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        n = (msg.p_high.i - msg.p_low.i) * (msg.p_high.j - msg.p_low.j);
+        MPI_Recv(values, n, MPI_MATRIX_ELEMENT_T, owner, mpi_server_thread_lazy_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        pthread_mutex_unlock(&lazy->fetch_lock);
+        *p_low = msg.p_low;
+        *p_high = msg.p_high;
+    } else {
+        n = -1;
+    }
+    return n;
+}
+
+//
+
+void
+mpi_lazy_matrix_serve(
+    mpi_lazy_matrix_t               *lazy,
+    mpi_server_thread_t             *server_info,
+    const mpi_server_thread_msg_t   *msg,
+    int                             source
+)
+{
+    mpi_server_thread_msg_t         reply = *msg;
+    base_int_t                      offset, tile = __mpi_lazy_matrix_locate(lazy, server_info, msg->p_low, &offset);
+    matrix_element_t                *values;
+    
+    if ( tile < 0 ) {
+        mpi_printf(-1, "ERROR:  rank %d requested an element that is not local", source);
+        MPI_Abort(MPI_COMM_WORLD, EINVAL);
+    }
+    values = __mpi_lazy_matrix_tile(lazy, server_info, tile);
+    if ( msg->msg_id == mpi_server_thread_msg_id_memory_get_element ) {
+        reply.value = matrix_element_to_double(values[offset]);
+        MPI_Send(&reply, 1, mpi_get_msg_datatype(), source, mpi_server_thread_lazy_tag, MPI_COMM_WORLD);
+    } else {
+        __mpi_lazy_matrix_tile_bounds(lazy, server_info, tile, &reply.p_low, &reply.p_high);
+        MPI_Send(&reply, 1, mpi_get_msg_datatype(), source, mpi_server_thread_lazy_tag, MPI_COMM_WORLD);
+        MPI_Send(values, (reply.p_high.i - reply.p_low.i) * (reply.p_high.j - reply.p_low.j), MPI_MATRIX_ELEMENT_T,
+                source, mpi_server_thread_lazy_tag, MPI_COMM_WORLD);
+    }
+}
@@ -0,0 +1,127 @@
+/*	mpi_lazy_matrix.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix lazy element generation
+
+	For consumers that only touch a small, data-dependent part of the
+	matrix, elements can be produced on first access instead of up
+	front.  Each rank's sub-matrix is divided into square tiles of
+	tile_dim rows and columns (smaller along the far edges), starting at
+	the sub-matrix origin.  A tile's storage is allocated and its
+	elements produced the first time any of them is read; a per-tile
+	state records which tiles are valid so that each is produced once.
+
+	Reads of elements held by another rank are sent to that rank's
+	server thread, which produces the tile if necessary and replies with
+	the element or the whole tile.  No work units are scheduled and no
+	matrix elements are written in lazy mode.
+*/
+
+#ifndef __MPI_LAZY_MATRIX_H__
+#define __MPI_LAZY_MATRIX_H__
+
+#include "project_config.h"
+#include "mpi_server_thread.h"
+
+/*
+ * @enum Lazy tile states
+ *
+ * A tile is missing until a thread starts producing it; other readers
+ * of the tile then wait until it is valid.
+ */
+enum {
+    mpi_lazy_matrix_tile_missing = 0,
+    mpi_lazy_matrix_tile_producing = 1,
+    mpi_lazy_matrix_tile_valid = 2
+};
+
+/*
+ * @typedef mpi_lazy_matrix_t
+ *
+ * Lazy tile state attached to a rank's server instance.  The local
+ * sub-matrix is covered by n_tiles[0] x n_tiles[1] tiles (row-major
+ * over the tile grid); tiles holds each one's storage, NULL until it
+ * is produced, with its elements in the server's storage order
+ * (i-major for row-major, j-major otherwise) and the tile's own
+ * extent as the leading dimension.  n_valid counts the tiles produced
+ * so far.
+ *
+ * Remote reads by this rank's threads are serialized by fetch_lock,
+ * since the replies are matched by source rank and tag alone.
+ */
+typedef struct mpi_lazy_matrix {
+    base_int_t                   tile_dim;
+    base_int_t                   n_tiles[2];
+    mpi_server_thread_produce_fn produce;
+    const void                   *context;
+    //
+    pthread_mutex_t              lock;
+    pthread_cond_t               tile_produced;
+    base_int_t                   n_valid;
+    unsigned char                *tile_state;
+    matrix_element_t             **tiles;
+    //
+    pthread_mutex_t              fetch_lock;
+} mpi_lazy_matrix_t;
+
+/*
+ * @function mpi_lazy_matrix_create
+ *
+ * Return a new lazy tile state for the local sub-matrix of
+ * server_info with tiles of tile_dim rows and columns, produced by
+ * the given callback.  Normally called through
+ * mpi_server_thread_set_lazy().
+ *
+ * Returns NULL on error.
+ */
+mpi_lazy_matrix_t* mpi_lazy_matrix_create(mpi_server_thread_t *server_info, base_int_t tile_dim,
+            mpi_server_thread_produce_fn produce, const void *context);
+
+/*
+ * @function mpi_lazy_matrix_destroy
+ *
+ * Dispose of the lazy tile state and every tile produced.
+ */
+void mpi_lazy_matrix_destroy(mpi_lazy_matrix_t *lazy);
+
+/*
+ * @function mpi_lazy_matrix_get_element
+ *
+ * Returns the matrix element at the global index p, producing the
+ * tile that holds it first if necessary.  If p is held by another rank
+ * its server thread is asked for the element.  Returns NaN if p is
+ * outside the matrix.  With packed symmetric storage an index on the
+ * unstored side of the diagonal is mapped to its transpose first.
+ */
+double mpi_lazy_matrix_get_element(mpi_lazy_matrix_t *lazy, mpi_server_thread_t *server_info, int_pair_t p);
+
+/*
+ * @function mpi_lazy_matrix_get_tile
+ *
+ * Copy the tile holding the global index p into values, which must
+ * have room for tile_dim * tile_dim elements, producing it first if
+ * necessary (on the rank that holds it).  The tile's global bounds are
+ * returned in *p_low (inclusive) and *p_high (exclusive); its elements
+ * are in the server's storage order with the tile's extent as the
+ * leading dimension.  With packed symmetric storage the tile holding
+ * the transpose of an index on the unstored side of the diagonal is
+ * returned.
+ *
+ * Returns the number of elements copied, or -1 if p is outside the
+ * matrix.
+ */
+base_int_t mpi_lazy_matrix_get_tile(mpi_lazy_matrix_t *lazy, mpi_server_thread_t *server_info, int_pair_t p,
+            int_pair_t *p_low, int_pair_t *p_high, matrix_element_t *values);
+
+/*
+ * @function mpi_lazy_matrix_serve
+ *
+ * Called by the server thread for a memory_get_element or
+ * memory_get_tile message from source:  produce the tile if necessary
+ * and reply with the element or tile on mpi_server_thread_lazy_tag.
+ */
+void mpi_lazy_matrix_serve(mpi_lazy_matrix_t *lazy, mpi_server_thread_t *server_info, const mpi_server_thread_msg_t *msg, int source);
+
+#endif /* __MPI_LAZY_MATRIX_H__ */
@@ -0,0 +1,181 @@
+/*	mpi_producer_pool.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_producer_pool.h"
+
+//
+
+typedef struct mpi_producer_pool {
+    int                     n_threads;
+    pthread_t               *threads;       // [n_threads - 1]
+    
+    pthread_mutex_t         lock;
+    pthread_cond_t          work_ready;
+    pthread_cond_t          work_done;
+    
+    // Each call to mpi_producer_pool_run() is a new generation; a
+    // thread joins in once per generation:
+    unsigned long           generation;
+    bool                    is_stopping;
+    int                     n_busy;
+    
+    base_int_t              n_items;
+    base_int_t              next_item;
+    mpi_producer_pool_fn_t  fn;
+    const void              *context;
+} mpi_producer_pool_t;
+
+typedef struct {
+    mpi_producer_pool_t     *pool;
+    int                     thread_idx;
+} __mpi_producer_pool_thread_arg_t;
+
+//
+
+static void
+__mpi_producer_pool_produce(
+    mpi_producer_pool_t     *pool,
+    int                     thread_idx
+)
+{
+    base_int_t              item;
+    
+    while ( (item = __atomic_fetch_add(&pool->next_item, 1, __ATOMIC_RELAXED)) < pool->n_items )
+        pool->fn(item, thread_idx, pool->context);
+}
+
+//
+
+static void*
+__mpi_producer_pool_thread(
+    void        *arg
+)
+{
+    __mpi_producer_pool_thread_arg_t    *thread_arg = (__mpi_producer_pool_thread_arg_t*)arg;
+    mpi_producer_pool_t                 *pool = thread_arg->pool;
+    int                                 thread_idx = thread_arg->thread_idx;
+    unsigned long                       generation = 0;
+    
+    free(arg);
+    pthread_mutex_lock(&pool->lock);
+    while ( true ) {
+        while ( ! pool->is_stopping && (pool->generation == generation) ) pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if ( pool->is_stopping ) break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        
+        __mpi_producer_pool_produce(pool, thread_idx);
+        
+        pthread_mutex_lock(&pool->lock);
+        if ( --pool->n_busy == 0 ) pthread_cond_signal(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+//
+
+mpi_producer_pool_ref
+mpi_producer_pool_create(
+    int         n_threads
+)
+{
+    mpi_producer_pool_t *new_pool;
+    
+    if ( n_threads < 1 ) n_threads = 1;
+    new_pool = (mpi_producer_pool_t*)malloc(sizeof(mpi_producer_pool_t) + (n_threads - 1) * sizeof(pthread_t));
+    if ( new_pool ) {
+        memset(new_pool, 0, sizeof(mpi_producer_pool_t));
+        new_pool->threads = (pthread_t*)((void*)new_pool + sizeof(mpi_producer_pool_t));
+        pthread_mutex_init(&new_pool->lock, NULL);
+        pthread_cond_init(&new_pool->work_ready, NULL);
+        pthread_cond_init(&new_pool->work_done, NULL);
+        
+        // The creating thread is producer 0:
+        new_pool->n_threads = 1;
+        while ( new_pool->n_threads < n_threads ) {
+            __mpi_producer_pool_thread_arg_t    *arg = (__mpi_producer_pool_thread_arg_t*)malloc(sizeof(__mpi_producer_pool_thread_arg_t));
+            
+            if ( ! arg ) break;
+            arg->pool = new_pool;
+            arg->thread_idx = new_pool->n_threads;
+            if ( pthread_create(&new_pool->threads[new_pool->n_threads - 1], NULL, __mpi_producer_pool_thread, arg) != 0 ) {
+                free((void*)arg);
+                break;
+            }
+            new_pool->n_threads++;
+        }
+        if ( new_pool->n_threads < n_threads ) {
+            mpi_producer_pool_destroy(new_pool);
+            new_pool = NULL;
+        }
+    }
+    return new_pool;
+}
+
+//
+
+void
+mpi_producer_pool_destroy(
+    mpi_producer_pool_ref   pool
+)
+{
+    int                     i = 0;
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->is_stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    while ( i < pool->n_threads - 1 ) pthread_join(pool->threads[i++], NULL);
+    
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free((void*)pool);
+}
+
+//
+
+int
+mpi_producer_pool_get_size(
+    mpi_producer_pool_ref   pool
+)
+{
+    return pool->n_threads;
+}
+
+//
+
+void
+mpi_producer_pool_run(
+    mpi_producer_pool_ref   pool,
+    base_int_t              n_items,
+    mpi_producer_pool_fn_t  fn,
+    const void              *context
+)
+{
+    // Not worth waking anyone for a single item:
+    if ( (pool->n_threads == 1) || (n_items <= 1) ) {
+        base_int_t          item = 0;
+        
+        while ( item < n_items ) fn(item++, 0, context);
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->n_items = n_items;
+    pool->next_item = 0;
+    pool->fn = fn;
+    pool->context = context;
+    pool->n_busy = pool->n_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    
+    __mpi_producer_pool_produce(pool, 0);
+    
+    pthread_mutex_lock(&pool->lock);
+    while ( pool->n_busy > 0 ) pthread_cond_wait(&pool->work_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
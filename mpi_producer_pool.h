@@ -0,0 +1,72 @@
+/*	mpi_producer_pool.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix producer thread pool
+
+	A fork-join pool of threads that share the production of a work
+	unit within a rank.  The calling thread hands the pool a count of
+	independent items and a function to produce one of them; every
+	thread in the pool, the caller included, claims items in turn until
+	none are left, and the call returns once all have been produced.
+
+	Between calls the pool threads sleep on a condition variable, so
+	the work unit protocol (requests, completions, checkpoints) stays
+	on the calling thread.
+*/
+
+#ifndef __MPI_PRODUCER_POOL_H__
+#define __MPI_PRODUCER_POOL_H__
+
+#include "project_config.h"
+
+/*
+ * @typedef mpi_producer_pool_fn_t
+ *
+ * Type of a function that produces the given item.  The thread_idx
+ * identifies the calling thread within the pool (0 is the thread that
+ * called mpi_producer_pool_run()) and can be used to index per-thread
+ * scratch space.
+ */
+typedef void (*mpi_producer_pool_fn_t)(base_int_t item, int thread_idx, const void *context);
+
+/*
+ * @typedef mpi_producer_pool_ref
+ *
+ * Opaque reference to a producer thread pool.
+ */
+typedef struct mpi_producer_pool * mpi_producer_pool_ref;
+
+/*
+ * @function mpi_producer_pool_create
+ *
+ * Create a pool of n_threads producers:  the calling thread plus
+ * n_threads - 1 new threads.  Returns NULL on error.
+ */
+mpi_producer_pool_ref mpi_producer_pool_create(int n_threads);
+
+/*
+ * @function mpi_producer_pool_destroy
+ *
+ * Stop and join the pool's threads and dispose of the pool.
+ */
+void mpi_producer_pool_destroy(mpi_producer_pool_ref pool);
+
+/*
+ * @function mpi_producer_pool_get_size
+ *
+ * Returns the number of threads in the pool, the caller included.
+ */
+int mpi_producer_pool_get_size(mpi_producer_pool_ref pool);
+
+/*
+ * @function mpi_producer_pool_run
+ *
+ * Call fn for every item in [0, n_items) across the threads of the
+ * pool and return once all calls have returned.  Items are claimed
+ * one at a time, so they need not be of equal cost.
+ */
+void mpi_producer_pool_run(mpi_producer_pool_ref pool, base_int_t n_items, mpi_producer_pool_fn_t fn, const void *context);
+
+#endif /* __MPI_PRODUCER_POOL_H__ */
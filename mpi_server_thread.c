@@ -1,11 +1,22 @@
 
 #include "mpi_server_thread.h"
+#include "mpi_checkpoint.h"
+#include "mpi_sparse_matrix.h"
+#include "mpi_lazy_matrix.h"
+#include "mpi_feature_cache.h"
 #include "mpi_utils.h"
 
 //
 
 const int mpi_server_thread_msg_tag = 2;
 const int mpi_client_thread_msg_tag = 3;
+const int mpi_server_thread_batch_tag = 4;
+const int mpi_server_thread_autotune_tag = 5;
+const int mpi_server_thread_work_set_tag = 6;
+const int mpi_server_thread_block_tag = 7;
+const int mpi_server_thread_lazy_tag = 8;
+const int mpi_server_thread_feature_tag = 9;
+const int mpi_server_thread_sync_tag = 10;
 
 //
 
@@ -89,6 +100,78 @@ mpi_get_msg_datatype()
 
 //
 
+static int __mpi_server_thread_element_type_fields = 2;
+static int __mpi_server_thread_element_type_counts[] = {
+                    1, // 1 int_pair
+                    1, // 1 matrix_element_t
+                };
+static MPI_Aint __mpi_server_thread_element_type_offsets[] = {
+                    offsetof(mpi_server_thread_element_t, p),
+                    offsetof(mpi_server_thread_element_t, value)
+                };
+static MPI_Datatype __mpi_server_thread_element_type_types[] = {
+                    0,          // must be filled-in later
+                    MPI_MATRIX_ELEMENT_T
+                };
+
+MPI_Datatype
+mpi_get_element_datatype()
+{
+    static bool is_inited = false;
+    static MPI_Datatype dtype;
+    
+    if ( ! is_inited ) {
+        MPI_Datatype    struct_dtype;
+        
+        __mpi_server_thread_element_type_types[0] = mpi_get_int_pair_datatype();
+        MPI_Type_create_struct(
+                __mpi_server_thread_element_type_fields,
+                __mpi_server_thread_element_type_counts,
+                __mpi_server_thread_element_type_offsets,
+                __mpi_server_thread_element_type_types,
+                &struct_dtype);
+        // Arrays of elements must honor the C struct's trailing padding:
+        MPI_Type_create_resized(struct_dtype, 0, sizeof(mpi_server_thread_element_t), &dtype);
+        MPI_Type_free(&struct_dtype);
+        MPI_Type_commit(&dtype);
+        is_inited = true;
+    }
+    return dtype;
+}
+
+//
+
+/*
+ * Per-destination write batch:  the buffer currently being filled and
+ * the number of elements in it, plus the requests for the buffers that
+ * have been sent.
+ */
+typedef struct mpi_server_thread_write_batch {
+    // Producer threads append under the lock; time spent waiting on an
+    // in-flight buffer collects in wait_time until the next flush:
+    pthread_mutex_t             lock;
+    double                      wait_time;
+    int                         buffer_idx;
+    base_int_t                  n_elements;
+    MPI_Request                 *requests;          // [write_batch_depth]
+    mpi_server_thread_element_t *elements;          // [write_batch_depth * write_batch_size]
+} mpi_server_thread_write_batch_t;
+
+//
+
+static void
+__mpi_server_thread_block_completed(
+    mpi_server_thread_t *server_info
+)
+{
+    // The root may learn of completion more than once (e.g. from two
+    // slots finishing at the same time); only the first one counts:
+    if ( ! __atomic_exchange_n(&server_info->is_block_completed, true, __ATOMIC_ACQ_REL) && server_info->block_completed_callback )
+        server_info->block_completed_callback(server_info, server_info->block_completed_context);
+}
+
+//
+
 void 
 __mpi_server_thread_cleanup(
     void    *context
@@ -111,7 +194,10 @@ __mpi_server_thread_start(
 {
     mpi_server_thread_t *SERVER = (mpi_server_thread_t*)context;
     bool                is_running = true;
-
+    mpi_server_thread_element_t *batch = NULL;
+    base_int_t          batch_capacity = 0;
+    int_set_ref         unit = int_set_create();
+    
     // We want to be cancellable at any time so that the root client can terminate
     // its server thread w/o MPI messaging:
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
@@ -144,6 +230,14 @@ __mpi_server_thread_start(
         SERVER->is_request_active = false;
         pthread_mutex_unlock(&SERVER->request_lock);
         
+        // Track how far behind the work unit manager is running:
+        if ( (SERVER->roles & mpi_server_thread_role_work_unit_mgr) && (SERVER->throttle_backlog > 0) ) {
+            int                 is_pending = 0;
+            
+            MPI_Iprobe(MPI_ANY_SOURCE, mpi_server_thread_msg_tag, MPI_COMM_WORLD, &is_pending, MPI_STATUS_IGNORE);
+            SERVER->request_backlog = is_pending ? (SERVER->request_backlog + 1) : 0;
+        }
+        
         switch ( msg.msg_type ) {
             case mpi_server_thread_msg_type_work: {
                 switch ( msg.msg_id ) {
@@ -151,26 +245,41 @@ __mpi_server_thread_start(
                         is_running = false;
                         break;
                     case mpi_server_thread_msg_id_work_complete_and_allocate:
-                        mpi_assignable_work_complete(SERVER->assignable_work, msg.p_low, msg.p_high);
+                    case mpi_server_thread_msg_id_work_set_complete_and_allocate:
+                        if ( mpi_server_thread_recv_work_unit(SERVER, &msg, status.MPI_SOURCE, unit) )
+                            mpi_assignable_work_complete_set(SERVER->assignable_work, status.MPI_SOURCE, unit);
+                        else
+                            mpi_printf(-1, "ERROR:  unable to receive work unit completed by rank %d", status.MPI_SOURCE);
+                        // The requestor's idle fraction is in value:
+                        mpi_assignable_work_note_idle(SERVER->assignable_work, msg.value);
+                        /* fall through */
                     case mpi_server_thread_msg_id_work_request: {
                         // The sender rank determines the primary work set we want to consult:
                         int         sender_rank = status.MPI_SOURCE;
-                        int         primary_slot = (SERVER->is_row_major) ?
-                                                    (sender_rank / SERVER->dim_blocks[1])
-                                                  : (sender_rank / SERVER->dim_blocks[0]);
-                        base_int_t  next_index;
+                        int         primary_slot = mpi_server_thread_rank_to_slot(SERVER, sender_rank);
                         
-                        //  By default, no more work available, period:
                         response.msg_type = mpi_server_thread_msg_type_work;
                         response.msg_id = mpi_server_thread_msg_id_work_allocated;
+                        if ( mpi_assignable_work_next_unit_set(SERVER->assignable_work, sender_rank, primary_slot, unit) ) {
+                            mpi_server_thread_send_work_unit(SERVER, &response, mpi_server_thread_msg_id_work_allocated_set,
+                                    unit, sender_rank, mpi_client_thread_msg_tag);
+                            break;
+                        }
+                        
+                        //  By default, no more work available, period:
                         response.p_low = response.p_high = int_pair_make(-1, -1);
                         
-                        mpi_assignable_work_next_unit(SERVER->assignable_work, sender_rank, primary_slot, &response.p_low, &response.p_high);
+                        // Outstanding work may yet be re-issued, have the requestor
+                        // check back later:
+                        if ( mpi_assignable_work_should_defer(SERVER->assignable_work, &response.value) )
+                            response.msg_id = mpi_server_thread_msg_id_work_deferred;
+                        else
+                            mpi_assignable_work_release_rank(SERVER->assignable_work, sender_rank);
                         MPI_Send(&response, 1, mpi_get_msg_datatype(), sender_rank, mpi_client_thread_msg_tag, MPI_COMM_WORLD);
                         break;
                     }
                     case mpi_server_thread_msg_id_work_completed: {
-                        mpi_assignable_work_complete(SERVER->assignable_work, msg.p_low, msg.p_high);
+                        mpi_assignable_work_complete(SERVER->assignable_work, status.MPI_SOURCE, msg.p_low, msg.p_high);
                         break;
                     }
                 }
@@ -185,37 +294,173 @@ __mpi_server_thread_start(
                         mpi_server_thread_memory_write(SERVER, msg.p_low, msg.value);
                         break;
                     }
+                    case mpi_server_thread_msg_id_memory_write_batch: {
+                        // The element count is in p_low.i and the elements follow:
+                        base_int_t      n_elements = msg.p_low.i, i = 0;
+                        
+                        if ( n_elements > batch_capacity ) {
+                            mpi_server_thread_element_t *new_batch = (mpi_server_thread_element_t*)realloc(batch, n_elements * sizeof(mpi_server_thread_element_t));
+                            
+                            if ( ! new_batch ) {
+                                mpi_printf(-1, "ERROR:  unable to allocate receive buffer for " BASE_INT_FMT " elements", n_elements);
+                                MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+                            }
+                            batch = new_batch;
+                            batch_capacity = n_elements;
+                        }
+                        MPI_Recv(batch, n_elements, mpi_get_element_datatype(), status.MPI_SOURCE, mpi_server_thread_batch_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                        if ( SERVER->sparse ) {
+                            // The sender already dropped values below the threshold:
+                            mpi_sparse_matrix_append(SERVER->sparse, batch, n_elements);
+                        } else {
+                            while ( i < n_elements ) {
+                                mpi_server_thread_memory_write(SERVER, batch[i].p, matrix_element_to_double(batch[i].value));
+                                i++;
+                            }
+                        }
+                        break;
+                    }
+                    case mpi_server_thread_msg_id_memory_write_block: {
+                        // The values are received straight into the sub-matrix:
+                        base_int_t      n_partitions = msg.p_high.i, partition_length = msg.p_high.j;
+                        base_int_t      offset = mpi_server_thread_index_global_to_local_offset(SERVER, msg.p_low);
+                        
+                        if ( (offset < 0) || (offset + n_partitions * partition_length > SERVER->local_sub_matrix_length) ) {
+                            mpi_printf(-1, "ERROR:  block write from rank %d does not fit the local sub-matrix", status.MPI_SOURCE);
+                            MPI_Abort(MPI_COMM_WORLD, EINVAL);
+                        }
+#ifdef MPI_SERVER_THREAD_HAVE_PARTITIONED
+                        if ( msg.value != 0.0 ) {
+                            MPI_Request block_request;
+                            
+                            MPI_Precv_init(SERVER->local_sub_matrix + offset, (int)n_partitions, partition_length, MPI_MATRIX_ELEMENT_T,
+                                    status.MPI_SOURCE, mpi_server_thread_block_tag, MPI_COMM_WORLD, MPI_INFO_NULL, &block_request);
+                            MPI_Start(&block_request);
+                            MPI_Wait(&block_request, MPI_STATUS_IGNORE);
+                            MPI_Request_free(&block_request);
+                        } else
+#endif
+                        MPI_Recv(SERVER->local_sub_matrix + offset, n_partitions * partition_length, MPI_MATRIX_ELEMENT_T,
+                                status.MPI_SOURCE, mpi_server_thread_block_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                        if ( SERVER->checkpoint ) mpi_checkpoint_mark_dirty_range(SERVER->checkpoint, offset, n_partitions * partition_length);
+                        break;
+                    }
+                    case mpi_server_thread_msg_id_memory_get_element:
+                    case mpi_server_thread_msg_id_memory_get_tile: {
+                        if ( SERVER->lazy ) {
+                            mpi_lazy_matrix_serve(SERVER->lazy, SERVER, &msg, status.MPI_SOURCE);
+                        } else {
+                            mpi_printf(-1, "ERROR:  rank %d read an element, but the sub-matrix is not lazy", status.MPI_SOURCE);
+                            MPI_Abort(MPI_COMM_WORLD, EINVAL);
+                        }
+                        break;
+                    }
+                    case mpi_server_thread_msg_id_memory_get_row_features:
+                    case mpi_server_thread_msg_id_memory_get_col_features: {
+                        if ( SERVER->features ) {
+                            mpi_feature_cache_serve(SERVER->features, &msg, status.MPI_SOURCE);
+                        } else {
+                            mpi_printf(-1, "ERROR:  rank %d requested kernel inputs, but none were loaded", status.MPI_SOURCE);
+                            MPI_Abort(MPI_COMM_WORLD, EINVAL);
+                        }
+                        break;
+                    }
+                    case mpi_server_thread_msg_id_memory_sync: {
+                        // Every earlier write from the sender has been applied:
+                        MPI_Send(&msg, 1, mpi_get_msg_datatype(), status.MPI_SOURCE, mpi_server_thread_sync_tag, MPI_COMM_WORLD);
+                        break;
+                    }
+                    case mpi_server_thread_msg_id_memory_block_completed: {
+                        __mpi_server_thread_block_completed(SERVER);
+                        break;
+                    }
+                    case mpi_server_thread_msg_id_memory_checkpoint: {
+                        // The epoch number is in p_low.i:
+                        if ( SERVER->checkpoint && ! mpi_checkpoint_write(SERVER->checkpoint, SERVER, msg.p_low.i) )
+                            mpi_printf(-1, "ERROR:  failed to write checkpoint epoch " BASE_INT_FMT " (errno = %d)", msg.p_low.i, errno);
+                        break;
+                    }
                 }
                 break;
             }
         }
     }
     mpi_printf(-1, "exiting server thread");
+    if ( batch ) free((void*)batch);
+    int_set_destroy(unit);
     pthread_cleanup_pop(0);
     return NULL;
 }
 
 //
 
+static inline mpi_assignable_work_geometry_t
+__mpi_server_thread_geometry(
+    mpi_server_thread_t *server_info
+)
+{
+    mpi_assignable_work_geometry_t  geometry = {
+                                        .dim_global = { server_info->dim_global[0], server_info->dim_global[1] },
+                                        .dim_per_rank = { server_info->dim_per_rank[0], server_info->dim_per_rank[1] },
+                                        .dim_blocks = { server_info->dim_blocks[0], server_info->dim_blocks[1] },
+                                        .is_row_major = server_info->is_row_major,
+                                        .is_triangular = (server_info->symmetry != mpi_server_thread_symmetry_none),
+                                        .dist_size = server_info->dist_size
+                                    };
+    return geometry;
+}
+
+//
+
 enum {
     mpi_server_thread_flag_was_allocated = 1 << 0,
     mpi_server_thread_flag_owns_local_sub_matrix = 1 << 1,
     mpi_server_thread_flag_is_thread_started = 1 << 2
 };
 
+static void
+__mpi_server_thread_rank_ranges(
+    mpi_server_thread_t *server_info,
+    int                 rank,
+    int_range_t         *rows,
+    int_range_t         *cols
+)
+{
+    base_int_t          r, c;
+    
+    if ( rank >= server_info->dim_blocks[0] * server_info->dim_blocks[1] ) {
+        *rows = int_range_make(0, 0);
+        *cols = int_range_make(0, 0);
+        return;
+    }
+    if ( server_info->is_row_major ) {
+        r = rank / server_info->dim_blocks[1];
+        c = rank % server_info->dim_blocks[1];
+    } else {
+        r = rank % server_info->dim_blocks[0];
+        c = rank / server_info->dim_blocks[0];
+    }
+    *rows = int_range_make(r * server_info->dim_per_rank[0], server_info->dim_per_rank[0]);
+    *cols = int_range_make(c * server_info->dim_per_rank[1], server_info->dim_per_rank[1]);
+}
+
+//
+
 mpi_server_thread_t*
 mpi_server_thread_init(
     mpi_server_thread_t *server_info,
     int                 root_rank,
+    mpi_server_thread_role_t root_roles,
     base_int_t          global_rows,
     base_int_t          global_cols,
     base_int_t          grid_rows,
     base_int_t          grid_cols,
     bool                is_row_major,
-    double              *local_sub_matrix
+    mpi_server_thread_storage_t storage,
+    matrix_element_t    *local_sub_matrix
 )
 {
-    base_int_t          r, c;
+    int                 n_block_ranks;
     
     // Force the MPI datatypes to get initialized now to avoid later
     // race conditions:
@@ -232,14 +477,46 @@ mpi_server_thread_init(
     
     server_info->is_request_active = false;
     pthread_mutex_init(&server_info->request_lock, NULL);
+    server_info->checkpoint = NULL;
+    server_info->sparse = NULL;
+    server_info->lazy = NULL;
+    server_info->features = NULL;
+    server_info->is_tracking_blocks = false;
+    server_info->is_block_completed = false;
+    server_info->block_completed_callback = NULL;
+    server_info->block_completed_context = NULL;
+    server_info->static_fraction = 0.0;
+    server_info->write_batch_size = 1;
+    server_info->write_batch_depth = 1;
+    server_info->write_batches = NULL;
+    server_info->write_wait_time = 0.0;
+    server_info->throttle_backlog = 0;
+    server_info->request_backlog = 0;
+    server_info->throttle_time = 0.0;
     
     // Initialize MPI comm dimensions:
     MPI_Comm_rank(MPI_COMM_WORLD, &server_info->dist_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &server_info->dist_size);
+    n_block_ranks = server_info->dist_size;
     
     // Which rank is root?
     server_info->root_rank = root_rank;
     
+    // A dedicated work unit manager holds no block, so it must lie beyond
+    // the last one:
+    if ( root_roles == mpi_server_thread_role_work_unit_mgr ) {
+        if ( (server_info->dist_size < 2) || (root_rank != server_info->dist_size - 1) ) {
+            mpi_printf(0, "a dedicated work unit manager must be the last of at least 2 ranks");
+            if ( server_info->flags & mpi_server_thread_flag_was_allocated ) free((void*)server_info);
+            return NULL;
+        }
+        n_block_ranks = server_info->dist_size - 1;
+    } else if ( root_roles != mpi_server_thread_role_all ) {
+        mpi_printf(0, "invalid root roles %X", root_roles);
+        if ( server_info->flags & mpi_server_thread_flag_was_allocated ) free((void*)server_info);
+        return NULL;
+    }
+    
     // Fill-in dimensions:
     server_info->dim_global[0] = global_rows;
     server_info->dim_global[1] = global_cols;
@@ -250,15 +527,21 @@ mpi_server_thread_init(
     
     // Auto grid?
     if ( ! grid_rows || ! grid_cols ) {
-        if ( mpi_auto_grid_2d(server_info->dist_size, true, true, server_info->dim_global, server_info->dim_blocks) ) {
+        if ( mpi_auto_grid_2d(n_block_ranks, true, true, server_info->dim_global, server_info->dim_blocks) ) {
             mpi_printf(0, "auto-grid block partitioning yielded " BASE_INT_FMT " x " BASE_INT_FMT,
                     server_info->dim_blocks[0], server_info->dim_blocks[1]);
         } else {
             mpi_printf(0, "auto-grid unable to find an exact fit for %d ranks and global dims " BASE_INT_FMT " x " BASE_INT_FMT,
-                    server_info->dist_size, server_info->dim_global[0], server_info->dim_global[1]);
+                    n_block_ranks, server_info->dim_global[0], server_info->dim_global[1]);
             if ( server_info->flags & mpi_server_thread_flag_was_allocated ) free((void*)server_info);
             return NULL;
         }
+    } else if ( (root_roles == mpi_server_thread_role_work_unit_mgr) && (grid_rows * grid_cols != n_block_ranks) ) {
+        // An explicit grid must leave the dedicated manager without a block:
+        mpi_printf(0, "block grid " BASE_INT_FMT " x " BASE_INT_FMT " does not match the %d ranks holding blocks",
+                server_info->dim_blocks[0], server_info->dim_blocks[1], n_block_ranks);
+        if ( server_info->flags & mpi_server_thread_flag_was_allocated ) free((void*)server_info);
+        return NULL;
     }
     
     mpi_printf(0, "block grid dimensions [" BASE_INT_FMT "," BASE_INT_FMT "]", server_info->dim_blocks[0], server_info->dim_blocks[1]);
@@ -271,25 +554,21 @@ mpi_server_thread_init(
     server_info->is_row_major = is_row_major;
     
     // Assign global row/col index ranges associated with this rank:
-    if ( is_row_major ) {
-        r = server_info->dist_rank / server_info->dim_blocks[1];
-        c = server_info->dist_rank % server_info->dim_blocks[1];
-        server_info->local_sub_matrix_row_range = int_range_make(r * server_info->dim_per_rank[0], server_info->dim_per_rank[0]);
-        server_info->local_sub_matrix_col_range = int_range_make(c * server_info->dim_per_rank[1], server_info->dim_per_rank[1]);
-    } else {
-        r = server_info->dist_rank / server_info->dim_blocks[0];
-        c = server_info->dist_rank % server_info->dim_blocks[0];
-        server_info->local_sub_matrix_row_range = int_range_make(r * server_info->dim_per_rank[0], server_info->dim_per_rank[0]);
-        server_info->local_sub_matrix_col_range = int_range_make(c * server_info->dim_per_rank[1], server_info->dim_per_rank[1]);
-    }
+    __mpi_server_thread_rank_ranges(server_info, server_info->dist_rank,
+            &server_info->local_sub_matrix_row_range, &server_info->local_sub_matrix_col_range);
     
     mpi_printf(-1, "local sub-matrix indices [" BASE_INT_FMT "," BASE_INT_FMT "]..[" BASE_INT_FMT "," BASE_INT_FMT "]",
             server_info->local_sub_matrix_row_range.start, server_info->local_sub_matrix_col_range.start,
             int_range_get_end(server_info->local_sub_matrix_row_range), int_range_get_end(server_info->local_sub_matrix_col_range));
     
-    // Setup the local sub-matrix storage:
-    if ( ! local_sub_matrix ) {
-        local_sub_matrix = (double*)malloc(sizeof(double) * server_info->dim_per_rank[0] * server_info->dim_per_rank[1]);
+    // Setup the local sub-matrix storage; other storage modes never
+    // need the dense array:
+    if ( (root_roles == mpi_server_thread_role_work_unit_mgr) && (server_info->dist_rank == root_rank) ) {
+        local_sub_matrix = NULL;
+    } else if ( storage != mpi_server_thread_storage_dense ) {
+        local_sub_matrix = NULL;
+    } else if ( ! local_sub_matrix ) {
+        local_sub_matrix = (matrix_element_t*)malloc(sizeof(matrix_element_t) * server_info->dim_per_rank[0] * server_info->dim_per_rank[1]);
         if ( ! local_sub_matrix ) {
             if ( server_info->flags & mpi_server_thread_flag_was_allocated ) free((void*)server_info);
             return NULL;
@@ -298,11 +577,17 @@ mpi_server_thread_init(
         server_info->flags |= mpi_server_thread_flag_owns_local_sub_matrix;
     }
     server_info->local_sub_matrix = local_sub_matrix;
-
+    server_info->local_sub_matrix_length = local_sub_matrix ?
+                    (server_info->local_sub_matrix_row_range.length * server_info->local_sub_matrix_col_range.length)
+                  : 0;
+    server_info->symmetry = mpi_server_thread_symmetry_none;
+    
     // Setup the role(s) for this instance:
     if ( server_info->dist_rank == server_info->root_rank ) {
-        server_info->roles = mpi_server_thread_role_all;
-        server_info->assignable_work = mpi_assignable_work_create(server_info);
+        mpi_assignable_work_geometry_t  geometry = __mpi_server_thread_geometry(server_info);
+        
+        server_info->roles = root_roles;
+        server_info->assignable_work = mpi_assignable_work_create(&geometry);
     } else {        
         server_info->roles = mpi_server_thread_role_memory_mgr;
         server_info->assignable_work = NULL;
@@ -320,6 +605,12 @@ mpi_server_thread_destroy(
 {
     mpi_server_thread_cancel(server_info);
     
+    mpi_server_thread_set_write_batching(server_info, 1, 1);
+    if ( server_info->checkpoint ) mpi_checkpoint_destroy(server_info->checkpoint);
+    if ( server_info->sparse ) mpi_sparse_matrix_destroy(server_info->sparse);
+    if ( server_info->lazy ) mpi_lazy_matrix_destroy(server_info->lazy);
+    if ( server_info->features ) mpi_feature_cache_destroy(server_info->features);
+    
     // We own the sub-matrix, deallocate it:
     if ( server_info->local_sub_matrix && (server_info->flags & mpi_server_thread_flag_owns_local_sub_matrix) )
         free((void*)server_info->local_sub_matrix);
@@ -331,6 +622,204 @@ mpi_server_thread_destroy(
 
 //
 
+bool
+mpi_server_thread_set_symmetry(
+    mpi_server_thread_t             *server_info,
+    mpi_server_thread_symmetry_t    symmetry
+)
+{
+    if ( symmetry == mpi_server_thread_symmetry_none ) {
+        if ( server_info->symmetry == mpi_server_thread_symmetry_packed ) return false;
+    } else if ( server_info->dim_global[0] != server_info->dim_global[1] ) {
+        return false;
+    } else if ( symmetry == mpi_server_thread_symmetry_packed ) {
+        base_int_t      d = server_info->dim_per_rank[0];
+        base_int_t      block_major, block_minor;
+        
+        if ( d != server_info->dim_per_rank[1] ) return false;
+        if ( server_info->is_row_major ) {
+            block_major = server_info->local_sub_matrix_row_range.start / d;
+            block_minor = server_info->local_sub_matrix_col_range.start / d;
+        } else {
+            block_major = server_info->local_sub_matrix_col_range.start / d;
+            block_minor = server_info->local_sub_matrix_row_range.start / d;
+        }
+        if ( server_info->local_sub_matrix_length > 0 ) {
+            if ( block_minor < block_major ) server_info->local_sub_matrix_length = 0;
+            else if ( block_minor == block_major ) server_info->local_sub_matrix_length = d * (d + 1) / 2;
+        }
+        if ( server_info->flags & mpi_server_thread_flag_owns_local_sub_matrix ) {
+            if ( server_info->local_sub_matrix_length == 0 ) {
+                free((void*)server_info->local_sub_matrix);
+                server_info->local_sub_matrix = NULL;
+                server_info->flags &= ~mpi_server_thread_flag_owns_local_sub_matrix;
+            } else {
+                matrix_element_t    *new_ptr = (matrix_element_t*)realloc(server_info->local_sub_matrix, sizeof(matrix_element_t) * server_info->local_sub_matrix_length);
+                
+                if ( new_ptr ) server_info->local_sub_matrix = new_ptr;
+            }
+        }
+    }
+    server_info->symmetry = symmetry;
+    if ( server_info->assignable_work )
+        server_info->assignable_work->geometry.is_triangular = (symmetry != mpi_server_thread_symmetry_none);
+    return true;
+}
+
+//
+
+bool
+mpi_server_thread_set_sparse(
+    mpi_server_thread_t *server_info,
+    double              threshold
+)
+{
+    if ( ! server_info->sparse ) {
+        server_info->sparse = mpi_sparse_matrix_create(server_info, threshold);
+        if ( ! server_info->sparse ) return false;
+    }
+    server_info->sparse->threshold = threshold;
+    
+    // The dense storage is no longer needed:
+    if ( server_info->local_sub_matrix && (server_info->flags & mpi_server_thread_flag_owns_local_sub_matrix) )
+        free((void*)server_info->local_sub_matrix);
+    server_info->flags &= ~mpi_server_thread_flag_owns_local_sub_matrix;
+    server_info->local_sub_matrix = NULL;
+    server_info->local_sub_matrix_length = 0;
+    return true;
+}
+
+//
+
+bool
+mpi_server_thread_set_lazy(
+    mpi_server_thread_t             *server_info,
+    base_int_t                      tile_dim,
+    mpi_server_thread_produce_fn    produce,
+    const void                      *context
+)
+{
+    if ( server_info->lazy ) return false;
+    server_info->lazy = mpi_lazy_matrix_create(server_info, tile_dim, produce, context);
+    if ( ! server_info->lazy ) return false;
+    
+    // The dense storage is no longer needed:
+    if ( server_info->local_sub_matrix && (server_info->flags & mpi_server_thread_flag_owns_local_sub_matrix) )
+        free((void*)server_info->local_sub_matrix);
+    server_info->flags &= ~mpi_server_thread_flag_owns_local_sub_matrix;
+    server_info->local_sub_matrix = NULL;
+    server_info->local_sub_matrix_length = 0;
+    return true;
+}
+
+//
+
+static bool
+__mpi_server_thread_block_is_final(
+    mpi_server_thread_t     *server_info,
+    int                     rank,
+    int                     slot
+)
+{
+    mpi_assignable_work_t   *work_units = server_info->assignable_work;
+    base_int_t              slot_length = server_info->is_row_major ? server_info->dim_per_rank[0] : server_info->dim_per_rank[1];
+    int_range_t             rows, cols, spans[2];
+    bool                    is_using_slot = (slot < 0);
+    int                     n_spans = 1, k;
+    
+    // The block's own rows (columns) write to it; with mirrored symmetry
+    // so do the rows (columns) that are its columns (rows) transposed:
+    __mpi_server_thread_rank_ranges(server_info, rank, &rows, &cols);
+    spans[0] = server_info->is_row_major ? rows : cols;
+    if ( server_info->symmetry == mpi_server_thread_symmetry_mirror ) spans[n_spans++] = server_info->is_row_major ? cols : rows;
+    for ( k = 0; k < n_spans; k++ ) {
+        int                 s = spans[k].start / slot_length,
+                            s_max = (int_range_get_max(spans[k]) - 1) / slot_length;
+        
+        if ( s_max >= work_units->n_slots ) s_max = work_units->n_slots - 1;
+        for ( ; s <= s_max; s++ ) {
+            if ( ! mpi_assignable_work_slot_is_completed(work_units, s) ) return false;
+            if ( s == slot ) is_using_slot = true;
+        }
+    }
+    return is_using_slot;
+}
+
+//
+
+static void
+__mpi_server_thread_notify_block_completed(
+    mpi_server_thread_t *server_info,
+    int                 rank
+)
+{
+    mpi_server_thread_msg_t msg = {
+                                .msg_type = mpi_server_thread_msg_type_memory,
+                                .msg_id = mpi_server_thread_msg_id_memory_block_completed,
+                                .p_low = int_pair_make(0, 0),
+                                .p_high = int_pair_make(0, 0),
+                                .value = 0.0
+                            };
+    
+    if ( rank == server_info->dist_rank )
+        __mpi_server_thread_block_completed(server_info);
+    else
+        MPI_Send(&msg, 1, mpi_get_msg_datatype(), rank, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+}
+
+//
+
+static void
+__mpi_server_thread_slot_completed(
+    mpi_assignable_work_t   *work_units,
+    int                     slot,
+    const void              *context
+)
+{
+    mpi_server_thread_t     *server_info = (mpi_server_thread_t*)context;
+    int                     rank, n_blocks = server_info->dim_blocks[0] * server_info->dim_blocks[1];
+    
+    (void)work_units;
+    for ( rank = 0; rank < n_blocks; rank++ )
+        if ( __mpi_server_thread_block_is_final(server_info, rank, slot) ) __mpi_server_thread_notify_block_completed(server_info, rank);
+}
+
+//
+
+void
+mpi_server_thread_track_block_completion(
+    mpi_server_thread_t                 *server_info,
+    mpi_server_thread_block_callback_t  callback,
+    const void                          *context
+)
+{
+    server_info->is_tracking_blocks = true;
+    server_info->block_completed_callback = callback;
+    server_info->block_completed_context = context;
+    if ( server_info->assignable_work ) {
+        int             rank, n_blocks = server_info->dim_blocks[0] * server_info->dim_blocks[1];
+        
+        server_info->assignable_work->slot_completed_callback = __mpi_server_thread_slot_completed;
+        server_info->assignable_work->slot_completed_context = server_info;
+        
+        // Blocks restored in full need no more work:
+        for ( rank = 0; rank < n_blocks; rank++ )
+            if ( __mpi_server_thread_block_is_final(server_info, rank, -1) ) __mpi_server_thread_notify_block_completed(server_info, rank);
+    }
+}
+
+//
+
+bool
+mpi_server_thread_block_is_completed(
+    mpi_server_thread_t *server_info
+)
+{
+    return __atomic_load_n(&server_info->is_block_completed, __ATOMIC_ACQUIRE);
+}
+
+//
+
 bool
 mpi_server_thread_start(
     mpi_server_thread_t *server_info
@@ -428,7 +917,18 @@ mpi_server_thread_index_global_to_local_offset(
     int_pair_t          p
 )
 {
+    p = mpi_server_thread_index_to_stored(server_info->symmetry == mpi_server_thread_symmetry_packed, server_info->is_row_major, p);
     if ( mpi_server_thread_index_global_to_local(server_info, &p) ) {
+        if ( (server_info->symmetry == mpi_server_thread_symmetry_packed) &&
+             (server_info->local_sub_matrix_row_range.start == server_info->local_sub_matrix_col_range.start) )
+        {
+            // Diagonal block, packed by rows (row-major) or columns:
+            base_int_t  d = server_info->dim_per_rank[0];
+            base_int_t  a = server_info->is_row_major ? p.i : p.j,
+                        b = server_info->is_row_major ? p.j : p.i;
+            
+            return a * d - a * (a - 1) / 2 + (b - a);
+        }
         if ( server_info->is_row_major ) return int_pair_get_i_major_offset(p, server_info->dim_per_rank[1]);
         return int_pair_get_j_major_offset(p, server_info->dim_per_rank[0]);
     }
@@ -443,6 +943,7 @@ mpi_server_thread_index_to_rank(
     int_pair_t          p
 )
 {
+    p = mpi_server_thread_index_to_stored(server_info->symmetry == mpi_server_thread_symmetry_packed, server_info->is_row_major, p);
     if ( server_info->is_row_major ) {
         return (p.i / server_info->dim_per_rank[0]) * server_info->dim_blocks[1] +
                (p.j / server_info->dim_per_rank[1]);
@@ -454,6 +955,177 @@ mpi_server_thread_index_to_rank(
 
 //
 
+int
+mpi_server_thread_rank_to_slot(
+    mpi_server_thread_t *server_info,
+    int                 rank
+)
+{
+    mpi_assignable_work_geometry_t  geometry = __mpi_server_thread_geometry(server_info);
+    
+    return mpi_assignable_work_geometry_rank_to_slot(&geometry, rank);
+}
+
+//
+
+bool
+mpi_server_thread_static_unit(
+    mpi_server_thread_t *server_info,
+    int                 rank,
+    int_pair_t          *p_low,
+    int_pair_t          *p_high
+)
+{
+    mpi_assignable_work_geometry_t  geometry = __mpi_server_thread_geometry(server_info);
+    
+    return mpi_assignable_work_geometry_static_unit(&geometry, server_info->static_fraction, rank, p_low, p_high);
+}
+
+//
+
+void
+mpi_server_thread_range_to_unit(
+    mpi_server_thread_t *server_info,
+    int_range_t         r,
+    int_pair_t          *p_low,
+    int_pair_t          *p_high
+)
+{
+    mpi_assignable_work_geometry_t  geometry = __mpi_server_thread_geometry(server_info);
+    
+    mpi_assignable_work_geometry_range_to_unit(&geometry, r, p_low, p_high);
+}
+
+//
+
+static bool
+__mpi_server_thread_first_range_enumerator(
+    int_range_t r,
+    const void  *context
+)
+{
+    *((int_range_t*)context) = r;
+    return false;
+}
+
+int
+mpi_server_thread_send_work_unit(
+    mpi_server_thread_t     *server_info,
+    mpi_server_thread_msg_t *msg,
+    int                     set_msg_id,
+    int_set_ref             unit,
+    int                     dest,
+    int                     tag
+)
+{
+    int_range_t             r = int_range_make(0, 0);
+    uint8_t                 packed_local[256], *packed = packed_local;
+    size_t                  n_packed;
+    int                     mpi_rc;
+    
+    // A single range travels in the message itself:
+    int_set_enumerate_ranges(unit, __mpi_server_thread_first_range_enumerator, &r);
+    if ( r.length == int_set_get_length(unit) ) {
+        mpi_server_thread_range_to_unit(server_info, r, &msg->p_low, &msg->p_high);
+        return MPI_Send(msg, 1, mpi_get_msg_datatype(), dest, tag, MPI_COMM_WORLD);
+    }
+    
+    n_packed = int_set_pack_size(unit);
+    if ( (n_packed > sizeof(packed_local)) && ! (packed = (uint8_t*)malloc(n_packed)) ) {
+        mpi_printf(-1, "ERROR:  unable to allocate %lu bytes to pack a work unit", (unsigned long)n_packed);
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    int_set_pack(unit, packed, n_packed);
+    msg->msg_id = set_msg_id;
+    msg->p_low = int_pair_make(n_packed, 0);
+    msg->p_high = int_pair_make(0, 0);
+    mpi_rc = MPI_Send(msg, 1, mpi_get_msg_datatype(), dest, tag, MPI_COMM_WORLD);
+    if ( mpi_rc == MPI_SUCCESS ) mpi_rc = MPI_Send(packed, n_packed, MPI_BYTE, dest, mpi_server_thread_work_set_tag, MPI_COMM_WORLD);
+    if ( packed != packed_local ) free((void*)packed);
+    return mpi_rc;
+}
+
+//
+
+bool
+mpi_server_thread_recv_work_unit(
+    mpi_server_thread_t             *server_info,
+    const mpi_server_thread_msg_t   *msg,
+    int                             source,
+    int_set_ref                     unit
+)
+{
+    uint8_t                         packed_local[256], *packed = packed_local;
+    size_t                          n_packed;
+    bool                            rc;
+    
+    if ( (msg->msg_id != mpi_server_thread_msg_id_work_allocated_set) &&
+         (msg->msg_id != mpi_server_thread_msg_id_work_set_complete_and_allocate) )
+    {
+        int_set_clear(unit);
+        return int_set_push_range(unit, (server_info->is_row_major) ?
+                        int_range_make(msg->p_low.i, msg->p_high.i - msg->p_low.i)
+                      : int_range_make(msg->p_low.j, msg->p_high.j - msg->p_low.j));
+    }
+    
+    n_packed = msg->p_low.i;
+    if ( (n_packed > sizeof(packed_local)) && ! (packed = (uint8_t*)malloc(n_packed)) ) {
+        mpi_printf(-1, "ERROR:  unable to allocate %lu bytes to receive a work unit", (unsigned long)n_packed);
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    rc = (MPI_Recv(packed, n_packed, MPI_BYTE, source, mpi_server_thread_work_set_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE) == MPI_SUCCESS) &&
+         int_set_unpack(unit, packed, n_packed);
+    if ( packed != packed_local ) free((void*)packed);
+    return rc;
+}
+
+//
+
+static void
+__mpi_server_thread_write_batch_send(
+    mpi_server_thread_t *server_info,
+    int                 dest
+)
+{
+    mpi_server_thread_write_batch_t *b = &server_info->write_batches[dest];
+    mpi_server_thread_msg_t         msg = {
+                                        .msg_type = mpi_server_thread_msg_type_memory,
+                                        .msg_id = mpi_server_thread_msg_id_memory_write_batch,
+                                        .p_low = int_pair_make(b->n_elements, 0),
+                                        .p_high = int_pair_make(0, 0),
+                                        .value = 0.0
+                                    };
+    
+    if ( b->n_elements == 0 ) return;
+    MPI_Send(&msg, 1, mpi_get_msg_datatype(), dest, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+    
+    // A synchronous send lets us know when the batch has been received
+    // (needed for checkpoints and before shutting down the server threads):
+    MPI_Issend(
+        b->elements + b->buffer_idx * server_info->write_batch_size, b->n_elements, mpi_get_element_datatype(),
+        dest, mpi_server_thread_batch_tag, MPI_COMM_WORLD, &b->requests[b->buffer_idx]);
+    b->buffer_idx = (b->buffer_idx + 1) % server_info->write_batch_depth;
+    b->n_elements = 0;
+}
+
+//
+
+static void
+__mpi_server_thread_write_batch_wait_all(
+    mpi_server_thread_t *server_info
+)
+{
+    int                 dest = 0;
+    
+    while ( dest < server_info->dist_size ) {
+        mpi_server_thread_write_batch_t *b = &server_info->write_batches[dest++];
+        
+        if ( b->requests ) MPI_Waitall(server_info->write_batch_depth, b->requests, MPI_STATUSES_IGNORE);
+    }
+}
+
+//
+
 void
 mpi_server_thread_memory_write(
     mpi_server_thread_t *server_info,
@@ -461,10 +1133,48 @@ mpi_server_thread_memory_write(
     double              value
 )
 {
-    base_int_t          local_offset = mpi_server_thread_index_global_to_local_offset(server_info, p);
+    base_int_t          local_offset;
     
+    if ( server_info->sparse && mpi_sparse_matrix_is_dropped(server_info->sparse, value) ) return;
+    local_offset = mpi_server_thread_index_global_to_local_offset(server_info, p);
     if ( local_offset >= 0 ) {
-        server_info->local_sub_matrix[local_offset] = value;
+        if ( server_info->sparse ) {
+            mpi_server_thread_element_t element = { .p = p, .value = matrix_element_from_double(value) };
+            
+            mpi_sparse_matrix_append(server_info->sparse, &element, 1);
+        } else {
+            server_info->local_sub_matrix[local_offset] = matrix_element_from_double(value);
+            if ( server_info->checkpoint ) mpi_checkpoint_mark_dirty(server_info->checkpoint, local_offset);
+        }
+    } else if ( server_info->write_batches ) {
+        int                             dest = mpi_server_thread_index_to_rank(server_info, p);
+        mpi_server_thread_write_batch_t *b = &server_info->write_batches[dest];
+        
+        pthread_mutex_lock(&b->lock);
+        if ( ! b->requests ) {
+            // First write to this destination:
+            void        *new_ptr = malloc(server_info->write_batch_depth * (sizeof(MPI_Request) + server_info->write_batch_size * sizeof(mpi_server_thread_element_t)));
+            int         i = 0;
+            
+            if ( ! new_ptr ) {
+                mpi_printf(-1, "ERROR:  unable to allocate write batch buffers");
+                MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+            }
+            b->requests = (MPI_Request*)new_ptr;
+            b->elements = (mpi_server_thread_element_t*)(b->requests + server_info->write_batch_depth);
+            while ( i < server_info->write_batch_depth ) b->requests[i++] = MPI_REQUEST_NULL;
+        }
+        if ( (b->n_elements == 0) && (b->requests[b->buffer_idx] != MPI_REQUEST_NULL) ) {
+            // Buffer is still in flight, wait for it:
+            double      t0 = MPI_Wtime();
+            
+            MPI_Wait(&b->requests[b->buffer_idx], MPI_STATUS_IGNORE);
+            b->wait_time += MPI_Wtime() - t0;
+        }
+        b->elements[b->buffer_idx * server_info->write_batch_size + b->n_elements].p = p;
+        b->elements[b->buffer_idx * server_info->write_batch_size + b->n_elements].value = matrix_element_from_double(value);
+        if ( ++b->n_elements == server_info->write_batch_size ) __mpi_server_thread_write_batch_send(server_info, dest);
+        pthread_mutex_unlock(&b->lock);
     } else {
         // Send to the rank that handles this sub-matrix:
         mpi_server_thread_msg_t    msg = {
@@ -474,7 +1184,9 @@ mpi_server_thread_memory_write(
                                         .p_high = p,
                                         .value = value
                                     };
-        MPI_Send(
+        // With checkpointing we must know the value was received before the
+        // work unit is reported complete:
+        (server_info->checkpoint ? MPI_Ssend : MPI_Send)(
             &msg, 1, mpi_get_msg_datatype(),
             mpi_server_thread_index_to_rank(server_info, p),
             mpi_server_thread_msg_tag,
@@ -484,247 +1196,293 @@ mpi_server_thread_memory_write(
 
 //
 
-void
-mpi_server_thread_summary(
+static base_int_t
+__mpi_server_thread_segment_offset(
     mpi_server_thread_t *server_info,
-    FILE                *stream
+    int_pair_t          p,
+    base_int_t          length
 )
 {
-    fprintf(stream, "mpi_server@%p (roles=%X, dim_global=(" BASE_INT_FMT "," BASE_INT_FMT "), dim_per_rank=(" BASE_INT_FMT "," BASE_INT_FMT "),\n"
-                    "               dim_blocks=(" BASE_INT_FMT "," BASE_INT_FMT "), is_row_major=%s, dist_rank=%d,\n"
-                    "               dist_size=%d, local_sub_matrix_row_range=[" BASE_INT_FMT "," BASE_INT_FMT "],\n"
-                    "               local_sub_matrix_col_range=[" BASE_INT_FMT "," BASE_INT_FMT "]) {\n",
-                    server_info, server_info->roles, server_info->dim_global[0], server_info->dim_global[1],
-                    server_info->dim_per_rank[0], server_info->dim_per_rank[1], server_info->dim_blocks[0],
-                    server_info->dim_blocks[1], server_info->is_row_major ? "true" : "false",
-                    server_info->dist_rank, server_info->dist_size, server_info->local_sub_matrix_row_range.start,
-                    int_range_get_end(server_info->local_sub_matrix_row_range),
-                    server_info->local_sub_matrix_col_range.start,
-                    int_range_get_end(server_info->local_sub_matrix_col_range)
-                );
-    if ( server_info->roles & mpi_server_thread_role_work_unit_mgr ) {
-        fprintf(stream, "    assignable_work: ");
-        mpi_assignable_work_summary(server_info->assignable_work, stream);
-    }
-    fprintf(stream, "}\n");
+    base_int_t          offset_lo = mpi_server_thread_index_global_to_local_offset(server_info, p), offset_hi;
+    
+    if ( (offset_lo < 0) || (length <= 0) ) return -1;
+    if ( server_info->is_row_major ) p.j += length - 1;
+    else p.i += length - 1;
+    
+    // Both ends local and length apart means the same block row/column:
+    offset_hi = mpi_server_thread_index_global_to_local_offset(server_info, p);
+    if ( offset_hi - offset_lo != length - 1 ) return -1;
+    return offset_lo;
 }
 
-//
-////
 //
 
-mpi_assignable_work_t*
-mpi_assignable_work_create(
-    mpi_server_thread_t     *server_info
+matrix_element_t*
+mpi_server_thread_local_segment(
+    mpi_server_thread_t *server_info,
+    int_pair_t          p,
+    base_int_t          length
 )
 {
-    mpi_assignable_work_t   *new_work;
-    void                    *new_ptr;
-    size_t                  work_rec_size = sizeof(mpi_assignable_work_t);
+    base_int_t          offset;
     
-    // Space for the three lists of int_set_ref's for the block rows/cols:
-    work_rec_size += 3 * sizeof(int_set_ref) * ((server_info->is_row_major) ? server_info->dim_blocks[0] : server_info->dim_blocks[1]);
+    if ( server_info->sparse ) return NULL;
+    offset = __mpi_server_thread_segment_offset(server_info, p, length);
+    return (offset < 0) ? NULL : (server_info->local_sub_matrix + offset);
+}
+
+//
+
+void
+mpi_server_thread_memory_write_segment(
+    mpi_server_thread_t *server_info,
+    int_pair_t          p,
+    base_int_t          length,
+    const double        *values
+)
+{
+    matrix_element_t    *local_values;
     
-    new_ptr = malloc(work_rec_size);
-    if ( new_ptr ) {
-        memset(new_ptr, 0, work_rec_size);
-        new_work = (mpi_assignable_work_t*)new_ptr;
-        new_work->server_info = server_info;
-        new_work->n_slots = (server_info->is_row_major) ? server_info->dim_blocks[0] : server_info->dim_blocks[1];
-        new_work->available_indices = (int_set_ref*)(new_ptr + sizeof(mpi_assignable_work_t));
-        new_work->assigned_indices = new_work->available_indices + new_work->n_slots;
-        new_work->completed_indices = new_work->assigned_indices + new_work->n_slots;
-        pthread_mutex_init(&new_work->alloc_lock, NULL);
+    if ( server_info->sparse && (__mpi_server_thread_segment_offset(server_info, p, length) >= 0) ) {
+        mpi_sparse_matrix_append_segment(server_info->sparse, p, length, values);
+        return;
+    }
+    local_values = mpi_server_thread_local_segment(server_info, p, length);
+    if ( local_values ) {
+        if ( (const void*)local_values != (const void*)values ) matrix_element_from_double_n(local_values, values, length);
+        if ( server_info->checkpoint ) {
+            mpi_checkpoint_mark_dirty_range(server_info->checkpoint, local_values - server_info->local_sub_matrix, length);
+        }
+    } else {
+        base_int_t      *k = server_info->is_row_major ? &p.j : &p.i;
+        base_int_t      k_hi = *k + length;
         
-        if ( server_info->is_row_major ) {
-            int         i = 0;
-            base_int_t  r = 0;
-            
-            while ( i < new_work->n_slots ) {
-                new_work->available_indices[i] = int_set_create();
-                new_work->assigned_indices[i] = int_set_create();
-                new_work->completed_indices[i] = int_set_create();
-                
-                // Push the index set for this block to the available list:
-                int_set_push_range(new_work->available_indices[i++], int_range_make(r, server_info->dim_per_rank[0]));
-                
-                // Next chunk:
-                r += server_info->dim_per_rank[0];
-            }
-        } else {
-            int         i = 0;
-            base_int_t  c = 0;
-            
-            while ( i < new_work->n_slots ) {
-                new_work->available_indices[i] = int_set_create();
-                new_work->assigned_indices[i] = int_set_create();
-                new_work->completed_indices[i] = int_set_create();
-                
-                // Push the index set for this block to the available list:
-                int_set_push_range(new_work->available_indices[i++], int_range_make(c, server_info->dim_per_rank[1]));
-                
-                // Next chunk:
-                c += server_info->dim_per_rank[1];
-            }
+        while ( *k < k_hi ) {
+            mpi_server_thread_memory_write(server_info, p, *values++);
+            (*k)++;
         }
     }
-    return new_work;
 }
 
 //
 
 void
-mpi_assignable_work_destroy(
-    mpi_assignable_work_t   *work_units
+mpi_server_thread_block_send_begin(
+    mpi_server_thread_t             *server_info,
+    mpi_server_thread_block_send_t  *send
 )
 {
-    int                     i = 0;
+    send->dest = mpi_server_thread_index_to_rank(server_info, send->p);
+    send->is_partitioned = false;
+    send->request = MPI_REQUEST_NULL;
+#ifdef MPI_SERVER_THREAD_HAVE_PARTITIONED
+    // Completion of a partitioned send says nothing about receipt, so
+    // checkpoints get a synchronous send of the whole block instead.
+    // Producers that fetch feature inputs need the destination's server
+    // thread while the block is produced, so it must not be held by a
+    // partitioned receive:
+    if ( ! server_info->checkpoint && ! server_info->features ) {
+        mpi_server_thread_msg_t     msg = {
+                                        .msg_type = mpi_server_thread_msg_type_memory,
+                                        .msg_id = mpi_server_thread_msg_id_memory_write_block,
+                                        .p_low = send->p,
+                                        .p_high = int_pair_make(send->n_partitions, send->partition_length),
+                                        .value = 1.0
+                                    };
+        
+        send->is_partitioned = true;
+        MPI_Send(&msg, 1, mpi_get_msg_datatype(), send->dest, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+        MPI_Psend_init(send->values, (int)send->n_partitions, send->partition_length, MPI_MATRIX_ELEMENT_T,
+                send->dest, mpi_server_thread_block_tag, MPI_COMM_WORLD, MPI_INFO_NULL, &send->request);
+        MPI_Start(&send->request);
+    }
+#endif
+}
+
+//
+
+void
+mpi_server_thread_block_send_ready(
+    mpi_server_thread_t             *server_info,
+    mpi_server_thread_block_send_t  *send,
+    base_int_t                      partition
+)
+{
+#ifdef MPI_SERVER_THREAD_HAVE_PARTITIONED
+    if ( send->is_partitioned ) MPI_Pready((int)partition, send->request);
+#else
+    (void)server_info;
+    (void)send;
+    (void)partition;
+#endif
+}
+
+//
+
+void
+mpi_server_thread_block_send_end(
+    mpi_server_thread_t             *server_info,
+    mpi_server_thread_block_send_t  *send
+)
+{
+    mpi_server_thread_msg_t         msg = {
+                                        .msg_type = mpi_server_thread_msg_type_memory,
+                                        .msg_id = mpi_server_thread_msg_id_memory_write_block,
+                                        .p_low = send->p,
+                                        .p_high = int_pair_make(send->n_partitions, send->partition_length),
+                                        .value = 0.0
+                                    };
     
-    while ( i < work_units->n_slots ) {
-        int_set_destroy(work_units->available_indices[i]);
-        int_set_destroy(work_units->assigned_indices[i]);
-        int_set_destroy(work_units->completed_indices[i++]);
+#ifdef MPI_SERVER_THREAD_HAVE_PARTITIONED
+    if ( send->is_partitioned ) {
+        MPI_Wait(&send->request, MPI_STATUS_IGNORE);
+        MPI_Request_free(&send->request);
+        return;
     }
-    free((void*)work_units);
+#endif
+    // The header goes out only now that the values are ready, so the
+    // destination's server thread never waits on a producer (and keeps
+    // serving reads that producer may depend on).  With checkpointing
+    // we must know the values were received before the work unit is
+    // reported complete:
+    MPI_Send(&msg, 1, mpi_get_msg_datatype(), send->dest, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+    (server_info->checkpoint ? MPI_Ssend : MPI_Send)(
+        send->values, send->n_partitions * send->partition_length, MPI_MATRIX_ELEMENT_T,
+        send->dest, mpi_server_thread_block_tag, MPI_COMM_WORLD);
 }
 
 //
 
-bool
-mpi_assignable_work_all_completed(
-    mpi_assignable_work_t   *work_units
+void
+mpi_server_thread_memory_flush(
+    mpi_server_thread_t *server_info
 )
 {
-    int                     i = 0;
+    int                 dest = 0;
     
-    pthread_mutex_lock(&work_units->alloc_lock);
-    while ( i < work_units->n_slots ) {
-        if ( int_set_get_length(work_units->available_indices[i]) > 0 ) break;
-        if ( int_set_get_length(work_units->assigned_indices[i]) > 0 ) break;
-        if ( int_set_get_length(work_units->completed_indices[i]) < ((work_units->server_info->is_row_major) ? work_units->server_info->dim_per_rank[0] : work_units->server_info->dim_per_rank[0]) ) break;
-        i++;
+    if ( ! server_info->write_batches ) return;
+    while ( dest < server_info->dist_size ) {
+        mpi_server_thread_write_batch_t *b = &server_info->write_batches[dest];
+        
+        pthread_mutex_lock(&b->lock);
+        __mpi_server_thread_write_batch_send(server_info, dest++);
+        server_info->write_wait_time += b->wait_time;
+        b->wait_time = 0.0;
+        pthread_mutex_unlock(&b->lock);
     }
-    pthread_mutex_unlock(&work_units->alloc_lock);
-    return (i == work_units->n_slots);
+    if ( server_info->checkpoint ) __mpi_server_thread_write_batch_wait_all(server_info);
 }
 
 //
 
-bool
-mpi_assignable_work_next_unit(
-    mpi_assignable_work_t   *work_units,
-    int                     target_rank,
-    int                     primary_slot,
-    int_pair_t              *p_low,
-    int_pair_t              *p_high
+void
+mpi_server_thread_memory_sync(
+    mpi_server_thread_t     *server_info
 )
 {
-    base_int_t              next_index;
-    bool                    rc = false;
+    mpi_server_thread_msg_t msg = {
+                                .msg_type = mpi_server_thread_msg_type_memory,
+                                .msg_id = mpi_server_thread_msg_id_memory_sync,
+                                .p_low = int_pair_make(0, 0),
+                                .p_high = int_pair_make(0, 0),
+                                .value = 0.0
+                            };
+    int                     rank, n_blocks = server_info->dim_blocks[0] * server_info->dim_blocks[1];
+    
+    mpi_server_thread_memory_flush(server_info);
+    if ( ! server_info->is_tracking_blocks ) return;
     
-    pthread_mutex_lock(&work_units->alloc_lock);
+    // Each server thread handles our messages in order, so once it echoes
+    // the sync every earlier write from us has been applied:
+    for ( rank = 0; rank < n_blocks; rank++ )
+        if ( rank != server_info->dist_rank ) MPI_Send(&msg, 1, mpi_get_msg_datatype(), rank, mpi_server_thread_msg_tag, MPI_COMM_WORLD);
+    for ( rank = 0; rank < n_blocks; rank++ )
+        if ( rank != server_info->dist_rank ) MPI_Recv(&msg, 1, mpi_get_msg_datatype(), rank, mpi_server_thread_sync_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
 
-    // Try to get a row from the preferred slot:
-    if ( int_set_pop_next_int(work_units->available_indices[primary_slot], &next_index) ) {
-        //mpi_printf(-1, "allocated index " BASE_INT_FMT " from primary slot %d for rank %d", next_index, primary_slot, target_rank);
-        int_set_push_int(work_units->assigned_indices[primary_slot], next_index);
-        if ( work_units->server_info->is_row_major ) {
-            p_low->i = next_index; p_high->i = next_index + 1;
-            p_low->j = 0; p_high->j = work_units->server_info->dim_global[1];
-        } else {
-            p_low->j = next_index; p_high->j = next_index + 1;
-            p_low->i = 0; p_high->i = work_units->server_info->dim_global[0];
-        }        
-        rc = true;
-    } else {
-        // Preferred slot was empty, take a work unit from the slot with the
-        // most work remaining:
-        int         slot_idx = 0, slot_idx_max = -1;
-        base_int_t  avail_max = 0;
+//
+
+bool
+mpi_server_thread_set_write_batching(
+    mpi_server_thread_t *server_info,
+    base_int_t          batch_size,
+    int                 batch_depth
+)
+{
+    if ( server_info->write_batches ) {
+        int             dest = 0;
         
-        while ( slot_idx < work_units->n_slots ) {
-            if ( slot_idx != primary_slot ) {
-                int l = int_set_get_length(work_units->available_indices[slot_idx]);
-                
-                if ( l > avail_max ) {
-                    slot_idx_max = slot_idx;
-                    avail_max = l;
-                }
-            }
-            slot_idx++;
-        }
-        if ( slot_idx_max >= 0 ) {
-            if ( int_set_pop_next_int(work_units->available_indices[slot_idx_max], &next_index) ) {
-                //mpi_printf(-1, "allocated index " BASE_INT_FMT " from alternate slot %d for rank %d", next_index, slot_idx_max, target_rank);
-                int_set_push_int(work_units->assigned_indices[slot_idx_max], next_index);
-                if ( work_units->server_info->is_row_major ) {
-                    p_low->i = next_index; p_high->i = next_index + 1;
-                    p_low->j = 0; p_high->j = work_units->server_info->dim_global[1];
-                } else {
-                    p_low->j = next_index; p_high->j = next_index + 1;
-                    p_low->i = 0; p_high->i = work_units->server_info->dim_global[0];
-                }        
-                rc = true;
-            }
+        mpi_server_thread_memory_flush(server_info);
+        __mpi_server_thread_write_batch_wait_all(server_info);
+        while ( dest < server_info->dist_size ) {
+            if ( server_info->write_batches[dest].requests ) free((void*)server_info->write_batches[dest].requests);
+            pthread_mutex_destroy(&server_info->write_batches[dest].lock);
+            dest++;
         }
+        free((void*)server_info->write_batches);
+        server_info->write_batches = NULL;
     }
-    pthread_mutex_unlock(&work_units->alloc_lock);
-    return rc;
+    server_info->write_batch_size = 1;
+    server_info->write_batch_depth = 1;
+    if ( batch_size > 1 ) {
+        // Buffers for each destination are allocated on first use:
+        server_info->write_batches = (mpi_server_thread_write_batch_t*)calloc(server_info->dist_size, sizeof(mpi_server_thread_write_batch_t));
+        int             dest = 0;
+        
+        if ( ! server_info->write_batches ) return false;
+        while ( dest < server_info->dist_size ) pthread_mutex_init(&server_info->write_batches[dest++].lock, NULL);
+        server_info->write_batch_size = batch_size;
+        server_info->write_batch_depth = (batch_depth > 1) ? batch_depth : 1;
+    }
+    return true;
 }
 
 //
 
+static pthread_mutex_t __mpi_server_thread_throttle_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void
-mpi_assignable_work_complete(
-    mpi_assignable_work_t   *work_units,
-    int_pair_t              p_low,
-    int_pair_t              p_high
+mpi_server_thread_throttle(
+    mpi_server_thread_t *server_info
 )
 {
-    pthread_mutex_lock(&work_units->alloc_lock);
-    
-    if ( work_units->server_info->is_row_major ) {
-        base_int_t          i = p_low.i;
+    if ( (server_info->throttle_backlog > 0) && (server_info->request_backlog >= server_info->throttle_backlog) ) {
+        double          t0 = MPI_Wtime();
+        int             n_sleeps = 0;
         
-        while ( i < p_high.i ) {
-            int     slot = i / work_units->server_info->dim_per_rank[0];
-            
-            int_set_remove_int(work_units->assigned_indices[slot], i);
-            int_set_push_int(work_units->completed_indices[slot], i++);
-        }
-    } else {
-        base_int_t          i = p_low.j;
+        while ( (server_info->request_backlog >= server_info->throttle_backlog) && (n_sleeps++ < 100) ) usleep(100);
         
-        while ( i < p_high.j ) {
-            int     slot = i / work_units->server_info->dim_per_rank[1];
-            
-            int_set_remove_int(work_units->assigned_indices[slot], i);
-            int_set_push_int(work_units->completed_indices[slot], i++);
-        }
+        // Any of the rank's producer threads may be throttled:
+        pthread_mutex_lock(&__mpi_server_thread_throttle_lock);
+        server_info->throttle_time += MPI_Wtime() - t0;
+        pthread_mutex_unlock(&__mpi_server_thread_throttle_lock);
     }
-    
-    pthread_mutex_unlock(&work_units->alloc_lock);
 }
 
 //
 
 void
-mpi_assignable_work_summary(
-    mpi_assignable_work_t   *work_units,
-    FILE                    *stream
+mpi_server_thread_summary(
+    mpi_server_thread_t *server_info,
+    FILE                *stream
 )
 {
-    int                     i = 0;
-    
-    fprintf(stream, "mpi_assignable_work@%p (n_slots=%d) {\n", work_units, work_units->n_slots);
-    while ( i < work_units->n_slots ) {
-        fprintf(stream, "%d: available -> ", i);
-        int_set_summary(work_units->available_indices[i], stream);
-        fprintf(stream, "       assigned -> ");
-        int_set_summary(work_units->assigned_indices[i], stream);
-        fprintf(stream, "       completed -> ");
-        int_set_summary(work_units->completed_indices[i], stream);
-        i++;
+    fprintf(stream, "mpi_server@%p (roles=%X, dim_global=(" BASE_INT_FMT "," BASE_INT_FMT "), dim_per_rank=(" BASE_INT_FMT "," BASE_INT_FMT "),\n"
+                    "               dim_blocks=(" BASE_INT_FMT "," BASE_INT_FMT "), is_row_major=%s, dist_rank=%d,\n"
+                    "               dist_size=%d, local_sub_matrix_row_range=[" BASE_INT_FMT "," BASE_INT_FMT "],\n"
+                    "               local_sub_matrix_col_range=[" BASE_INT_FMT "," BASE_INT_FMT "]) {\n",
+                    server_info, server_info->roles, server_info->dim_global[0], server_info->dim_global[1],
+                    server_info->dim_per_rank[0], server_info->dim_per_rank[1], server_info->dim_blocks[0],
+                    server_info->dim_blocks[1], server_info->is_row_major ? "true" : "false",
+                    server_info->dist_rank, server_info->dist_size, server_info->local_sub_matrix_row_range.start,
+                    int_range_get_end(server_info->local_sub_matrix_row_range),
+                    server_info->local_sub_matrix_col_range.start,
+                    int_range_get_end(server_info->local_sub_matrix_col_range)
+                );
+    if ( server_info->roles & mpi_server_thread_role_work_unit_mgr ) {
+        fprintf(stream, "    assignable_work: ");
+        mpi_assignable_work_summary(server_info->assignable_work, stream);
     }
     fprintf(stream, "}\n");
 }
+
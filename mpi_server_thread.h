@@ -35,6 +35,8 @@
 #include "project_config.h"
 #include "int_set.h"
 #include "int_pair.h"
+#include "mpi_assignable_work.h"
+#include "matrix_element.h"
 
 #include "mpi.h"
 
@@ -52,6 +54,74 @@ extern const int mpi_server_thread_msg_tag;
  */
 extern const int mpi_client_thread_msg_tag;
 
+/*
+ * @constant mpi_server_thread_batch_tag
+ *
+ * MPI tag used to send/receive the elements of a batched memory
+ * write to a rank's server thread.
+ */
+extern const int mpi_server_thread_batch_tag;
+
+/*
+ * @constant mpi_server_thread_autotune_tag
+ *
+ * MPI tag used for the latency and bandwidth round trips between the
+ * root and the other ranks (see mpi_autotune.h).
+ */
+extern const int mpi_server_thread_autotune_tag;
+
+/*
+ * @constant mpi_server_thread_work_set_tag
+ *
+ * MPI tag used to send/receive the packed index set of a multi-range
+ * work unit (see int_set_pack()).
+ */
+extern const int mpi_server_thread_work_set_tag;
+
+/*
+ * @constant mpi_server_thread_block_tag
+ *
+ * MPI tag used to send/receive the values of a block write to a
+ * rank's server thread (see mpi_server_thread_block_send_begin()).
+ */
+extern const int mpi_server_thread_block_tag;
+
+/*
+ * @constant mpi_server_thread_lazy_tag
+ *
+ * MPI tag on which a server thread replies to lazy element and tile
+ * reads (see mpi_lazy_matrix.h).
+ */
+extern const int mpi_server_thread_lazy_tag;
+
+/*
+ * @constant mpi_server_thread_feature_tag
+ *
+ * MPI tag on which a server thread replies to requests for the row or
+ * column inputs of a feature kernel (see mpi_feature_cache.h).
+ */
+extern const int mpi_server_thread_feature_tag;
+
+/*
+ * @constant mpi_server_thread_sync_tag
+ *
+ * MPI tag on which a server thread acknowledges a memory_sync message
+ * (see mpi_server_thread_memory_sync()).
+ */
+extern const int mpi_server_thread_sync_tag;
+
+/*
+ * @defined MPI_SERVER_THREAD_HAVE_PARTITIONED
+ *
+ * Defined when block writes can use MPI-4 partitioned communication:
+ * the MPI library implements MPI 4.0 or newer and the build has not
+ * disabled it (the ENABLE_MPI_PARTITIONED option).  Otherwise each
+ * block is sent as a single message once all of it has been produced.
+ */
+#if defined(ENABLE_MPI_PARTITIONED) && (MPI_VERSION >= 4)
+#   define MPI_SERVER_THREAD_HAVE_PARTITIONED
+#endif
+
 /*
  * @function mpi_get_int_pair_datatype
  *
@@ -68,6 +138,25 @@ MPI_Datatype mpi_get_int_pair_datatype();
  */
 MPI_Datatype mpi_get_msg_datatype();
 
+/*
+ * @typedef mpi_server_thread_element_t
+ *
+ * A matrix element value and its global row,column index, as sent
+ * in batched memory writes.
+ */
+typedef struct {
+    int_pair_t          p;
+    matrix_element_t    value;
+} mpi_server_thread_element_t;
+
+/*
+ * @function mpi_get_element_datatype
+ *
+ * Lazily registers the mpi_server_thread_element_t MPI datatype and
+ * returns the reference to it.
+ */
+MPI_Datatype mpi_get_element_datatype();
+
 /*
  * @enum MPI distributed matrix element server, roles
  *
@@ -96,6 +185,62 @@ enum {
  */
 typedef unsigned int mpi_server_thread_role_t;
 
+/*
+ * @enum MPI distributed matrix element server, symmetry modes
+ *
+ * How a symmetric (square) matrix is produced and stored:
+ *
+ *     - none:  every element is produced and stored
+ *     - mirror:  only elements on or beyond the diagonal along the
+ *              minor dimension (the upper triangle for row-major,
+ *              the lower for column-major) are produced; each value
+ *              is written to both (i,j) and (j,i)
+ *     - packed:  as for mirror, but only the produced triangle is
+ *              stored; diagonal blocks hold it packed, off-diagonal
+ *              blocks on the other side of the diagonal hold nothing
+ *              and accesses to their elements are served by the
+ *              transposed element
+ */
+enum {
+    mpi_server_thread_symmetry_none = 0,
+    mpi_server_thread_symmetry_mirror = 1,
+    mpi_server_thread_symmetry_packed = 2
+};
+
+/*
+ * @typedef mpi_server_thread_symmetry_t
+ *
+ * The type of a MPI server symmetry mode.
+ */
+typedef unsigned int mpi_server_thread_symmetry_t;
+
+/*
+ * @enum MPI distributed matrix element server, storage modes
+ *
+ * How the local sub-matrix is held:
+ *
+ *     - dense:  a contiguous array of every element, allocated by
+ *              mpi_server_thread_init() unless the caller provides it
+ *     - sparse:  only elements at or above a threshold are kept, see
+ *              mpi_server_thread_set_sparse(); no dense array is
+ *              allocated
+ *     - lazy:  tiles are produced on first read, see
+ *              mpi_server_thread_set_lazy(); no dense array is
+ *              allocated
+ */
+enum {
+    mpi_server_thread_storage_dense = 0,
+    mpi_server_thread_storage_sparse = 1,
+    mpi_server_thread_storage_lazy = 2
+};
+
+/*
+ * @typedef mpi_server_thread_storage_t
+ *
+ * The type of a MPI server storage mode.
+ */
+typedef unsigned int mpi_server_thread_storage_t;
+
 /*
  * @enum MPI distributed matrix element server, message types
  *
@@ -119,8 +264,20 @@ enum {
     mpi_server_thread_msg_id_work_allocated = 1,
     mpi_server_thread_msg_id_work_completed = 2,
     mpi_server_thread_msg_id_work_complete_and_allocate = 3,
+    mpi_server_thread_msg_id_work_deferred = 4,
+    mpi_server_thread_msg_id_work_allocated_set = 5,
+    mpi_server_thread_msg_id_work_set_complete_and_allocate = 6,
     //
     mpi_server_thread_msg_id_memory_write = 0,
+    mpi_server_thread_msg_id_memory_checkpoint = 1,
+    mpi_server_thread_msg_id_memory_write_batch = 2,
+    mpi_server_thread_msg_id_memory_write_block = 3,
+    mpi_server_thread_msg_id_memory_get_element = 4,
+    mpi_server_thread_msg_id_memory_get_tile = 5,
+    mpi_server_thread_msg_id_memory_get_row_features = 6,
+    mpi_server_thread_msg_id_memory_get_col_features = 7,
+    mpi_server_thread_msg_id_memory_sync = 8,
+    mpi_server_thread_msg_id_memory_block_completed = 9,
     //
     mpi_server_thread_msg_id_shutdown = 255
 };
@@ -132,6 +289,48 @@ enum {
  * messages.  Specific message ids will/will not use all of
  * the fields.
  *
+ * A work_complete_and_allocate request may carry in value the
+ * fraction of time the requestor spent waiting on the root since its
+ * previous request (negative if not measured).
+ *
+ * A work_deferred response indicates that no work is available
+ * right now but outstanding work units may yet be re-issued; the
+ * value field holds the number of seconds the requestor should
+ * wait before asking again.
+ *
+ * A work unit covering several runs of indices is sent as a
+ * work_allocated_set response or work_set_complete_and_allocate
+ * request instead:  p_low.i carries the number of bytes in the packed
+ * index set, which follows from the same sender on
+ * mpi_server_thread_work_set_tag (see mpi_server_thread_send_work_unit()).
+ *
+ * A memory_write_batch message carries the number of elements in
+ * p_low.i; the elements themselves follow from the same sender as an
+ * array of mpi_server_thread_element_t on mpi_server_thread_batch_tag.
+ *
+ * A memory_write_block message carries the global index of the
+ * block's first element in p_low and the number of partitions and
+ * elements per partition in p_high.i and p_high.j; value is non-zero
+ * if the values follow as a partitioned transfer rather than a single
+ * message, in either case from the same sender on
+ * mpi_server_thread_block_tag.
+ *
+ * A memory_get_element or memory_get_tile message asks for the lazily
+ * produced element at p_low, or the whole tile holding it.  The reply
+ * goes to the sender on mpi_server_thread_lazy_tag:  the same message
+ * with the element in value, or with the tile bounds in p_low and
+ * p_high followed by the tile's elements.
+ *
+ * A memory_get_row_features (memory_get_col_features) message asks for
+ * the feature kernel inputs of rows p_low.i through p_high.i - 1
+ * (columns p_low.j through p_high.j - 1), which the server thread
+ * sends to the requestor on mpi_server_thread_feature_tag.
+ *
+ * A memory_sync message is echoed back to the sender on
+ * mpi_server_thread_sync_tag once every write the sender issued before
+ * it has been applied.  A memory_block_completed message from the root
+ * says that the local sub-matrix holds its final values.
+ *
  * An MPI Datatype is registered behind the scenes so that
  * the message can be easily sent/received as a single
  * transaction.
@@ -157,7 +356,9 @@ typedef struct {
  * Only a single rank should be configured to handle both roles:
  * the mpi_server_thread_init() function configures the elected
  * root rank as such and all other ranks solely for memory
- * management.
+ * management.  Alternatively, the root can be a dedicated work unit
+ * manager:  it must then be the last rank, it holds no sub-matrix
+ * and the blocks are distributed across the remaining ranks.
  *
  * Storage for the rank's sub-matrix is attached to the instance.
  * If no external pointer is supplied to mpi_server_thread_init()
@@ -167,7 +368,18 @@ typedef struct {
  * initialize an object in the elected root rank only that represents
  * the assignable work units for production of matrix elements.
  */
-typedef struct {
+struct mpi_server_thread;
+
+/*
+ * @typedef mpi_server_thread_block_callback_t
+ *
+ * Type of a function called when the local sub-matrix of server_info
+ * has been completed.  The context is the pointer registered alongside
+ * the callback.
+ */
+typedef void (*mpi_server_thread_block_callback_t)(struct mpi_server_thread *server_info, const void *context);
+
+typedef struct mpi_server_thread {
     unsigned int                flags;
     mpi_server_thread_role_t    roles;
     //
@@ -208,9 +420,14 @@ typedef struct {
     // ranges:
     int_range_t         local_sub_matrix_row_range;
     int_range_t         local_sub_matrix_col_range;
-
-    // Local sub-matrix:
-    double              *local_sub_matrix;
+    
+    // Local sub-matrix and the number of elements it holds:
+    matrix_element_t    *local_sub_matrix;
+    base_int_t          local_sub_matrix_length;
+    
+    // Symmetric matrices may be produced (and stored) a triangle at a
+    // time, see mpi_server_thread_set_symmetry():
+    mpi_server_thread_symmetry_t symmetry;
     
     // The thread we will run in:
     pthread_t           server_thread;
@@ -222,6 +439,57 @@ typedef struct {
     
     // Assignable work (for the root rank):
     struct mpi_assignable_work *assignable_work;
+    
+    // Fraction of each slot's indices that is divided among the slot's
+    // ranks at startup without any messaging; the remainder of the slot
+    // is assigned dynamically:
+    double              static_fraction;
+    
+    // Checkpoint state (optional):
+    struct mpi_checkpoint *checkpoint;
+    
+    // Sparse sub-matrix storage (optional, replaces local_sub_matrix; see
+    // mpi_server_thread_set_sparse()):
+    struct mpi_sparse_matrix *sparse;
+    
+    // Lazily-produced tiles (optional, replaces local_sub_matrix; see
+    // mpi_server_thread_set_lazy()):
+    struct mpi_lazy_matrix *lazy;
+    
+    // Row and column inputs of a feature kernel (optional):
+    struct mpi_feature_cache *features;
+    
+    // Block completion tracking (optional, see
+    // mpi_server_thread_track_block_completion()):  producers wait for
+    // their remote writes to be applied before reporting work complete,
+    // and is_block_completed is set once every work unit that writes to
+    // the local sub-matrix has been completed:
+    bool                is_tracking_blocks;
+    bool                is_block_completed;
+    mpi_server_thread_block_callback_t block_completed_callback;
+    const void          *block_completed_context;
+    
+    // Remote writes are collected per destination rank and sent in
+    // batches of up to write_batch_size elements; each destination has
+    // write_batch_depth buffers so production can continue while earlier
+    // batches are in flight.  A write_batch_size of 1 sends every element
+    // on its own.  Each destination's batches are guarded by their own
+    // lock so several producer threads may write at once.  The time the
+    // producers spent waiting for a buffer to drain accumulates in
+    // write_wait_time at each mpi_server_thread_memory_flush():
+    base_int_t          write_batch_size;
+    int                 write_batch_depth;
+    struct mpi_server_thread_write_batch *write_batches;
+    double              write_wait_time;
+    
+    // The work unit manager counts how many requests in a row were
+    // already waiting when it finished the previous one.  If that backlog
+    // reaches throttle_backlog (0 disables), the root's own production
+    // yields the CPU to its server thread (see mpi_server_thread_throttle());
+    // the time spent yielding accumulates in throttle_time:
+    int                 throttle_backlog;
+    volatile int        request_backlog;
+    double              throttle_time;
 } mpi_server_thread_t;
 
 /*
@@ -232,8 +500,12 @@ typedef struct {
  * be initialized.
  *
  * The root_rank is the MPI rank number that will act as root for the
- * matrix element generation:  it will run both a memory server and
- * work unit server.
+ * matrix element generation.  The root_roles are the roles it will
+ * handle:  mpi_server_thread_role_all to run both a memory server and
+ * work unit server, or mpi_server_thread_role_work_unit_mgr to act
+ * solely as a dedicated work unit manager.  A dedicated manager must
+ * be the last rank and holds no sub-matrix; the grid is then sized
+ * for the other ranks.
  *
  * The global_rows and global_cols define the dimension of the global
  * matrix that is to be distributed across ranks.
@@ -248,6 +520,11 @@ typedef struct {
  * makes the sub-matrix column count the leading dimension, and
  * column-major uses sub-matrix row count as the leading dimension.
  *
+ * The storage mode selects how the local sub-matrix is held.  Only
+ * mpi_server_thread_storage_dense uses local_sub_matrix; for any other
+ * mode it must be NULL and the storage is attached afterwards (e.g.
+ * by mpi_server_thread_set_sparse()).
+ *
  * If local_sub_matrix is NULL, then the local sub-matrix will be
  * allocated by this function.  If non-NULL, local_sub_matrix is
  * assumed to point to a memory region at least as large as
@@ -265,11 +542,12 @@ typedef struct {
 mpi_server_thread_t*
 mpi_server_thread_init(
     mpi_server_thread_t *server_info,
-    int root_rank,
+    int root_rank, mpi_server_thread_role_t root_roles,
     base_int_t global_rows, base_int_t global_cols,
     base_int_t grid_rows, base_int_t grid_cols,
     bool is_row_major,
-    double *local_sub_matrix
+    mpi_server_thread_storage_t storage,
+    matrix_element_t *local_sub_matrix
 );
 
 /*
@@ -287,6 +565,91 @@ mpi_server_thread_destroy(
     mpi_server_thread_t *server_info
 );
 
+/*
+ * @function mpi_server_thread_set_symmetry
+ *
+ * Must be called before the server thread is started and before any
+ * checkpoint is attached.  The global matrix must be square; packed
+ * storage additionally requires square blocks.  For packed storage an
+ * owned local sub-matrix shrinks to the elements in the produced
+ * triangle.  On the root the work units are switched to triangular
+ * geometry (see mpi_assignable_work_geometry_t).
+ *
+ * Returns false if the matrix or block dimensions do not allow the
+ * requested mode.
+ */
+bool mpi_server_thread_set_symmetry(mpi_server_thread_t *server_info, mpi_server_thread_symmetry_t symmetry);
+
+/*
+ * @function mpi_server_thread_set_sparse
+ *
+ * Hold the local sub-matrix sparse (see mpi_sparse_matrix.h):  values
+ * whose magnitude is below threshold are dropped where they are
+ * produced and the rest accumulate until mpi_sparse_matrix_compact()
+ * is called.  The server should be initialized with
+ * mpi_server_thread_storage_sparse so no dense local sub-matrix is
+ * allocated; an owned one is otherwise released.  Must be called
+ * after mpi_server_thread_set_symmetry(), before the server
+ * thread is started; block writes, checkpoints and the tile cache need
+ * the dense sub-matrix and cannot be used.
+ *
+ * Returns false if the sparse storage could not be allocated.
+ */
+bool mpi_server_thread_set_sparse(mpi_server_thread_t *server_info, double threshold);
+
+/*
+ * @typedef mpi_server_thread_produce_fn
+ *
+ * Callback that produces the length elements along the minor dimension
+ * starting at the global index p -- (i, j) through (i, j + length - 1)
+ * for a row-major server, (i, j) through (i + length - 1, j) otherwise
+ * -- into values.  It may be called on any thread, by several threads
+ * at once.
+ */
+typedef void (*mpi_server_thread_produce_fn)(int_pair_t p, base_int_t length, double *values, const void *context);
+
+/*
+ * @function mpi_server_thread_set_lazy
+ *
+ * Produce the local sub-matrix lazily (see mpi_lazy_matrix.h):  it is
+ * divided into tiles of tile_dim rows and columns that are allocated
+ * and produced by the given callback when first read.  The server
+ * should be initialized with mpi_server_thread_storage_lazy so no
+ * dense local sub-matrix is allocated; an owned one is otherwise
+ * released.  Must be called after mpi_server_thread_set_symmetry(),
+ * before the server thread is started; the server then serves reads
+ * of its tiles by other ranks and no elements may be written.
+ *
+ * Returns false if the tile table could not be allocated.
+ */
+bool mpi_server_thread_set_lazy(mpi_server_thread_t *server_info, base_int_t tile_dim,
+            mpi_server_thread_produce_fn produce, const void *context);
+
+/*
+ * @function mpi_server_thread_track_block_completion
+ *
+ * Enable block completion tracking; every rank must call this before
+ * mpi_server_thread_start() and after any completed work has been
+ * restored (from a checkpoint or the tile cache).  Producers then wait
+ * in mpi_server_thread_memory_sync() until their remote writes have
+ * been applied, so a work unit reported complete is in its
+ * destinations' memory.  The root notifies each rank as soon as every
+ * work unit writing to its sub-matrix (including, with mirrored
+ * symmetry, the transposed writes) is complete.  The rank then sets
+ * is_block_completed and calls the optional callback, on its server
+ * thread or -- on the root -- on whichever thread completed the final
+ * work unit.
+ */
+void mpi_server_thread_track_block_completion(mpi_server_thread_t *server_info, mpi_server_thread_block_callback_t callback, const void *context);
+
+/*
+ * @function mpi_server_thread_block_is_completed
+ *
+ * Returns true once block completion tracking has found the local
+ * sub-matrix complete:  every element in it holds its final value.
+ */
+bool mpi_server_thread_block_is_completed(mpi_server_thread_t *server_info);
+
 /*
  * @function mpi_server_thread_start
  *
@@ -343,6 +706,25 @@ bool mpi_server_thread_index_global_to_local(mpi_server_thread_t *server_info, i
  */
 bool mpi_server_thread_index_local_to_global(mpi_server_thread_t *server_info, int_pair_t *p);
 
+/*
+ * @function mpi_server_thread_index_to_stored
+ *
+ * Packed symmetric storage only holds indices whose minor index is at
+ * least their major index (the upper triangle for row-major, the
+ * lower for column-major).  If is_packed and p lies on the other side
+ * of the diagonal, returns its transpose; otherwise returns p.
+ */
+static inline int_pair_t
+mpi_server_thread_index_to_stored(
+    bool        is_packed,
+    bool        is_row_major,
+    int_pair_t  p
+)
+{
+    if ( is_packed && (is_row_major ? (p.j < p.i) : (p.i < p.j)) ) return int_pair_make(p.j, p.i);
+    return p;
+}
+
 /*
  * @function mpi_server_thread_index_global_to_local_offset
  *
@@ -352,6 +734,9 @@ bool mpi_server_thread_index_local_to_global(mpi_server_thread_t *server_info, i
  * is influenced by the row- versus column-major format of
  * server_info.
  *
+ * With packed symmetric storage, an index on the unstored side of the
+ * diagonal is mapped to its transpose first.
+ *
  * Returns -1 if p is not a location within the local sub-
  * matrix.
  */
@@ -364,10 +749,68 @@ base_int_t mpi_server_thread_index_global_to_local_offset(mpi_server_thread_t *s
  * index p is within its local sub-matrix.
  *
  * The calculation is influenced by the row- versus column-major
- * format of server_info.
+ * format of server_info and, with packed symmetric storage, p is
+ * mapped to the stored side of the diagonal first.
  */
 int mpi_server_thread_index_to_rank(mpi_server_thread_t *server_info, int_pair_t p);
 
+/*
+ * @function mpi_server_thread_rank_to_slot
+ *
+ * Calculate the work unit slot (block row for row-major, block column
+ * for column-major distribution) in which the given MPI rank's local
+ * sub-matrix lies.  This is the slot from which work is preferentially
+ * assigned to that rank.
+ */
+int mpi_server_thread_rank_to_slot(mpi_server_thread_t *server_info, int rank);
+
+/*
+ * @function mpi_server_thread_static_unit
+ *
+ * Calculate the statically-assigned work unit for the given MPI rank:
+ * the first static_fraction of the indices in each slot is split
+ * evenly among the ranks whose primary slot it is.  Every rank can
+ * calculate this without communicating with the root.
+ *
+ * Returns false if the rank has no statically-assigned work, otherwise
+ * *p_low and *p_high are set to the bounds of the work unit.
+ */
+bool mpi_server_thread_static_unit(mpi_server_thread_t *server_info, int rank, int_pair_t *p_low, int_pair_t *p_high);
+
+/*
+ * @function mpi_server_thread_send_work_unit
+ *
+ * Send msg to dest on the given tag describing the work unit whose
+ * row (row-major) or column (column-major) indices are in unit.  A
+ * unit consisting of a single range is sent in msg's p_low and p_high;
+ * otherwise msg's id is changed to set_msg_id and the packed index set
+ * follows on mpi_server_thread_work_set_tag.  Returns the MPI return
+ * code of the (last) send.
+ */
+int mpi_server_thread_send_work_unit(mpi_server_thread_t *server_info, mpi_server_thread_msg_t *msg,
+            int set_msg_id, int_set_ref unit, int dest, int tag);
+
+/*
+ * @function mpi_server_thread_recv_work_unit
+ *
+ * Replace the contents of unit with the work unit described by msg,
+ * which was received from source:  for a work_allocated_set or
+ * work_set_complete_and_allocate message the packed index set is
+ * received on mpi_server_thread_work_set_tag, otherwise the indices
+ * are taken from p_low and p_high.  Returns false if the packed set
+ * could not be received or unpacked.
+ */
+bool mpi_server_thread_recv_work_unit(mpi_server_thread_t *server_info, const mpi_server_thread_msg_t *msg,
+            int source, int_set_ref unit);
+
+/*
+ * @function mpi_server_thread_range_to_unit
+ *
+ * Set *p_low and *p_high to the bounds of the work unit covering the
+ * row (row-major) or column (column-major) indices in r.
+ */
+void mpi_server_thread_range_to_unit(mpi_server_thread_t *server_info, int_range_t r, int_pair_t *p_low, int_pair_t *p_high);
+
 /*
  * @function mpi_server_thread_memory_write
  *
@@ -377,73 +820,159 @@ int mpi_server_thread_index_to_rank(mpi_server_thread_t *server_info, int_pair_t
  * - set the value in the local sub-matrix if p is a position in it
  * - determine the MPI rank which holds the sub-matrix for p and send a
  *   memory write message to it
+ *
+ * When a checkpoint is attached to server_info, local writes mark the
+ * checkpoint tile dirty and remote writes use a synchronous send so
+ * that the value has been received by the time this function returns
+ * (or, with write batching, by the time mpi_server_thread_memory_flush()
+ * returns).
+ *
+ * The value is rounded to matrix_element_t where it is stored; batched
+ * writes carry the rounded value, an unbatched memory write message
+ * carries the double in its value field.  With sparse storage a value
+ * below the threshold is dropped here, before it is sent.
+ *
+ * Several producer threads may call this function (and
+ * mpi_server_thread_memory_write_segment()) concurrently.
  */
 void mpi_server_thread_memory_write(mpi_server_thread_t *server_info, int_pair_t p, double value);
 
 /*
- * @function mpi_server_thread_summary
+ * @function mpi_server_thread_local_segment
  *
- * Write a textual summary of the server_info instance to the
- * given file stream.
+ * Returns a pointer into the local sub-matrix at the global index p
+ * if the length elements that follow p along the minor dimension --
+ * (i, j) through (i, j + length - 1) if server_info is row-major,
+ * (i, j) through (i + length - 1, j) otherwise -- are all held in
+ * the local sub-matrix, in which case they are contiguous.
+ *
+ * Returns NULL if any of the elements are held by another rank or the
+ * local sub-matrix is sparse.
  */
-void mpi_server_thread_summary(mpi_server_thread_t *server_info, FILE *stream);
+matrix_element_t* mpi_server_thread_local_segment(mpi_server_thread_t *server_info, int_pair_t p, base_int_t length);
 
+/*
+ * @function mpi_server_thread_memory_write_segment
+ *
+ * Write the length values along the minor dimension starting at the
+ * global index p (see mpi_server_thread_local_segment()).  A local
+ * segment is rounded to matrix_element_t and copied in one operation
+ * (with double elements, not at all if values already points at it,
+ * e.g. it was produced in place) and marks its checkpoint tiles dirty;
+ * with sparse storage the values above the threshold are appended in
+ * one operation.  Otherwise each element is written as by
+ * mpi_server_thread_memory_write().
+ */
+void mpi_server_thread_memory_write_segment(mpi_server_thread_t *server_info, int_pair_t p, base_int_t length, const double *values);
 
-typedef struct mpi_assignable_work {
-    // Reference to the local server info:
-    mpi_server_thread_t     *server_info;
-    
-    //
-    // For a row-major distribution, it would be ideal to assign rows
-    // lying within the first block row to the ranks holding the
-    // sub-matrices for those blocks.  Likewise, for the second block row
-    // only those ranks would be ideal.  In short, the work assignment
-    // should be biased toward rows that will at least partially overlap
-    // with the local sub-matrix.
-    //
-    // For column-major distribution, the difference is that the bias is
-    // w.r.t. block columns and the distribution is over columns and not
-    // rows.
-    //
-    // To that end, the assigned work unit should consist of a pair of
-    // rows [lo,hi] and columns [lo,hi].  Generally-speaking, the worker
-    // rank should loop over both ranges -- for a single-row work unit
-    // rows [lo,hi] = [lo,lo] and there is only a single row iteration
-    // involved.
-    //
-    // We will split the row/col indices (as determined by the row- versus
-    // column major attribute of server_info) into a number of ranges
-    // matching with the block-cyclic row/col count.  Initially all ranks
-    // in that row/col of the grid will be allocated indices from the
-    // corresponding set -- if those workers complete all the rows early
-    // then they can be assigned indices from the set with the most rows
-    // available.
+/*
+ * @typedef mpi_server_thread_block_send_t
+ *
+ * A block write in progress:  n_partitions consecutive segments of
+ * partition_length elements each, starting at the global index p,
+ * that are contiguous in the destination rank's sub-matrix (e.g. whole
+ * block rows of a row-major sub-matrix).  The caller owns the values
+ * buffer, which must not be reused until
+ * mpi_server_thread_block_send_end() returns.
+ */
+typedef struct {
+    int_pair_t          p;
+    base_int_t          n_partitions, partition_length;
+    matrix_element_t    *values;
     //
-    int                 n_slots;                // e.g. server_info->dim_blocks[0]
-    int_set_ref         *available_indices;     // e.g. [server_info->dim_blocks[0]]
-    int_set_ref         *assigned_indices;      // e.g. [server_info->dim_blocks[0]]
-    int_set_ref         *completed_indices;     // e.g. [server_info->dim_blocks[0]]
-    
-    // A mutex is necessary because the root rank will allocate work
-    // directly versus going through the MPI protocol; we need to ensure
-    // the server thread isn't allocating work to another rank while the
-    // root's client thread is doing likewise:
-    pthread_mutex_t     alloc_lock;
-} mpi_assignable_work_t;
+    // Set by mpi_server_thread_block_send_begin():
+    int                 dest;
+    bool                is_partitioned;
+    MPI_Request         request;
+} mpi_server_thread_block_send_t;
 
-//
+/*
+ * @function mpi_server_thread_block_send_begin
+ *
+ * Begin the block write described by send to the rank that holds it;
+ * the values are received directly into that rank's sub-matrix.  With
+ * MPI_SERVER_THREAD_HAVE_PARTITIONED (and no checkpoint or feature
+ * inputs attached) the block is announced and a partitioned send is
+ * started so that each partition is transferred as soon as it is
+ * marked ready, while the remaining partitions are still being
+ * produced; the destination's server thread is occupied with the
+ * transfer until the block is complete.  Otherwise only the
+ * destination is recorded and nothing is sent until
+ * mpi_server_thread_block_send_end().
+ */
+void mpi_server_thread_block_send_begin(mpi_server_thread_t *server_info, mpi_server_thread_block_send_t *send);
 
-mpi_assignable_work_t* mpi_assignable_work_create(mpi_server_thread_t *server_info);
+/*
+ * @function mpi_server_thread_block_send_ready
+ *
+ * Note that the given partition of send's values has been produced.
+ * Producer threads may call this concurrently for distinct partitions.
+ */
+void mpi_server_thread_block_send_ready(mpi_server_thread_t *server_info, mpi_server_thread_block_send_t *send, base_int_t partition);
 
-void mpi_assignable_work_destroy(mpi_assignable_work_t *work_units);
+/*
+ * @function mpi_server_thread_block_send_end
+ *
+ * Complete the block write once every partition is ready:  without
+ * partitioned communication the block is announced and its values
+ * sent now, back to back.
+ * When a checkpoint is attached the values have been received by the
+ * time this function returns.
+ */
+void mpi_server_thread_block_send_end(mpi_server_thread_t *server_info, mpi_server_thread_block_send_t *send);
 
-bool mpi_assignable_work_all_completed(mpi_assignable_work_t *work_units);
+/*
+ * @function mpi_server_thread_set_write_batching
+ *
+ * Flush any pending batched writes, wait for every batch to have been
+ * received, then change the batch size and buffer depth used for
+ * remote writes.  Must be called by the thread producing matrix
+ * elements; calling it with a batch_size of 1 before the server threads
+ * are shut down ensures no batched writes are lost.  Returns false if
+ * the buffers could not be allocated, in which case writes are no
+ * longer batched.
+ */
+bool mpi_server_thread_set_write_batching(mpi_server_thread_t *server_info, base_int_t batch_size, int batch_depth);
 
-bool mpi_assignable_work_next_unit(mpi_assignable_work_t *work_units, int target_rank,
-            int primary_slot, int_pair_t *p_low, int_pair_t *p_high);
+/*
+ * @function mpi_server_thread_memory_flush
+ *
+ * Send all partially-filled write batches.  A work unit should not be
+ * reported complete before its writes have been flushed.  When a
+ * checkpoint is attached to server_info this also waits for every
+ * batch to have been received.  No other thread may be writing while
+ * the flush is in progress.
+ */
+void mpi_server_thread_memory_flush(mpi_server_thread_t *server_info);
 
-void mpi_assignable_work_complete(mpi_assignable_work_t *work_units, int_pair_t p_low, int_pair_t p_high);
+/*
+ * @function mpi_server_thread_memory_sync
+ *
+ * Flush any batched writes (see mpi_server_thread_memory_flush()).
+ * With block completion tracking enabled, also wait until every rank
+ * holding a block has applied all of the writes issued before the
+ * call.  Must not be called by more than one thread at a time.
+ */
+void mpi_server_thread_memory_sync(mpi_server_thread_t *server_info);
+
+/*
+ * @function mpi_server_thread_throttle
+ *
+ * Called periodically by the root while it produces matrix elements.
+ * If the work unit manager's request backlog has reached
+ * throttle_backlog, sleep until the server thread has caught up (for
+ * at most 10 ms) so that requests from other ranks are not queued
+ * behind the root's own production.
+ */
+void mpi_server_thread_throttle(mpi_server_thread_t *server_info);
+
+/*
+ * @function mpi_server_thread_summary
+ *
+ * Write a textual summary of the server_info instance to the
+ * given file stream.
+ */
+void mpi_server_thread_summary(mpi_server_thread_t *server_info, FILE *stream);
 
-void mpi_assignable_work_summary(mpi_assignable_work_t *work_units, FILE *stream);
 
 #endif /* __MPI_SERVER_THREAD_H__ */
@@ -0,0 +1,269 @@
+/*	mpi_sparse_matrix.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_sparse_matrix.h"
+#include "mpi_utils.h"
+
+//
+
+enum {
+    // Smallest number of entries allocated at a time:
+    __mpi_sparse_matrix_min_capacity = 4096
+};
+
+//
+
+static inline base_int_t
+__mpi_sparse_matrix_major(
+    mpi_sparse_matrix_t *sparse,
+    int_pair_t          p
+)
+{
+    return (sparse->is_row_major ? p.i : p.j) - sparse->major_range.start;
+}
+
+static inline base_int_t
+__mpi_sparse_matrix_minor(
+    mpi_sparse_matrix_t *sparse,
+    int_pair_t          p
+)
+{
+    return (sparse->is_row_major ? p.j : p.i) - sparse->minor_range.start;
+}
+
+//
+
+static int
+__mpi_sparse_matrix_cmp_j(
+    const void  *a,
+    const void  *b
+)
+{
+    base_int_t  ja = ((const mpi_server_thread_element_t*)a)->p.j,
+                jb = ((const mpi_server_thread_element_t*)b)->p.j;
+    
+    return (ja < jb) ? -1 : (ja > jb);
+}
+
+static int
+__mpi_sparse_matrix_cmp_i(
+    const void  *a,
+    const void  *b
+)
+{
+    base_int_t  ia = ((const mpi_server_thread_element_t*)a)->p.i,
+                ib = ((const mpi_server_thread_element_t*)b)->p.i;
+    
+    return (ia < ib) ? -1 : (ia > ib);
+}
+
+//
+
+static void
+__mpi_sparse_matrix_reserve(
+    mpi_sparse_matrix_t *sparse,
+    base_int_t          n
+)
+{
+    // Called with the lock held:
+    if ( sparse->n_entries + n > sparse->capacity ) {
+        base_int_t                  new_capacity = 2 * sparse->capacity;
+        mpi_server_thread_element_t *new_entries;
+        
+        if ( new_capacity < sparse->n_entries + n ) new_capacity = sparse->n_entries + n;
+        if ( new_capacity < __mpi_sparse_matrix_min_capacity ) new_capacity = __mpi_sparse_matrix_min_capacity;
+        new_entries = (mpi_server_thread_element_t*)realloc(sparse->entries, new_capacity * sizeof(mpi_server_thread_element_t));
+        if ( ! new_entries ) {
+            mpi_printf(-1, "ERROR:  unable to grow sparse sub-matrix to " BASE_INT_FMT " entries", new_capacity);
+            MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+        }
+        sparse->entries = new_entries;
+        sparse->capacity = new_capacity;
+    }
+}
+
+//
+
+mpi_sparse_matrix_t*
+mpi_sparse_matrix_create(
+    mpi_server_thread_t *server_info,
+    double              threshold
+)
+{
+    mpi_sparse_matrix_t *new_sparse = (mpi_sparse_matrix_t*)malloc(sizeof(mpi_sparse_matrix_t));
+    
+    if ( new_sparse ) {
+        memset(new_sparse, 0, sizeof(mpi_sparse_matrix_t));
+        new_sparse->threshold = threshold;
+        new_sparse->is_row_major = server_info->is_row_major;
+        new_sparse->is_packed = (server_info->symmetry == mpi_server_thread_symmetry_packed);
+        if ( server_info->is_row_major ) {
+            new_sparse->major_range = server_info->local_sub_matrix_row_range;
+            new_sparse->minor_range = server_info->local_sub_matrix_col_range;
+        } else {
+            new_sparse->major_range = server_info->local_sub_matrix_col_range;
+            new_sparse->minor_range = server_info->local_sub_matrix_row_range;
+        }
+        pthread_mutex_init(&new_sparse->lock, NULL);
+    }
+    return new_sparse;
+}
+
+//
+
+void
+mpi_sparse_matrix_destroy(
+    mpi_sparse_matrix_t *sparse
+)
+{
+    if ( sparse->entries ) free((void*)sparse->entries);
+    if ( sparse->major_offsets ) free((void*)sparse->major_offsets);
+    if ( sparse->minor_indices ) free((void*)sparse->minor_indices);
+    if ( sparse->values ) free((void*)sparse->values);
+    pthread_mutex_destroy(&sparse->lock);
+    free((void*)sparse);
+}
+
+//
+
+void
+mpi_sparse_matrix_append(
+    mpi_sparse_matrix_t                 *sparse,
+    const mpi_server_thread_element_t   *elements,
+    base_int_t                          n
+)
+{
+    if ( n <= 0 ) return;
+    pthread_mutex_lock(&sparse->lock);
+    __mpi_sparse_matrix_reserve(sparse, n);
+    memcpy(sparse->entries + sparse->n_entries, elements, n * sizeof(mpi_server_thread_element_t));
+    sparse->n_entries += n;
+    pthread_mutex_unlock(&sparse->lock);
+}
+
+//
+
+void
+mpi_sparse_matrix_append_segment(
+    mpi_sparse_matrix_t *sparse,
+    int_pair_t          p,
+    base_int_t          length,
+    const double        *values
+)
+{
+    base_int_t          *k = sparse->is_row_major ? &p.j : &p.i;
+    base_int_t          k_hi = *k + length;
+    
+    pthread_mutex_lock(&sparse->lock);
+    __mpi_sparse_matrix_reserve(sparse, length);
+    while ( *k < k_hi ) {
+        if ( ! mpi_sparse_matrix_is_dropped(sparse, *values) ) {
+            sparse->entries[sparse->n_entries].p = p;
+            sparse->entries[sparse->n_entries++].value = matrix_element_from_double(*values);
+        }
+        values++, (*k)++;
+    }
+    pthread_mutex_unlock(&sparse->lock);
+}
+
+//
+
+base_int_t
+mpi_sparse_matrix_compact(
+    mpi_sparse_matrix_t *sparse
+)
+{
+    base_int_t                  n_major = sparse->major_range.length, m, k, w;
+    base_int_t                  *offsets;
+    mpi_server_thread_element_t *sorted;
+    int                         (*cmp)(const void*, const void*) = sparse->is_row_major ? __mpi_sparse_matrix_cmp_j : __mpi_sparse_matrix_cmp_i;
+    
+    if ( sparse->is_compact ) return sparse->nnz;
+    
+    offsets = (base_int_t*)calloc(n_major + 1, sizeof(base_int_t));
+    sorted = (mpi_server_thread_element_t*)malloc((sparse->n_entries ? sparse->n_entries : 1) * sizeof(mpi_server_thread_element_t));
+    if ( ! offsets || ! sorted ) {
+        if ( offsets ) free((void*)offsets);
+        if ( sorted ) free((void*)sorted);
+        return -1;
+    }
+    
+    // Counting sort on the major index; once scattered, offsets[m] is the
+    // end of major index m, so shift them up by one:
+    for ( k = 0; k < sparse->n_entries; k++ ) offsets[__mpi_sparse_matrix_major(sparse, sparse->entries[k].p) + 1]++;
+    for ( m = 0; m < n_major; m++ ) offsets[m + 1] += offsets[m];
+    for ( k = 0; k < sparse->n_entries; k++ ) sorted[offsets[__mpi_sparse_matrix_major(sparse, sparse->entries[k].p)]++] = sparse->entries[k];
+    for ( m = n_major; m > 0; m-- ) offsets[m] = offsets[m - 1];
+    offsets[0] = 0;
+    free((void*)sparse->entries);
+    sparse->entries = sorted;
+    sparse->capacity = sparse->n_entries ? sparse->n_entries : 1;
+    
+    // Sort each major index by minor index (segments are mostly appended in
+    // order already), dropping repeated indices:
+    for ( m = 0, w = 0; m < n_major; m++ ) {
+        base_int_t      lo = offsets[m], hi = offsets[m + 1];
+        
+        for ( k = lo + 1; k < hi; k++ ) if ( cmp(&sorted[k - 1], &sorted[k]) > 0 ) break;
+        if ( k < hi ) qsort(sorted + lo, hi - lo, sizeof(mpi_server_thread_element_t), cmp);
+        offsets[m] = w;
+        for ( k = lo; k < hi; k++ ) {
+            if ( (k > lo) && (cmp(&sorted[k], &sorted[w - 1]) == 0) ) continue;
+            sorted[w++] = sorted[k];
+        }
+    }
+    offsets[n_major] = w;
+    sparse->n_entries = w;
+    
+    sparse->minor_indices = (base_int_t*)malloc((w ? w : 1) * sizeof(base_int_t));
+    sparse->values = (matrix_element_t*)malloc((w ? w : 1) * sizeof(matrix_element_t));
+    if ( ! sparse->minor_indices || ! sparse->values ) {
+        if ( sparse->minor_indices ) free((void*)sparse->minor_indices);
+        if ( sparse->values ) free((void*)sparse->values);
+        sparse->minor_indices = NULL;
+        sparse->values = NULL;
+        free((void*)offsets);
+        return -1;
+    }
+    for ( k = 0; k < w; k++ ) {
+        sparse->minor_indices[k] = __mpi_sparse_matrix_minor(sparse, sorted[k].p);
+        sparse->values[k] = sorted[k].value;
+    }
+    free((void*)sparse->entries);
+    sparse->entries = NULL;
+    sparse->n_entries = sparse->capacity = 0;
+    sparse->major_offsets = offsets;
+    sparse->nnz = w;
+    sparse->is_compact = true;
+    return w;
+}
+
+//
+
+double
+mpi_sparse_matrix_get(
+    mpi_sparse_matrix_t *sparse,
+    int_pair_t          p
+)
+{
+    base_int_t          m, minor, lo, hi;
+    
+    p = mpi_server_thread_index_to_stored(sparse->is_packed, sparse->is_row_major, p);
+    m = __mpi_sparse_matrix_major(sparse, p);
+    minor = __mpi_sparse_matrix_minor(sparse, p);
+    if ( ! sparse->is_compact || (m < 0) || (m >= sparse->major_range.length) ) return 0.0;
+    
+    // Binary search of the major index' minor indices:
+    lo = sparse->major_offsets[m];
+    hi = sparse->major_offsets[m + 1];
+    while ( lo < hi ) {
+        base_int_t      mid = lo + (hi - lo) / 2;
+        
+        if ( sparse->minor_indices[mid] < minor ) lo = mid + 1;
+        else hi = mid;
+    }
+    if ( (lo < sparse->major_offsets[m + 1]) && (sparse->minor_indices[lo] == minor) )
+        return matrix_element_to_double(sparse->values[lo]);
+    return 0.0;
+}
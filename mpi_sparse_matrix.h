@@ -0,0 +1,142 @@
+/*	mpi_sparse_matrix.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix sparse sub-matrix storage
+
+	For kernels whose values mostly fall below a useful magnitude, a
+	rank's sub-matrix can be held sparse instead of as the dense
+	dim_per_rank[0] x dim_per_rank[1] array.  Values whose magnitude is
+	below the threshold are dropped by the producing rank, so they are
+	neither sent nor stored.
+
+	While elements are being produced the survivors accumulate in
+	arbitrary order as (global index, value) entries -- the same
+	records that batched remote writes carry, so a received batch is
+	appended as-is.  Once every element has been received,
+	mpi_sparse_matrix_compact() sorts them into compressed storage along
+	the sub-matrix's major dimension:  CSR for row-major, CSC for
+	column-major.  Memory and write traffic then scale with the number
+	of nonzeros rather than the number of elements.
+*/
+
+#ifndef __MPI_SPARSE_MATRIX_H__
+#define __MPI_SPARSE_MATRIX_H__
+
+#include "project_config.h"
+#include "mpi_server_thread.h"
+
+/*
+ * @typedef mpi_sparse_matrix_t
+ *
+ * Sparse storage attached to a rank's server instance.  Until
+ * mpi_sparse_matrix_compact() is called the n_entries elements in
+ * entries hold the stored values with their global indices, in the
+ * order they were written.
+ *
+ * Afterwards the nnz stored values are compressed along the major
+ * dimension:  the values of local major index k (a row for row-major,
+ * a column for column-major) are values[major_offsets[k]] through
+ * values[major_offsets[k + 1] - 1], in ascending order of the local
+ * minor indices held in minor_indices.
+ *
+ * With packed symmetric storage (is_packed) only the produced triangle
+ * is stored.
+ */
+typedef struct mpi_sparse_matrix {
+    double                      threshold;
+    bool                        is_row_major, is_packed;
+    int_range_t                 major_range, minor_range;
+    //
+    // Accumulated entries, appended under the lock:
+    pthread_mutex_t             lock;
+    base_int_t                  n_entries, capacity;
+    mpi_server_thread_element_t *entries;
+    //
+    // Compressed storage:
+    bool                        is_compact;
+    base_int_t                  nnz;
+    base_int_t                  *major_offsets;     // [major_range.length + 1]
+    base_int_t                  *minor_indices;     // [nnz]
+    matrix_element_t            *values;            // [nnz]
+} mpi_sparse_matrix_t;
+
+/*
+ * @function mpi_sparse_matrix_create
+ *
+ * Return a new, empty sparse storage instance for the local
+ * sub-matrix of server_info that drops values whose magnitude is
+ * below threshold.  Normally called through
+ * mpi_server_thread_set_sparse().
+ *
+ * Returns NULL on error.
+ */
+mpi_sparse_matrix_t* mpi_sparse_matrix_create(mpi_server_thread_t *server_info, double threshold);
+
+/*
+ * @function mpi_sparse_matrix_destroy
+ *
+ * Dispose of the sparse storage instance.
+ */
+void mpi_sparse_matrix_destroy(mpi_sparse_matrix_t *sparse);
+
+/*
+ * @function mpi_sparse_matrix_is_dropped
+ *
+ * Returns true if value falls below the threshold and should be
+ * neither sent nor stored.
+ */
+static inline bool
+mpi_sparse_matrix_is_dropped(
+    mpi_sparse_matrix_t *sparse,
+    double              value
+)
+{
+    return (fabs(value) < sparse->threshold);
+}
+
+/*
+ * @function mpi_sparse_matrix_append
+ *
+ * Append n elements, all of which lie in the local sub-matrix and
+ * have already been checked against the threshold.  Several threads
+ * may append concurrently.
+ */
+void mpi_sparse_matrix_append(mpi_sparse_matrix_t *sparse, const mpi_server_thread_element_t *elements, base_int_t n);
+
+/*
+ * @function mpi_sparse_matrix_append_segment
+ *
+ * Append the values that survive the threshold among the length
+ * values along the minor dimension starting at the global index p,
+ * all of which lie in the local sub-matrix.  Several threads may
+ * append concurrently.
+ */
+void mpi_sparse_matrix_append_segment(mpi_sparse_matrix_t *sparse, int_pair_t p, base_int_t length, const double *values);
+
+/*
+ * @function mpi_sparse_matrix_compact
+ *
+ * Sort the accumulated entries into compressed storage and release
+ * them.  An index written more than once (e.g. by a work unit that was
+ * re-issued) is stored once.  Must be called once all matrix elements
+ * have been produced and received; no further elements can be
+ * appended.
+ *
+ * Returns the number of stored values, or -1 if memory could not be
+ * allocated (the entries are then kept).
+ */
+base_int_t mpi_sparse_matrix_compact(mpi_sparse_matrix_t *sparse);
+
+/*
+ * @function mpi_sparse_matrix_get
+ *
+ * Returns the value stored at the global index p of the compacted
+ * local sub-matrix, or zero if no value is stored there.  With packed
+ * symmetric storage an index on the unstored side of the diagonal is
+ * mapped to its transpose first.
+ */
+double mpi_sparse_matrix_get(mpi_sparse_matrix_t *sparse, int_pair_t p);
+
+#endif /* __MPI_SPARSE_MATRIX_H__ */
@@ -0,0 +1,325 @@
+/*	mpi_sparsity_pattern.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_sparsity_pattern.h"
+
+#include <ctype.h>
+
+//
+
+static mpi_sparsity_pattern_t*
+__mpi_sparsity_pattern_alloc(
+    base_int_t  n_major,
+    base_int_t  n_minor,
+    bool        is_row_major,
+    base_int_t  n_runs
+)
+{
+    mpi_sparsity_pattern_t  *new_pattern = (mpi_sparsity_pattern_t*)malloc(sizeof(mpi_sparsity_pattern_t));
+    
+    if ( new_pattern ) {
+        memset(new_pattern, 0, sizeof(mpi_sparsity_pattern_t));
+        new_pattern->is_row_major = is_row_major;
+        new_pattern->n_major = n_major;
+        new_pattern->n_minor = n_minor;
+        new_pattern->run_offsets = (base_int_t*)calloc(n_major + 1, sizeof(base_int_t));
+        new_pattern->element_offsets = (base_int_t*)calloc(n_major + 1, sizeof(base_int_t));
+        new_pattern->runs = (int_range_t*)malloc((n_runs ? n_runs : 1) * sizeof(int_range_t));
+        if ( ! new_pattern->run_offsets || ! new_pattern->element_offsets || ! new_pattern->runs ) {
+            mpi_sparsity_pattern_destroy(new_pattern);
+            new_pattern = NULL;
+        }
+    }
+    return new_pattern;
+}
+
+//
+
+static void
+__mpi_sparsity_pattern_count_elements(
+    mpi_sparsity_pattern_t  *pattern
+)
+{
+    base_int_t              k, r;
+    
+    for ( k = 0; k < pattern->n_major; k++ ) {
+        pattern->element_offsets[k + 1] = pattern->element_offsets[k];
+        for ( r = pattern->run_offsets[k]; r < pattern->run_offsets[k + 1]; r++ )
+            pattern->element_offsets[k + 1] += pattern->runs[r].length;
+    }
+    pattern->nnz = pattern->element_offsets[pattern->n_major];
+}
+
+//
+
+static mpi_sparsity_pattern_t*
+__mpi_sparsity_pattern_create_band(
+    base_int_t  n_major,
+    base_int_t  n_minor,
+    bool        is_row_major,
+    base_int_t  half_width
+)
+{
+    mpi_sparsity_pattern_t  *new_pattern = __mpi_sparsity_pattern_alloc(n_major, n_minor, is_row_major, n_major);
+    base_int_t              k, n_runs = 0;
+    
+    if ( ! new_pattern ) return NULL;
+    
+    // |i - j| <= w is symmetric, so one formula serves both orders:
+    for ( k = 0; k < n_major; k++ ) {
+        base_int_t          lo = (k > half_width) ? (k - half_width) : 0,
+                            hi = (k < n_minor - half_width) ? (k + half_width + 1) : n_minor;
+        
+        if ( lo < hi ) new_pattern->runs[n_runs++] = int_range_make(lo, hi - lo);
+        new_pattern->run_offsets[k + 1] = n_runs;
+    }
+    __mpi_sparsity_pattern_count_elements(new_pattern);
+    return new_pattern;
+}
+
+//
+
+static mpi_sparsity_pattern_t*
+__mpi_sparsity_pattern_create_block_diagonal(
+    base_int_t  n_major,
+    base_int_t  n_minor,
+    bool        is_row_major,
+    base_int_t  block_dim
+)
+{
+    mpi_sparsity_pattern_t  *new_pattern = __mpi_sparsity_pattern_alloc(n_major, n_minor, is_row_major, n_major);
+    base_int_t              k, n_runs = 0;
+    
+    if ( ! new_pattern ) return NULL;
+    for ( k = 0; k < n_major; k++ ) {
+        base_int_t          lo = (k / block_dim) * block_dim,
+                            hi = (lo < n_minor - block_dim) ? (lo + block_dim) : n_minor;
+        
+        if ( lo < hi ) new_pattern->runs[n_runs++] = int_range_make(lo, hi - lo);
+        new_pattern->run_offsets[k + 1] = n_runs;
+    }
+    __mpi_sparsity_pattern_count_elements(new_pattern);
+    return new_pattern;
+}
+
+//
+
+static bool
+__mpi_sparsity_pattern_read_int(
+    FILE        *fptr,
+    base_int_t  *value
+)
+{
+    long long   v;
+    int         c;
+    
+    // Skip whitespace and comment lines:
+    while ( (c = fgetc(fptr)) != EOF ) {
+        if ( c == '#' ) {
+            while ( ((c = fgetc(fptr)) != EOF) && (c != '\n') );
+        } else if ( ! isspace(c) ) {
+            ungetc(c, fptr);
+            break;
+        }
+    }
+    if ( fscanf(fptr, "%lld", &v) != 1 ) return false;
+    *value = (base_int_t)v;
+    return ((long long)*value == v);
+}
+
+static int
+__mpi_sparsity_pattern_cmp_index(
+    const void  *a,
+    const void  *b
+)
+{
+    base_int_t  ia = *((const base_int_t*)a),
+                ib = *((const base_int_t*)b);
+    
+    return (ia < ib) ? -1 : (ia > ib);
+}
+
+static bool
+__mpi_sparsity_pattern_read_csr(
+    FILE        *fptr,
+    base_int_t  n_rows,
+    base_int_t  n_cols,
+    base_int_t  nnz,
+    base_int_t  *row_offsets,
+    base_int_t  *col_indices,
+    const char* *error_msg
+)
+{
+    base_int_t  k;
+    
+    for ( k = 0; k <= n_rows; k++ ) {
+        if ( ! __mpi_sparsity_pattern_read_int(fptr, &row_offsets[k]) || (row_offsets[k] < (k ? row_offsets[k - 1] : 0)) ||
+             (row_offsets[k] > nnz) )
+        {
+            *error_msg = "invalid CSR row offsets";
+            return false;
+        }
+    }
+    if ( (row_offsets[0] != 0) || (row_offsets[n_rows] != nnz) ) {
+        *error_msg = "invalid CSR row offsets";
+        return false;
+    }
+    for ( k = 0; k < nnz; k++ ) {
+        if ( ! __mpi_sparsity_pattern_read_int(fptr, &col_indices[k]) || (col_indices[k] < 0) || (col_indices[k] >= n_cols) ) {
+            *error_msg = "invalid CSR column index";
+            return false;
+        }
+    }
+    return true;
+}
+
+static mpi_sparsity_pattern_t*
+__mpi_sparsity_pattern_create_from_lists(
+    base_int_t  n_major,
+    base_int_t  n_minor,
+    bool        is_row_major,
+    base_int_t  *minor_offsets,
+    base_int_t  *minor_indices
+)
+{
+    mpi_sparsity_pattern_t  *new_pattern;
+    base_int_t              k, m, n_runs;
+    
+    // Sort each major index' minor indices and count the runs they form:
+    for ( k = 0, n_runs = 0; k < n_major; k++ ) {
+        base_int_t          lo = minor_offsets[k], hi = minor_offsets[k + 1];
+        
+        qsort(minor_indices + lo, hi - lo, sizeof(base_int_t), __mpi_sparsity_pattern_cmp_index);
+        for ( m = lo; m < hi; m++ ) if ( (m == lo) || (minor_indices[m] > minor_indices[m - 1] + 1) ) n_runs++;
+    }
+    new_pattern = __mpi_sparsity_pattern_alloc(n_major, n_minor, is_row_major, n_runs);
+    if ( ! new_pattern ) return NULL;
+    for ( k = 0, n_runs = 0; k < n_major; k++ ) {
+        for ( m = minor_offsets[k]; m < minor_offsets[k + 1]; m++ ) {
+            if ( (m > minor_offsets[k]) && (minor_indices[m] <= int_range_get_max(new_pattern->runs[n_runs - 1])) ) {
+                // A repeated or adjacent index extends the current run:
+                new_pattern->runs[n_runs - 1].length = minor_indices[m] + 1 - new_pattern->runs[n_runs - 1].start;
+            } else {
+                new_pattern->runs[n_runs++] = int_range_make(minor_indices[m], 1);
+            }
+        }
+        new_pattern->run_offsets[k + 1] = n_runs;
+    }
+    __mpi_sparsity_pattern_count_elements(new_pattern);
+    return new_pattern;
+}
+
+static mpi_sparsity_pattern_t*
+__mpi_sparsity_pattern_create_csr_file(
+    const char  *path,
+    base_int_t  n_rows,
+    base_int_t  n_cols,
+    bool        is_row_major,
+    const char* *error_msg
+)
+{
+    mpi_sparsity_pattern_t  *new_pattern = NULL;
+    FILE                    *fptr = fopen(path, "r");
+    base_int_t              file_rows, file_cols, nnz, i, k;
+    base_int_t              *row_offsets, *col_indices, *col_offsets = NULL, *row_indices = NULL;
+    bool                    is_read;
+    
+    if ( ! fptr ) {
+        *error_msg = strerror(errno);
+        return NULL;
+    }
+    if ( ! __mpi_sparsity_pattern_read_int(fptr, &file_rows) || ! __mpi_sparsity_pattern_read_int(fptr, &file_cols) ||
+         ! __mpi_sparsity_pattern_read_int(fptr, &nnz) || (nnz < 0) )
+    {
+        *error_msg = "invalid CSR header";
+        fclose(fptr);
+        return NULL;
+    }
+    if ( (file_rows != n_rows) || (file_cols != n_cols) ) {
+        *error_msg = "CSR dimensions do not match the matrix";
+        fclose(fptr);
+        return NULL;
+    }
+    row_offsets = (base_int_t*)malloc((n_rows + 1) * sizeof(base_int_t));
+    col_indices = (base_int_t*)malloc((nnz ? nnz : 1) * sizeof(base_int_t));
+    is_read = row_offsets && col_indices && __mpi_sparsity_pattern_read_csr(fptr, n_rows, n_cols, nnz, row_offsets, col_indices, error_msg);
+    fclose(fptr);
+    
+    if ( is_read ) {
+        if ( is_row_major ) {
+            new_pattern = __mpi_sparsity_pattern_create_from_lists(n_rows, n_cols, true, row_offsets, col_indices);
+        } else {
+            // Transpose with a counting sort on the column index:
+            col_offsets = (base_int_t*)calloc(n_cols + 1, sizeof(base_int_t));
+            row_indices = (base_int_t*)malloc((nnz ? nnz : 1) * sizeof(base_int_t));
+            if ( col_offsets && row_indices ) {
+                for ( k = 0; k < nnz; k++ ) col_offsets[col_indices[k] + 1]++;
+                for ( k = 0; k < n_cols; k++ ) col_offsets[k + 1] += col_offsets[k];
+                for ( i = 0; i < n_rows; i++ )
+                    for ( k = row_offsets[i]; k < row_offsets[i + 1]; k++ ) row_indices[col_offsets[col_indices[k]]++] = i;
+                for ( k = n_cols; k > 0; k-- ) col_offsets[k] = col_offsets[k - 1];
+                col_offsets[0] = 0;
+                new_pattern = __mpi_sparsity_pattern_create_from_lists(n_cols, n_rows, false, col_offsets, row_indices);
+            }
+        }
+    }
+    if ( row_offsets ) free((void*)row_offsets);
+    if ( col_indices ) free((void*)col_indices);
+    if ( col_offsets ) free((void*)col_offsets);
+    if ( row_indices ) free((void*)row_indices);
+    return new_pattern;
+}
+
+//
+
+mpi_sparsity_pattern_t*
+mpi_sparsity_pattern_create(
+    const char  *spec,
+    base_int_t  n_rows,
+    base_int_t  n_cols,
+    bool        is_row_major,
+    const char* *error_msg
+)
+{
+    const char  *dummy_msg, *arg = strchr(spec, ':');
+    base_int_t  n_major = is_row_major ? n_rows : n_cols,
+                n_minor = is_row_major ? n_cols : n_rows;
+    
+    if ( ! error_msg ) error_msg = &dummy_msg;
+    *error_msg = "unable to allocate sparsity pattern";
+    if ( ! arg || ! *(++arg) ) {
+        *error_msg = "no pattern argument";
+        return NULL;
+    }
+    if ( ! strncmp(spec, "csr:", 4) )
+        return __mpi_sparsity_pattern_create_csr_file(arg, n_rows, n_cols, is_row_major, error_msg);
+    if ( ! strncmp(spec, "band:", 5) || ! strncmp(spec, "block-diagonal:", 15) ) {
+        bool        is_band = (spec[1] == 'a');
+        char        *endptr;
+        long long   n = strtoll(arg, &endptr, 0);
+        
+        // A band may be just the diagonal, a block holds at least one element:
+        if ( (endptr == arg) || *endptr || (n < (is_band ? 0 : 1)) || (n > BASE_INT_MAX) ) {
+            *error_msg = "invalid pattern width";
+            return NULL;
+        }
+        if ( is_band ) return __mpi_sparsity_pattern_create_band(n_major, n_minor, is_row_major, (base_int_t)n);
+        return __mpi_sparsity_pattern_create_block_diagonal(n_major, n_minor, is_row_major, (base_int_t)n);
+    }
+    *error_msg = "unknown pattern type";
+    return NULL;
+}
+
+//
+
+void
+mpi_sparsity_pattern_destroy(
+    mpi_sparsity_pattern_t  *pattern
+)
+{
+    if ( pattern->run_offsets ) free((void*)pattern->run_offsets);
+    if ( pattern->runs ) free((void*)pattern->runs);
+    if ( pattern->element_offsets ) free((void*)pattern->element_offsets);
+    free((void*)pattern);
+}
@@ -0,0 +1,92 @@
+/*	mpi_sparsity_pattern.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix sparsity patterns
+
+	When the nonzero structure of the matrix is known in advance --
+	banded, block-diagonal or e.g. the adjacency of a mesh -- only the
+	elements in that pattern need to be produced.  The pattern is held
+	along the matrix's major dimension (rows for row-major, columns for
+	column-major) as runs of consecutive minor indices, so the segment
+	kernels still produce each run in one call and a band costs one run
+	per row (column).
+
+	The cumulative element count per major index is kept alongside, so
+	work units can be sized by the number of elements they produce
+	rather than by the number of rows (columns) they span.
+*/
+
+#ifndef __MPI_SPARSITY_PATTERN_H__
+#define __MPI_SPARSITY_PATTERN_H__
+
+#include "project_config.h"
+#include "int_range.h"
+
+/*
+ * @typedef mpi_sparsity_pattern_t
+ *
+ * The elements in the pattern for major index k are the minor indices
+ * in runs[run_offsets[k]] through runs[run_offsets[k + 1] - 1], which
+ * are in ascending order and neither overlap nor touch.  Major index k
+ * holds element_offsets[k + 1] - element_offsets[k] of the nnz
+ * elements in the pattern.
+ */
+typedef struct mpi_sparsity_pattern {
+    bool                is_row_major;
+    base_int_t          n_major, n_minor;
+    base_int_t          nnz;
+    base_int_t          *run_offsets;       // [n_major + 1]
+    int_range_t         *runs;              // [run_offsets[n_major]]
+    base_int_t          *element_offsets;   // [n_major + 1]
+} mpi_sparsity_pattern_t;
+
+/*
+ * @function mpi_sparsity_pattern_create
+ *
+ * Return the sparsity pattern described by spec for a matrix of
+ * n_rows x n_cols elements, held along the rows (is_row_major) or the
+ * columns.  The spec is one of:
+ *
+ *     band:<w>             elements with |i - j| <= w
+ *     block-diagonal:<b>   the diagonal blocks of b x b elements
+ *     csr:<path>           the nonzero structure in a text file
+ *
+ * The file holds the row and column counts (which must match the
+ * matrix), the number of nonzeros, the n_rows + 1 row offsets and the
+ * column index of every nonzero, all as whitespace-separated 0-based
+ * integers; lines starting with '#' are ignored.  The column indices
+ * of a row need not be sorted and repeats are ignored.
+ *
+ * Returns NULL on error, with *error_msg (if not NULL) set to a
+ * description of the problem.
+ */
+mpi_sparsity_pattern_t* mpi_sparsity_pattern_create(const char *spec, base_int_t n_rows, base_int_t n_cols,
+            bool is_row_major, const char **error_msg);
+
+/*
+ * @function mpi_sparsity_pattern_destroy
+ *
+ * Dispose of the sparsity pattern.
+ */
+void mpi_sparsity_pattern_destroy(mpi_sparsity_pattern_t *pattern);
+
+/*
+ * @function mpi_sparsity_pattern_get_runs
+ *
+ * Returns the runs of minor indices in the pattern for the given major
+ * index and sets *n_runs to their count.
+ */
+static inline const int_range_t*
+mpi_sparsity_pattern_get_runs(
+    const mpi_sparsity_pattern_t    *pattern,
+    base_int_t                      major,
+    base_int_t                      *n_runs
+)
+{
+    *n_runs = pattern->run_offsets[major + 1] - pattern->run_offsets[major];
+    return pattern->runs + pattern->run_offsets[major];
+}
+
+#endif /* __MPI_SPARSITY_PATTERN_H__ */
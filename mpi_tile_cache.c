@@ -0,0 +1,573 @@
+/*	mpi_tile_cache.c
+	Copyright (c) 2024, J T Frey
+*/
+
+#include "mpi_tile_cache.h"
+#include "mpi_checkpoint.h"
+#include "mpi_utils.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+//
+
+const base_int_t mpi_tile_cache_tile_dim = 512;
+
+//
+
+static const char __mpi_tile_cache_magic[8] = { 'M', 'D', 'M', 'T', 'I', 'L', 'E', 'C' };
+
+enum {
+    __mpi_tile_cache_version = 1,
+    // Tile data starts at this offset in a tile file, the header and
+    // key precede it:
+    __mpi_tile_cache_data_offset = 4096
+};
+
+typedef struct {
+    char        magic[8];
+    int32_t     version;
+    int32_t     element_size;
+    int64_t     tile_dim;
+    int64_t     tile[2];
+    int64_t     extent[2];
+    uint64_t    key_hash;
+    int64_t     key_length;
+} __mpi_tile_cache_header_t;
+
+//
+
+static uint64_t
+__mpi_tile_cache_hash(
+    uint64_t    hash,
+    const void  *data,
+    size_t      length
+)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    
+    // 64-bit FNV-1a:
+    while ( length-- ) {
+        hash ^= *bytes++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+//
+
+static char*
+__mpi_tile_cache_path(
+    mpi_tile_cache_t    *cache,
+    base_int_t          ti,
+    base_int_t          tj,
+    bool                is_temporary
+)
+{
+    int64_t             address[3] = { mpi_tile_cache_tile_dim, ti, tj };
+    uint64_t            hash = __mpi_tile_cache_hash(cache->key_hash, address, sizeof(address));
+    size_t              path_len = strlen(cache->directory) + 32;
+    char                *path = (char*)malloc(path_len);
+    
+    if ( path ) snprintf(path, path_len, "%s/%02x/%016" PRIx64 ".tile%s", cache->directory, (unsigned int)(hash >> 56), hash, is_temporary ? ".tmp" : "");
+    return path;
+}
+
+//
+
+static bool
+__mpi_tile_cache_pwrite(
+    int         fd,
+    const void  *buffer,
+    size_t      length,
+    off_t       offset
+)
+{
+    while ( length > 0 ) {
+        ssize_t n = pwrite(fd, buffer, length, offset);
+        
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            return false;
+        }
+        buffer += n, length -= n, offset += n;
+    }
+    return true;
+}
+
+static bool
+__mpi_tile_cache_pread(
+    int         fd,
+    void        *buffer,
+    size_t      length,
+    off_t       offset
+)
+{
+    while ( length > 0 ) {
+        ssize_t n = pread(fd, buffer, length, offset);
+        
+        if ( n <= 0 ) {
+            if ( (n < 0) && (errno == EINTR) ) continue;
+            return false;
+        }
+        buffer += n, length -= n, offset += n;
+    }
+    return true;
+}
+
+//
+
+static inline base_int_t
+__mpi_tile_cache_extent(
+    base_int_t  dim,
+    base_int_t  t
+)
+{
+    // Border tiles extend past the end of the matrix:
+    return (dim - t * mpi_tile_cache_tile_dim < mpi_tile_cache_tile_dim) ? (dim - t * mpi_tile_cache_tile_dim) : mpi_tile_cache_tile_dim;
+}
+
+//
+
+static void
+__mpi_tile_cache_header_init(
+    __mpi_tile_cache_header_t   *header,
+    mpi_tile_cache_t            *cache,
+    mpi_server_thread_t         *server_info,
+    base_int_t                  ti,
+    base_int_t                  tj
+)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, __mpi_tile_cache_magic, sizeof(header->magic));
+    header->version = __mpi_tile_cache_version;
+    header->element_size = sizeof(matrix_element_t);
+    header->tile_dim = mpi_tile_cache_tile_dim;
+    header->tile[0] = ti;
+    header->tile[1] = tj;
+    header->extent[0] = __mpi_tile_cache_extent(server_info->dim_global[0], ti);
+    header->extent[1] = __mpi_tile_cache_extent(server_info->dim_global[1], tj);
+    header->key_hash = cache->key_hash;
+    header->key_length = strlen(cache->key);
+}
+
+//
+
+static bool
+__mpi_tile_cache_local_part(
+    mpi_server_thread_t *server_info,
+    base_int_t          ti,
+    base_int_t          tj,
+    int_range_t         *rows,
+    int_range_t         *cols
+)
+{
+    *rows = int_range_intersection(server_info->local_sub_matrix_row_range, int_range_make(ti * mpi_tile_cache_tile_dim, mpi_tile_cache_tile_dim));
+    *cols = int_range_intersection(server_info->local_sub_matrix_col_range, int_range_make(tj * mpi_tile_cache_tile_dim, mpi_tile_cache_tile_dim));
+    return (rows->length > 0) && (cols->length > 0);
+}
+
+//
+
+/*
+ * Copy the part of a tile held in the local sub-matrix between it and
+ * buffer, which holds whole tile rows starting at rows.start.
+ */
+static void
+__mpi_tile_cache_copy(
+    mpi_server_thread_t *server_info,
+    matrix_element_t    *buffer,
+    base_int_t          tj,
+    int_range_t         rows,
+    int_range_t         cols,
+    bool                is_load
+)
+{
+    base_int_t          col0 = cols.start - tj * mpi_tile_cache_tile_dim, k;
+    
+    if ( server_info->is_row_major ) {
+        for ( k = 0; k < rows.length; k++ ) {
+            matrix_element_t    *local = mpi_server_thread_local_segment(server_info, int_pair_make(rows.start + k, cols.start), cols.length);
+            matrix_element_t    *tile = buffer + k * mpi_tile_cache_tile_dim + col0;
+            
+            if ( is_load ) memcpy(local, tile, cols.length * sizeof(matrix_element_t));
+            else memcpy(tile, local, cols.length * sizeof(matrix_element_t));
+        }
+    } else {
+        for ( k = 0; k < cols.length; k++ ) {
+            matrix_element_t    *local = mpi_server_thread_local_segment(server_info, int_pair_make(rows.start, cols.start + k), rows.length);
+            matrix_element_t    *tile = buffer + col0 + k;
+            base_int_t  i;
+            
+            for ( i = 0; i < rows.length; i++ ) {
+                if ( is_load ) local[i] = tile[i * mpi_tile_cache_tile_dim];
+                else tile[i * mpi_tile_cache_tile_dim] = local[i];
+            }
+        }
+    }
+    if ( is_load && server_info->checkpoint ) {
+        // Row-major or not, the block rows (columns) of the tile are runs:
+        for ( k = 0; k < (server_info->is_row_major ? rows.length : cols.length); k++ ) {
+            int_pair_t  p = server_info->is_row_major ? int_pair_make(rows.start + k, cols.start) : int_pair_make(rows.start, cols.start + k);
+            
+            mpi_checkpoint_mark_dirty_range(server_info->checkpoint, mpi_server_thread_index_global_to_local_offset(server_info, p),
+                    server_info->is_row_major ? cols.length : rows.length);
+        }
+    }
+}
+
+//
+
+static bool
+__mpi_tile_cache_load_tile(
+    mpi_tile_cache_t    *cache,
+    mpi_server_thread_t *server_info,
+    base_int_t          ti,
+    base_int_t          tj,
+    int_range_t         rows,
+    int_range_t         cols,
+    matrix_element_t    *buffer
+)
+{
+    __mpi_tile_cache_header_t   file_header, our_header;
+    char                        *path = __mpi_tile_cache_path(cache, ti, tj, false);
+    char                        *file_key;
+    int                         fd;
+    bool                        rc = false;
+    
+    if ( ! path ) return false;
+    fd = open(path, O_RDONLY);
+    free((void*)path);
+    if ( fd < 0 ) return false;
+    
+    // Same key and tile, and at least as much of the tile inside the matrix:
+    __mpi_tile_cache_header_init(&our_header, cache, server_info, ti, tj);
+    if ( __mpi_tile_cache_pread(fd, &file_header, sizeof(file_header), 0) &&
+         (memcmp(file_header.magic, our_header.magic, sizeof(our_header.magic)) == 0) &&
+         (file_header.version == our_header.version) && (file_header.element_size == our_header.element_size) &&
+         (file_header.tile_dim == our_header.tile_dim) &&
+         (file_header.tile[0] == ti) && (file_header.tile[1] == tj) &&
+         (file_header.extent[0] >= our_header.extent[0]) && (file_header.extent[1] >= our_header.extent[1]) &&
+         (file_header.key_hash == our_header.key_hash) && (file_header.key_length == our_header.key_length) &&
+         (file_key = (char*)malloc(our_header.key_length + 1)) )
+    {
+        if ( __mpi_tile_cache_pread(fd, file_key, our_header.key_length, sizeof(file_header)) &&
+             (memcmp(file_key, cache->key, our_header.key_length) == 0) &&
+             __mpi_tile_cache_pread(fd, buffer, rows.length * mpi_tile_cache_tile_dim * sizeof(matrix_element_t),
+                    __mpi_tile_cache_data_offset + (rows.start - ti * mpi_tile_cache_tile_dim) * mpi_tile_cache_tile_dim * sizeof(matrix_element_t)) )
+        {
+            __mpi_tile_cache_copy(server_info, buffer, tj, rows, cols, true);
+            rc = true;
+        }
+        free((void*)file_key);
+    }
+    close(fd);
+    return rc;
+}
+
+//
+
+static bool
+__mpi_tile_cache_save_tile(
+    mpi_tile_cache_t    *cache,
+    mpi_server_thread_t *server_info,
+    base_int_t          ti,
+    base_int_t          tj,
+    int_range_t         rows,
+    int_range_t         cols,
+    matrix_element_t    *buffer
+)
+{
+    char                *path = __mpi_tile_cache_path(cache, ti, tj, true);
+    off_t               offset = __mpi_tile_cache_data_offset + (rows.start - ti * mpi_tile_cache_tile_dim) * mpi_tile_cache_tile_dim * sizeof(matrix_element_t);
+    int                 fd;
+    bool                rc = true;
+    
+    if ( ! path ) return false;
+    fd = open(path, O_WRONLY);
+    free((void*)path);
+    if ( fd < 0 ) return false;
+    
+    __mpi_tile_cache_copy(server_info, buffer, tj, rows, cols, false);
+    if ( cols.length == mpi_tile_cache_tile_dim ) {
+        rc = __mpi_tile_cache_pwrite(fd, buffer, rows.length * mpi_tile_cache_tile_dim * sizeof(matrix_element_t), offset);
+    } else {
+        // Other ranks hold the rest of each tile row:
+        base_int_t      col0 = cols.start - tj * mpi_tile_cache_tile_dim, k;
+        
+        for ( k = 0; rc && (k < rows.length); k++ ) {
+            rc = __mpi_tile_cache_pwrite(fd, buffer + k * mpi_tile_cache_tile_dim + col0, cols.length * sizeof(matrix_element_t),
+                        offset + (k * mpi_tile_cache_tile_dim + col0) * sizeof(matrix_element_t));
+        }
+    }
+    if ( close(fd) != 0 ) rc = false;
+    return rc;
+}
+
+//
+
+static inline bool
+__mpi_tile_cache_is_owner(
+    mpi_server_thread_t *server_info,
+    base_int_t          ti,
+    base_int_t          tj
+)
+{
+    return (mpi_server_thread_index_to_rank(server_info, int_pair_make(ti * mpi_tile_cache_tile_dim, tj * mpi_tile_cache_tile_dim)) == server_info->dist_rank);
+}
+
+//
+////
+//
+
+mpi_tile_cache_t*
+mpi_tile_cache_create(
+    mpi_server_thread_t *server_info,
+    const char          *directory,
+    const char          *key
+)
+{
+    mpi_tile_cache_t    *new_cache;
+    base_int_t          n_tiles[2] = {
+                            (server_info->dim_global[0] + mpi_tile_cache_tile_dim - 1) / mpi_tile_cache_tile_dim,
+                            (server_info->dim_global[1] + mpi_tile_cache_tile_dim - 1) / mpi_tile_cache_tile_dim
+                        };
+    size_t              dir_len = strlen(directory), key_len = strlen(key);
+    size_t              rec_size = sizeof(mpi_tile_cache_t) + n_tiles[0] * n_tiles[1] + dir_len + 1 + key_len + 1;
+    
+    // The key must fit ahead of the tile data:
+    if ( sizeof(__mpi_tile_cache_header_t) + key_len > __mpi_tile_cache_data_offset ) {
+        mpi_printf(-1, "ERROR:  tile cache key is too long");
+        return NULL;
+    }
+    if ( (mkdir(directory, 0755) != 0) && (errno != EEXIST) ) {
+        mpi_printf(-1, "ERROR:  unable to create tile cache directory `%s` (errno = %d)", directory, errno);
+        return NULL;
+    }
+    new_cache = (mpi_tile_cache_t*)malloc(rec_size);
+    if ( ! new_cache ) return NULL;
+    memset(new_cache, 0, rec_size);
+    new_cache->is_valid = (unsigned char*)((void*)new_cache + sizeof(mpi_tile_cache_t));
+    new_cache->directory = (char*)(new_cache->is_valid + n_tiles[0] * n_tiles[1]);
+    strcpy(new_cache->directory, directory);
+    new_cache->key = new_cache->directory + dir_len + 1;
+    strcpy(new_cache->key, key);
+    new_cache->key_hash = __mpi_tile_cache_hash(0xcbf29ce484222325ULL, key, key_len);
+    new_cache->n_tiles[0] = n_tiles[0];
+    new_cache->n_tiles[1] = n_tiles[1];
+    return new_cache;
+}
+
+//
+
+void
+mpi_tile_cache_destroy(
+    mpi_tile_cache_t    *cache
+)
+{
+    free((void*)cache);
+}
+
+//
+
+base_int_t
+mpi_tile_cache_load(
+    mpi_tile_cache_t    *cache,
+    mpi_server_thread_t *server_info
+)
+{
+    base_int_t          n_tiles = cache->n_tiles[0] * cache->n_tiles[1], ti, tj;
+    int_range_t         row_range = server_info->local_sub_matrix_row_range,
+                        col_range = server_info->local_sub_matrix_col_range;
+    matrix_element_t    *buffer = (matrix_element_t*)malloc(mpi_tile_cache_tile_dim * mpi_tile_cache_tile_dim * sizeof(matrix_element_t));
+    unsigned char       *is_missing = cache->is_valid;
+    
+    if ( ! buffer ) {
+        mpi_printf(-1, "ERROR:  unable to allocate tile cache buffer");
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    
+    // Note which of the tiles we hold part of could not be loaded...
+    memset(is_missing, 0, n_tiles);
+    if ( (row_range.length > 0) && (col_range.length > 0) ) {
+        for ( ti = row_range.start / mpi_tile_cache_tile_dim; ti <= (row_range.start + row_range.length - 1) / mpi_tile_cache_tile_dim; ti++ ) {
+            for ( tj = col_range.start / mpi_tile_cache_tile_dim; tj <= (col_range.start + col_range.length - 1) / mpi_tile_cache_tile_dim; tj++ ) {
+                int_range_t     rows, cols;
+                
+                if ( __mpi_tile_cache_local_part(server_info, ti, tj, &rows, &cols) &&
+                     ! __mpi_tile_cache_load_tile(cache, server_info, ti, tj, rows, cols, buffer) ) is_missing[ti * cache->n_tiles[1] + tj] = 1;
+            }
+        }
+    }
+    free((void*)buffer);
+    
+    // ...then a tile is valid only if no rank is missing its part:
+    MPI_Allreduce(MPI_IN_PLACE, is_missing, n_tiles, MPI_UNSIGNED_CHAR, MPI_BOR, MPI_COMM_WORLD);
+    for ( ti = 0; ti < n_tiles; ti++ ) cache->is_valid[ti] = ! is_missing[ti];
+    
+    // Mirrored production skips a valid tile's transpose, too:
+    if ( server_info->symmetry == mpi_server_thread_symmetry_mirror ) {
+        for ( ti = 0; ti < cache->n_tiles[0]; ti++ ) {
+            for ( tj = ti + 1; tj < cache->n_tiles[1]; tj++ ) {
+                unsigned char   both = cache->is_valid[ti * cache->n_tiles[1] + tj] && cache->is_valid[tj * cache->n_tiles[1] + ti];
+                
+                cache->is_valid[ti * cache->n_tiles[1] + tj] = cache->is_valid[tj * cache->n_tiles[1] + ti] = both;
+            }
+        }
+    }
+    cache->n_valid = 0;
+    for ( ti = 0; ti < n_tiles; ti++ ) if ( cache->is_valid[ti] ) cache->n_valid++;
+    return cache->n_valid;
+}
+
+//
+
+bool
+mpi_tile_cache_any_valid(
+    mpi_tile_cache_t    *cache,
+    int_pair_t          p_low,
+    int_pair_t          p_high
+)
+{
+    base_int_t          ti, tj;
+    
+    for ( ti = p_low.i / mpi_tile_cache_tile_dim; ti <= (p_high.i - 1) / mpi_tile_cache_tile_dim; ti++ ) {
+        for ( tj = p_low.j / mpi_tile_cache_tile_dim; tj <= (p_high.j - 1) / mpi_tile_cache_tile_dim; tj++ ) {
+            if ( cache->is_valid[ti * cache->n_tiles[1] + tj] ) return true;
+        }
+    }
+    return false;
+}
+
+//
+
+base_int_t
+mpi_tile_cache_restore_completed(
+    mpi_tile_cache_t        *cache,
+    mpi_assignable_work_t   *work_units
+)
+{
+    bool                    is_row_major = work_units->geometry.is_row_major;
+    base_int_t              n_major = cache->n_tiles[is_row_major ? 0 : 1],
+                            n_minor = cache->n_tiles[is_row_major ? 1 : 0],
+                            dim = work_units->geometry.dim_global[is_row_major ? 0 : 1];
+    base_int_t              t, u, n_completed = 0;
+    
+    // A row (column) of tiles is complete only if all of its tiles are valid:
+    for ( t = 0; t < n_major; t++ ) {
+        for ( u = 0; u < n_minor; u++ ) {
+            if ( ! cache->is_valid[is_row_major ? (t * cache->n_tiles[1] + u) : (u * cache->n_tiles[1] + t)] ) break;
+        }
+        if ( u == n_minor ) {
+            int_range_t     r = int_range_make(t * mpi_tile_cache_tile_dim, __mpi_tile_cache_extent(dim, t));
+            
+            mpi_assignable_work_restore_completed(work_units, r);
+            n_completed += r.length;
+        }
+    }
+    return n_completed;
+}
+
+//
+
+base_int_t
+mpi_tile_cache_save(
+    mpi_tile_cache_t    *cache,
+    mpi_server_thread_t *server_info
+)
+{
+    base_int_t          n_tiles = cache->n_tiles[0] * cache->n_tiles[1], ti, tj, n_saved = 0;
+    int_range_t         row_range = server_info->local_sub_matrix_row_range,
+                        col_range = server_info->local_sub_matrix_col_range;
+    matrix_element_t    *buffer = (matrix_element_t*)malloc(mpi_tile_cache_tile_dim * mpi_tile_cache_tile_dim * sizeof(matrix_element_t));
+    unsigned char       *is_failed = (unsigned char*)calloc(n_tiles, 1);
+    
+    if ( ! buffer || ! is_failed ) {
+        mpi_printf(-1, "ERROR:  unable to allocate tile cache buffer");
+        MPI_Abort(MPI_COMM_WORLD, ENOMEM);
+    }
+    
+    // The rank holding a tile's first element creates its temporary file...
+    for ( ti = 0; ti < cache->n_tiles[0]; ti++ ) {
+        for ( tj = 0; tj < cache->n_tiles[1]; tj++ ) {
+            if ( ! cache->is_valid[ti * cache->n_tiles[1] + tj] && __mpi_tile_cache_is_owner(server_info, ti, tj) ) {
+                char    *path = __mpi_tile_cache_path(cache, ti, tj, true);
+                int     fd = -1;
+                
+                if ( path ) {
+                    // The <hh> sub-directory comes first:
+                    *strrchr(path, '/') = '\0';
+                    if ( (mkdir(path, 0755) == 0) || (errno == EEXIST) ) {
+                        path[strlen(path)] = '/';
+                        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    }
+                    free((void*)path);
+                }
+                if ( (fd < 0) || (ftruncate(fd, __mpi_tile_cache_data_offset + mpi_tile_cache_tile_dim * mpi_tile_cache_tile_dim * sizeof(matrix_element_t)) != 0) )
+                    is_failed[ti * cache->n_tiles[1] + tj] = 1;
+                if ( fd >= 0 ) close(fd);
+            }
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    
+    // ...every rank writes its part...
+    if ( (row_range.length > 0) && (col_range.length > 0) ) {
+        for ( ti = row_range.start / mpi_tile_cache_tile_dim; ti <= (row_range.start + row_range.length - 1) / mpi_tile_cache_tile_dim; ti++ ) {
+            for ( tj = col_range.start / mpi_tile_cache_tile_dim; tj <= (col_range.start + col_range.length - 1) / mpi_tile_cache_tile_dim; tj++ ) {
+                int_range_t     rows, cols;
+                
+                if ( ! cache->is_valid[ti * cache->n_tiles[1] + tj] && __mpi_tile_cache_local_part(server_info, ti, tj, &rows, &cols) &&
+                     ! __mpi_tile_cache_save_tile(cache, server_info, ti, tj, rows, cols, buffer) ) is_failed[ti * cache->n_tiles[1] + tj] = 1;
+            }
+        }
+    }
+    free((void*)buffer);
+    sync();
+    MPI_Allreduce(MPI_IN_PLACE, is_failed, n_tiles, MPI_UNSIGNED_CHAR, MPI_BOR, MPI_COMM_WORLD);
+    
+    // ...and once all parts are present the owner adds the header...
+    for ( ti = 0; ti < cache->n_tiles[0]; ti++ ) {
+        for ( tj = 0; tj < cache->n_tiles[1]; tj++ ) {
+            unsigned char   *tile_failed = &is_failed[ti * cache->n_tiles[1] + tj];
+            
+            if ( cache->is_valid[ti * cache->n_tiles[1] + tj] || *tile_failed ) continue;
+            n_saved++;
+            if ( __mpi_tile_cache_is_owner(server_info, ti, tj) ) {
+                __mpi_tile_cache_header_t   header;
+                char                        *tmp_path = __mpi_tile_cache_path(cache, ti, tj, true);
+                int                         fd = tmp_path ? open(tmp_path, O_WRONLY) : -1;
+                
+                __mpi_tile_cache_header_init(&header, cache, server_info, ti, tj);
+                if ( (fd < 0) ||
+                     ! __mpi_tile_cache_pwrite(fd, &header, sizeof(header), 0) ||
+                     ! __mpi_tile_cache_pwrite(fd, cache->key, header.key_length, sizeof(header)) ) *tile_failed = 1;
+                if ( (fd >= 0) && (close(fd) != 0) ) *tile_failed = 1;
+                if ( tmp_path ) free((void*)tmp_path);
+            }
+        }
+    }
+    
+    // ...and publishes the tile once it is on disk (a single sync is far
+    // cheaper than syncing every tile file):
+    sync();
+    for ( ti = 0; ti < cache->n_tiles[0]; ti++ ) {
+        for ( tj = 0; tj < cache->n_tiles[1]; tj++ ) {
+            if ( ! cache->is_valid[ti * cache->n_tiles[1] + tj] && __mpi_tile_cache_is_owner(server_info, ti, tj) ) {
+                char    *tmp_path = __mpi_tile_cache_path(cache, ti, tj, true);
+                char    *path = __mpi_tile_cache_path(cache, ti, tj, false);
+                
+                if ( tmp_path && path ) {
+                    if ( is_failed[ti * cache->n_tiles[1] + tj] || (rename(tmp_path, path) != 0) ) {
+                        mpi_printf(-1, "ERROR:  unable to publish cache tile `%s` (errno = %d)", path, errno);
+                        unlink(tmp_path);
+                    }
+                }
+                if ( tmp_path ) free((void*)tmp_path);
+                if ( path ) free((void*)path);
+            }
+        }
+    }
+    free((void*)is_failed);
+    return n_saved;
+}
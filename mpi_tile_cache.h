@@ -0,0 +1,139 @@
+/*	mpi_tile_cache.h
+	Copyright (c) 2024, J T Frey
+*/
+
+/*!
+	@header MPI distributed matrix tile cache
+
+	A content-addressed on-disk cache of matrix elements shared by
+	successive runs.  The global matrix is divided into square tiles of
+	mpi_tile_cache_tile_dim rows and columns, independent of the rank
+	count and block layout, and each tile is stored in its own file
+	named for a hash of the cache key and the tile coordinates:
+
+	    <directory>/<hh>/<hash>.tile
+
+	The cache key identifies the kernel (its description) and any
+	parameters the user supplies that alter its output.  A tile file
+	also records the key itself and how many rows and columns of the
+	tile were inside the matrix when it was written, so a tile on the
+	border of a smaller matrix is not valid for a larger one.
+
+	At startup every rank loads the parts of the valid tiles that fall
+	in its local sub-matrix and the ranks agree on which tiles are
+	valid.  Rows (row-major) or columns (column-major) lying entirely in
+	valid tiles are marked completed in the root's work units; the
+	remaining work units skip the valid tiles they cross.  At the end of
+	a run the tiles that were not valid are written by the ranks that
+	hold them.  Growing the matrix therefore only produces the new
+	border.
+*/
+
+#ifndef __MPI_TILE_CACHE_H__
+#define __MPI_TILE_CACHE_H__
+
+#include "project_config.h"
+#include "mpi_server_thread.h"
+
+/*
+ * @constant mpi_tile_cache_tile_dim
+ *
+ * Number of rows and columns in a cache tile.
+ */
+extern const base_int_t mpi_tile_cache_tile_dim;
+
+/*
+ * @typedef mpi_tile_cache_t
+ *
+ * Tile cache state, identical on every rank once
+ * mpi_tile_cache_load() returns.  The is_valid array holds a flag per
+ * global tile (row-major over the n_tiles[0] x n_tiles[1] tile grid)
+ * that is set if the tile was loaded from the cache.
+ */
+typedef struct mpi_tile_cache {
+    char                *directory;
+    char                *key;
+    uint64_t            key_hash;
+    base_int_t          n_tiles[2];
+    base_int_t          n_valid;
+    unsigned char       *is_valid;
+} mpi_tile_cache_t;
+
+/*
+ * @function mpi_tile_cache_create
+ *
+ * Return a new tile cache instance for the matrix of server_info,
+ * stored under the given directory (which is created if necessary)
+ * and keyed by the given string.  No tile is valid until
+ * mpi_tile_cache_load() is called.
+ *
+ * Returns NULL on error.
+ */
+mpi_tile_cache_t* mpi_tile_cache_create(mpi_server_thread_t *server_info, const char *directory, const char *key);
+
+/*
+ * @function mpi_tile_cache_destroy
+ *
+ * Dispose of the tile cache instance.
+ */
+void mpi_tile_cache_destroy(mpi_tile_cache_t *cache);
+
+/*
+ * @function mpi_tile_cache_load
+ *
+ * Collective:  every rank loads its part of each cached tile into the
+ * local sub-matrix of server_info, then the ranks agree that a tile is
+ * valid only if every rank holding part of it loaded that part.  With
+ * mirrored symmetric production a tile is only valid if its transpose
+ * is, too.  Loaded elements are marked dirty in an attached checkpoint.
+ *
+ * Returns the number of valid tiles.
+ */
+base_int_t mpi_tile_cache_load(mpi_tile_cache_t *cache, mpi_server_thread_t *server_info);
+
+/*
+ * @function mpi_tile_cache_is_valid
+ *
+ * Returns true if the tile containing the global index p was loaded
+ * from the cache.
+ */
+static inline bool
+mpi_tile_cache_is_valid(
+    mpi_tile_cache_t    *cache,
+    int_pair_t          p
+)
+{
+    return cache->is_valid[(p.i / mpi_tile_cache_tile_dim) * cache->n_tiles[1] + (p.j / mpi_tile_cache_tile_dim)];
+}
+
+/*
+ * @function mpi_tile_cache_any_valid
+ *
+ * Returns true if any tile overlapping the global index rectangle
+ * p_low (inclusive) to p_high (exclusive) was loaded from the cache.
+ */
+bool mpi_tile_cache_any_valid(mpi_tile_cache_t *cache, int_pair_t p_low, int_pair_t p_high);
+
+/*
+ * @function mpi_tile_cache_restore_completed
+ *
+ * Root rank only:  mark as completed in work_units every row
+ * (row-major) or column (column-major) index that lies entirely in
+ * valid tiles.  Returns the number of indices so marked.
+ */
+base_int_t mpi_tile_cache_restore_completed(mpi_tile_cache_t *cache, mpi_assignable_work_t *work_units);
+
+/*
+ * @function mpi_tile_cache_save
+ *
+ * Collective:  write every tile that was not valid at load time from
+ * the local sub-matrices of all ranks.  Each tile is assembled in a
+ * temporary file and renamed into place once complete, so a tile is
+ * never seen half-written.  Must be called once all matrix elements
+ * have been produced and received.
+ *
+ * Returns the number of tiles written.
+ */
+base_int_t mpi_tile_cache_save(mpi_tile_cache_t *cache, mpi_server_thread_t *server_info);
+
+#endif /* __MPI_TILE_CACHE_H__ */
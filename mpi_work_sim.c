@@ -0,0 +1,695 @@
+/*	mpi_work_sim.c
+	Copyright (c) 2024, J T Frey
+*/
+
+/*
+ * Offline discrete-event simulation of the work unit protocol.
+ *
+ * The real mpi_assignable_work_t (and int_set) code is driven by a
+ * virtual clock.  Each simulated rank requests work from the root,
+ * "computes" the unit it is given for a modelled duration and reports
+ * it complete, exactly as the MPI program does:  non-root ranks pay a
+ * one-way message latency for every request/response while the root
+ * allocates to itself directly.  Unit costs are either synthesized from
+ * a per-element cost (optionally with slow ranks and random jitter) or
+ * replayed from a trace recorded by mpi_dist_matrix --trace.
+ *
+ * Every combination of the requested policies, unit sizes, static
+ * fractions and lease timeouts is simulated and a line of statistics
+ * is printed for each.
+ */
+
+#include "mpi_assignable_work.h"
+
+#include <getopt.h>
+
+//
+
+enum {
+    sim_event_compute_done = 0,     // rank finished computing its unit
+    sim_event_at_root,              // rank's request arrived at the root
+    sim_event_root_retry,           // root re-checks for work after a deferral
+    sim_event_none                  // rank has been released
+};
+
+typedef struct {
+    int             event;
+    double          event_time;
+    bool            has_unit;
+    int_pair_t      p_low, p_high;
+    double          busy_time;
+} sim_rank_t;
+
+typedef struct {
+    // Geometry and cost model:
+    mpi_assignable_work_geometry_t geometry;
+    double          *index_cost;        // seconds per index, [n_indices]
+    double          *rank_factor;       // relative slowness, [dist_size]
+    double          jitter;
+    double          latency;
+    unsigned int    seed;
+    
+    // Scheduling parameters for one simulation:
+    const char      *policy;
+    mpi_assignable_work_order_t order;
+    bool            is_throughput_aware;
+    base_int_t      unit_size;
+    double          static_fraction;
+    double          lease_timeout;
+} sim_config_t;
+
+typedef struct {
+    double          makespan;
+    double          idle_fraction;
+    base_int_t      n_work_msgs;
+    base_int_t      n_write_msgs;
+    base_int_t      n_speculative_units;
+    base_int_t      n_duplicate_completions;
+} sim_result_t;
+
+//
+
+static double sim_now = 0.0;
+
+static double
+sim_clock(void)
+{
+    return sim_now;
+}
+
+//
+
+static inline base_int_t
+sim_overlap(
+    base_int_t      lo1,
+    base_int_t      hi1,
+    base_int_t      lo2,
+    base_int_t      hi2
+)
+{
+    base_int_t      lo = (lo1 > lo2) ? lo1 : lo2, hi = (hi1 < hi2) ? hi1 : hi2;
+    
+    return (hi > lo) ? (hi - lo) : 0;
+}
+
+//
+
+static base_int_t
+sim_remote_writes(
+    const mpi_assignable_work_geometry_t *geometry,
+    int             rank,
+    int_pair_t      p_low,
+    int_pair_t      p_high
+)
+{
+    base_int_t      r, c, n_local;
+    
+    if ( geometry->is_row_major ) {
+        r = rank / geometry->dim_blocks[1];
+        c = rank % geometry->dim_blocks[1];
+    } else {
+        r = rank % geometry->dim_blocks[0];
+        c = rank / geometry->dim_blocks[0];
+    }
+    n_local = sim_overlap(p_low.i, p_high.i, r * geometry->dim_per_rank[0], (r + 1) * geometry->dim_per_rank[0]) *
+              sim_overlap(p_low.j, p_high.j, c * geometry->dim_per_rank[1], (c + 1) * geometry->dim_per_rank[1]);
+    return (p_high.i - p_low.i) * (p_high.j - p_low.j) - n_local;
+}
+
+//
+
+static double
+sim_unit_cost(
+    sim_config_t    *config,
+    int             rank,
+    int_pair_t      p_low,
+    int_pair_t      p_high
+)
+{
+    base_int_t      i, i_max;
+    double          cost = 0.0;
+    
+    if ( config->geometry.is_row_major ) {
+        i = p_low.i, i_max = p_high.i;
+    } else {
+        i = p_low.j, i_max = p_high.j;
+    }
+    while ( i < i_max ) cost += config->index_cost[i++];
+    cost *= config->rank_factor[rank];
+    if ( config->jitter > 0.0 ) cost *= 1.0 + config->jitter * (2.0 * rand_r(&config->seed) / RAND_MAX - 1.0);
+    return cost;
+}
+
+//
+
+static void
+sim_start_unit(
+    sim_config_t    *config,
+    sim_rank_t      *ranks,
+    sim_result_t    *result,
+    int             rank,
+    double          start_time
+)
+{
+    double          cost = sim_unit_cost(config, rank, ranks[rank].p_low, ranks[rank].p_high);
+    
+    ranks[rank].has_unit = true;
+    ranks[rank].busy_time += cost;
+    ranks[rank].event = sim_event_compute_done;
+    ranks[rank].event_time = start_time + cost;
+    result->n_write_msgs += sim_remote_writes(&config->geometry, rank, ranks[rank].p_low, ranks[rank].p_high);
+}
+
+//
+
+static void
+sim_allocate(
+    sim_config_t            *config,
+    mpi_assignable_work_t   *work_units,
+    sim_rank_t              *ranks,
+    sim_result_t            *result,
+    int                     rank
+)
+{
+    double                  retry_delay;
+    bool                    is_root = (rank == 0);
+    
+    if ( mpi_assignable_work_next_unit(work_units, rank, mpi_assignable_work_geometry_rank_to_slot(&config->geometry, rank),
+                &ranks[rank].p_low, &ranks[rank].p_high) )
+    {
+        if ( ! is_root ) result->n_work_msgs++;
+        sim_start_unit(config, ranks, result, rank, sim_now + (is_root ? 0.0 : config->latency));
+    }
+    else if ( mpi_assignable_work_should_defer(work_units, &retry_delay) ) {
+        ranks[rank].has_unit = false;
+        if ( is_root ) {
+            ranks[rank].event = sim_event_root_retry;
+            ranks[rank].event_time = sim_now + retry_delay;
+        } else {
+            // Deferred response, then a fresh request:
+            result->n_work_msgs += 2;
+            ranks[rank].event = sim_event_at_root;
+            ranks[rank].event_time = sim_now + config->latency + retry_delay + config->latency;
+        }
+    }
+    else {
+        ranks[rank].has_unit = false;
+        ranks[rank].event = sim_event_none;
+        if ( ! is_root ) {
+            result->n_work_msgs++;
+            mpi_assignable_work_release_rank(work_units, rank);
+        }
+    }
+}
+
+//
+
+static bool
+sim_run(
+    sim_config_t            *config,
+    sim_result_t            *result
+)
+{
+    mpi_assignable_work_t   *work_units = mpi_assignable_work_create(&config->geometry);
+    sim_rank_t              *ranks;
+    int                     rank, n_ranks = config->geometry.dist_size;
+    bool                    is_completed = false;
+    double                  idle = 0.0;
+    
+    if ( ! work_units ) return false;
+    ranks = (sim_rank_t*)calloc(n_ranks, sizeof(sim_rank_t));
+    if ( ! ranks ) {
+        mpi_assignable_work_destroy(work_units);
+        return false;
+    }
+    memset(result, 0, sizeof(*result));
+    sim_now = 0.0;
+    work_units->clock = sim_clock;
+    work_units->order = config->order;
+    work_units->is_throughput_aware = config->is_throughput_aware;
+    work_units->unit_size = config->unit_size;
+    work_units->lease_timeout = config->lease_timeout;
+    mpi_assignable_work_apply_static_partition(work_units, config->static_fraction);
+    
+    // Rank 0 plays the root.  Ranks with a static unit start computing it
+    // at once; the others send a work request:
+    for ( rank = 0; rank < n_ranks; rank++ ) {
+        if ( mpi_assignable_work_geometry_static_unit(&config->geometry, config->static_fraction, rank, &ranks[rank].p_low, &ranks[rank].p_high) ) {
+            sim_start_unit(config, ranks, result, rank, 0.0);
+        } else if ( rank == 0 ) {
+            ranks[rank].event = sim_event_root_retry;
+            ranks[rank].event_time = 0.0;
+        } else {
+            result->n_work_msgs++;
+            ranks[rank].event = sim_event_at_root;
+            ranks[rank].event_time = config->latency;
+        }
+    }
+    
+    while ( true ) {
+        int                 next_rank = -1;
+        
+        // Next event in time order:
+        for ( rank = 0; rank < n_ranks; rank++ ) {
+            if ( ranks[rank].event == sim_event_none ) continue;
+            if ( (next_rank < 0) || (ranks[rank].event_time < ranks[next_rank].event_time) ) next_rank = rank;
+        }
+        if ( next_rank < 0 ) break;
+        rank = next_rank;
+        sim_now = ranks[rank].event_time;
+        
+        switch ( ranks[rank].event ) {
+            case sim_event_compute_done:
+                if ( rank == 0 ) {
+                    mpi_assignable_work_complete(work_units, rank, ranks[rank].p_low, ranks[rank].p_high);
+                    ranks[rank].has_unit = false;
+                    sim_allocate(config, work_units, ranks, result, rank);
+                } else {
+                    // Completion (and request for more) travels to the root:
+                    result->n_work_msgs++;
+                    ranks[rank].event = sim_event_at_root;
+                    ranks[rank].event_time = sim_now + config->latency;
+                }
+                break;
+            case sim_event_at_root:
+                if ( ranks[rank].has_unit ) {
+                    mpi_assignable_work_complete(work_units, rank, ranks[rank].p_low, ranks[rank].p_high);
+                    ranks[rank].has_unit = false;
+                }
+                sim_allocate(config, work_units, ranks, result, rank);
+                break;
+            case sim_event_root_retry:
+                sim_allocate(config, work_units, ranks, result, rank);
+                break;
+        }
+        if ( ! is_completed && mpi_assignable_work_all_completed(work_units) ) {
+            is_completed = true;
+            result->makespan = sim_now;
+        }
+    }
+    
+    for ( rank = 0; rank < n_ranks; rank++ ) {
+        if ( ranks[rank].busy_time < result->makespan ) idle += result->makespan - ranks[rank].busy_time;
+    }
+    result->idle_fraction = (result->makespan > 0.0) ? (idle / (n_ranks * result->makespan)) : 0.0;
+    result->n_speculative_units = work_units->n_speculative_units;
+    result->n_duplicate_completions = work_units->n_duplicate_completions;
+    
+    free((void*)ranks);
+    mpi_assignable_work_destroy(work_units);
+    return is_completed;
+}
+
+//
+
+static bool
+sim_load_trace(
+    const char                      *path,
+    mpi_assignable_work_geometry_t  *geometry,
+    double                          **index_cost,
+    double                          **rank_factor
+)
+{
+    FILE            *fptr = fopen(path, "r");
+    char            line[256];
+    long long int   g0, g1, b0, b1;
+    int             is_row_major, dist_size, rank;
+    double          *costs = NULL, *dur_sum = NULL, *idx_sum = NULL, dur_total = 0.0, idx_total = 0.0;
+    base_int_t      n_indices = 0, i;
+    bool            rc = false;
+    
+    if ( ! fptr ) {
+        fprintf(stderr, "ERROR:  unable to open trace file `%s` (errno = %d)\n", path, errno);
+        return false;
+    }
+    if ( ! fgets(line, sizeof(line), fptr) ||
+         (sscanf(line, "# dim_global=%lld,%lld dim_blocks=%lld,%lld is_row_major=%d dist_size=%d",
+                    &g0, &g1, &b0, &b1, &is_row_major, &dist_size) != 6) )
+    {
+        fprintf(stderr, "ERROR:  `%s` is not a work unit trace\n", path);
+        goto early_exit;
+    }
+    geometry->dim_global[0] = g0, geometry->dim_global[1] = g1;
+    geometry->dim_blocks[0] = b0, geometry->dim_blocks[1] = b1;
+    geometry->dim_per_rank[0] = g0 / b0, geometry->dim_per_rank[1] = g1 / b1;
+    geometry->is_row_major = is_row_major;
+    geometry->dist_size = dist_size;
+    
+    n_indices = is_row_major ? g0 : g1;
+    costs = (double*)malloc(n_indices * sizeof(double));
+    dur_sum = (double*)calloc(dist_size, sizeof(double));
+    idx_sum = (double*)calloc(dist_size, sizeof(double));
+    *rank_factor = (double*)malloc(dist_size * sizeof(double));
+    if ( ! costs || ! dur_sum || ! idx_sum || ! *rank_factor ) goto early_exit;
+    // First pass:  per-rank time per index:
+    while ( fgets(line, sizeof(line), fptr) ) {
+        long long int   index, count;
+        double          start, end;
+        
+        if ( *line == '#' ) continue;
+        if ( sscanf(line, "%d,%lld,%lld,%lf,%lf", &rank, &index, &count, &start, &end) != 5 ) continue;
+        if ( (rank < 0) || (rank >= dist_size) || (count <= 0) || (index < 0) || (index + count > n_indices) ) continue;
+        dur_sum[rank] += end - start;
+        idx_sum[rank] += count;
+    }
+    for ( rank = 0; rank < dist_size; rank++ ) {
+        dur_total += dur_sum[rank];
+        idx_total += idx_sum[rank];
+    }
+    if ( idx_total <= 0.0 ) {
+        fprintf(stderr, "ERROR:  `%s` contains no work units\n", path);
+        goto early_exit;
+    }
+    
+    // Second pass:  a rank's factor is its time per index relative to the
+    // mean; the cost of an index is the time per index of its first
+    // completion, normalized by the factor of the rank that produced it:
+    for ( rank = 0; rank < dist_size; rank++ )
+        (*rank_factor)[rank] = (idx_sum[rank] > 0.0) ? ((dur_sum[rank] / idx_sum[rank]) / (dur_total / idx_total)) : 1.0;
+    rewind(fptr);
+    for ( i = 0; i < n_indices; i++ ) costs[i] = -1.0;
+    while ( fgets(line, sizeof(line), fptr) ) {
+        long long int   index, count;
+        double          start, end;
+        
+        if ( *line == '#' ) continue;
+        if ( sscanf(line, "%d,%lld,%lld,%lf,%lf", &rank, &index, &count, &start, &end) != 5 ) continue;
+        if ( (rank < 0) || (rank >= dist_size) || (count <= 0) || (index < 0) || (index + count > n_indices) ) continue;
+        for ( i = index; i < index + count; i++ )
+            if ( costs[i] < 0.0 ) costs[i] = ((end - start) / count) / (*rank_factor)[rank];
+    }
+    
+    // Indices absent from the trace (e.g. restored from a checkpoint) get
+    // the mean cost:
+    for ( i = 0; i < n_indices; i++ ) if ( costs[i] < 0.0 ) costs[i] = dur_total / idx_total;
+    *index_cost = costs;
+    costs = NULL;
+    rc = true;
+
+early_exit:
+    if ( costs ) free((void*)costs);
+    if ( dur_sum ) free((void*)dur_sum);
+    if ( idx_sum ) free((void*)idx_sum);
+    if ( ! rc && *rank_factor ) {
+        free((void*)*rank_factor);
+        *rank_factor = NULL;
+    }
+    fclose(fptr);
+    return rc;
+}
+
+//
+
+static const struct option cliOptions[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "dims", required_argument, NULL, 'd' },
+        { "blocks", required_argument, NULL, 'b' },
+        { "row-major", no_argument, NULL, 'r' },
+        { "column-major", no_argument, NULL, 'c' },
+        { "trace", required_argument, NULL, 'T' },
+        { "element-cost", required_argument, NULL, 'e' },
+        { "slow", required_argument, NULL, 'S' },
+        { "jitter", required_argument, NULL, 'j' },
+        { "seed", required_argument, NULL, 'x' },
+        { "latency", required_argument, NULL, 'L' },
+        { "policies", required_argument, NULL, 'P' },
+        { "unit-size", required_argument, NULL, 'u' },
+        { "static-fraction", required_argument, NULL, 's' },
+        { "lease-timeout", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 }
+    };
+static const char *cliOptionsStr = "hd:b:rcT:e:S:j:x:L:P:u:s:l:";
+
+#define SIM_MAX_SWEEP   16
+#define SIM_MAX_SLOW    64
+
+static const char *sim_policy_names[] = { "affinity", "throughput", "block", "block-throughput" };
+static const int sim_n_policies = sizeof(sim_policy_names) / sizeof(sim_policy_names[0]);
+
+//
+
+void
+usage(
+    const char  *exe
+)
+{
+    printf(
+            "usage:\n\n"
+            "    %s {options}\n\n"
+            "  options:\n\n"
+            "    --help/-h                  show this information\n"
+            "    --dims/-d #|#,#            matrix dimensions (default 1000)\n"
+            "    --blocks/-b #,#            block grid dimensions, one rank per block (default 2,2)\n"
+            "    --row-major/-r             row-major distribution (default)\n"
+            "    --column-major/-c          column-major distribution\n"
+            "    --trace/-T <path>          replay unit costs recorded by mpi_dist_matrix --trace;\n"
+            "                               the trace also determines the dims and blocks\n"
+            "    --element-cost/-e #        seconds to compute one matrix element (default 1e-6)\n"
+            "    --slow/-S <rank>:<factor>  the given rank computes factor times slower (may be\n"
+            "                               repeated)\n"
+            "    --jitter/-j #              scale each unit's cost by a random factor in [1-#,1+#]\n"
+            "    --seed/-x #                random seed for jitter (default 1)\n"
+            "    --latency/-L #             one-way message latency in seconds (default 5e-6)\n"
+            "    --policies/-P <list>       comma-separated scheduling policies to simulate (default\n"
+            "                               all):  affinity, throughput, block, block-throughput\n"
+            "    --unit-size/-u <list>      comma-separated work unit sizes (default 1)\n"
+            "    --static-fraction/-s <list> comma-separated static fractions (default 0)\n"
+            "    --lease-timeout/-l <list>  comma-separated lease timeouts (default 0)\n"
+            "\n",
+            exe
+        );
+}
+
+//
+
+static int
+parse_double_list(
+    const char  *optarg,
+    double      *values,
+    int         max_values
+)
+{
+    int         n = 0;
+    char        *endptr;
+    
+    while ( n < max_values ) {
+        values[n] = strtod(optarg, &endptr);
+        if ( (endptr == optarg) || (values[n] < 0.0) ) return 0;
+        n++;
+        if ( *endptr != ',' ) break;
+        optarg = endptr + 1;
+    }
+    return (*endptr == '\0') ? n : 0;
+}
+
+//
+
+int
+main(
+    int         argc,
+    char*       argv[]
+)
+{
+    int                     optch, i_policy, i_unit, i_static, i_lease, rank;
+    long long int           dims[2] = { 1000, 1000 }, blocks[2] = { 2, 2 };
+    bool                    is_row_major = true;
+    const char              *trace_path = NULL;
+    double                  element_cost = 1e-6;
+    int                     slow_ranks[SIM_MAX_SLOW], n_slow = 0;
+    double                  slow_factors[SIM_MAX_SLOW];
+    double                  unit_sizes[SIM_MAX_SWEEP] = { 1.0 }, static_fractions[SIM_MAX_SWEEP] = { 0.0 },
+                            lease_timeouts[SIM_MAX_SWEEP] = { 0.0 };
+    int                     n_unit_sizes = 1, n_static_fractions = 1, n_lease_timeouts = 1;
+    bool                    policies[sizeof(sim_policy_names) / sizeof(sim_policy_names[0])] = { true, true, true, true };
+    sim_config_t            config = { .latency = 5e-6, .seed = 1 };
+    unsigned int            seed;
+    base_int_t              n_indices, i;
+    
+    while ( (optch = getopt_long(argc, argv, cliOptionsStr, cliOptions, NULL)) != -1 ) {
+        switch ( optch ) {
+            
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            
+            case 'd':
+                switch ( sscanf(optarg, "%lld,%lld", &dims[0], &dims[1]) ) {
+                    case 1:
+                        dims[1] = dims[0];
+                        /* fall through */
+                    case 2:
+                        if ( (dims[0] > 0) && (dims[1] > 0) ) break;
+                        /* fall through */
+                    default:
+                        fprintf(stderr, "ERROR:  invalid dimensions `%s`\n", optarg);
+                        exit(EINVAL);
+                }
+                break;
+            
+            case 'b':
+                if ( (sscanf(optarg, "%lld,%lld", &blocks[0], &blocks[1]) != 2) || (blocks[0] <= 0) || (blocks[1] <= 0) ) {
+                    fprintf(stderr, "ERROR:  invalid block dimensions `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 'r':
+                is_row_major = true;
+                break;
+            
+            case 'c':
+                is_row_major = false;
+                break;
+            
+            case 'T':
+                trace_path = optarg;
+                break;
+            
+            case 'e':
+                if ( parse_double_list(optarg, &element_cost, 1) != 1 ) {
+                    fprintf(stderr, "ERROR:  invalid element cost `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 'S':
+                if ( (n_slow == SIM_MAX_SLOW) || (sscanf(optarg, "%d:%lf", &slow_ranks[n_slow], &slow_factors[n_slow]) != 2) ||
+                     (slow_ranks[n_slow] < 0) || (slow_factors[n_slow] <= 0.0) )
+                {
+                    fprintf(stderr, "ERROR:  invalid slow rank `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                n_slow++;
+                break;
+            
+            case 'j':
+                if ( (parse_double_list(optarg, &config.jitter, 1) != 1) || (config.jitter >= 1.0) ) {
+                    fprintf(stderr, "ERROR:  invalid jitter `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 'x':
+                config.seed = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            
+            case 'L':
+                if ( parse_double_list(optarg, &config.latency, 1) != 1 ) {
+                    fprintf(stderr, "ERROR:  invalid latency `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 'P': {
+                char        *list = strdup(optarg), *name, *state = NULL;
+                
+                for ( i_policy = 0; i_policy < sim_n_policies; i_policy++ ) policies[i_policy] = false;
+                for ( name = strtok_r(list, ",", &state); name; name = strtok_r(NULL, ",", &state) ) {
+                    for ( i_policy = 0; i_policy < sim_n_policies; i_policy++ )
+                        if ( strcmp(name, sim_policy_names[i_policy]) == 0 ) break;
+                    if ( i_policy == sim_n_policies ) {
+                        fprintf(stderr, "ERROR:  unknown policy `%s`\n", name);
+                        exit(EINVAL);
+                    }
+                    policies[i_policy] = true;
+                }
+                free((void*)list);
+                break;
+            }
+            
+            case 'u':
+                n_unit_sizes = parse_double_list(optarg, unit_sizes, SIM_MAX_SWEEP);
+                for ( i_unit = 0; i_unit < n_unit_sizes; i_unit++ ) if ( unit_sizes[i_unit] < 1.0 ) n_unit_sizes = 0;
+                if ( ! n_unit_sizes ) {
+                    fprintf(stderr, "ERROR:  invalid unit sizes `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 's':
+                n_static_fractions = parse_double_list(optarg, static_fractions, SIM_MAX_SWEEP);
+                for ( i_static = 0; i_static < n_static_fractions; i_static++ ) if ( static_fractions[i_static] > 1.0 ) n_static_fractions = 0;
+                if ( ! n_static_fractions ) {
+                    fprintf(stderr, "ERROR:  invalid static fractions `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+            
+            case 'l':
+                n_lease_timeouts = parse_double_list(optarg, lease_timeouts, SIM_MAX_SWEEP);
+                if ( ! n_lease_timeouts ) {
+                    fprintf(stderr, "ERROR:  invalid lease timeouts `%s`\n", optarg);
+                    exit(EINVAL);
+                }
+                break;
+        
+        }
+    }
+    
+    if ( trace_path ) {
+        if ( ! sim_load_trace(trace_path, &config.geometry, &config.index_cost, &config.rank_factor) ) exit(1);
+    } else {
+        config.geometry.dim_global[0] = dims[0], config.geometry.dim_global[1] = dims[1];
+        config.geometry.dim_blocks[0] = blocks[0], config.geometry.dim_blocks[1] = blocks[1];
+        config.geometry.dim_per_rank[0] = dims[0] / blocks[0], config.geometry.dim_per_rank[1] = dims[1] / blocks[1];
+        config.geometry.is_row_major = is_row_major;
+        config.geometry.dist_size = blocks[0] * blocks[1];
+        if ( (dims[0] % blocks[0]) || (dims[1] % blocks[1]) ) {
+            fprintf(stderr, "ERROR:  block dimensions must evenly divide the matrix dimensions\n");
+            exit(EINVAL);
+        }
+        n_indices = is_row_major ? dims[0] : dims[1];
+        config.index_cost = (double*)malloc(n_indices * sizeof(double));
+        config.rank_factor = (double*)malloc(config.geometry.dist_size * sizeof(double));
+        if ( ! config.index_cost || ! config.rank_factor ) exit(ENOMEM);
+        for ( i = 0; i < n_indices; i++ ) config.index_cost[i] = element_cost * (is_row_major ? dims[1] : dims[0]);
+        for ( rank = 0; rank < config.geometry.dist_size; rank++ ) config.rank_factor[rank] = 1.0;
+    }
+    while ( n_slow-- > 0 ) {
+        if ( slow_ranks[n_slow] >= config.geometry.dist_size ) {
+            fprintf(stderr, "ERROR:  slow rank %d exceeds rank count %d\n", slow_ranks[n_slow], config.geometry.dist_size);
+            exit(EINVAL);
+        }
+        config.rank_factor[slow_ranks[n_slow]] *= slow_factors[n_slow];
+    }
+    
+    printf("# dim_global=" BASE_INT_FMT "," BASE_INT_FMT " dim_blocks=" BASE_INT_FMT "," BASE_INT_FMT " is_row_major=%d dist_size=%d latency=%lg\n",
+            config.geometry.dim_global[0], config.geometry.dim_global[1],
+            config.geometry.dim_blocks[0], config.geometry.dim_blocks[1],
+            config.geometry.is_row_major ? 1 : 0, config.geometry.dist_size, config.latency);
+    printf("%-16s %6s %6s %8s %12s %7s %10s %12s %6s %6s\n",
+            "policy", "unit", "static", "lease", "makespan", "idle%", "work_msgs", "write_msgs", "spec", "dups");
+    seed = config.seed;
+    for ( i_policy = 0; i_policy < sim_n_policies; i_policy++ ) {
+        if ( ! policies[i_policy] ) continue;
+        config.policy = sim_policy_names[i_policy];
+        config.order = (i_policy >= 2) ? mpi_assignable_work_order_block_completion : mpi_assignable_work_order_slot_affinity;
+        config.is_throughput_aware = (i_policy % 2) != 0;
+        for ( i_unit = 0; i_unit < n_unit_sizes; i_unit++ ) {
+            config.unit_size = (base_int_t)unit_sizes[i_unit];
+            for ( i_static = 0; i_static < n_static_fractions; i_static++ ) {
+                config.static_fraction = static_fractions[i_static];
+                for ( i_lease = 0; i_lease < n_lease_timeouts; i_lease++ ) {
+                    sim_result_t    result;
+                    
+                    config.lease_timeout = lease_timeouts[i_lease];
+                    
+                    // Same jitter sequence for every parameter set:
+                    config.seed = seed;
+                    if ( ! sim_run(&config, &result) ) {
+                        fprintf(stderr, "ERROR:  simulation of policy %s did not complete\n", config.policy);
+                        exit(1);
+                    }
+                    printf("%-16s %6" PRId64 " %6.3lf %8lg %12.6lf %7.2lf %10" PRId64 " %12" PRId64 " %6" PRId64 " %6" PRId64 "\n",
+                            config.policy, (int64_t)config.unit_size, config.static_fraction, config.lease_timeout,
+                            result.makespan, 100.0 * result.idle_fraction,
+                            (int64_t)result.n_work_msgs, (int64_t)result.n_write_msgs,
+                            (int64_t)result.n_speculative_units, (int64_t)result.n_duplicate_completions);
+                }
+            }
+        }
+    }
+    free((void*)config.index_cost);
+    free((void*)config.rank_factor);
+    return 0;
+}